@@ -0,0 +1,282 @@
+#pragma once
+
+// This is a stand-in for the Windows and D3D11 headers, for building the
+// XR_HEADLESS version of main.cpp on other platforms. The headless runtime
+// never makes a graphics device, and the sample skips all its D3D work when
+// d3d_device is null, so none of this ever actually gets called! It just
+// needs to be declared well enough for the D3D code to compile.
+//
+// Only what main.cpp uses is here, and the few functions with bodies all
+// fail, so if something does reach them, it finds out right away.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdio.h>
+
+///////////////////////////////////////////
+// Windows and MSVC runtime              //
+///////////////////////////////////////////
+
+#define __stdcall
+
+typedef void    *HINSTANCE;
+typedef wchar_t *LPWSTR;
+typedef long     HRESULT;
+typedef int      BOOL;
+typedef int      INT;
+typedef unsigned int UINT;
+typedef uint8_t  BYTE;
+typedef uint64_t UINT64;
+typedef float    FLOAT;
+typedef size_t   SIZE_T;
+
+#define S_OK         ((HRESULT)0)
+#define E_FAIL       ((HRESULT)0x80004005L)
+#define SUCCEEDED(hr) (((HRESULT)(hr)) >= 0)
+#define FAILED(hr)    (((HRESULT)(hr)) <  0)
+#ifndef TRUE
+#define TRUE  1
+#define FALSE 0
+#endif
+
+struct LUID { uint32_t LowPart; int32_t HighPart; };
+struct GUID { uint32_t Data1; uint16_t Data2, Data3; uint8_t Data4[8]; };
+typedef const GUID &REFIID;
+
+// There's no COM here, so every interface has the same empty id
+#define __uuidof(type) GUID{}
+
+#define _countof(array) (sizeof(array) / sizeof((array)[0]))
+
+template<size_t size>
+inline int strcpy_s(char (&dest)[size], const char *src) {
+	snprintf(dest, size, "%s", src);
+	return 0;
+}
+template<size_t size, typename... args_t>
+inline int sprintf_s(char (&dest)[size], const char *format, args_t... args) {
+	return snprintf(dest, size, format, args...);
+}
+inline int fopen_s(FILE **file, const char *filename, const char *mode) {
+	*file = fopen(filename, mode);
+	return *file == nullptr ? 1 : 0;
+}
+
+// No message boxes or debugger output window, so it all goes to stderr
+inline int MessageBox(void *, const char *text, const char *caption, unsigned int) {
+	fprintf(stderr, "%s: %s", caption, text);
+	return 0;
+}
+inline void OutputDebugStringA(const char *text) {
+	fputs(text, stderr);
+}
+
+///////////////////////////////////////////
+// DXGI                                  //
+///////////////////////////////////////////
+
+struct IUnknown {
+	virtual HRESULT       QueryInterface(REFIID id, void **object) = 0;
+	virtual unsigned long AddRef () = 0;
+	virtual unsigned long Release() = 0;
+};
+
+enum DXGI_FORMAT {
+	DXGI_FORMAT_UNKNOWN              = 0,
+	DXGI_FORMAT_R32G32B32A32_FLOAT   = 2,
+	DXGI_FORMAT_R32G32B32_FLOAT      = 6,
+	DXGI_FORMAT_R16G16B16A16_FLOAT   = 10,
+	DXGI_FORMAT_R16G16B16A16_UNORM   = 11,
+	DXGI_FORMAT_R32G32_FLOAT         = 16,
+	DXGI_FORMAT_D32_FLOAT_S8X24_UINT = 20,
+	DXGI_FORMAT_R10G10B10A2_UNORM    = 24,
+	DXGI_FORMAT_R11G11B10_FLOAT      = 26,
+	DXGI_FORMAT_R8G8B8A8_TYPELESS    = 27,
+	DXGI_FORMAT_R8G8B8A8_UNORM       = 28,
+	DXGI_FORMAT_R8G8B8A8_UNORM_SRGB  = 29,
+	DXGI_FORMAT_R32_TYPELESS         = 39,
+	DXGI_FORMAT_D32_FLOAT            = 40,
+	DXGI_FORMAT_R32_UINT             = 42,
+	DXGI_FORMAT_R24G8_TYPELESS       = 44,
+	DXGI_FORMAT_D24_UNORM_S8_UINT    = 45,
+	DXGI_FORMAT_R16_TYPELESS         = 53,
+	DXGI_FORMAT_D16_UNORM            = 55,
+	DXGI_FORMAT_R16_UINT             = 57,
+	DXGI_FORMAT_B8G8R8A8_UNORM       = 87,
+	DXGI_FORMAT_B8G8R8A8_UNORM_SRGB  = 91,
+};
+
+struct DXGI_SAMPLE_DESC   { UINT Count; UINT Quality; };
+struct DXGI_ADAPTER_DESC1 { wchar_t Description[128]; UINT VendorId, DeviceId, SubSysId, Revision; SIZE_T DedicatedVideoMemory, DedicatedSystemMemory, SharedSystemMemory; LUID AdapterLuid; UINT Flags; };
+
+struct IDXGIAdapter1 : IUnknown {
+	virtual HRESULT GetDesc1(DXGI_ADAPTER_DESC1 *desc) = 0;
+};
+struct IDXGIFactory1 : IUnknown {
+	virtual HRESULT EnumAdapters1(UINT index, IDXGIAdapter1 **adapter) = 0;
+};
+
+inline HRESULT CreateDXGIFactory1(REFIID, void **factory) { *factory = nullptr; return E_FAIL; }
+
+///////////////////////////////////////////
+// D3D11                                 //
+///////////////////////////////////////////
+
+enum D3D_FEATURE_LEVEL { D3D_FEATURE_LEVEL_11_0 = 0xb000, D3D_FEATURE_LEVEL_11_1 = 0xb100 };
+enum D3D_DRIVER_TYPE   { D3D_DRIVER_TYPE_UNKNOWN = 0, D3D_DRIVER_TYPE_HARDWARE = 1 };
+
+#define D3D11_SDK_VERSION                        7
+#define D3D11_CREATE_DEVICE_BGRA_SUPPORT         0x20
+#define D3D11_CREATE_DEVICE_DEBUG                0x2
+#define D3D11_APPEND_ALIGNED_ELEMENT             0xffffffff
+#define D3D11_REQ_CONSTANT_BUFFER_ELEMENT_COUNT  4096
+#define D3D11_ASYNC_GETDATA_DONOTFLUSH           0x1
+
+enum D3D11_INPUT_CLASSIFICATION { D3D11_INPUT_PER_VERTEX_DATA = 0, D3D11_INPUT_PER_INSTANCE_DATA = 1 };
+enum D3D11_USAGE                { D3D11_USAGE_DEFAULT = 0, D3D11_USAGE_IMMUTABLE = 1, D3D11_USAGE_DYNAMIC = 2, D3D11_USAGE_STAGING = 3 };
+enum D3D11_BIND_FLAG            { D3D11_BIND_VERTEX_BUFFER = 0x1, D3D11_BIND_INDEX_BUFFER = 0x2, D3D11_BIND_CONSTANT_BUFFER = 0x4, D3D11_BIND_SHADER_RESOURCE = 0x8, D3D11_BIND_RENDER_TARGET = 0x20, D3D11_BIND_DEPTH_STENCIL = 0x40 };
+enum D3D11_CPU_ACCESS_FLAG      { D3D11_CPU_ACCESS_WRITE = 0x10000, D3D11_CPU_ACCESS_READ = 0x20000 };
+enum D3D11_RESOURCE_MISC_FLAG   { D3D11_RESOURCE_MISC_BUFFER_STRUCTURED = 0x40 };
+enum D3D11_MAP                  { D3D11_MAP_READ = 1, D3D11_MAP_WRITE = 2, D3D11_MAP_READ_WRITE = 3, D3D11_MAP_WRITE_DISCARD = 4, D3D11_MAP_WRITE_NO_OVERWRITE = 5 };
+enum D3D11_CLEAR_FLAG           { D3D11_CLEAR_DEPTH = 0x1, D3D11_CLEAR_STENCIL = 0x2 };
+enum D3D11_PRIMITIVE_TOPOLOGY   { D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST = 4 };
+enum D3D11_RTV_DIMENSION        { D3D11_RTV_DIMENSION_TEXTURE2D = 4, D3D11_RTV_DIMENSION_TEXTURE2DARRAY = 5 };
+enum D3D11_DSV_DIMENSION        { D3D11_DSV_DIMENSION_TEXTURE2D = 3, D3D11_DSV_DIMENSION_TEXTURE2DARRAY = 4 };
+enum D3D11_SRV_DIMENSION        { D3D11_SRV_DIMENSION_BUFFER = 1 };
+enum D3D11_FEATURE              { D3D11_FEATURE_THREADING = 0, D3D11_FEATURE_D3D11_OPTIONS = 7, D3D11_FEATURE_D3D11_OPTIONS3 = 15 };
+enum D3D11_QUERY                { D3D11_QUERY_EVENT = 0, D3D11_QUERY_TIMESTAMP = 2, D3D11_QUERY_TIMESTAMP_DISJOINT = 3 };
+
+struct D3D11_INPUT_ELEMENT_DESC { const char *SemanticName; UINT SemanticIndex; DXGI_FORMAT Format; UINT InputSlot; UINT AlignedByteOffset; D3D11_INPUT_CLASSIFICATION InputSlotClass; UINT InstanceDataStepRate; };
+struct D3D11_SUBRESOURCE_DATA   { const void *pSysMem; UINT SysMemPitch; UINT SysMemSlicePitch; };
+struct D3D11_MAPPED_SUBRESOURCE { void *pData; UINT RowPitch; UINT DepthPitch; };
+struct D3D11_BOX                { UINT left, top, front, right, bottom, back; };
+struct D3D11_VIEWPORT           { FLOAT TopLeftX, TopLeftY, Width, Height, MinDepth, MaxDepth; };
+struct CD3D11_VIEWPORT : D3D11_VIEWPORT {
+	CD3D11_VIEWPORT(FLOAT x, FLOAT y, FLOAT width, FLOAT height, FLOAT min_depth = 0, FLOAT max_depth = 1) {
+		TopLeftX = x; TopLeftY = y; Width = width; Height = height; MinDepth = min_depth; MaxDepth = max_depth; }
+};
+struct D3D11_QUERY_DESC         { D3D11_QUERY Query; UINT MiscFlags; };
+struct D3D11_QUERY_DATA_TIMESTAMP_DISJOINT { UINT64 Frequency; BOOL Disjoint; };
+struct D3D11_FEATURE_DATA_THREADING        { BOOL DriverConcurrentCreates; BOOL DriverCommandLists; };
+struct D3D11_FEATURE_DATA_D3D11_OPTIONS    { BOOL OutputMergerLogicOp, UAVOnlyRenderingForcedSampleCount, DiscardAPIsSeenByDriver, FlagsForUpdateAndCopySeenByDriver, ClearView, CopyWithOverlap, ConstantBufferPartialUpdate, ConstantBufferOffsetting, MapNoOverwriteOnDynamicConstantBuffer, MapNoOverwriteOnDynamicBufferSRV, MultisampleRTVWithForcedSampleCountOne, SAD4ShaderInstructions, ExtendedDoublesShaderInstructions, ExtendedResourceSharing; };
+struct D3D11_FEATURE_DATA_D3D11_OPTIONS3   { BOOL VPAndRTArrayIndexFromAnyShaderFeedingRasterizer; };
+
+struct D3D11_BUFFER_DESC { UINT ByteWidth; D3D11_USAGE Usage; UINT BindFlags; UINT CPUAccessFlags; UINT MiscFlags; UINT StructureByteStride; };
+struct CD3D11_BUFFER_DESC : D3D11_BUFFER_DESC {
+	CD3D11_BUFFER_DESC(UINT byte_width, UINT bind_flags, D3D11_USAGE usage = D3D11_USAGE_DEFAULT, UINT cpu_access = 0, UINT misc = 0, UINT stride = 0) {
+		ByteWidth = byte_width; BindFlags = bind_flags; Usage = usage; CPUAccessFlags = cpu_access; MiscFlags = misc; StructureByteStride = stride; }
+};
+struct D3D11_TEXTURE2D_DESC { UINT Width, Height, MipLevels, ArraySize; DXGI_FORMAT Format; DXGI_SAMPLE_DESC SampleDesc; D3D11_USAGE Usage; UINT BindFlags, CPUAccessFlags, MiscFlags; };
+
+struct D3D11_TEX2D_RTV       { UINT MipSlice; };
+struct D3D11_TEX2D_ARRAY_RTV { UINT MipSlice, FirstArraySlice, ArraySize; };
+struct D3D11_RENDER_TARGET_VIEW_DESC { DXGI_FORMAT Format; D3D11_RTV_DIMENSION ViewDimension; union { D3D11_TEX2D_RTV Texture2D; D3D11_TEX2D_ARRAY_RTV Texture2DArray; }; };
+struct D3D11_TEX2D_DSV       { UINT MipSlice; };
+struct D3D11_TEX2D_ARRAY_DSV { UINT MipSlice, FirstArraySlice, ArraySize; };
+struct D3D11_DEPTH_STENCIL_VIEW_DESC { DXGI_FORMAT Format; D3D11_DSV_DIMENSION ViewDimension; UINT Flags; union { D3D11_TEX2D_DSV Texture2D; D3D11_TEX2D_ARRAY_DSV Texture2DArray; }; };
+struct D3D11_BUFFER_SRV      { UINT FirstElement, NumElements; };
+struct D3D11_SHADER_RESOURCE_VIEW_DESC { DXGI_FORMAT Format; D3D11_SRV_DIMENSION ViewDimension; union { D3D11_BUFFER_SRV Buffer; }; };
+struct CD3D11_SHADER_RESOURCE_VIEW_DESC : D3D11_SHADER_RESOURCE_VIEW_DESC {
+	CD3D11_SHADER_RESOURCE_VIEW_DESC(D3D11_SRV_DIMENSION dimension, DXGI_FORMAT format, UINT first = 0, UINT count = (UINT)-1) {
+		ViewDimension = dimension; Format = format; Buffer.FirstElement = first; Buffer.NumElements = count; }
+};
+
+struct ID3D11DeviceChild        : IUnknown {};
+struct ID3D11Resource           : ID3D11DeviceChild {};
+struct ID3D11Buffer             : ID3D11Resource { virtual void GetDesc(D3D11_BUFFER_DESC    *desc) = 0; };
+struct ID3D11Texture2D          : ID3D11Resource { virtual void GetDesc(D3D11_TEXTURE2D_DESC *desc) = 0; };
+struct ID3D11View               : ID3D11DeviceChild { virtual void GetResource(ID3D11Resource **resource) = 0; };
+struct ID3D11RenderTargetView   : ID3D11View {};
+struct ID3D11DepthStencilView   : ID3D11View {};
+struct ID3D11ShaderResourceView : ID3D11View {};
+struct ID3D11VertexShader       : ID3D11DeviceChild {};
+struct ID3D11PixelShader        : ID3D11DeviceChild {};
+struct ID3D11InputLayout        : ID3D11DeviceChild {};
+struct ID3D11Asynchronous       : ID3D11DeviceChild {};
+struct ID3D11Query              : ID3D11Asynchronous {};
+struct ID3D11CommandList        : ID3D11DeviceChild {};
+struct ID3D11ClassLinkage;
+struct ID3D11ClassInstance;
+
+struct ID3D11DeviceContext : ID3D11DeviceChild {
+	virtual void    RSSetViewports        (UINT count, const D3D11_VIEWPORT *viewports) = 0;
+	virtual void    ClearRenderTargetView (ID3D11RenderTargetView *view, const FLOAT color[4]) = 0;
+	virtual void    ClearDepthStencilView (ID3D11DepthStencilView *view, UINT flags, FLOAT depth, BYTE stencil) = 0;
+	virtual void    OMSetRenderTargets    (UINT count, ID3D11RenderTargetView *const *targets, ID3D11DepthStencilView *depth) = 0;
+	virtual void    VSSetConstantBuffers  (UINT slot, UINT count, ID3D11Buffer *const *buffers) = 0;
+	virtual void    PSSetConstantBuffers  (UINT slot, UINT count, ID3D11Buffer *const *buffers) = 0;
+	virtual void    VSSetShaderResources  (UINT slot, UINT count, ID3D11ShaderResourceView *const *views) = 0;
+	virtual void    VSSetShader           (ID3D11VertexShader *shader, ID3D11ClassInstance *const *instances, UINT instance_count) = 0;
+	virtual void    PSSetShader           (ID3D11PixelShader  *shader, ID3D11ClassInstance *const *instances, UINT instance_count) = 0;
+	virtual void    IASetVertexBuffers    (UINT slot, UINT count, ID3D11Buffer *const *buffers, const UINT *strides, const UINT *offsets) = 0;
+	virtual void    IASetIndexBuffer      (ID3D11Buffer *buffer, DXGI_FORMAT format, UINT offset) = 0;
+	virtual void    IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY topology) = 0;
+	virtual void    IASetInputLayout      (ID3D11InputLayout *layout) = 0;
+	virtual void    UpdateSubresource     (ID3D11Resource *resource, UINT subresource, const D3D11_BOX *box, const void *data, UINT row_pitch, UINT depth_pitch) = 0;
+	virtual void    CopySubresourceRegion (ID3D11Resource *dest, UINT dest_subresource, UINT x, UINT y, UINT z, ID3D11Resource *src, UINT src_subresource, const D3D11_BOX *box) = 0;
+	virtual void    DrawIndexed           (UINT index_count, UINT start_index, INT base_vertex) = 0;
+	virtual void    DrawIndexedInstanced  (UINT index_count, UINT instance_count, UINT start_index, INT base_vertex, UINT start_instance) = 0;
+	virtual HRESULT Map                   (ID3D11Resource *resource, UINT subresource, D3D11_MAP type, UINT flags, D3D11_MAPPED_SUBRESOURCE *mapped) = 0;
+	virtual void    Unmap                 (ID3D11Resource *resource, UINT subresource) = 0;
+	virtual void    Begin                 (ID3D11Asynchronous *async) = 0;
+	virtual void    End                   (ID3D11Asynchronous *async) = 0;
+	virtual HRESULT GetData               (ID3D11Asynchronous *async, void *data, UINT size, UINT flags) = 0;
+	virtual void    Flush                 () = 0;
+	virtual void    ClearState            () = 0;
+	virtual HRESULT FinishCommandList     (BOOL restore_state, ID3D11CommandList **list) = 0;
+	virtual void    ExecuteCommandList    (ID3D11CommandList *list, BOOL restore_state) = 0;
+};
+struct ID3D11DeviceContext1 : ID3D11DeviceContext {
+	virtual void VSSetConstantBuffers1(UINT slot, UINT count, ID3D11Buffer *const *buffers, const UINT *first_constant, const UINT *constant_count) = 0;
+	virtual void PSSetConstantBuffers1(UINT slot, UINT count, ID3D11Buffer *const *buffers, const UINT *first_constant, const UINT *constant_count) = 0;
+};
+
+struct ID3D11Device : IUnknown {
+	virtual HRESULT CreateBuffer            (const D3D11_BUFFER_DESC *desc, const D3D11_SUBRESOURCE_DATA *data, ID3D11Buffer **buffer) = 0;
+	virtual HRESULT CreateTexture2D         (const D3D11_TEXTURE2D_DESC *desc, const D3D11_SUBRESOURCE_DATA *data, ID3D11Texture2D **texture) = 0;
+	virtual HRESULT CreateShaderResourceView(ID3D11Resource *resource, const D3D11_SHADER_RESOURCE_VIEW_DESC *desc, ID3D11ShaderResourceView **view) = 0;
+	virtual HRESULT CreateRenderTargetView  (ID3D11Resource *resource, const D3D11_RENDER_TARGET_VIEW_DESC   *desc, ID3D11RenderTargetView   **view) = 0;
+	virtual HRESULT CreateDepthStencilView  (ID3D11Resource *resource, const D3D11_DEPTH_STENCIL_VIEW_DESC   *desc, ID3D11DepthStencilView   **view) = 0;
+	virtual HRESULT CreateInputLayout       (const D3D11_INPUT_ELEMENT_DESC *elements, UINT count, const void *bytecode, SIZE_T size, ID3D11InputLayout **layout) = 0;
+	virtual HRESULT CreateVertexShader      (const void *bytecode, SIZE_T size, ID3D11ClassLinkage *linkage, ID3D11VertexShader **shader) = 0;
+	virtual HRESULT CreatePixelShader       (const void *bytecode, SIZE_T size, ID3D11ClassLinkage *linkage, ID3D11PixelShader  **shader) = 0;
+	virtual HRESULT CreateQuery             (const D3D11_QUERY_DESC *desc, ID3D11Query **query) = 0;
+	virtual HRESULT CreateDeferredContext   (UINT flags, ID3D11DeviceContext **context) = 0;
+	virtual HRESULT CheckFeatureSupport     (D3D11_FEATURE feature, void *data, UINT size) = 0;
+};
+
+inline HRESULT D3D11CreateDevice(IDXGIAdapter1 *, D3D_DRIVER_TYPE, void *, UINT, const D3D_FEATURE_LEVEL *, UINT, UINT, ID3D11Device **device, D3D_FEATURE_LEVEL *, ID3D11DeviceContext **context) {
+	if (device)  *device  = nullptr;
+	if (context) *context = nullptr;
+	return E_FAIL;
+}
+
+///////////////////////////////////////////
+// D3DCompiler                           //
+///////////////////////////////////////////
+
+struct ID3D10Blob : IUnknown {
+	virtual void  *GetBufferPointer() = 0;
+	virtual SIZE_T GetBufferSize   () = 0;
+};
+typedef ID3D10Blob ID3DBlob;
+
+struct D3D_SHADER_MACRO { const char *Name; const char *Definition; };
+
+#define D3DCOMPILE_DEBUG                    (1 << 0)
+#define D3DCOMPILE_SKIP_OPTIMIZATION        (1 << 2)
+#define D3DCOMPILE_PACK_MATRIX_COLUMN_MAJOR (1 << 4)
+#define D3DCOMPILE_ENABLE_STRICTNESS        (1 << 11)
+#define D3DCOMPILE_OPTIMIZATION_LEVEL3      (1 << 15)
+#define D3DCOMPILE_WARNINGS_ARE_ERRORS      (1 << 18)
+
+inline HRESULT D3DCompile(const void *, SIZE_T, const char *, const D3D_SHADER_MACRO *, void *, const char *, const char *, UINT, UINT, ID3DBlob **code, ID3DBlob **errors) {
+	if (code)   *code   = nullptr;
+	if (errors) *errors = nullptr;
+	return E_FAIL;
+}
+inline HRESULT D3DCreateBlob(SIZE_T, ID3DBlob **blob) {
+	*blob = nullptr;
+	return E_FAIL;
+}
@@ -1,28 +1,84 @@
+#ifdef _MSC_VER
 #pragma comment(lib,"D3D11.lib")
 #pragma comment(lib,"D3dcompiler.lib") // for shader compile
 #pragma comment(lib,"Dxgi.lib") // for CreateDXGIFactory1
+#endif
+
+// Define this to replace the OpenXR runtime with a stand-in that lives at
+// the bottom of this file! It needs no headset or graphics card, and runs
+// the frame loop as fast as it can, which is handy for benchmarking. It's
+// also the only part of this sample that builds off Windows, see
+// CMakeLists.txt in the root folder.
+//#define XR_HEADLESS
 
-// Tell OpenXR what platform code we'll be using
+// Tell OpenXR what platform code we'll be using. Off Windows, there's no
+// performance counter to convert times from, so we use timespec instead.
+#ifdef _WIN32
 #define XR_USE_PLATFORM_WIN32
+#else
+#define XR_USE_TIMESPEC
+#endif
 #define XR_USE_GRAPHICS_API_D3D11
 
+#ifdef _WIN32
 #include <d3d11.h>
+#include <d3d11_1.h>     // ID3D11DeviceContext1, for binding constant buffers at an offset
 #include <directxmath.h> // Matrix math functions and objects
 #include <d3dcompiler.h> // For compiling shaders! D3DCompile
+#elif defined(XR_HEADLESS)
+// The headless runtime never makes a graphics device, so all it needs is
+// enough of the Windows and D3D11 declarations for the D3D code to build.
+#include "headless_platform.h"
+#include <time.h> // timespec, which XR_USE_TIMESPEC needs declared first
+#else
+#error Only the XR_HEADLESS build of this sample works outside of Windows!
+#endif
 #include <openxr/openxr.h>
 #include <openxr/openxr_platform.h>
 
 #include <thread> // sleep_for
+#include <chrono> // high_resolution_clock, for timing draw submission
 #include <vector>
+#include <unordered_map>
+#include <string>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
 #include <algorithm> // any_of
+#include <float.h>   // FLT_MAX
+#include <math.h>    // sinf, cosf, sqrtf, etc.
+
+// SIMD intrinsics for the batched math code, we'll use the widest
+// instruction set the compiler is targeting.
+#if defined(__AVX2__)
+	#define MATH_AVX2
+	#include <immintrin.h>
+#elif defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+	#define MATH_SSE
+	#include <xmmintrin.h>
+#elif defined(_M_ARM64) || defined(__aarch64__)
+	#define MATH_NEON
+	#include <arm_neon.h>
+#else
+	#define MATH_SCALAR
+#endif
+
+#ifndef _WIN32
+#include <fcntl.h>    // open, for mapping files
+#include <unistd.h>   // close, getpid
+#include <sys/mman.h> // mmap
+#include <sys/stat.h> // fstat
+#endif
 
 using namespace std;
+#ifdef _WIN32
 using namespace DirectX; // Matrix math
+#endif
 
 ///////////////////////////////////////////
 
 struct swapchain_surfdata_t {
-	ID3D11DepthStencilView *depth_view;
+	ID3D11DepthStencilView *depth_view; // Shared by all of the swapchain's images
 	ID3D11RenderTargetView *target_view;
 };
 
@@ -30,19 +86,490 @@ struct swapchain_t {
 	XrSwapchain handle;
 	int32_t     width;
 	int32_t     height;
+	int32_t     view_width;  // The recommended size, the swapchain may be bigger
+	int32_t     view_height;
+	uint32_t    array_size;
+	uint32_t    sample_count;
+	ID3D11DepthStencilView          *depth_view;
 	vector<XrSwapchainImageD3D11KHR> surface_images;
 	vector<swapchain_surfdata_t>     surface_data;
+	// When we give depth to the runtime, it lives in its own swapchain
+	// instead of depth_view.
+	XrSwapchain                      depth_handle;
+	vector<XrSwapchainImageD3D11KHR> depth_images;
+	vector<ID3D11DepthStencilView*>  depth_views;
+};
+
+// A small pool of threads for recording views in parallel. Each batch of
+// jobs bumps 'generation' to wake the workers, and then everyone,
+// including whoever started the batch, pulls job indices from 'next'
+// until they run out. A batch is only set up while no worker is busy, so
+// the job fields never change under a worker's feet.
+struct d3d_workers_t {
+	vector<thread>     threads;
+	mutex              lock;
+	condition_variable wake;
+	condition_variable finished;
+	uint64_t           generation;
+	uint32_t           busy; // Workers between waking up and running out of jobs
+	bool               quit;
+	void             (*job)(uint32_t index, void *data);
+	void              *data;
+	uint32_t           count;
+	atomic<uint32_t>   next;
+};
+
+// A 4x4 matrix, stored column-major for column vectors. Note that this
+// is the exact same memory layout as a DirectXMath row-major matrix for
+// row vectors, so these can go straight into the same shader code!
+struct mat4_t {
+	float m[16];
+};
+
+// A convex volume made of 6 planes, with normals facing inwards. Each
+// plane is stored as { normal.x, normal.y, normal.z, distance }.
+struct math_frustum_t {
+	float planes[6][4];
+};
+
+// Placed cubes are stored in fixed size chunks, so adding more never moves
+// the ones we already have around in memory. Cube ids are just their order.
+const size_t cube_chunk_size = 4096;
+struct cube_store_t {
+	vector<vector<XrPosef>> chunks;
+	size_t                  count;
+};
+
+// Placed cubes are saved in two files. The snapshot has every cube up to
+// some point, and the journal has every cube placed after it, appended as
+// they're placed. Both are this header followed by XrPosef records.
+struct cube_file_header_t {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t base; // Snapshot: how many cubes it has. Journal: how many the snapshot had when it started.
+};
+
+// A snapshot or journal mapped into memory. A crash can leave part of a
+// record at the end of a journal, so 'count' is only the whole ones.
+struct cube_file_t {
+	const uint8_t            *data;
+	size_t                    size;
+	const cube_file_header_t *header;
+	const XrPosef            *poses;
+	size_t                    count;
+	bool                      torn; // Leftover bytes after the last record
+};
+
+// Writes placed cubes to the journal on a background thread, so the frame
+// loop never waits on the disk. Placements wait in 'pending' until the
+// writer picks them up, a batch at a time.
+struct cube_journal_t {
+	thread             worker;
+	mutex              lock;
+	condition_variable wake;
+	vector<XrPosef>    pending;
+	bool               quit;
+	bool               clean; // Files are ready to append to as they are
+	const char        *snapshot_file;
+	const char        *journal_file;
+	// These belong to the writer thread once it's started
+	uint64_t           snapshot_count;
+	uint64_t           journal_count;
+	uint64_t           batches;
+	uint64_t           compactions;
+};
+
+// A hashed grid of cells for finding cubes quickly. Each cube lives in the
+// 'home' cell that contains its center, and is also listed as an 'overlap'
+// in any neighboring cells its bounds poke into. Only occupied cells exist.
+struct spatial_cell_t {
+	int32_t          x, y, z;
+	vector<uint32_t> home;
+	vector<uint32_t> overlap;
+};
+
+// The lookup is keyed by a cell's whole coordinates. They're packed into a
+// 64 bit hash that wraps far away from the origin, so cells there can hash
+// the same, but the full compare keeps them from ever being mixed up.
+struct spatial_cell_key_t {
+	int32_t x, y, z;
+	bool operator==(const spatial_cell_key_t &other) const { return x == other.x && y == other.y && z == other.z; }
+};
+struct spatial_cell_hash_t {
+	size_t operator()(const spatial_cell_key_t &key) const {
+		const uint64_t mask = (1 << 21) - 1;
+		return (size_t)(((uint64_t)(key.x & mask) << 42) | ((uint64_t)(key.y & mask) << 21) | (uint64_t)(key.z & mask));
+	}
+};
+
+struct spatial_index_t {
+	float                              cell_size;
+	vector<spatial_cell_t>             cells;
+	unordered_map<spatial_cell_key_t, uint32_t, spatial_cell_hash_t> lookup; // cell coordinates -> cells index
+};
+
+// A vertex squeezed into 8 bytes. The position is 16 bit normalized within
+// the mesh's bounds, and the normal is octahedral encoded into two 8 bit
+// values, packed together into the last 16 bits.
+struct mesh_vert_t {
+	uint16_t x, y, z;
+	uint16_t normal;
+};
+
+// A mesh that's been optimized and packed, ready to go to the GPU
+struct mesh_t {
+	vector<mesh_vert_t> verts;
+	vector<uint16_t>    inds;
+	XrVector3f          bounds_min;
+	XrVector3f          bounds_size;
+};
+
+// A mesh file is this header, followed by 'stream_count' streams, followed
+// by each stream's data. The data is aligned, and laid out exactly how the
+// GPU wants it, so it can go to D3D straight from the mapped file.
+struct mesh_file_header_t {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t stream_count;
+	uint32_t reserved;
+	float    bounds_min [3];
+	float    bounds_size[3];
+};
+
+struct mesh_file_stream_t {
+	uint32_t type;   // mesh_stream_vertices or mesh_stream_indices
+	uint32_t stride; // Bytes per element
+	uint32_t count;
+	uint32_t reserved;
+	uint64_t offset; // From the start of the file, mesh_file_align aligned
+};
+
+// A mesh file mapped into memory. The stream pointers point into the
+// mapping, so they're only good until mesh_file_unmap.
+struct mesh_file_t {
+	const uint8_t            *data;
+	size_t                    size;
+	const mesh_file_header_t *header;
+	const mesh_vert_t        *verts;
+	const uint16_t           *inds;
+	uint32_t                  vert_count;
+	uint32_t                  ind_count;
+};
+
+// A mesh file being loaded onto the GPU by a background thread. The
+// loader thread owns everything in here until 'state' says it's done.
+struct mesh_loader_t {
+	thread          worker;
+	atomic<int32_t> state; // mesh_load_ values
+	const char     *filename;
+	ID3D11Buffer   *vertex_buffer;
+	ID3D11Buffer   *index_buffer;
+	ID3D11Buffer   *mesh_buffer; // An app_mesh_buffer_t, for unpacking positions
+	uint32_t        ind_count;
+	size_t          bytes;
+	double          load_ms;
+};
+
+// Picks a render resolution each frame, so that rendering fits in the
+// time we have for it. Scales are a fraction of the recommended
+// resolution, on each axis.
+struct res_governor_t {
+	float    scale;
+	float    scale_min;
+	float    scale_max;
+	float    smoothed_ms; // Recent render times, smoothed out
+	uint32_t samples;
+};
+
+// A single timed section of a frame, like xrWaitFrame, or drawing a view.
+struct prof_event_t {
+	const char *name; // Always a string literal, so we can just keep the pointer
+	uint64_t    start_ns;
+	uint64_t    end_ns;
+	uint64_t    frame;
+};
+
+// Each thread writes its timings into its own ring buffer, so recording
+// never needs a lock, or an allocation. Only the owning thread writes to
+// it, and the profiler reads it from another thread when flushing.
+const uint64_t prof_ring_size = 4096;
+struct prof_ring_t {
+	prof_event_t     events[prof_ring_size];
+	atomic<uint64_t> head;      // Total events ever written
+	uint64_t         tail;      // Total events read, only used when flushing
+	uint32_t         thread_id;
+};
+
+// What the runtime told us about each frame, so slow frames can be lined
+// up with what the runtime was doing.
+struct prof_frame_t {
+	uint64_t frame;
+	uint64_t time_ns;
+	XrTime   predicted_time;
+	XrBool32 should_render;
+};
+
+// Times a section of code from its constructor to its destructor
+struct prof_scope_t {
+	const char *name;
+	uint64_t    start_ns;
+	prof_scope_t(const char *name);
+	~prof_scope_t();
+};
+
+// Turns shader source into bytecode. The shader cache only talks to its
+// compiler through this, so anything that produces bytes from source can
+// stand in for D3DCompile.
+struct shader_compiler_t {
+	const char *name;  // Part of the cache key, so compilers never share blobs
+	uint32_t    flags; // Passed along to compile, and also part of the cache key
+	bool      (*compile)(const char *hlsl, const char *entrypoint, const char *target, const D3D_SHADER_MACRO *defines, uint32_t flags, vector<uint8_t> &out_bytecode);
+};
+
+// The shader cache's pack file is this header, followed by 'count'
+// entries, followed by all the bytecode the entries point to.
+struct shader_cache_header_t {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t count;
+	uint32_t reserved;
+};
+
+struct shader_cache_entry_t {
+	uint64_t key;    // Hash of everything that went into compiling it
+	uint64_t hash;   // Hash of the bytecode, for catching corrupt files
+	uint32_t offset; // From the start of the file
+	uint32_t size;
+};
+
+// Shaders compiled this run, that aren't in the pack file yet
+struct shader_cache_new_t {
+	uint64_t        key;
+	vector<uint8_t> bytecode;
+};
+
+// The pack file is mapped into memory rather than read, so shaders we
+// find in it can go straight from the mapping to the GPU.
+struct shader_cache_t {
+	const uint8_t *data;
+	size_t         size;
+	vector<shader_cache_entry_t> entries; // Only the ones that passed validation
+	vector<shader_cache_new_t>   added;
+	bool           dirty; // The pack file needs writing again
+	uint32_t       hits;
+	uint32_t       misses;
+};
+
+// One row of the action table. Each action gets made for every subaction
+// path in xr_subaction_names, and is bound to 'binding' under each of
+// those paths on the Khronos simple_controller.
+struct action_info_t {
+	const char  *name;
+	const char  *localized_name;
+	XrActionType type;
+	const char  *binding;
+};
+
+// The state of every action for every subaction path, in flat arrays. An
+// action's state for a subaction path lives at openxr_action_slot(action,
+// subaction). Pose actions also get a space for each subaction path, and
+// those go in their own arrays so they can all be located together.
+struct action_state_t {
+	vector<XrAction>  actions;
+	vector<XrPath>    subactions;
+	// One per action per subaction path
+	vector<XrBool32>  active;
+	vector<XrBool32>  current;     // Boolean actions
+	vector<XrBool32>  changed;     // Boolean actions, since the last sync
+	vector<float>     value;       // Float actions
+	vector<XrTime>    changed_at;
+	vector<int32_t>   space_index; // Pose actions, into 'spaces', or -1
+	// One per space
+	vector<XrSpace>   spaces;
+	vector<XrPosef>   poses;
+	vector<XrSpaceLocationFlags> flags;
+	// Runtime calls and time spent polling, since app_draw_prepare last
+	// picked them up
+	uint32_t          calls;
+	double            poll_ms;
+};
+
+// A located hand pose, and the time it was located for
+struct input_sample_t {
+	XrTime               time;
+	XrPosef              pose;
+	XrSpaceLocationFlags flags;
+};
+
+// A button from the action table being pressed or released
+struct input_event_t {
+	XrTime   time;
+	int32_t  action; // Row in xr_action_table
+	XrBool32 pressed;
+};
+
+// A hand's recent poses and button presses. One thread writes to it, and
+// any thread can read it, all without locks. Like the profiler's rings,
+// an entry is written before the head moves past it. Readers check the
+// head again when they're done, to see if the writer lapped them while
+// they were reading, and try again if it did.
+const uint64_t input_history_size   = 512; // Poses, about 2 seconds at 250Hz
+const uint64_t input_history_events = 64;
+const uint64_t input_history_margin = 16;  // Writes a reader can overlap with before it has to retry
+struct input_history_t {
+	input_sample_t   samples[input_history_size];
+	atomic<uint64_t> sample_head; // Total samples ever written
+	input_event_t    events[input_history_events];
+	atomic<uint64_t> event_head;
+};
+
+// Every hand joint we're drawing this frame, kept as a structure of
+// arrays so the whole lot can become matrices in one SIMD batch. Only the
+// joints the runtime could locate are kept, packed at the front, so the
+// GPU draws exactly 'count' of them. It's all fixed size, so copying it
+// into a frame never touches the heap.
+const uint32_t hand_joint_max = XR_HAND_JOINT_COUNT_EXT * 2;
+struct hand_joints_t {
+	float    pos_x [hand_joint_max];
+	float    pos_y [hand_joint_max];
+	float    pos_z [hand_joint_max];
+	float    rot_x [hand_joint_max];
+	float    rot_y [hand_joint_max];
+	float    rot_z [hand_joint_max];
+	float    rot_w [hand_joint_max];
+	float    radius[hand_joint_max];
+	uint32_t count;
+};
+
+// Hands out space in one big GPU buffer, front to back, wrapping around
+// at the end. Positions only ever count up, and the buffer offset is just
+// the position modulo the size. Each frame remembers where its space
+// ended, and once the GPU is done with that frame, everything before it
+// can be written again. None of this touches the GPU itself, so it works
+// the same with frame counters or real fences.
+const uint32_t upload_ring_frames = 4; // Frames that can be waiting on the GPU
+struct upload_ring_t {
+	uint64_t size;
+	uint64_t align;
+	uint64_t head;        // Total bytes ever handed out, padding included
+	uint64_t tail;        // The GPU is done with everything before this
+	uint64_t frame_start; // Where the frame we're filling now began
+	uint64_t frame_ids [upload_ring_frames]; // Frames the GPU may still be reading, oldest first
+	uint64_t frame_ends[upload_ring_frames]; // And where each of them ended
+	uint32_t frame_first;
+	uint32_t frame_count;
+	uint32_t wraps;       // Times we skipped back to the start of the buffer
+	uint32_t full;        // Allocations that didn't fit
+	uint32_t resets;      // Times the whole ring got thrown out
+};
+
+// How long things take to reach the display, sorted into fixed size
+// buckets so adding to it never allocates. Percentiles come out at the
+// bucket size, which is plenty to tell one frame of latency from two.
+const uint32_t latency_buckets   = 200;
+const float    latency_bucket_ms = 0.5f; // So 0-100ms, anything longer goes in the last bucket
+struct latency_hist_t {
+	uint32_t buckets[latency_buckets];
+	uint32_t count;
+	double   total_ms;
+	float    min_ms;
+	float    max_ms;
+};
+
+// What latency_check has to say about a histogram and a budget
+const int32_t latency_within     = 0;
+const int32_t latency_over       = 1;
+const int32_t latency_no_samples = 2; // Nothing was measured, so there's nothing to judge
+
+// A recorded session is this header, followed by records. Each record is
+// a session_record_t saying what kind it is and how many bytes follow,
+// then one of the structs below. Everything that happens between frames
+// is tagged with how many frames had been waited for when it happened,
+// so a replay can hand it out at the same point. Locates are looked up
+// by the time they were for instead, since any thread can ask for one.
+struct session_file_header_t {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t view_count;
+	uint32_t action_count;
+};
+struct session_record_t {
+	uint32_t type;
+	uint32_t size;
+};
+struct session_frame_t {
+	XrTime     display_time;
+	XrDuration period;
+	XrTime     waited_at; // openxr_time_now() as xrWaitFrame returned, or 0 if we can't tell
+	XrBool32   should_render;
+	uint32_t   pad;
+};
+struct session_event_t {
+	uint64_t        frame;
+	XrStructureType type;
+	XrSessionState  state; // For XR_TYPE_EVENT_DATA_SESSION_STATE_CHANGED
+	XrTime          time;
+};
+struct session_action_t {
+	uint64_t frame;
+	uint16_t action;    // Row in xr_action_table
+	uint16_t subaction; // Index in xr_subaction_names
+	XrBool32 active;
+	XrBool32 current;
+	XrBool32 changed;
+	float    value;
+	uint32_t pad;
+	XrTime   changed_at;
+};
+struct session_locate_t {
+	XrTime               time;
+	XrPosef              pose;
+	uint32_t             hand;
+	XrSpaceLocationFlags flags;
+};
+const uint32_t session_view_max = 4; // Enough for quad views
+struct session_views_t { // Followed by 'count' session_view_t
+	XrTime           display_time;
+	XrViewStateFlags flags;
+	uint32_t         count;
+	uint32_t         pad;
+};
+struct session_view_t {
+	XrPosef pose;
+	XrFovf  fov;
+};
+
+// Streams a session recording out to disk on a background thread, the
+// same way the cube journal does. Records wait in 'pending' until the
+// writer swaps it out, and 'pending' never grows past 'capacity', so if
+// the disk falls behind, whoever is recording waits for it.
+struct session_recorder_t {
+	bool               active;
+	thread             worker;
+	mutex              lock;
+	condition_variable wake;
+	condition_variable room;
+	vector<uint8_t>    pending;
+	size_t             capacity;
+	bool               quit;
+	uint64_t           records;
+	uint64_t           stalls;    // Times a record had to wait for the writer
+	// These belong to the thread calling xrWaitFrame and xrSyncActions
+	uint64_t           frame;
+	vector<session_action_t> last_actions; // Only actions that change get recorded
+	// And these belong to the writer thread once it's started
+	FILE              *fp;
+	uint64_t           bytes;
+	bool               failed;
 };
 
+// What the app uses from the action state, for the two hands
 struct input_state_t {
 	XrActionSet actionSet;
-	XrAction    poseAction;
-	XrAction    selectAction;
-	XrPath   handSubactionPath[2];
-	XrSpace  handSpace[2];
 	XrPosef  handPose[2];
 	XrBool32 renderHand[2];
 	XrBool32 handSelect[2];
+	XrTime   handSelectTime[2];
 };
 
 ///////////////////////////////////////////
@@ -51,16 +578,82 @@ struct input_state_t {
 PFN_xrGetD3D11GraphicsRequirementsKHR ext_xrGetD3D11GraphicsRequirementsKHR = nullptr;
 PFN_xrCreateDebugUtilsMessengerEXT    ext_xrCreateDebugUtilsMessengerEXT    = nullptr;
 PFN_xrDestroyDebugUtilsMessengerEXT   ext_xrDestroyDebugUtilsMessengerEXT   = nullptr;
+#ifdef XR_USE_PLATFORM_WIN32
+PFN_xrConvertWin32PerformanceCounterToTimeKHR ext_xrConvertWin32PerformanceCounterToTimeKHR = nullptr;
+#else
+PFN_xrConvertTimespecTimeToTimeKHR    ext_xrConvertTimespecTimeToTimeKHR    = nullptr;
+#endif
+#ifdef XR_KHR_locate_spaces
+PFN_xrLocateSpacesKHR                 ext_xrLocateSpacesKHR                 = nullptr;
+#endif
+PFN_xrCreateHandTrackerEXT            ext_xrCreateHandTrackerEXT            = nullptr;
+PFN_xrDestroyHandTrackerEXT           ext_xrDestroyHandTrackerEXT           = nullptr;
+PFN_xrLocateHandJointsEXT             ext_xrLocateHandJointsEXT             = nullptr;
 
 ///////////////////////////////////////////
 
 struct app_transform_buffer_t {
-	XMFLOAT4X4 world;
-	XMFLOAT4X4 viewproj;
+	mat4_t viewproj[2];
+};
+
+// How to unpack the mesh's positions, xyz with an unused w
+struct app_mesh_buffer_t {
+	float mesh_min [4];
+	float mesh_size[4];
+};
+
+// Per-frame draw statistics, so we can see how much work each frame
+// actually submits to the GPU as the scene grows.
+struct app_stats_t {
+	uint32_t draw_calls;
+	uint32_t instances;
+	uint32_t cubes_tested;
+	uint32_t cubes_visible;
+	uint32_t upload_bytes;    // Cube transforms sent to the GPU
+	uint32_t upload_id_bytes; // Visible cube ids sent to the GPU
+	double   submit_ms;
+	double   latency_ms;      // From xrWaitFrame returning, to xrEndFrame returning
+	double   pose_age_ms;     // How far before predictedDisplayTime the hands were first located
+	double   latch_age_ms;    // And how far before it they were late latched
+	double   latch_gain_ms;   // Time between those two, measured on our own clock
+	uint32_t latches;
+	float    render_ms;       // What the resolution governor measured
+	float    res_scale;       // And the resolution it picked
+	uint32_t input_calls;     // OpenXR calls made polling and locating input
+	double   input_ms;        // And the time they took
+	uint32_t joints;          // Hand joints drawn
+	double   joint_locate_ms; // Locating and packing them
+	double   joint_matrix_ms; // Turning them into matrices
+	uint32_t ring_bytes;      // Upload ring space used, padding included
+};
+
+// Everything needed to draw a frame. The simulation fills this in right
+// after xrWaitFrame, and then leaves it alone until the frame has been
+// submitted, so drawing it can happen on another thread while the
+// simulation moves on to the next frame.
+struct app_frame_t {
+	XrFrameState     state;
+	bool             render;     // False if the session isn't visible
+	uint64_t         prof_frame;
+	chrono::high_resolution_clock::time_point waited_at;
+	vector<XrView>   views;      // Always one per config view, so the runtime has room to write
+	uint32_t         view_count; // How many of them the runtime located this frame
+	XrPosef          hands[2];
+	XrBool32         hands_active[2];
+	XrTime           hands_located_at; // When the hands were located, or 0 if we can't tell
+	hand_joints_t    joints;
+	uint32_t         reprojected;      // Displays we missed right before this frame
+	vector<XrPosef>  new_cubes;  // Cubes placed since the last rendered frame
+	vector<uint32_t> draw_ids;   // GPU ids of every visible cube
+	vector<XrTime>   select_times; // Select presses whose cubes first show up in this frame
+	app_stats_t      stats;
 };
 
 XrFormFactor            app_config_form = XR_FORM_FACTOR_HEAD_MOUNTED_DISPLAY;
 XrViewConfigurationType app_config_view = XR_VIEW_CONFIGURATION_TYPE_PRIMARY_STEREO;
+// Render both eyes in a single pass into a texture array swapchain, when
+// the hardware supports it. Turn this off to render each view separately.
+bool                    app_config_single_pass = true;
 
 ID3D11VertexShader *app_vshader;
 ID3D11PixelShader  *app_pshader;
@@ -68,13 +661,201 @@ ID3D11InputLayout  *app_shader_layout;
 ID3D11Buffer       *app_constant_buffer;
 ID3D11Buffer       *app_vertex_buffer;
 ID3D11Buffer       *app_index_buffer;
-
-vector<XrPosef> app_cubes;
+ID3D11Buffer       *app_mesh_buffer;
+mesh_t              app_mesh;
+uint32_t            app_index_count;
+mesh_loader_t       app_mesh_loader;
+ID3D11Buffer       *app_world_buffer;
+ID3D11ShaderResourceView *app_world_srv;
+uint32_t            app_world_capacity;
+ID3D11Buffer       *app_id_buffer;
+uint32_t            app_id_capacity;
+// Hand joints move every frame, so they get a world buffer of their own
+// that's replaced whole each frame, and an instance buffer that's just
+// the numbers 0 to hand_joint_max, so joint i uses matrix i.
+ID3D11Buffer       *app_joint_buffer;
+ID3D11ShaderResourceView *app_joint_srv;
+ID3D11Buffer       *app_joint_id_buffer;
+mat4_t              app_joint_matrices[hand_joint_max];
+uint32_t            app_joint_count;
+
+// Draw all cubes with a single instanced draw call per view. Turn this off
+// to draw each cube with its own draw call, for comparison.
+bool     app_config_instancing  = true;
+// Fill the scene with this many extra cubes on startup, and log draw
+// statistics periodically. Handy for checking how rendering scales.
+uint32_t app_config_bench_cubes = 0;
+// Run a quick benchmark of the matrix math on startup.
+bool     app_config_bench_math  = false;
+// Skip drawing cubes that are outside of the view frustum.
+bool     app_config_culling     = true;
+// Use a spatial index to find visible cubes, instead of testing each one.
+bool     app_config_spatial_index = true;
+// Run a benchmark of spatial index inserts and queries on startup.
+bool     app_config_bench_spatial = false;
+// Run a benchmark of the mesh optimization pipeline on startup.
+bool     app_config_bench_mesh    = false;
+// Stream the cube mesh in from app_mesh_file on a background thread,
+// drawing the built-in cube until it's ready. The file gets built and
+// written to the working directory if it isn't there yet.
+bool     app_config_mesh_stream   = false;
+// Run a benchmark of mesh file streaming on startup.
+bool     app_config_bench_mesh_load = false;
+// Save placed cubes to a journal on disk, and put them back on startup.
+// The writer waits app_config_journal_batch_ms to gather placements into a
+// single write, and folds the journal into the snapshot once it's at least
+// app_config_journal_compact cubes and as big as the snapshot. Both files
+// go in the working directory, and cubes from earlier runs come back.
+bool     app_config_journal       = false;
+uint32_t app_config_journal_batch_ms = 100;
+uint64_t app_config_journal_compact  = 4096;
+// Run a benchmark of saving and restoring a million cubes on startup.
+bool     app_config_bench_journal = false;
+// Time each phase of the frame, and write out a Chrome/Perfetto trace
+// (chrome://tracing or ui.perfetto.dev) and a CSV of p50/p95/p99 times.
+bool     app_config_profile       = false;
+// Simulate on the main thread, and render on a second thread, so the next
+// frame's simulation overlaps with submitting the current one.
+bool     app_config_pipelined     = false;
+// Burn this much time in each app_update and each frame's rendering, to
+// see how the frame loop holds up under a heavy load. Frame rate and
+// latency get logged when either of these is set.
+float    app_config_bench_update_ms = 0;
+float    app_config_bench_render_ms = 0;
+// Locate the hands again right before drawing each view, and patch just
+// their transforms on the GPU, so the time spent rendering doesn't add to
+// how far behind the controllers look.
+bool     app_config_late_latch    = true;
+// Keep compiled shaders in a file between runs, instead of compiling them
+// every time we start up. The file goes in the working directory.
+bool     app_config_shader_cache  = false;
+// The depth buffer format. D16 is half the memory and bandwidth of the
+// 32 bit formats, and plenty for a scene like this one. Use
+// DXGI_FORMAT_D24_UNORM_S8_UINT if you need stencil, or
+// DXGI_FORMAT_D32_FLOAT for the most precision.
+DXGI_FORMAT app_config_depth_fmt  = DXGI_FORMAT_D16_UNORM;
+// Submit our depth buffers along with color, if the runtime supports
+// XR_KHR_composition_layer_depth. When we miss a frame, the runtime can
+// then reproject the old one using depth, instead of just rotating it.
+bool     app_config_depth_layer   = true;
+// Render at a lower resolution when frames take too long, and a higher
+// one when there's time to spare, instead of dropping frames. Swapchains
+// are made bigger than recommended, so there's room to go up as well.
+// The limits are a fraction of the recommended resolution, on each axis.
+bool     app_config_dynamic_res   = false;
+float    app_config_res_min       = 0.5f;
+float    app_config_res_max       = 1.4f;
+// When the session is running but not visible, nothing we draw gets shown,
+// so we save power by only doing a frame this often. While we wait, we
+// still check for events every app_config_idle_poll_ms, so becoming
+// visible gets us drawing again right away.
+uint32_t app_config_idle_frame_ms = 250;
+uint32_t app_config_idle_poll_ms  = 5;
+// With this many views or more, record each view's draw calls in
+// parallel on worker threads, and play them back in order. This only
+// applies when views have their own swapchains, not single pass stereo.
+// 0 always records them one at a time. It's off until app_bench_views
+// shows it paying off on real hardware; 4 is a good place to start.
+uint32_t app_config_parallel_views = 0;
+// Run a benchmark of recording 2 to 12 views in parallel, with different
+// numbers of worker threads, after startup. Needs a graphics device.
+bool     app_config_bench_views   = false;
+// Log how many OpenXR calls polling and locating input takes each frame,
+// and how long they take. With app_config_late_latch, this also logs how
+// old the hand poses are when we draw them.
+bool     app_config_input_stats   = false;
+// Locate the hands this many times a second on their own thread, for a
+// finer pose history than once per frame. 0 records the poses each frame
+// uses instead.
+uint32_t app_config_input_sample_hz = 0;
+// Measure how accurate the input history's poses are, and how long a
+// query takes, on startup. Tests/test_input_history.cpp checks the rest.
+bool     app_config_bench_input   = false;
+// Draw every joint of each hand as a little cube, when the runtime has
+// XR_EXT_hand_tracking and a system that can track hands.
+bool     app_config_hand_joints   = true;
+// Size of the ring buffer camera matrices get written into each frame,
+// bound at an offset instead of updating one buffer per draw. 0 turns it
+// off, and so does a driver without Direct3D 11.1 constant buffer offsets.
+uint32_t app_config_upload_ring_kb = 64;
+// Fail with an exit code of 1 if the 99th percentile of select to photon
+// or pose to photon latency goes over this many milliseconds. 0 turns
+// the check off. The headless runtime's timing is exact, so there,
+// Tests/test_latency.cpp uses this to catch any extra frame we add.
+#ifdef XR_HEADLESS
+float    app_config_latency_budget_ms = 40;
+#else
+float    app_config_latency_budget_ms = 0;
+#endif
+// Record everything the runtime tells us, events, action states, hand and
+// view poses, and frame timing, into this file. nullptr turns it off.
+// Records are buffered in app_config_record_buffer_kb of memory, twice
+// over, and the writer flushes every app_config_record_flush_ms.
+const char *app_config_record_file      = nullptr;
+uint32_t    app_config_record_buffer_kb = 256;
+uint32_t    app_config_record_flush_ms  = 100;
+// The headless runtime can play a recording back instead of following
+// its script, so a session from a real headset can be run again, the
+// same way every time, with no headset. It either keeps to the recorded
+// frame timing, or goes as fast as it can, for benchmarking.
+const char *app_config_replay_file      = nullptr;
+bool        app_config_replay_realtime  = false;
+
+const float app_clip_near   = 0.05f;
+const float app_clip_far    = 100.0f;
+const float app_cube_scale  = 0.05f;
+const float app_cube_radius = app_cube_scale * 1.7320508f; // sqrt(3), corner of a unit cube
+
+// The hands move every frame, while placed cubes never change once they're
+// added. The GPU keeps a copy of all their world matrices, with the hands
+// first, followed by every placed cube. We only need to upload the hands,
+// and whatever cubes were placed since last frame.
+// These belong to the simulation:
+XrPosef          app_hands[2] = { { {0,0,0,1}, {0,0,0} }, { {0,0,0,1}, {0,0,0} } };
+cube_store_t     app_cubes;
+size_t           app_cubes_sent; // How many cubes have gone out in an app_frame_t
+spatial_index_t  app_cube_index = { 1.0f };
+cube_journal_t   app_journal;
+vector<XrPosef>  app_cull_scratch;
+vector<uint32_t> app_cull_scratch_ids;
+vector<XrTime>   app_latency_pending; // Select presses that placed a cube no frame has shown yet
+
+// And these belong to rendering. Each frame, we make a list of the world
+// matrix ids that are visible. The GPU draws from its own copy of that
+// list, which we only update where it's changed.
+size_t           app_cubes_uploaded;
+vector<uint32_t> app_draw_ids_uploaded;
+vector<mat4_t>   app_upload_scratch;
+size_t           app_draw_count;
+vector<uint32_t> app_view_constants;     // Each pass's first constant in the upload ring, if it's there
+uint32_t         app_views_per_pass = 1; // Views that share a pass, and its block of constants
+XrTime           app_latency_pose_at;    // When the hands being drawn were located
+latency_hist_t   app_latency_select;
+latency_hist_t   app_latency_pose;
+app_stats_t      app_stats; // The frame currently being drawn
+app_stats_t      app_stats_total;
+uint32_t         app_stats_frames;
+chrono::high_resolution_clock::time_point app_stats_start;
 
 void app_init  ();
-void app_draw  (XrCompositionLayerProjectionView &layerView);
+void app_draw_prepare(app_frame_t &frame);
+void app_draw_cull   (app_frame_t &frame);
+void app_draw_upload (const app_frame_t &frame);
+void app_draw  (ID3D11DeviceContext *context, XrCompositionLayerProjectionView *layerViews, uint32_t view_count, uint32_t first_view, app_stats_t &stats);
+void app_draw_finish (const app_frame_t &frame);
+void app_draw_latch  (const app_frame_t &frame, const XrPosef *hands, XrTime located_at);
+void app_latency_record(const app_frame_t &frame);
+bool app_latency_report();
 void app_update();
 void app_update_predicted();
+void app_bench_math();
+void app_bench_spatial();
+void app_bench_mesh();
+void app_bench_mesh_load();
+void app_bench_journal();
+void app_bench_input();
+void app_bench_views();
+void app_bench_spin(float ms);
 
 ///////////////////////////////////////////
 
@@ -86,59 +867,417 @@ bool           xr_running       = false;
 XrSpace        xr_app_space     = {};
 XrSystemId     xr_system_id     = XR_NULL_SYSTEM_ID;
 input_state_t  xr_input         = { };
+action_state_t xr_actions       = { };
 XrEnvironmentBlendMode   xr_blend = {};
 XrDebugUtilsMessengerEXT xr_debug = {};
+bool           xr_single_pass   = false;
+bool           xr_depth_layers  = false;
+bool           xr_locate_batched = false; // XR_KHR_locate_spaces is available
+bool           xr_hand_tracking  = false; // XR_EXT_hand_tracking is available, and the system can track hands
+int64_t        xr_depth_fmt     = 0;
+
+// Every action the app listens for. Adding an action is just adding a
+// row here, and the xr_action_ ids are rows in this table.
+const char         *xr_subaction_names[] = { "/user/hand/left", "/user/hand/right" };
+const action_info_t xr_action_table[] = {
+	{ "hand_pose", "Hand Pose", XR_ACTION_TYPE_POSE_INPUT,    "/input/grip/pose"    },
+	{ "select",    "Select",    XR_ACTION_TYPE_BOOLEAN_INPUT, "/input/select/click" }, };
+const int32_t       xr_action_hand_pose  = 0;
+const int32_t       xr_action_select     = 1;
 
-vector<XrView>                  xr_views;
 vector<XrViewConfigurationView> xr_config_views;
 vector<swapchain_t>             xr_swapchains;
 
-bool openxr_init          (const char *app_name, int64_t swapchain_format);
+// Frames waiting to be drawn. The simulation fills these in order, and
+// the render thread draws them in the same order, so the frames don't
+// need a lock, only the counts do. Whichever thread can't go on sleeps
+// until the other moves a count along, so neither burns a core waiting,
+// like when the session's idle. With only two, the simulation can never
+// get more than one frame ahead, which is what OpenXR's frame pacing
+// expects anyway.
+app_frame_t        xr_frames[2];
+mutex              xr_frames_lock;
+condition_variable xr_frames_changed;
+uint64_t           xr_frames_waited;    // Frames filled in by the simulation
+uint64_t           xr_frames_submitted; // Frames drawn by the render thread
+bool               xr_render_quit;
+thread             xr_render_thread;
+
+// How many frames we've submitted, and how many extra times the runtime
+// had to show one of them again, because we didn't have a new one ready.
+// Those get reprojected, which is where depth layers help!
+XrTime   xr_last_display_time = 0; // Belongs to the simulation
+uint64_t xr_frames_submitted_total   = 0; // And these belong to rendering
+uint64_t xr_frames_reprojected_total = 0;
+res_governor_t xr_res_governor = {}; // Also belongs to rendering
+
+// For measuring how long it takes from a session state change to the
+// first frame that follows it.
+bool           xr_transition_pending = false;
+XrSessionState xr_transition_state   = XR_SESSION_STATE_UNKNOWN;
+uint64_t       xr_transition_ns      = 0;
+
+bool openxr_init          (const char *app_name, const int64_t *swapchain_formats, uint32_t format_count);
 void openxr_make_actions  ();
+void openxr_make_hand_trackers();
+void openxr_locate_joints (XrTime predicted_time);
 void openxr_shutdown      ();
-void openxr_poll_events   (bool &exit);
+bool openxr_poll_events   (bool &exit);
+void openxr_idle          (bool &exit);
+const char *openxr_state_name(XrSessionState state);
+uint32_t openxr_action_slot(int32_t action, int32_t subaction);
 void openxr_poll_actions  ();
 void openxr_poll_predicted(XrTime predicted_time);
+uint32_t openxr_locate_spaces(XrTime time, const XrSpace *spaces, uint32_t count, XrPosef *out_poses, XrSpaceLocationFlags *out_flags);
+void openxr_latch_hands   (const app_frame_t &frame);
+XrTime openxr_time_now    ();
 void openxr_render_frame  ();
-bool openxr_render_layer  (XrTime predictedTime, vector<XrCompositionLayerProjectionView> &projectionViews, XrCompositionLayerProjection &layer);
+void openxr_wait_frame    (app_frame_t &frame);
+void openxr_submit_frame  (app_frame_t &frame);
+bool openxr_render_layer  (const app_frame_t &frame, vector<XrCompositionLayerProjectionView> &projectionViews, vector<XrCompositionLayerDepthInfoKHR> &depthInfos, XrCompositionLayerProjection &layer);
+ID3D11DepthStencilView *openxr_acquire_depth(swapchain_t &swapchain);
+void openxr_release_depth (swapchain_t &swapchain);
+void openxr_depth_info    (XrCompositionLayerProjectionView &view, XrCompositionLayerDepthInfoKHR &info, const swapchain_t &swapchain, uint32_t array_index);
+XrRect2Di openxr_view_rect(const swapchain_t &swapchain);
+void openxr_pipeline_start();
+void openxr_pipeline_drain();
+void openxr_pipeline_stop ();
+void openxr_sampler_start ();
+void openxr_sampler_stop  ();
+
+// Each hand's recent history. Either the sampler thread writes these, or
+// if it's not running, openxr_poll_predicted writes them each frame.
+input_history_t  xr_history[2];
+thread           xr_sampler_thread;
+atomic<bool>     xr_sampler_quit;
+
+// Articulated hands, when the runtime has them. The runtime fills in
+// xr_joint_scratch one hand at a time, and the valid joints get packed
+// into xr_joints, which app_draw_prepare copies into the frame.
+XrHandTrackerEXT       xr_hand_trackers[2] = {};
+XrHandJointLocationEXT xr_joint_scratch[XR_HAND_JOINT_COUNT_EXT];
+hand_joints_t          xr_joints;
+double                 xr_joint_ms; // Time spent in openxr_locate_joints, since app_draw_prepare last took it
+
+// Everything the runtime tells us gets copied in here, when we're
+// recording the session.
+session_recorder_t     xr_recorder;
 
 ///////////////////////////////////////////
 
 ID3D11Device        *d3d_device        = nullptr;
 ID3D11DeviceContext *d3d_context       = nullptr;
-int64_t              d3d_swapchain_fmt = DXGI_FORMAT_R8G8B8A8_UNORM;
+
+// Swapchain color formats we can draw with, best first. Our shader writes
+// its colors out as they are, so these are all linear formats: an sRGB
+// one would convert them on the way out, and change how they look. The
+// 32 bit formats come first, since they're the least bandwidth for both
+// us and the compositor, and 64 bit FP16 is the last resort.
+const int64_t        d3d_swapchain_fmts[] = {
+	DXGI_FORMAT_R8G8B8A8_UNORM,    DXGI_FORMAT_B8G8R8A8_UNORM,
+	DXGI_FORMAT_R10G10B10A2_UNORM, DXGI_FORMAT_R16G16B16A16_FLOAT, };
 
 bool                 d3d_init             (LUID &adapter_luid);
 void                 d3d_shutdown         ();
 IDXGIAdapter1       *d3d_get_adapter      (LUID &adapter_luid);
-swapchain_surfdata_t d3d_make_surface_data(XrBaseInStructure &swapchainImage);
-void                 d3d_render_layer     (XrCompositionLayerProjectionView &layerView, swapchain_surfdata_t &surface);
+swapchain_surfdata_t d3d_make_surface_data(XrBaseInStructure &swapchainImage, int64_t format, ID3D11DepthStencilView *depth_view);
+ID3D11DepthStencilView *d3d_make_depth    (uint32_t width, uint32_t height, uint32_t array_size);
+ID3D11DepthStencilView *d3d_make_depth_view(ID3D11Texture2D *texture, int64_t format, uint32_t array_size);
+uint32_t             d3d_format_size      (int64_t format);
+void                 d3d_memory_report    (const vector<swapchain_t> &swapchains, int64_t color_format);
+void                 d3d_timer_begin      ();
+void                 d3d_timer_end        ();
+bool                 d3d_timer_read       (float &out_ms);
+bool                 d3d_ring_init        (uint32_t size);
+void                 d3d_ring_shutdown    ();
+uint8_t             *d3d_ring_map         (uint32_t bytes, uint32_t count, uint32_t *out_offsets);
+void                 d3d_ring_unmap       ();
+void                 d3d_ring_fence       ();
+
+// GPU timestamps for measuring how long frames take to render. Results
+// show up a few frames late, so we keep a few sets of queries around.
+const uint32_t       d3d_timer_count = 4;
+ID3D11Query         *d3d_timer_queries[d3d_timer_count][3]; // Disjoint, start, end
+uint64_t             d3d_timer_issued = 0;
+uint64_t             d3d_timer_done   = 0;
+bool                 d3d_timer_active = false;
+
+// Per-frame GPU data goes through one big dynamic buffer, mapped once a
+// frame. An event query after each frame's rendering tells us when the
+// GPU is done with that frame's part of it. The buffer is null when the
+// driver can't bind constant buffers at an offset.
+const uint32_t       d3d_ring_align   = 256; // Offsets are bound in blocks of 16 constants, 16 bytes each
+upload_ring_t        d3d_ring;
+ID3D11Buffer        *d3d_ring_buffer;
+ID3D11Query         *d3d_ring_fences[upload_ring_frames];
+uint64_t             d3d_ring_issued  = 0;
+uint64_t             d3d_ring_done    = 0;
+bool                 d3d_ring_mapped  = false; // Used this frame, so it needs a fence
+bool                 d3d_ring_fresh   = true;  // Nothing's been written yet, so the first map discards
+
+// For recording views in parallel, each view gets a deferred context of
+// its own, which records into a command list that the immediate context
+// plays back. These are empty when views are recorded one at a time.
+vector<ID3D11DeviceContext*>  d3d_view_contexts;
+vector<ID3D11CommandList*>    d3d_view_lists;
+vector<swapchain_surfdata_t>  d3d_view_surfaces;
+vector<app_stats_t>           d3d_view_stats; // Each view's draw stats, so workers don't share app_stats
+d3d_workers_t                 d3d_workers;
+bool                 d3d_supports_single_pass();
+void                 d3d_render_layer     (ID3D11DeviceContext *context, XrCompositionLayerProjectionView *layerViews, uint32_t view_count, uint32_t first_view, swapchain_surfdata_t &surface, app_stats_t &stats);
+bool                 d3d_views_init       (uint32_t view_count, uint32_t thread_count);
+void                 d3d_views_shutdown   ();
+void                 d3d_render_views     (XrCompositionLayerProjectionView *layerViews, swapchain_surfdata_t *surfaces, uint32_t view_count);
+void                 d3d_record_view      (uint32_t index, void *data);
+void                 d3d_workers_start    (d3d_workers_t &workers, uint32_t thread_count);
+void                 d3d_workers_stop     (d3d_workers_t &workers);
+void                 d3d_workers_run      (d3d_workers_t &workers, uint32_t job_count, void (*job)(uint32_t index, void *data), void *data);
+void                 d3d_workers_drain    (d3d_workers_t &workers);
 void                 d3d_swapchain_destroy(swapchain_t &swapchain);
-XMMATRIX             d3d_xr_projection    (XrFovf fov, float clip_near, float clip_far);
-ID3DBlob            *d3d_compile_shader   (const char* hlsl, const char* entrypoint, const char* target);
+bool                 d3d_compile_shader   (const char* hlsl, const char* entrypoint, const char* target, const D3D_SHADER_MACRO *defines, uint32_t flags, vector<uint8_t> &out_bytecode);
+
+#ifdef _DEBUG
+const uint32_t    d3d_shader_flags    = D3DCOMPILE_PACK_MATRIX_COLUMN_MAJOR | D3DCOMPILE_ENABLE_STRICTNESS | D3DCOMPILE_WARNINGS_ARE_ERRORS | D3DCOMPILE_SKIP_OPTIMIZATION | D3DCOMPILE_DEBUG;
+#else
+const uint32_t    d3d_shader_flags    = D3DCOMPILE_PACK_MATRIX_COLUMN_MAJOR | D3DCOMPILE_ENABLE_STRICTNESS | D3DCOMPILE_WARNINGS_ARE_ERRORS | D3DCOMPILE_OPTIMIZATION_LEVEL3;
+#endif
+shader_compiler_t d3d_shader_compiler = { "D3DCompile", d3d_shader_flags, d3d_compile_shader };
+
+///////////////////////////////////////////
+
+bool file_map      (const char *filename, const uint8_t **out_data, size_t *out_size);
+void file_unmap    (const uint8_t *data, size_t size);
+void file_temp_name(char *out_name, size_t out_size, const char *filename);
+bool file_replace  (const char *temp_file, const char *filename);
+
+///////////////////////////////////////////
+
+const char    *shader_cache_file    = "shader_cache.bin";
+const uint32_t shader_cache_magic   = 0x43485358; // 'XSHC'
+const uint32_t shader_cache_version = 1;
+
+bool     shader_cache_open (shader_cache_t &cache, const char *filename);
+bool     shader_cache_get  (shader_cache_t &cache, const shader_compiler_t &compiler, const char *hlsl, const char *entrypoint, const char *target, const D3D_SHADER_MACRO *defines, const uint8_t **out_bytecode, size_t *out_size);
+bool     shader_cache_close(shader_cache_t &cache, const char *filename);
+void     shader_cache_unmap(shader_cache_t &cache);
+uint64_t shader_cache_hash (uint64_t hash, const void *data, size_t size);
+
+///////////////////////////////////////////
+
+extern const char *math_simd_name;
+
+void    math_poses_to_matrices(const XrPosef *poses, size_t count, float scale, mat4_t *out_matrices);
+void    math_joints_to_matrices(const hand_joints_t &joints, mat4_t *out_matrices);
+mat4_t  math_pose_matrix      (const XrPosef &pose, float scale);
+XrPosef math_pose_inverse     (const XrPosef &pose);
+XrVector3f math_quat_rotate   (const XrQuaternionf &q, const XrVector3f &v);
+XrQuaternionf math_quat_mul   (const XrQuaternionf &a, const XrQuaternionf &b);
+XrQuaternionf math_quat_slerp (const XrQuaternionf &a, const XrQuaternionf &b, float t);
+XrQuaternionf math_quat_from_rotation(const XrVector3f &rotation);
+XrVector3f    math_quat_to_rotation  (const XrQuaternionf &q);
+mat4_t  math_projection       (XrFovf fov, float clip_near, float clip_far);
+mat4_t  math_mul              (const mat4_t &a, const mat4_t &b);
+math_frustum_t math_frustum_combined(const XrView *views, uint32_t view_count, float clip_near, float clip_far);
+size_t         math_frustum_cull    (const math_frustum_t &frustum, const XrPosef *poses, size_t count, float radius, uint32_t *out_visible);
+bool           math_frustum_bounds  (const math_frustum_t &frustum, XrVector3f *out_min, XrVector3f *out_max);
+uint32_t math_rand            (uint32_t &seed);
+float    math_rand_range      (uint32_t &seed, float min, float max);
+
+///////////////////////////////////////////
+
+uint32_t       cube_store_add(cube_store_t &store, const XrPosef &pose);
+const XrPosef &cube_store_get(const cube_store_t &store, uint32_t id);
+
+///////////////////////////////////////////
+
+const char    *cube_snapshot_file    = "cubes.snapshot";
+const char    *cube_journal_file     = "cubes.journal";
+const uint32_t cube_snapshot_magic   = 0x50414E53; // 'SNAP'
+const uint32_t cube_journal_magic    = 0x4C4E524A; // 'JRNL'
+const uint32_t cube_file_version     = 1;
+
+bool   cube_journal_open   (cube_journal_t &journal, const char *snapshot_file, const char *journal_file, cube_store_t &cubes, spatial_index_t &index);
+void   cube_journal_append (cube_journal_t &journal, const XrPosef &pose);
+void   cube_journal_close  (cube_journal_t &journal);
+void   cube_journal_run    (cube_journal_t *journal);
+bool   cube_journal_compact(cube_journal_t &journal);
+size_t cube_journal_skip   (const cube_file_t &snapshot, cube_file_t &log);
+bool   cube_file_map       (cube_file_t &file, const char *filename, uint32_t magic);
+void   cube_file_unmap     (cube_file_t &file);
+bool   cube_file_write     (const char *filename, uint32_t magic, uint64_t base, const XrPosef **pose_lists, const size_t *counts, int32_t list_count);
+
+///////////////////////////////////////////
+
+void    spatial_insert       (spatial_index_t &index, uint32_t id, const XrVector3f &center, float radius);
+void    spatial_insert_many  (spatial_index_t &index, uint32_t first_id, const XrPosef *poses, size_t count, float radius);
+size_t  spatial_query_frustum(const spatial_index_t &index, const math_frustum_t &frustum, const cube_store_t &cubes, float radius, vector<XrPosef> &scratch, vector<uint32_t> &scratch_ids, uint32_t *out_ids, uint32_t *out_tested);
+int64_t spatial_query_ray    (const spatial_index_t &index, const cube_store_t &cubes, XrVector3f origin, XrVector3f dir, float max_dist, float half_size, float *out_dist);
+
+///////////////////////////////////////////
+
+const uint32_t mesh_cache_size = 32; // Vertices in the cache we optimize for
+
+bool        mesh_build         (const float *verts, size_t vert_count, const uint32_t *inds, size_t ind_count, mesh_t &out_mesh, uint32_t *out_remap = nullptr);
+void        mesh_optimize_cache(uint32_t *inds, size_t ind_count, size_t vert_count);
+size_t      mesh_optimize_fetch(uint32_t *inds, size_t ind_count, size_t vert_count, uint32_t *out_remap);
+float       mesh_acmr          (const uint32_t *inds, size_t ind_count, uint32_t cache_size);
+mesh_vert_t mesh_pack_vert     (const float *pos_norm, const XrVector3f &bounds_min, const XrVector3f &bounds_size);
+float       mesh_vert_score    (int32_t cache_pos, uint32_t remaining);
+uint16_t    mesh_encode_normal (XrVector3f normal);
+XrVector3f  mesh_decode_normal (uint16_t normal);
+
+///////////////////////////////////////////
+
+const char    *app_mesh_file        = "cube.mesh";
+const uint32_t mesh_file_magic      = 0x4853454D; // 'MESH'
+const uint32_t mesh_file_version    = 1;
+const uint32_t mesh_file_align      = 64; // Stream data starts on a cache line
+const uint32_t mesh_stream_vertices = 1;
+const uint32_t mesh_stream_indices  = 2;
+
+// Where a mesh_loader_t is at. The loader thread only ever moves it from
+// loading to ready or failed, and mesh_load_poll takes it from there.
+const int32_t  mesh_load_idle       = 0;
+const int32_t  mesh_load_loading    = 1;
+const int32_t  mesh_load_ready      = 2;
+const int32_t  mesh_load_failed     = 3;
+
+bool mesh_file_write(const char *filename, const mesh_t &mesh);
+bool mesh_file_map  (mesh_file_t &file, const char *filename);
+void mesh_file_unmap(mesh_file_t &file);
+bool mesh_load_start(mesh_loader_t &loader, const char *filename);
+void mesh_load_run  (mesh_loader_t *loader);
+bool mesh_load_poll (mesh_loader_t &loader);
+void mesh_load_stop (mesh_loader_t &loader);
+
+///////////////////////////////////////////
+
+const XrDuration input_velocity_window  = 20000000;  // Velocity is measured over at least this long, 20ms
+const XrDuration input_extrapolate_max  = 100000000; // How far past the newest pose we'll guess, 100ms
+
+void     input_history_add         (input_history_t &history, XrTime time, const XrPosef &pose, XrSpaceLocationFlags flags);
+void     input_history_event       (input_history_t &history, XrTime time, int32_t action, XrBool32 pressed);
+uint32_t input_history_events_since(const input_history_t &history, XrTime since, input_event_t *out_events, uint32_t capacity);
+bool     input_history_pose        (const input_history_t &history, XrTime time, XrPosef *out_pose);
+bool     input_history_velocity    (const input_history_t &history, XrVector3f *out_linear, XrVector3f *out_angular);
+
+///////////////////////////////////////////
+
+void upload_ring_init  (upload_ring_t &ring, uint64_t size, uint64_t align);
+bool upload_ring_alloc (upload_ring_t &ring, uint64_t bytes, uint64_t *out_offset);
+void upload_ring_end   (upload_ring_t &ring, uint64_t frame_id);
+void upload_ring_retire(upload_ring_t &ring, uint64_t done_before);
+void upload_ring_reset (upload_ring_t &ring);
+
+///////////////////////////////////////////
+
+void    latency_add       (latency_hist_t &hist, float ms);
+float   latency_percentile(const latency_hist_t &hist, float percent);
+void    latency_print     (const latency_hist_t &hist, const char *name);
+int32_t latency_check     (const latency_hist_t &hist, float budget_ms);
+
+///////////////////////////////////////////
+
+const uint32_t session_file_magic   = 0x43455258; // 'XREC'
+const uint32_t session_file_version = 1;
+const uint32_t session_type_frame   = 1; // session_frame_t
+const uint32_t session_type_event   = 2; // session_event_t
+const uint32_t session_type_action  = 3; // session_action_t
+const uint32_t session_type_locate  = 4; // session_locate_t
+const uint32_t session_type_views   = 5; // session_views_t, then its session_view_t
+
+bool session_record_open   (session_recorder_t &recorder, const char *filename, uint32_t view_count, uint32_t action_count);
+void session_record_close  (session_recorder_t &recorder);
+void session_record_run    (session_recorder_t *recorder);
+void session_record_append (session_recorder_t &recorder, uint32_t type, const void *data, size_t size, const void *extra, size_t extra_size);
+void session_record_frame  (session_recorder_t &recorder, const XrFrameState &state);
+void session_record_event  (session_recorder_t &recorder, const XrEventDataBuffer &event);
+void session_record_action (session_recorder_t &recorder, uint32_t action, uint32_t subaction);
+void session_record_locates(session_recorder_t &recorder, XrTime time, const XrSpace *spaces, uint32_t count, const XrPosef *poses, const XrSpaceLocationFlags *flags);
+void session_record_views  (session_recorder_t &recorder, XrTime display_time, const XrViewState &state, const XrView *views, uint32_t count);
+
+///////////////////////////////////////////
+
+const float res_governor_target = 0.85f; // Fraction of the display period we'd like to spend rendering
+const float res_governor_band   = 0.15f; // How far under target we'll go before scaling back up
+
+void  res_governor_init  (res_governor_t &gov, float scale_min, float scale_max);
+float res_governor_update(res_governor_t &gov, float render_ms, float period_ms);
+
+///////////////////////////////////////////
+
+bool              prof_enabled      = false;
+const char       *prof_trace_file   = "frame_trace.json";
+const char       *prof_summary_file = "frame_summary.csv";
+const uint64_t    prof_window       = 90; // Frames per row of the CSV summary
+
+void     prof_init       ();
+void     prof_shutdown   ();
+uint64_t prof_now        ();
+void     prof_record     (const char *name, uint64_t start_ns, uint64_t end_ns);
+void     prof_frame_begin();
+uint64_t prof_frame_info (XrTime predicted_time, XrBool32 should_render);
+void     prof_frame_set  (uint64_t frame);
+void     prof_flush      ();
+void     prof_summarize  (uint64_t last_frame);
 
 ///////////////////////////////////////////
 
 constexpr char app_shader_code[] = R"_(
 cbuffer TransformBuffer : register(b0) {
-	float4x4 world;
-	float4x4 viewproj;
+	row_major float4x4 viewproj[2];
+};
+cbuffer MeshBuffer : register(b1) {
+	float4 mesh_min;
+	float4 mesh_size;
 };
+// The world matrix of every cube, kept on the GPU between frames
+struct cube_t {
+	row_major float4x4 world;
+};
+StructuredBuffer<cube_t> cubes : register(t0);
 struct vsIn {
-	float4 pos  : SV_POSITION;
-	float3 norm : NORMAL;
+	float4 pos  : SV_POSITION; // Packed by mesh_pack_vert, the normal is in w
+	uint   cube : CUBE_ID; // Which cube to draw, from the instance buffer
+	uint   inst : SV_InstanceID;
 };
 struct psIn {
 	float4 pos   : SV_POSITION;
 	float3 color : COLOR0;
+#ifdef SINGLE_PASS
+	uint   view  : SV_RenderTargetArrayIndex;
+#endif
 };
 
+// Positions are 16 bit normalized values inside the mesh's bounds
+float3 mesh_position(float4 packed) {
+	return mesh_min.xyz + packed.xyz * mesh_size.xyz;
+}
+// Normals are octahedral encoded, two 8 bit values packed into 16 bits
+float3 mesh_normal(float4 packed) {
+	uint   bits = (uint)round(packed.w * 65535);
+	float2 oct  = float2(bits >> 8, bits & 255) / 255.0 * 2 - 1;
+	float3 n    = float3(oct, 1 - abs(oct.x) - abs(oct.y));
+	float  t    = saturate(-n.z);
+	n.xy += n.xy >= 0 ? -t : t;
+	return normalize(n);
+}
+
 psIn vs(vsIn input) {
 	psIn output;
-	output.pos = mul(float4(input.pos.xyz, 1), world);
-	output.pos = mul(output.pos, viewproj);
+#ifdef SINGLE_PASS
+	// Each cube is instanced once per eye, so the instance id tells us which
+	// eye we're drawing, and which slice of the texture array it goes to!
+	uint view   = input.inst % 2;
+	output.view = view;
+#else
+	uint view = 0;
+#endif
+	float4x4 world = cubes[input.cube].world;
+	output.pos = mul(float4(mesh_position(input.pos), 1), world);
+	output.pos = mul(output.pos, viewproj[view]);
 
-	float3 normal = normalize(mul(float4(input.norm, 0), world).xyz);
+	float3 normal = normalize(mul(float4(mesh_normal(input.pos), 0), world).xyz);
 
 	output.color = saturate(dot(normal, float3(0,1,0))).xxx;
 	return output;
@@ -157,7 +1296,7 @@ float app_verts[] = {
 	 1, 1, 1,  1, 1, 1,
 	-1, 1, 1, -1, 1, 1, };
 
-uint16_t app_inds[] = {
+uint32_t app_inds[] = {
 	1,2,0, 2,3,0, 4,6,5, 7,6,4,
 	6,2,1, 5,6,1, 3,7,4, 0,3,4,
 	4,5,1, 0,4,1, 2,7,3, 2,6,7, };
@@ -167,40 +1306,78 @@ uint16_t app_inds[] = {
 ///////////////////////////////////////////
 
 int __stdcall wWinMain(HINSTANCE, HINSTANCE, LPWSTR, int) {
-	if (!openxr_init("Single file OpenXR", d3d_swapchain_fmt)) {
+	if (app_config_bench_math)
+		app_bench_math();
+	if (app_config_bench_spatial)
+		app_bench_spatial();
+	if (app_config_bench_mesh)
+		app_bench_mesh();
+	if (app_config_bench_mesh_load)
+		app_bench_mesh_load();
+	if (app_config_bench_journal)
+		app_bench_journal();
+	if (app_config_bench_input)
+		app_bench_input();
+
+	if (!openxr_init("Single file OpenXR", d3d_swapchain_fmts, _countof(d3d_swapchain_fmts))) {
 		d3d_shutdown();
 		MessageBox(nullptr, "OpenXR initialization failed\n", "Error", 1);
 		return 1;
 	}
 	openxr_make_actions();
+	openxr_make_hand_trackers();
+	if (app_config_record_file != nullptr)
+		session_record_open(xr_recorder, app_config_record_file, (uint32_t)xr_config_views.size(), (uint32_t)xr_actions.actions.size());
+	openxr_sampler_start();
 	app_init();
+	if (app_config_bench_views)
+		app_bench_views();
+	if (app_config_profile)
+		prof_init();
+	if (app_config_pipelined)
+		openxr_pipeline_start();
 
 	bool quit = false;
 	while (!quit) {
+		prof_frame_begin();
 		openxr_poll_events(quit);
 
 		if (xr_running) {
 			openxr_poll_actions();
 			app_update();
 			openxr_render_frame();
-
-			if (xr_session_state != XR_SESSION_STATE_VISIBLE && 
-				xr_session_state != XR_SESSION_STATE_FOCUSED) {
-				this_thread::sleep_for(chrono::milliseconds(250));
-			}
 		}
+		if (!quit)
+			openxr_idle(quit);
+		prof_flush();
 	}
 
+	openxr_pipeline_stop();
+	openxr_sampler_stop();
+	session_record_close(xr_recorder);
+	bool latency_ok = app_latency_report();
+	mesh_load_stop(app_mesh_loader);
+	if (app_config_journal)
+		cube_journal_close(app_journal);
+	prof_shutdown();
 	openxr_shutdown();
 	d3d_shutdown();
-	return 0;
+	return latency_ok ? 0 : 1;
+}
+
+// Everywhere but Windows starts at plain old main. The tests define
+// APP_NO_MAIN, since they include this file and bring their own.
+#if !defined(_WIN32) && !defined(APP_NO_MAIN)
+int main() {
+	return wWinMain(nullptr, nullptr, nullptr, 0);
 }
+#endif
 
 ///////////////////////////////////////////
 // OpenXR code                           //
 ///////////////////////////////////////////
 
-bool openxr_init(const char *app_name, int64_t swapchain_format) {
+bool openxr_init(const char *app_name, const int64_t *swapchain_formats, uint32_t format_count) {
 	// OpenXR will fail to initialize if we ask for an extension that OpenXR
 	// can't provide! So we need to check our all extensions before 
 	// initializing OpenXR with them. Note that even if the extension is 
@@ -212,6 +1389,16 @@ bool openxr_init(const char *app_name, int64_t swapchain_format) {
 	const char         *ask_extensions[] = { 
 		XR_KHR_D3D11_ENABLE_EXTENSION_NAME, // Use Direct3D11 for rendering
 		XR_EXT_DEBUG_UTILS_EXTENSION_NAME,  // Debug utils for extra info
+#ifdef XR_USE_PLATFORM_WIN32
+		XR_KHR_WIN32_CONVERT_PERFORMANCE_COUNTER_TIME_EXTENSION_NAME, // For measuring how old poses are
+#else
+		XR_KHR_CONVERT_TIMESPEC_TIME_EXTENSION_NAME, // Same, for when we're not on Windows
+#endif
+		XR_KHR_COMPOSITION_LAYER_DEPTH_EXTENSION_NAME, // Depth, for better reprojection
+#ifdef XR_KHR_locate_spaces
+		XR_KHR_LOCATE_SPACES_EXTENSION_NAME, // Locate all our spaces in one call
+#endif
+		XR_EXT_HAND_TRACKING_EXTENSION_NAME, // Articulated hands
 	};
 
 	// We'll get a list of extensions that OpenXR provides using this 
@@ -244,6 +1431,10 @@ bool openxr_init(const char *app_name, int64_t swapchain_format) {
 			return strcmp(ext, XR_KHR_D3D11_ENABLE_EXTENSION_NAME)==0;
 		}))
 		return false;
+	xr_depth_layers = app_config_depth_layer && std::any_of(use_extensions.begin(), use_extensions.end(),
+		[] (const char *ext) {
+			return strcmp(ext, XR_KHR_COMPOSITION_LAYER_DEPTH_EXTENSION_NAME)==0;
+		});
 
 	// Initialize OpenXR with the extensions we've found!
 	XrInstanceCreateInfo createInfo = { XR_TYPE_INSTANCE_CREATE_INFO };
@@ -265,6 +1456,18 @@ bool openxr_init(const char *app_name, int64_t swapchain_format) {
 	xrGetInstanceProcAddr(xr_instance, "xrCreateDebugUtilsMessengerEXT",    (PFN_xrVoidFunction *)(&ext_xrCreateDebugUtilsMessengerEXT   ));
 	xrGetInstanceProcAddr(xr_instance, "xrDestroyDebugUtilsMessengerEXT",   (PFN_xrVoidFunction *)(&ext_xrDestroyDebugUtilsMessengerEXT  ));
 	xrGetInstanceProcAddr(xr_instance, "xrGetD3D11GraphicsRequirementsKHR", (PFN_xrVoidFunction *)(&ext_xrGetD3D11GraphicsRequirementsKHR));
+#ifdef XR_USE_PLATFORM_WIN32
+	xrGetInstanceProcAddr(xr_instance, "xrConvertWin32PerformanceCounterToTimeKHR", (PFN_xrVoidFunction *)(&ext_xrConvertWin32PerformanceCounterToTimeKHR));
+#else
+	xrGetInstanceProcAddr(xr_instance, "xrConvertTimespecTimeToTimeKHR",    (PFN_xrVoidFunction *)(&ext_xrConvertTimespecTimeToTimeKHR   ));
+#endif
+#ifdef XR_KHR_locate_spaces
+	xrGetInstanceProcAddr(xr_instance, "xrLocateSpacesKHR",                 (PFN_xrVoidFunction *)(&ext_xrLocateSpacesKHR                ));
+	xr_locate_batched = ext_xrLocateSpacesKHR != nullptr;
+#endif
+	xrGetInstanceProcAddr(xr_instance, "xrCreateHandTrackerEXT",            (PFN_xrVoidFunction *)(&ext_xrCreateHandTrackerEXT           ));
+	xrGetInstanceProcAddr(xr_instance, "xrDestroyHandTrackerEXT",           (PFN_xrVoidFunction *)(&ext_xrDestroyHandTrackerEXT          ));
+	xrGetInstanceProcAddr(xr_instance, "xrLocateHandJointsEXT",             (PFN_xrVoidFunction *)(&ext_xrLocateHandJointsEXT            ));
 
 	// Set up a really verbose debug log! Great for dev, but turn this off or
 	// down for final builds. WMR doesn't produce much output here, but it
@@ -305,11 +1508,22 @@ bool openxr_init(const char *app_name, int64_t swapchain_format) {
 	systemInfo.formFactor = app_config_form;
 	xrGetSystem(xr_instance, &systemInfo, &xr_system_id);
 
+	// This is the extra check mentioned up top! The hand tracking
+	// extension being there doesn't mean this system can track hands, so
+	// we ask the system itself.
+	if (app_config_hand_joints && ext_xrCreateHandTrackerEXT != nullptr) {
+		XrSystemHandTrackingPropertiesEXT hand_properties = { XR_TYPE_SYSTEM_HAND_TRACKING_PROPERTIES_EXT };
+		XrSystemProperties                properties      = { XR_TYPE_SYSTEM_PROPERTIES, &hand_properties };
+		xrGetSystemProperties(xr_instance, xr_system_id, &properties);
+		xr_hand_tracking = hand_properties.supportsHandTracking;
+	}
+
 	// Check what blend mode is valid for this device (opaque vs transparent displays)
 	// We'll just take the first one available!
 	uint32_t blend_count = 0;
 	xrEnumerateEnvironmentBlendModes(xr_instance, xr_system_id, app_config_view, 1, &blend_count, &xr_blend);
 
+#ifndef XR_HEADLESS
 	// OpenXR wants to ensure apps are using the correct graphics card, so this MUST be called 
 	// before xrCreateSession. This is crucial on devices that have multiple graphics cards, 
 	// like laptops with integrated graphics chips in addition to dedicated graphics cards.
@@ -317,6 +1531,9 @@ bool openxr_init(const char *app_name, int64_t swapchain_format) {
 	ext_xrGetD3D11GraphicsRequirementsKHR(xr_instance, xr_system_id, &requirement);
 	if (!d3d_init(requirement.adapterLuid))
 		return false;
+#endif
+	// The headless runtime doesn't display anything, so it's happy with a
+	// null device here, and we'll skip all our drawing.
 
 	// A session represents this application's desire to display things! This is where we hook up our graphics API.
 	// This does not start the session, for that, you'll need a call to xrBeginSession, which we do in openxr_poll_events
@@ -344,9 +1561,49 @@ bool openxr_init(const char *app_name, int64_t swapchain_format) {
 	uint32_t view_count = 0;
 	xrEnumerateViewConfigurationViews(xr_instance, xr_system_id, app_config_view, 0, &view_count, nullptr);
 	xr_config_views.resize(view_count, { XR_TYPE_VIEW_CONFIGURATION_VIEW });
-	xr_views       .resize(view_count, { XR_TYPE_VIEW });
+	for (size_t i = 0; i < _countof(xr_frames); i++)
+		xr_frames[i].views.resize(view_count, { XR_TYPE_VIEW });
 	xrEnumerateViewConfigurationViews(xr_instance, xr_system_id, app_config_view, view_count, &view_count, xr_config_views.data());
-	for (uint32_t i = 0; i < view_count; i++) {
+
+	// Single pass stereo draws both eyes at once into a texture array, so
+	// we'll need a single swapchain with a slice for each eye, instead of a
+	// swapchain for each view. This only works if both eyes are the same
+	// size, and the GPU can pick the array slice from the vertex shader.
+	xr_single_pass = app_config_single_pass && view_count == 2 &&
+		xr_config_views[0].recommendedImageRectWidth  == xr_config_views[1].recommendedImageRectWidth  &&
+		xr_config_views[0].recommendedImageRectHeight == xr_config_views[1].recommendedImageRectHeight &&
+		d3d_supports_single_pass();
+	uint32_t swapchain_count = xr_single_pass ? 1          : view_count;
+	uint32_t array_size      = xr_single_pass ? view_count : 1;
+
+	// The runtime lists the color formats it can make swapchains with, and
+	// we'll use the first one from our own list that's in there.
+	uint32_t runtime_format_count = 0;
+	xrEnumerateSwapchainFormats(xr_session, 0, &runtime_format_count, nullptr);
+	vector<int64_t> runtime_formats(runtime_format_count);
+	xrEnumerateSwapchainFormats(xr_session, runtime_format_count, &runtime_format_count, runtime_formats.data());
+	int64_t swapchain_format = 0;
+	for (uint32_t i = 0; i < format_count && swapchain_format == 0; i++) {
+		if (find(runtime_formats.begin(), runtime_formats.end(), swapchain_formats[i]) != runtime_formats.end())
+			swapchain_format = swapchain_formats[i];
+	}
+	if (swapchain_format == 0) {
+		printf("Error: runtime doesn't support any of our swapchain formats\n");
+		return false;
+	}
+
+	// Depth swapchains need a depth format, we'd like the one we picked in
+	// app_config_depth_fmt, but we'll take any the runtime has.
+	if (xr_depth_layers) {
+		const int64_t depth_formats[] = { app_config_depth_fmt, DXGI_FORMAT_D16_UNORM, DXGI_FORMAT_D24_UNORM_S8_UINT, DXGI_FORMAT_D32_FLOAT };
+		xr_depth_fmt = 0;
+		for (uint32_t i = 0; i < _countof(depth_formats) && xr_depth_fmt == 0; i++) {
+			if (find(runtime_formats.begin(), runtime_formats.end(), depth_formats[i]) != runtime_formats.end())
+				xr_depth_fmt = depth_formats[i];
+		}
+		xr_depth_layers = xr_depth_fmt != 0;
+	}
+	for (uint32_t i = 0; i < swapchain_count; i++) {
 		// Create a swapchain for this viewpoint! A swapchain is a set of texture buffers used for displaying to screen,
 		// typically this is a backbuffer and a front buffer, one for rendering data to, and one for displaying on-screen.
 		// A note about swapchain image format here! OpenXR doesn't create a concrete image format for the texture, like 
@@ -357,12 +1614,17 @@ bool openxr_init(const char *app_name, int64_t swapchain_format) {
 		XrViewConfigurationView &view           = xr_config_views[i];
 		XrSwapchainCreateInfo    swapchain_info = { XR_TYPE_SWAPCHAIN_CREATE_INFO };
 		XrSwapchain              handle;
-		swapchain_info.arraySize   = 1;
+		swapchain_info.arraySize   = array_size;
 		swapchain_info.mipCount    = 1;
 		swapchain_info.faceCount   = 1;
 		swapchain_info.format      = swapchain_format;
 		swapchain_info.width       = view.recommendedImageRectWidth;
 		swapchain_info.height      = view.recommendedImageRectHeight;
+		if (app_config_dynamic_res) {
+			// Leave room to render above the recommended resolution
+			swapchain_info.width  = min(view.maxImageRectWidth,  (uint32_t)(view.recommendedImageRectWidth  * app_config_res_max));
+			swapchain_info.height = min(view.maxImageRectHeight, (uint32_t)(view.recommendedImageRectHeight * app_config_res_max));
+		}
 		swapchain_info.sampleCount = view.recommendedSwapchainSampleCount;
 		swapchain_info.usageFlags  = XR_SWAPCHAIN_USAGE_SAMPLED_BIT | XR_SWAPCHAIN_USAGE_COLOR_ATTACHMENT_BIT;
 		xrCreateSwapchain(xr_session, &swapchain_info, &handle);
@@ -371,20 +1633,54 @@ bool openxr_init(const char *app_name, int64_t swapchain_format) {
 		uint32_t surface_count = 0;
 		xrEnumerateSwapchainImages(handle, 0, &surface_count, nullptr);
 
-		// We'll want to track our own information about the swapchain, so we can draw stuff onto it! We'll also create
-		// a depth buffer for each generated texture here as well with make_surfacedata.
+		// We'll want to track our own information about the swapchain, so we can draw stuff onto it! We'll also need
+		// a depth buffer. Only one of the swapchain's images is drawn at a time, and depth gets cleared before
+		// drawing, so all of its images can share the same one.
 		swapchain_t swapchain = {};
-		swapchain.width  = swapchain_info.width;
-		swapchain.height = swapchain_info.height;
-		swapchain.handle = handle;
+		swapchain.width        = swapchain_info.width;
+		swapchain.height       = swapchain_info.height;
+		swapchain.view_width   = view.recommendedImageRectWidth;
+		swapchain.view_height  = view.recommendedImageRectHeight;
+		swapchain.array_size   = swapchain_info.arraySize;
+		swapchain.sample_count = swapchain_info.sampleCount;
+		swapchain.handle       = handle;
 		swapchain.surface_images.resize(surface_count, { XR_TYPE_SWAPCHAIN_IMAGE_D3D11_KHR } );
 		swapchain.surface_data  .resize(surface_count);
 		xrEnumerateSwapchainImages(swapchain.handle, surface_count, &surface_count, (XrSwapchainImageBaseHeader*)swapchain.surface_images.data());
-		for (uint32_t i = 0; i < surface_count; i++) {
-			swapchain.surface_data[i] = d3d_make_surface_data((XrBaseInStructure&)swapchain.surface_images[i]);
+		if (xr_depth_layers) {
+			// The runtime will read our depth, so it has to come from its
+			// own swapchain. It's made just like the color one, with a depth
+			// format. Its images get acquired separately from the color ones,
+			// so each one has its own view.
+			XrSwapchainCreateInfo depth_info = swapchain_info;
+			depth_info.format     = xr_depth_fmt;
+			depth_info.usageFlags = XR_SWAPCHAIN_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+			xrCreateSwapchain(xr_session, &depth_info, &swapchain.depth_handle);
+
+			uint32_t depth_count = 0;
+			xrEnumerateSwapchainImages(swapchain.depth_handle, 0, &depth_count, nullptr);
+			swapchain.depth_images.resize(depth_count, { XR_TYPE_SWAPCHAIN_IMAGE_D3D11_KHR });
+			swapchain.depth_views .resize(depth_count);
+			xrEnumerateSwapchainImages(swapchain.depth_handle, depth_count, &depth_count, (XrSwapchainImageBaseHeader*)swapchain.depth_images.data());
+			for (uint32_t d = 0; d < depth_count && d3d_device; d++)
+				swapchain.depth_views[d] = d3d_make_depth_view(swapchain.depth_images[d].texture, xr_depth_fmt, swapchain_info.arraySize);
+		} else if (d3d_device) {
+			swapchain.depth_view = d3d_make_depth(swapchain_info.width, swapchain_info.height, swapchain_info.arraySize);
+		}
+		for (uint32_t i = 0; i < surface_count && d3d_device; i++) {
+			swapchain.surface_data[i] = d3d_make_surface_data((XrBaseInStructure&)swapchain.surface_images[i], swapchain_format, swapchain.depth_view);
 		}
 		xr_swapchains.push_back(swapchain);
 	}
+	d3d_memory_report(xr_swapchains, swapchain_format);
+
+	// The resolution can only go as high as the swapchains we got
+	float scale_max = app_config_res_max;
+	for (size_t i = 0; i < xr_swapchains.size(); i++) {
+		scale_max = min(scale_max, (float)xr_swapchains[i].width  / xr_swapchains[i].view_width);
+		scale_max = min(scale_max, (float)xr_swapchains[i].height / xr_swapchains[i].view_height);
+	}
+	res_governor_init(xr_res_governor, app_config_res_min, scale_max);
 
 	return true;
 }
@@ -396,57 +1692,75 @@ void openxr_make_actions() {
 	strcpy_s(actionset_info.actionSetName,          "gameplay");
 	strcpy_s(actionset_info.localizedActionSetName, "Gameplay");
 	xrCreateActionSet(xr_instance, &actionset_info, &xr_input.actionSet);
-	xrStringToPath(xr_instance, "/user/hand/left",  &xr_input.handSubactionPath[0]);
-	xrStringToPath(xr_instance, "/user/hand/right", &xr_input.handSubactionPath[1]);
 
-	// Create an action to track the position and orientation of the hands! This is
-	// the controller location, or the center of the palms for actual hands.
+	const uint32_t action_count    = _countof(xr_action_table);
+	const uint32_t subaction_count = _countof(xr_subaction_names);
+	xr_actions.subactions.resize(subaction_count);
+	for (uint32_t s = 0; s < subaction_count; s++)
+		xrStringToPath(xr_instance, xr_subaction_names[s], &xr_actions.subactions[s]);
+
+	// Create every action in the table. Pose actions track the position and
+	// orientation of something, like the controller for the grip pose, or
+	// the center of the palm for actual hands. Boolean actions are buttons,
+	// like select, which is the trigger on controllers, and an airtap on
+	// HoloLens.
 	XrActionCreateInfo action_info = { XR_TYPE_ACTION_CREATE_INFO };
-	action_info.countSubactionPaths = _countof(xr_input.handSubactionPath);
-	action_info.subactionPaths      = xr_input.handSubactionPath;
-	action_info.actionType          = XR_ACTION_TYPE_POSE_INPUT;
-	strcpy_s(action_info.actionName,          "hand_pose");
-	strcpy_s(action_info.localizedActionName, "Hand Pose");
-	xrCreateAction(xr_input.actionSet, &action_info, &xr_input.poseAction);
-
-	// Create an action for listening to the select action! This is primary trigger
-	// on controllers, and an airtap on HoloLens
-	action_info.actionType = XR_ACTION_TYPE_BOOLEAN_INPUT;
-	strcpy_s(action_info.actionName,          "select");
-	strcpy_s(action_info.localizedActionName, "Select");
-	xrCreateAction(xr_input.actionSet, &action_info, &xr_input.selectAction);
+	action_info.countSubactionPaths = subaction_count;
+	action_info.subactionPaths      = xr_actions.subactions.data();
+	xr_actions.actions.resize(action_count);
+	for (uint32_t a = 0; a < action_count; a++) {
+		action_info.actionType = xr_action_table[a].type;
+		strcpy_s(action_info.actionName,          xr_action_table[a].name);
+		strcpy_s(action_info.localizedActionName, xr_action_table[a].localized_name);
+		xrCreateAction(xr_input.actionSet, &action_info, &xr_actions.actions[a]);
+	}
 
 	// Bind the actions we just created to specific locations on the Khronos simple_controller
 	// definition! These are labeled as 'suggested' because they may be overridden by the runtime
 	// preferences. For example, if the runtime allows you to remap buttons, or provides input
 	// accessibility settings.
 	XrPath profile_path;
-	XrPath pose_path  [2];
-	XrPath select_path[2];
-	xrStringToPath(xr_instance, "/user/hand/left/input/grip/pose",     &pose_path[0]);
-	xrStringToPath(xr_instance, "/user/hand/right/input/grip/pose",    &pose_path[1]);
-	xrStringToPath(xr_instance, "/user/hand/left/input/select/click",  &select_path[0]);
-	xrStringToPath(xr_instance, "/user/hand/right/input/select/click", &select_path[1]);
+	vector<XrActionSuggestedBinding> bindings;
 	xrStringToPath(xr_instance, "/interaction_profiles/khr/simple_controller", &profile_path);
-	XrActionSuggestedBinding bindings[] = {
-		{ xr_input.poseAction,   pose_path[0]   },
-		{ xr_input.poseAction,   pose_path[1]   },
-		{ xr_input.selectAction, select_path[0] },
-		{ xr_input.selectAction, select_path[1] }, };
+	for (uint32_t a = 0; a < action_count; a++) {
+		for (uint32_t s = 0; s < subaction_count; s++) {
+			string   binding = string(xr_subaction_names[s]) + xr_action_table[a].binding;
+			XrPath   path;
+			xrStringToPath(xr_instance, binding.c_str(), &path);
+			bindings.push_back({ xr_actions.actions[a], path });
+		}
+	}
 	XrInteractionProfileSuggestedBinding suggested_binds = { XR_TYPE_INTERACTION_PROFILE_SUGGESTED_BINDING };
 	suggested_binds.interactionProfile     = profile_path;
-	suggested_binds.suggestedBindings      = &bindings[0];
-	suggested_binds.countSuggestedBindings = _countof(bindings);
+	suggested_binds.suggestedBindings      = bindings.data();
+	suggested_binds.countSuggestedBindings = (uint32_t)bindings.size();
 	xrSuggestInteractionProfileBindings(xr_instance, &suggested_binds);
 
-	// Create frames of reference for the pose actions
-	for (int32_t i = 0; i < 2; i++) {
-		XrActionSpaceCreateInfo action_space_info = { XR_TYPE_ACTION_SPACE_CREATE_INFO };
-		action_space_info.action            = xr_input.poseAction;
-		action_space_info.poseInActionSpace = xr_pose_identity;
-		action_space_info.subactionPath     = xr_input.handSubactionPath[i];
-		xrCreateActionSpace(xr_session, &action_space_info, &xr_input.handSpace[i]);
+	// Make room for all the state, and create frames of reference for the
+	// pose actions
+	uint32_t slot_count = action_count * subaction_count;
+	xr_actions.active     .assign(slot_count, XR_FALSE);
+	xr_actions.current    .assign(slot_count, XR_FALSE);
+	xr_actions.changed    .assign(slot_count, XR_FALSE);
+	xr_actions.value      .assign(slot_count, 0.0f);
+	xr_actions.changed_at .assign(slot_count, 0);
+	xr_actions.space_index.assign(slot_count, -1);
+	for (uint32_t a = 0; a < action_count; a++) {
+		if (xr_action_table[a].type != XR_ACTION_TYPE_POSE_INPUT)
+			continue;
+		for (uint32_t s = 0; s < subaction_count; s++) {
+			XrActionSpaceCreateInfo action_space_info = { XR_TYPE_ACTION_SPACE_CREATE_INFO };
+			action_space_info.action            = xr_actions.actions[a];
+			action_space_info.poseInActionSpace = xr_pose_identity;
+			action_space_info.subactionPath     = xr_actions.subactions[s];
+			XrSpace space = XR_NULL_HANDLE;
+			xrCreateActionSpace(xr_session, &action_space_info, &space);
+			xr_actions.space_index[openxr_action_slot(a, s)] = (int32_t)xr_actions.spaces.size();
+			xr_actions.spaces.push_back(space);
+		}
 	}
+	xr_actions.poses.assign(xr_actions.spaces.size(), xr_pose_identity);
+	xr_actions.flags.assign(xr_actions.spaces.size(), 0);
 
 	// Attach the action set we just made to the session
 	XrSessionActionSetsAttachInfo attach_info = { XR_TYPE_SESSION_ACTION_SETS_ATTACH_INFO };
@@ -457,20 +1771,42 @@ void openxr_make_actions() {
 
 ///////////////////////////////////////////
 
+void openxr_make_hand_trackers() {
+	if (!xr_hand_tracking)
+		return;
+	const XrHandEXT hands[2] = { XR_HAND_LEFT_EXT, XR_HAND_RIGHT_EXT };
+	for (int32_t i = 0; i < 2; i++) {
+		XrHandTrackerCreateInfoEXT info = { XR_TYPE_HAND_TRACKER_CREATE_INFO_EXT };
+		info.hand         = hands[i];
+		info.handJointSet = XR_HAND_JOINT_SET_DEFAULT_EXT;
+		if (XR_FAILED(ext_xrCreateHandTrackerEXT(xr_session, &info, &xr_hand_trackers[i])))
+			xr_hand_trackers[i] = XR_NULL_HANDLE;
+	}
+}
+
+///////////////////////////////////////////
+
 void openxr_shutdown() {
 	// We used a graphics API to initialize the swapchain data, so we'll
 	// give it a chance to release anythig here!
 	for (int32_t i = 0; i < xr_swapchains.size(); i++) {
 		xrDestroySwapchain(xr_swapchains[i].handle);
+		if (xr_swapchains[i].depth_handle != XR_NULL_HANDLE) xrDestroySwapchain(xr_swapchains[i].depth_handle);
 		d3d_swapchain_destroy(xr_swapchains[i]);
 	}
 	xr_swapchains.clear();
+	printf("frames submitted: %llu, reprojected by the runtime: %llu, with%s depth\n",
+		(unsigned long long)xr_frames_submitted_total, (unsigned long long)xr_frames_reprojected_total, xr_depth_layers ? "" : "out");
 
 	// Release all the other OpenXR resources that we've created!
 	// What gets allocated, must get deallocated!
+	for (int32_t i = 0; i < 2; i++) {
+		if (xr_hand_trackers[i] != XR_NULL_HANDLE) ext_xrDestroyHandTrackerEXT(xr_hand_trackers[i]);
+	}
 	if (xr_input.actionSet != XR_NULL_HANDLE) {
-		if (xr_input.handSpace[0] != XR_NULL_HANDLE) xrDestroySpace(xr_input.handSpace[0]);
-		if (xr_input.handSpace[1] != XR_NULL_HANDLE) xrDestroySpace(xr_input.handSpace[1]);
+		for (size_t i = 0; i < xr_actions.spaces.size(); i++) {
+			if (xr_actions.spaces[i] != XR_NULL_HANDLE) xrDestroySpace(xr_actions.spaces[i]);
+		}
 		xrDestroyActionSet(xr_input.actionSet);
 	}
 	if (xr_app_space != XR_NULL_HANDLE) xrDestroySpace   (xr_app_space);
@@ -481,16 +1817,30 @@ void openxr_shutdown() {
 
 ///////////////////////////////////////////
 
-void openxr_poll_events(bool &exit) {
+bool openxr_poll_events(bool &exit) {
+	prof_scope_t prof("openxr_poll_events");
 	exit = false;
+	bool changed_state = false;
 
 	XrEventDataBuffer event_buffer = { XR_TYPE_EVENT_DATA_BUFFER };
 
 	while (xrPollEvent(xr_instance, &event_buffer) == XR_SUCCESS) {
+		session_record_event(xr_recorder, event_buffer);
 		switch (event_buffer.type) {
 		case XR_TYPE_EVENT_DATA_SESSION_STATE_CHANGED: {
 			XrEventDataSessionStateChanged *changed = (XrEventDataSessionStateChanged*)&event_buffer;
 			xr_session_state = changed->state;
+			changed_state    = true;
+
+			// These are the states where we need to get frames going, so
+			// we'll keep track of how long that takes.
+			if (xr_session_state == XR_SESSION_STATE_READY ||
+				xr_session_state == XR_SESSION_STATE_VISIBLE ||
+				xr_session_state == XR_SESSION_STATE_FOCUSED) {
+				xr_transition_pending = true;
+				xr_transition_state   = xr_session_state;
+				xr_transition_ns      = prof_now();
+			}
 
 			// Session state change is where we can begin and end sessions, as well as find quit messages!
 			switch (xr_session_state) {
@@ -501,6 +1851,8 @@ void openxr_poll_events(bool &exit) {
 				xr_running = true;
 			} break;
 			case XR_SESSION_STATE_STOPPING: {
+				// Any frames still in flight need to be finished first!
+				openxr_pipeline_drain();
 				xr_running = false;
 				xrEndSession(xr_session); 
 			} break;
@@ -508,17 +1860,73 @@ void openxr_poll_events(bool &exit) {
 			case XR_SESSION_STATE_LOSS_PENDING: exit = true;              break;
 			}
 		} break;
-		case XR_TYPE_EVENT_DATA_INSTANCE_LOSS_PENDING: exit = true; return;
+		case XR_TYPE_EVENT_DATA_INSTANCE_LOSS_PENDING: exit = true; return changed_state;
 		}
 		event_buffer = { XR_TYPE_EVENT_DATA_BUFFER };
 	}
+	return changed_state;
+}
+
+///////////////////////////////////////////
+
+void openxr_idle(bool &exit) {
+	// OpenXR doesn't have a way to block until an event shows up, so the
+	// best we can do is check for them in short, bounded waits. How long
+	// we're allowed to wait for depends on what state the session is in.
+	uint32_t budget_ms = 0;
+	switch (xr_session_state) {
+	// Not running yet, or anymore, so there's no frame to do. We just wait
+	// for the runtime to tell us something.
+	case XR_SESSION_STATE_UNKNOWN:
+	case XR_SESSION_STATE_IDLE:         budget_ms = app_config_idle_frame_ms; break;
+	// Running, but not visible. We still have to submit frames, but nobody
+	// sees them, so it's safe to slow down.
+	case XR_SESSION_STATE_SYNCHRONIZED: budget_ms = xr_running ? app_config_idle_frame_ms : 0; break;
+	// Visible and focused need every frame, and xrWaitFrame already paces
+	// us. READY, STOPPING and the exit states all need handling right now.
+	default: return;
+	}
+
+	prof_scope_t prof("openxr_idle");
+	auto until = chrono::steady_clock::now() + chrono::milliseconds(budget_ms);
+	while (chrono::steady_clock::now() < until) {
+		this_thread::sleep_for(chrono::milliseconds(app_config_idle_poll_ms));
+		// Any state change means we should go back to the main loop and see
+		// what needs doing.
+		if (openxr_poll_events(exit) || exit)
+			return;
+	}
+}
+
+///////////////////////////////////////////
+
+const char *openxr_state_name(XrSessionState state) {
+	switch (state) {
+	case XR_SESSION_STATE_IDLE:         return "IDLE";
+	case XR_SESSION_STATE_READY:        return "READY";
+	case XR_SESSION_STATE_SYNCHRONIZED: return "SYNCHRONIZED";
+	case XR_SESSION_STATE_VISIBLE:      return "VISIBLE";
+	case XR_SESSION_STATE_FOCUSED:      return "FOCUSED";
+	case XR_SESSION_STATE_STOPPING:     return "STOPPING";
+	case XR_SESSION_STATE_LOSS_PENDING: return "LOSS_PENDING";
+	case XR_SESSION_STATE_EXITING:      return "EXITING";
+	default:                            return "UNKNOWN";
+	}
+}
+
+///////////////////////////////////////////
+
+uint32_t openxr_action_slot(int32_t action, int32_t subaction) {
+	return action * (uint32_t)xr_actions.subactions.size() + subaction;
 }
 
 ///////////////////////////////////////////
 
 void openxr_poll_actions() {
+	prof_scope_t prof("openxr_poll_actions");
 	if (xr_session_state != XR_SESSION_STATE_FOCUSED)
 		return;
+	auto start = chrono::high_resolution_clock::now();
 
 	// Update our action set with up-to-date input data!
 	XrActiveActionSet action_set = { };
@@ -530,34 +1938,77 @@ void openxr_poll_actions() {
 	sync_info.activeActionSets      = &action_set;
 
 	xrSyncActions(xr_session, &sync_info);
-
-	// Now we'll get the current states of our actions, and store them for later use
-	for (uint32_t hand = 0; hand < 2; hand++) {
+	uint32_t calls = 1;
+
+	// Now we'll get the current states of all our actions, and store them
+	// for later use. OpenXR has no call for getting more than one of these
+	// at a time, but going through the table keeps it to exactly one call
+	// per action and subaction path.
+	const uint32_t action_count    = (uint32_t)xr_actions.actions.size();
+	const uint32_t subaction_count = (uint32_t)xr_actions.subactions.size();
+	for (uint32_t a = 0; a < action_count; a++) {
 		XrActionStateGetInfo get_info = { XR_TYPE_ACTION_STATE_GET_INFO };
-		get_info.subactionPath = xr_input.handSubactionPath[hand];
-
-		XrActionStatePose pose_state = { XR_TYPE_ACTION_STATE_POSE };
-		get_info.action = xr_input.poseAction;
-		xrGetActionStatePose(xr_session, &get_info, &pose_state);
-		xr_input.renderHand[hand] = pose_state.isActive;
-
-		// Events come with a timestamp
-		XrActionStateBoolean select_state = { XR_TYPE_ACTION_STATE_BOOLEAN };
-		get_info.action = xr_input.selectAction;
-		xrGetActionStateBoolean(xr_session, &get_info, &select_state);
-		xr_input.handSelect[hand] = select_state.currentState && select_state.changedSinceLastSync;
+		get_info.action = xr_actions.actions[a];
+		for (uint32_t s = 0; s < subaction_count; s++) {
+			uint32_t slot = openxr_action_slot(a, s);
+			get_info.subactionPath = xr_actions.subactions[s];
+			switch (xr_action_table[a].type) {
+			case XR_ACTION_TYPE_POSE_INPUT: {
+				XrActionStatePose state = { XR_TYPE_ACTION_STATE_POSE };
+				xrGetActionStatePose(xr_session, &get_info, &state);
+				xr_actions.active[slot] = state.isActive;
+			} break;
+			case XR_ACTION_TYPE_BOOLEAN_INPUT: {
+				// Events come with a timestamp
+				XrActionStateBoolean state = { XR_TYPE_ACTION_STATE_BOOLEAN };
+				xrGetActionStateBoolean(xr_session, &get_info, &state);
+				xr_actions.active    [slot] = state.isActive;
+				xr_actions.current   [slot] = state.currentState;
+				xr_actions.changed   [slot] = state.changedSinceLastSync;
+				xr_actions.changed_at[slot] = state.lastChangeTime;
+				if (state.changedSinceLastSync && s < _countof(xr_history))
+					input_history_event(xr_history[s], state.lastChangeTime, a, state.currentState);
+			} break;
+			case XR_ACTION_TYPE_FLOAT_INPUT: {
+				XrActionStateFloat state = { XR_TYPE_ACTION_STATE_FLOAT };
+				xrGetActionStateFloat(xr_session, &get_info, &state);
+				xr_actions.active    [slot] = state.isActive;
+				xr_actions.value     [slot] = state.currentState;
+				xr_actions.changed   [slot] = state.changedSinceLastSync;
+				xr_actions.changed_at[slot] = state.lastChangeTime;
+			} break;
+			default: break;
+			}
+			session_record_action(xr_recorder, a, s);
+			calls += 1;
+		}
+	}
 
-		// If we have a select event, update the hand pose to match the event's timestamp
+	// Pick out what the app uses for each hand
+	for (uint32_t hand = 0; hand < 2; hand++) {
+		uint32_t pose_slot   = openxr_action_slot(xr_action_hand_pose, hand);
+		uint32_t select_slot = openxr_action_slot(xr_action_select,    hand);
+		xr_input.renderHand[hand] = xr_actions.active[pose_slot];
+		xr_input.handSelect[hand] = xr_actions.current[select_slot] && xr_actions.changed[select_slot];
+		xr_input.handSelectTime[hand] = xr_actions.changed_at[select_slot];
+
+		// If we have a select event, update the hand pose to match the event's timestamp.
+		// Each event has its own time, so these can't be located together.
 		if (xr_input.handSelect[hand]) {
-			XrSpaceLocation space_location = { XR_TYPE_SPACE_LOCATION };
-			XrResult        res            = xrLocateSpace(xr_input.handSpace[hand], xr_app_space, select_state.lastChangeTime, &space_location);
-			if (XR_UNQUALIFIED_SUCCESS(res) &&
-				(space_location.locationFlags & XR_SPACE_LOCATION_POSITION_VALID_BIT   ) != 0 &&
-				(space_location.locationFlags & XR_SPACE_LOCATION_ORIENTATION_VALID_BIT) != 0) {
-				xr_input.handPose[hand] = space_location.pose;
+			XrPosef              pose;
+			XrSpaceLocationFlags flags = 0;
+			calls += openxr_locate_spaces(xr_actions.changed_at[select_slot], &xr_actions.spaces[xr_actions.space_index[pose_slot]], 1, &pose, &flags);
+			if ((flags & XR_SPACE_LOCATION_POSITION_VALID_BIT   ) != 0 &&
+				(flags & XR_SPACE_LOCATION_ORIENTATION_VALID_BIT) != 0) {
+				xr_input.handPose[hand] = pose;
+			} else if (input_history_pose(xr_history[hand], xr_actions.changed_at[select_slot], &pose)) {
+				// The runtime couldn't tell us, but we saw the hand around then
+				xr_input.handPose[hand] = pose;
 			}
 		}
 	}
+	xr_actions.calls   += calls;
+	xr_actions.poll_ms += chrono::duration<double, milli>(chrono::high_resolution_clock::now() - start).count();
 }
 
 ///////////////////////////////////////////
@@ -565,71 +2016,509 @@ void openxr_poll_actions() {
 void openxr_poll_predicted(XrTime predicted_time) {
 	if (xr_session_state != XR_SESSION_STATE_FOCUSED)
 		return;
+	auto start = chrono::high_resolution_clock::now();
 
 	// Update hand position based on the predicted time of when the frame will be rendered! This 
-	// should result in a more accurate location, and reduce perceived lag.
-	for (size_t i = 0; i < 2; i++) {
+	// should result in a more accurate location, and reduce perceived lag. Every pose action's
+	// space gets located here, all at once.
+	xr_actions.calls += openxr_locate_spaces(predicted_time, xr_actions.spaces.data(), (uint32_t)xr_actions.spaces.size(), xr_actions.poses.data(), xr_actions.flags.data());
+	bool sampling = xr_sampler_thread.joinable();
+	for (uint32_t i = 0; i < 2; i++) {
+		int32_t              space = xr_actions.space_index[openxr_action_slot(xr_action_hand_pose, i)];
+		XrSpaceLocationFlags flags = xr_actions.flags[space];
+		if (!sampling)
+			input_history_add(xr_history[i], predicted_time, xr_actions.poses[space], flags);
 		if (!xr_input.renderHand[i])
 			continue;
-		XrSpaceLocation spaceRelation = { XR_TYPE_SPACE_LOCATION };
-		XrResult        res           = xrLocateSpace(xr_input.handSpace[i], xr_app_space, predicted_time, &spaceRelation);
-		if (XR_UNQUALIFIED_SUCCESS(res) &&
-			(spaceRelation.locationFlags & XR_SPACE_LOCATION_POSITION_VALID_BIT   ) != 0 &&
-			(spaceRelation.locationFlags & XR_SPACE_LOCATION_ORIENTATION_VALID_BIT) != 0) {
-			xr_input.handPose[i] = spaceRelation.pose;
+		if ((flags & XR_SPACE_LOCATION_POSITION_VALID_BIT   ) != 0 &&
+			(flags & XR_SPACE_LOCATION_ORIENTATION_VALID_BIT) != 0) {
+			xr_input.handPose[i] = xr_actions.poses[space];
+		} else {
+			// Tracking dropped out for a moment, so carry on the way the
+			// hand was moving, for as long as that's believable.
+			XrPosef pose;
+			if (input_history_pose(xr_history[i], predicted_time, &pose))
+				xr_input.handPose[i] = pose;
 		}
 	}
+	xr_actions.poll_ms += chrono::duration<double, milli>(chrono::high_resolution_clock::now() - start).count();
+
+	openxr_locate_joints(predicted_time);
 }
 
 ///////////////////////////////////////////
 
-void openxr_render_frame() {
-	// Block until the previous frame is finished displaying, and is ready for another one.
-	// Also returns a prediction of when the next frame will be displayed, for use with predicting
-	// locations of controllers, viewpoints, etc.
-	XrFrameState frame_state = { XR_TYPE_FRAME_STATE };
-	xrWaitFrame (xr_session, nullptr, &frame_state);
-	// Must be called before any rendering is done! This can return some interesting flags, like 
-	// XR_SESSION_VISIBILITY_UNAVAILABLE, which means we could skip rendering this frame and call
-	// xrEndFrame right away.
-	xrBeginFrame(xr_session, nullptr);
+void openxr_locate_joints(XrTime predicted_time) {
+	if (!xr_hand_tracking)
+		return;
+	auto start = chrono::high_resolution_clock::now();
+
+	// The runtime hands us each hand's joints as an array of structures,
+	// which we scatter into our structure of arrays, skipping any joint it
+	// couldn't locate. This happens every frame, so everything it touches
+	// was allocated up front.
+	hand_joints_t &joints = xr_joints;
+	joints.count = 0;
+	for (int32_t h = 0; h < 2; h++) {
+		if (xr_hand_trackers[h] == XR_NULL_HANDLE)
+			continue;
+		XrHandJointsLocateInfoEXT locate_info = { XR_TYPE_HAND_JOINTS_LOCATE_INFO_EXT };
+		locate_info.baseSpace = xr_app_space;
+		locate_info.time      = predicted_time;
+		XrHandJointLocationsEXT locations = { XR_TYPE_HAND_JOINT_LOCATIONS_EXT };
+		locations.jointCount     = XR_HAND_JOINT_COUNT_EXT;
+		locations.jointLocations = xr_joint_scratch;
+		if (XR_FAILED(ext_xrLocateHandJointsEXT(xr_hand_trackers[h], &locate_info, &locations)) || !locations.isActive)
+			continue;
 
-	// Execute any code that's dependant on the predicted time, such as updating the location of
-	// controller models.
-	openxr_poll_predicted(frame_state.predictedDisplayTime);
-	app_update_predicted();
+		for (uint32_t j = 0; j < XR_HAND_JOINT_COUNT_EXT; j++) {
+			const XrHandJointLocationEXT &joint = xr_joint_scratch[j];
+			if ((joint.locationFlags & XR_SPACE_LOCATION_POSITION_VALID_BIT   ) == 0 ||
+				(joint.locationFlags & XR_SPACE_LOCATION_ORIENTATION_VALID_BIT) == 0)
+				continue;
+			uint32_t i = joints.count++;
+			joints.pos_x [i] = joint.pose.position.x;
+			joints.pos_y [i] = joint.pose.position.y;
+			joints.pos_z [i] = joint.pose.position.z;
+			joints.rot_x [i] = joint.pose.orientation.x;
+			joints.rot_y [i] = joint.pose.orientation.y;
+			joints.rot_z [i] = joint.pose.orientation.z;
+			joints.rot_w [i] = joint.pose.orientation.w;
+			joints.radius[i] = joint.radius;
+		}
+	}
+	xr_joint_ms += chrono::duration<double, milli>(chrono::high_resolution_clock::now() - start).count();
+}
 
-	// If the session is active, lets render our layer in the compositor!
-	XrCompositionLayerBaseHeader            *layer      = nullptr;
-	XrCompositionLayerProjection             layer_proj = { XR_TYPE_COMPOSITION_LAYER_PROJECTION };
-	vector<XrCompositionLayerProjectionView> views;
+///////////////////////////////////////////
+
+uint32_t openxr_locate_spaces(XrTime time, const XrSpace *spaces, uint32_t count, XrPosef *out_poses, XrSpaceLocationFlags *out_flags) {
+	// Spaces that fail to locate come back with no flags set. Returns how
+	// many calls it took, which is one with XR_KHR_locate_spaces, and one
+	// per space without it.
+#ifdef XR_KHR_locate_spaces
+	if (xr_locate_batched && count > 1) {
+		XrSpaceLocationDataKHR  stack_data[16];
+		vector<XrSpaceLocationDataKHR> heap_data;
+		XrSpaceLocationDataKHR *data = stack_data;
+		if (count > _countof(stack_data)) {
+			heap_data.resize(count);
+			data = heap_data.data();
+		}
+		XrSpacesLocateInfoKHR info      = { XR_TYPE_SPACES_LOCATE_INFO_KHR };
+		XrSpaceLocationsKHR   locations = { XR_TYPE_SPACE_LOCATIONS_KHR };
+		info.baseSpace           = xr_app_space;
+		info.time                = time;
+		info.spaceCount          = count;
+		info.spaces              = spaces;
+		locations.locationCount  = count;
+		locations.locations      = data;
+		XrResult res = ext_xrLocateSpacesKHR(xr_session, &info, &locations);
+		for (uint32_t i = 0; i < count; i++) {
+			out_poses[i] = data[i].pose;
+			out_flags[i] = XR_UNQUALIFIED_SUCCESS(res) ? data[i].locationFlags : 0;
+		}
+		session_record_locates(xr_recorder, time, spaces, count, out_poses, out_flags);
+		return 1;
+	}
+#endif
+	for (uint32_t i = 0; i < count; i++) {
+		XrSpaceLocation location = { XR_TYPE_SPACE_LOCATION };
+		XrResult        res      = xrLocateSpace(spaces[i], xr_app_space, time, &location);
+		out_poses[i] = location.pose;
+		out_flags[i] = XR_UNQUALIFIED_SUCCESS(res) ? location.locationFlags : 0;
+	}
+	session_record_locates(xr_recorder, time, spaces, count, out_poses, out_flags);
+	return count;
+}
+
+///////////////////////////////////////////
+
+ID3D11DepthStencilView *openxr_acquire_depth(swapchain_t &swapchain) {
+	prof_scope_t prof("openxr_acquire_depth");
+	uint32_t                    img_id;
+	XrSwapchainImageAcquireInfo acquire_info = { XR_TYPE_SWAPCHAIN_IMAGE_ACQUIRE_INFO };
+	xrAcquireSwapchainImage(swapchain.depth_handle, &acquire_info, &img_id);
+
+	XrSwapchainImageWaitInfo wait_info = { XR_TYPE_SWAPCHAIN_IMAGE_WAIT_INFO };
+	wait_info.timeout = XR_INFINITE_DURATION;
+	xrWaitSwapchainImage(swapchain.depth_handle, &wait_info);
+	return swapchain.depth_views[img_id];
+}
+
+///////////////////////////////////////////
+
+void openxr_release_depth(swapchain_t &swapchain) {
+	XrSwapchainImageReleaseInfo release_info = { XR_TYPE_SWAPCHAIN_IMAGE_RELEASE_INFO };
+	xrReleaseSwapchainImage(swapchain.depth_handle, &release_info);
+}
+
+///////////////////////////////////////////
+
+void openxr_depth_info(XrCompositionLayerProjectionView &view, XrCompositionLayerDepthInfoKHR &info, const swapchain_t &swapchain, uint32_t array_index) {
+	// The runtime needs to know how to turn our depth values back into
+	// distances, so it gets the same near and far planes as our projection.
+	info = { XR_TYPE_COMPOSITION_LAYER_DEPTH_INFO_KHR };
+	info.subImage.swapchain        = swapchain.depth_handle;
+	info.subImage.imageRect        = view.subImage.imageRect;
+	info.subImage.imageArrayIndex  = array_index;
+	info.minDepth = 0;
+	info.maxDepth = 1;
+	info.nearZ    = app_clip_near;
+	info.farZ     = app_clip_far;
+	view.next     = &info;
+}
+
+///////////////////////////////////////////
+
+XrRect2Di openxr_view_rect(const swapchain_t &swapchain) {
+	// We only draw to the top left corner of the swapchain, at whatever
+	// resolution the governor picked. The compositor scales it back up.
+	XrRect2Di rect  = { { 0, 0 }, { swapchain.width, swapchain.height } };
+	if (app_config_dynamic_res) {
+		float scale = xr_res_governor.scale;
+		rect.extent.width  = max(1, min(swapchain.width,  (int32_t)(swapchain.view_width  * scale)));
+		rect.extent.height = max(1, min(swapchain.height, (int32_t)(swapchain.view_height * scale)));
+	}
+	return rect;
+}
+
+///////////////////////////////////////////
+
+void openxr_latch_hands(const app_frame_t &frame) {
+	// Locate the hands one more time, as close to drawing as we can. This
+	// is still for the frame's predicted display time, but the runtime has
+	// newer tracking data to predict from now!
+	auto     start      = chrono::high_resolution_clock::now();
+	XrTime   located_at = openxr_time_now();
+	XrPosef  hands[2]   = { frame.hands[0], frame.hands[1] };
+	XrSpace  spaces[2];
+	uint32_t hand_ids[2];
+	uint32_t count = 0;
+	for (uint32_t i = 0; i < 2; i++) {
+		if (!frame.hands_active[i])
+			continue;
+		spaces  [count] = xr_actions.spaces[xr_actions.space_index[openxr_action_slot(xr_action_hand_pose, i)]];
+		hand_ids[count] = i;
+		count++;
+	}
+
+	XrPosef              poses[2];
+	XrSpaceLocationFlags flags[2];
+	app_stats.input_calls += openxr_locate_spaces(frame.state.predictedDisplayTime, spaces, count, poses, flags);
+	for (uint32_t i = 0; i < count; i++) {
+		if ((flags[i] & XR_SPACE_LOCATION_POSITION_VALID_BIT   ) != 0 &&
+			(flags[i] & XR_SPACE_LOCATION_ORIENTATION_VALID_BIT) != 0) {
+			hands[hand_ids[i]] = poses[i];
+		}
+	}
+	app_stats.input_ms += chrono::duration<double, milli>(chrono::high_resolution_clock::now() - start).count();
+	app_draw_latch(frame, hands, located_at);
+}
+
+///////////////////////////////////////////
+
+XrTime openxr_time_now() {
+	// OpenXR has its own clock, so we need an extension to find out what
+	// time it is right now. If it's not there, we just can't tell.
+	XrTime time = 0;
+#ifdef XR_USE_PLATFORM_WIN32
+	if (ext_xrConvertWin32PerformanceCounterToTimeKHR == nullptr)
+		return 0;
+	LARGE_INTEGER counter;
+	QueryPerformanceCounter(&counter);
+	ext_xrConvertWin32PerformanceCounterToTimeKHR(xr_instance, &counter, &time);
+#else
+	if (ext_xrConvertTimespecTimeToTimeKHR == nullptr)
+		return 0;
+	timespec counter;
+	clock_gettime(CLOCK_MONOTONIC, &counter);
+	ext_xrConvertTimespecTimeToTimeKHR(xr_instance, &counter, &time);
+#endif
+	return time;
+}
+
+///////////////////////////////////////////
+
+void openxr_render_frame() {
+	// When everything's on one thread, we just wait for the frame, and draw
+	// it right away.
+	if (!app_config_pipelined) {
+		openxr_wait_frame  (xr_frames[0]);
+		openxr_submit_frame(xr_frames[0]);
+		return;
+	}
+
+	// Otherwise, wait for the render thread to finish with a frame slot,
+	// fill it in, and hand it over.
+	uint64_t waited;
+	{
+		unique_lock<mutex> lock(xr_frames_lock);
+		xr_frames_changed.wait(lock, []() { return xr_frames_waited - xr_frames_submitted < _countof(xr_frames); });
+		waited = xr_frames_waited;
+	}
+	openxr_wait_frame(xr_frames[waited % _countof(xr_frames)]);
+	{
+		lock_guard<mutex> lock(xr_frames_lock);
+		xr_frames_waited = waited + 1;
+	}
+	xr_frames_changed.notify_all();
+}
+
+///////////////////////////////////////////
+
+void openxr_wait_frame(app_frame_t &frame) {
+	// Block until the previous frame is finished displaying, and is ready for another one.
+	// Also returns a prediction of when the next frame will be displayed, for use with predicting
+	// locations of controllers, viewpoints, etc.
+	frame.state = { XR_TYPE_FRAME_STATE };
+	{
+		prof_scope_t prof("xrWaitFrame");
+		xrWaitFrame(xr_session, nullptr, &frame.state);
+	}
+	frame.waited_at  = chrono::high_resolution_clock::now();
+	session_record_frame(xr_recorder, frame.state);
+	frame.prof_frame = prof_frame_info(frame.state.predictedDisplayTime, frame.state.shouldRender);
+
+	// If more than one display period went by since the last frame, the
+	// runtime had nothing new to show for the ones in between, so it had
+	// to reproject an old frame instead.
+	frame.reprojected = 0;
+	if (xr_last_display_time != 0 && frame.state.predictedDisplayPeriod > 0) {
+		XrDuration period = frame.state.predictedDisplayPeriod;
+		XrTime     gap    = frame.state.predictedDisplayTime - xr_last_display_time;
+		frame.reprojected = (uint32_t)max((XrTime)0, (gap + period / 2) / period - 1);
+	}
+	xr_last_display_time = frame.state.predictedDisplayTime;
+
+	// If the session state just changed, this is the first frame since
+	// then, so we can see how long it took to get here.
+	if (xr_transition_pending) {
+		uint64_t now = prof_now();
+		xr_transition_pending = false;
+		printf("%s -> first frame: %.3fms\n", openxr_state_name(xr_transition_state), (now - xr_transition_ns) / 1000000.0);
+		if (prof_enabled)
+			prof_record("state_to_first_frame", xr_transition_ns, now);
+	}
+
+	// Execute any code that's dependant on the predicted time, such as updating the location of
+	// controller models.
+	frame.hands_located_at = openxr_time_now();
+	openxr_poll_predicted(frame.state.predictedDisplayTime);
+	app_update_predicted();
+
+	// If the session is active, we'll want to render a layer in the compositor!
 	bool session_active = xr_session_state == XR_SESSION_STATE_VISIBLE || xr_session_state == XR_SESSION_STATE_FOCUSED;
-	if (session_active && openxr_render_layer(frame_state.predictedDisplayTime, views, layer_proj)) {
+	frame.render = session_active && frame.state.shouldRender;
+	if (!frame.render)
+		return;
+
+	// Find the state and location of each viewpoint at the predicted time.
+	// The views stay their full size, with their types intact, so the next
+	// call always has room. If the runtime can't give us every view, we've
+	// got nothing to draw this frame.
+	XrResult         result      = XR_ERROR_VALIDATION_FAILURE;
+	XrViewState      view_state  = { XR_TYPE_VIEW_STATE };
+	XrViewLocateInfo locate_info = { XR_TYPE_VIEW_LOCATE_INFO };
+	locate_info.viewConfigurationType = app_config_view;
+	locate_info.displayTime           = frame.state.predictedDisplayTime;
+	locate_info.space                 = xr_app_space;
+	frame.view_count = 0;
+	{
+		prof_scope_t prof("xrLocateViews");
+		result = xrLocateViews(xr_session, &locate_info, &view_state, (uint32_t)frame.views.size(), &frame.view_count, frame.views.data());
+	}
+	if (XR_FAILED(result) || frame.view_count != frame.views.size()) {
+		frame.view_count = 0;
+		frame.render     = false;
+		return;
+	}
+	session_record_views(xr_recorder, locate_info.displayTime, view_state, frame.views.data(), frame.view_count);
+
+	// Give the application a chance to do any work that's shared between
+	// all the views, and to pack up what it needs for drawing them.
+	{
+		prof_scope_t prof("app_draw_prepare");
+		app_draw_prepare(frame);
+	}
+}
+
+///////////////////////////////////////////
+
+void openxr_submit_frame(app_frame_t &frame) {
+	prof_frame_set(frame.prof_frame);
+
+	// Must be called before any rendering is done! This can return some interesting flags, like 
+	// XR_SESSION_VISIBILITY_UNAVAILABLE, which means we could skip rendering this frame and call
+	// xrEndFrame right away.
+	{
+		prof_scope_t prof("xrBeginFrame");
+		xrBeginFrame(xr_session, nullptr);
+	}
+
+	// If the session is active, lets render our layer in the compositor!
+	XrCompositionLayerBaseHeader            *layer      = nullptr;
+	XrCompositionLayerProjection             layer_proj = { XR_TYPE_COMPOSITION_LAYER_PROJECTION };
+	vector<XrCompositionLayerProjectionView> views;
+	vector<XrCompositionLayerDepthInfoKHR>   depth_infos;
+	auto render_start = chrono::high_resolution_clock::now();
+	d3d_timer_begin();
+	if (frame.render && openxr_render_layer(frame, views, depth_infos, layer_proj)) {
 		layer = (XrCompositionLayerBaseHeader*)&layer_proj;
 	}
+	d3d_timer_end();
+	d3d_ring_fence();
+	float render_ms = chrono::duration<float, milli>(chrono::high_resolution_clock::now() - render_start).count();
 
 	// We're finished with rendering our layer, so send it off for display!
 	XrFrameEndInfo end_info{ XR_TYPE_FRAME_END_INFO };
-	end_info.displayTime          = frame_state.predictedDisplayTime;
+	end_info.displayTime          = frame.state.predictedDisplayTime;
 	end_info.environmentBlendMode = xr_blend;
 	end_info.layerCount           = layer == nullptr ? 0 : 1;
 	end_info.layers               = &layer;
-	xrEndFrame(xr_session, &end_info);
+	{
+		prof_scope_t prof("xrEndFrame");
+		xrEndFrame(xr_session, &end_info);
+	}
+	xr_frames_submitted_total   += 1;
+	xr_frames_reprojected_total += frame.reprojected;
+	if (layer != nullptr)
+		app_latency_record(frame);
+
+	// Pick the resolution for the next frames, based on how long recent
+	// ones took to render. GPU time is what we really want, but without a
+	// GPU, our own render time is all we've got.
+	if (layer != nullptr && app_config_dynamic_res) {
+		if (d3d_device == nullptr || d3d_timer_read(render_ms)) {
+			res_governor_update(xr_res_governor, render_ms, frame.state.predictedDisplayPeriod / 1000000.0f);
+			app_stats.render_ms = render_ms;
+		}
+		app_stats.res_scale = xr_res_governor.scale;
+	}
+
+	if (frame.render)
+		app_draw_finish(frame);
 }
 
 ///////////////////////////////////////////
 
-bool openxr_render_layer(XrTime predictedTime, vector<XrCompositionLayerProjectionView> &views, XrCompositionLayerProjection &layer) {
-	
-	// Find the state and location of each viewpoint at the predicted time
-	uint32_t         view_count  = 0;
-	XrViewState      view_state  = { XR_TYPE_VIEW_STATE };
-	XrViewLocateInfo locate_info = { XR_TYPE_VIEW_LOCATE_INFO };
-	locate_info.viewConfigurationType = app_config_view;
-	locate_info.displayTime           = predictedTime;
-	locate_info.space                 = xr_app_space;
-	xrLocateViews(xr_session, &locate_info, &view_state, (uint32_t)xr_views.size(), &view_count, xr_views.data());
-	views.resize(view_count);
+bool openxr_render_layer(const app_frame_t &frame, vector<XrCompositionLayerProjectionView> &views, vector<XrCompositionLayerDepthInfoKHR> &depth_infos, XrCompositionLayerProjection &layer) {
+	prof_scope_t prof("openxr_render_layer");
+	uint32_t     view_count = frame.view_count;
+	views      .resize(view_count);
+	depth_infos.resize(view_count);
+
+	// Send anything that's changed since the last frame over to the GPU
+	{
+		prof_scope_t prof("app_draw_upload");
+		app_draw_upload(frame);
+	}
+
+	// For single pass stereo, there's only one swapchain, and each view
+	// renders to its own slice of it. Both views get drawn together!
+	if (xr_single_pass) {
+		uint32_t                    img_id;
+		XrSwapchainImageAcquireInfo acquire_info = { XR_TYPE_SWAPCHAIN_IMAGE_ACQUIRE_INFO };
+		{
+			prof_scope_t prof("xrAcquireSwapchainImage");
+			xrAcquireSwapchainImage(xr_swapchains[0].handle, &acquire_info, &img_id);
+		}
+
+		XrSwapchainImageWaitInfo wait_info = { XR_TYPE_SWAPCHAIN_IMAGE_WAIT_INFO };
+		wait_info.timeout = XR_INFINITE_DURATION;
+		{
+			prof_scope_t prof("xrWaitSwapchainImage");
+			xrWaitSwapchainImage(xr_swapchains[0].handle, &wait_info);
+		}
+
+		swapchain_surfdata_t surface = xr_swapchains[0].surface_data[img_id];
+		if (xr_depth_layers)
+			surface.depth_view = openxr_acquire_depth(xr_swapchains[0]);
+
+		for (uint32_t i = 0; i < view_count; i++) {
+			views[i] = { XR_TYPE_COMPOSITION_LAYER_PROJECTION_VIEW };
+			views[i].pose = frame.views[i].pose;
+			views[i].fov  = frame.views[i].fov;
+			views[i].subImage.swapchain        = xr_swapchains[0].handle;
+			views[i].subImage.imageRect        = openxr_view_rect(xr_swapchains[0]);
+			views[i].subImage.imageArrayIndex  = i;
+			if (xr_depth_layers)
+				openxr_depth_info(views[i], depth_infos[i], xr_swapchains[0], i);
+		}
+		if (app_config_late_latch) {
+			prof_scope_t prof("openxr_latch_hands");
+			openxr_latch_hands(frame);
+		}
+		{
+			prof_scope_t prof("d3d_render_layer");
+			d3d_render_layer(d3d_context, views.data(), view_count, 0, surface, app_stats);
+		}
+		if (xr_depth_layers)
+			openxr_release_depth(xr_swapchains[0]);
+
+		XrSwapchainImageReleaseInfo release_info = { XR_TYPE_SWAPCHAIN_IMAGE_RELEASE_INFO };
+		{
+			prof_scope_t prof("xrReleaseSwapchainImage");
+			xrReleaseSwapchainImage(xr_swapchains[0].handle, &release_info);
+		}
+
+		layer.space     = xr_app_space;
+		layer.viewCount = (uint32_t)views.size();
+		layer.views     = views.data();
+		return true;
+	}
+
+	// With lots of views, they're recorded in parallel. Swapchain images
+	// all get acquired up front on this thread, since OpenXR wants that
+	// done by the thread that owns the session. Hands get latched once, as
+	// every view draws at the same time.
+	if (d3d_view_contexts.size() == view_count) {
+		for (uint32_t i = 0; i < view_count; i++) {
+			uint32_t                    img_id;
+			XrSwapchainImageAcquireInfo acquire_info = { XR_TYPE_SWAPCHAIN_IMAGE_ACQUIRE_INFO };
+			XrSwapchainImageWaitInfo    wait_info    = { XR_TYPE_SWAPCHAIN_IMAGE_WAIT_INFO };
+			wait_info.timeout = XR_INFINITE_DURATION;
+			{
+				prof_scope_t prof("xrAcquireSwapchainImage");
+				xrAcquireSwapchainImage(xr_swapchains[i].handle, &acquire_info, &img_id);
+			}
+			{
+				prof_scope_t prof("xrWaitSwapchainImage");
+				xrWaitSwapchainImage(xr_swapchains[i].handle, &wait_info);
+			}
+
+			views[i] = { XR_TYPE_COMPOSITION_LAYER_PROJECTION_VIEW };
+			views[i].pose = frame.views[i].pose;
+			views[i].fov  = frame.views[i].fov;
+			views[i].subImage.swapchain = xr_swapchains[i].handle;
+			views[i].subImage.imageRect = openxr_view_rect(xr_swapchains[i]);
+			d3d_view_surfaces[i] = xr_swapchains[i].surface_data[img_id];
+			if (xr_depth_layers) {
+				d3d_view_surfaces[i].depth_view = openxr_acquire_depth(xr_swapchains[i]);
+				openxr_depth_info(views[i], depth_infos[i], xr_swapchains[i], 0);
+			}
+		}
+		if (app_config_late_latch) {
+			prof_scope_t prof("openxr_latch_hands");
+			openxr_latch_hands(frame);
+		}
+		{
+			prof_scope_t prof("d3d_render_views");
+			d3d_render_views(views.data(), d3d_view_surfaces.data(), view_count);
+		}
+		for (uint32_t i = 0; i < view_count; i++) {
+			if (xr_depth_layers)
+				openxr_release_depth(xr_swapchains[i]);
+			XrSwapchainImageReleaseInfo release_info = { XR_TYPE_SWAPCHAIN_IMAGE_RELEASE_INFO };
+			prof_scope_t prof("xrReleaseSwapchainImage");
+			xrReleaseSwapchainImage(xr_swapchains[i].handle, &release_info);
+		}
+
+		layer.space     = xr_app_space;
+		layer.viewCount = (uint32_t)views.size();
+		layer.views     = views.data();
+		return true;
+	}
 
 	// And now we'll iterate through each viewpoint, and render it!
 	for (uint32_t i = 0; i < view_count; i++) {
@@ -638,28 +2527,53 @@ bool openxr_render_layer(XrTime predictedTime, vector<XrCompositionLayerProjecti
 		// Who knows! It's up to the runtime to decide.
 		uint32_t                    img_id;
 		XrSwapchainImageAcquireInfo acquire_info = { XR_TYPE_SWAPCHAIN_IMAGE_ACQUIRE_INFO };
-		xrAcquireSwapchainImage(xr_swapchains[i].handle, &acquire_info, &img_id);
+		{
+			prof_scope_t prof("xrAcquireSwapchainImage");
+			xrAcquireSwapchainImage(xr_swapchains[i].handle, &acquire_info, &img_id);
+		}
 
 		// Wait until the image is available to render to. The compositor could still be
 		// reading from it.
 		XrSwapchainImageWaitInfo wait_info = { XR_TYPE_SWAPCHAIN_IMAGE_WAIT_INFO };
 		wait_info.timeout = XR_INFINITE_DURATION;
-		xrWaitSwapchainImage(xr_swapchains[i].handle, &wait_info);
+		{
+			prof_scope_t prof("xrWaitSwapchainImage");
+			xrWaitSwapchainImage(xr_swapchains[i].handle, &wait_info);
+		}
 
 		// Set up our rendering information for the viewpoint we're using right now!
 		views[i] = { XR_TYPE_COMPOSITION_LAYER_PROJECTION_VIEW };
-		views[i].pose = xr_views[i].pose;
-		views[i].fov  = xr_views[i].fov;
+		views[i].pose = frame.views[i].pose;
+		views[i].fov  = frame.views[i].fov;
 		views[i].subImage.swapchain        = xr_swapchains[i].handle;
-		views[i].subImage.imageRect.offset = { 0, 0 };
-		views[i].subImage.imageRect.extent = { xr_swapchains[i].width, xr_swapchains[i].height };
+		views[i].subImage.imageRect        = openxr_view_rect(xr_swapchains[i]);
+
+		// Depth gets drawn to its own swapchain image, and attached to the view
+		swapchain_surfdata_t surface = xr_swapchains[i].surface_data[img_id];
+		if (xr_depth_layers) {
+			surface.depth_view = openxr_acquire_depth(xr_swapchains[i]);
+			openxr_depth_info(views[i], depth_infos[i], xr_swapchains[i], 0);
+		}
 
-		// Call the rendering callback with our view and swapchain info
-		d3d_render_layer(views[i], xr_swapchains[i].surface_data[img_id]);
+		// Call the rendering callback with our view and swapchain info. Later
+		// views get more up-to-date hands, if we're late latching them.
+		if (app_config_late_latch) {
+			prof_scope_t prof("openxr_latch_hands");
+			openxr_latch_hands(frame);
+		}
+		{
+			prof_scope_t prof("d3d_render_layer");
+			d3d_render_layer(d3d_context, &views[i], 1, i, surface, app_stats);
+		}
+		if (xr_depth_layers)
+			openxr_release_depth(xr_swapchains[i]);
 
 		// And tell OpenXR we're done with rendering to this one!
 		XrSwapchainImageReleaseInfo release_info = { XR_TYPE_SWAPCHAIN_IMAGE_RELEASE_INFO };
-		xrReleaseSwapchainImage(xr_swapchains[i].handle, &release_info);
+		{
+			prof_scope_t prof("xrReleaseSwapchainImage");
+			xrReleaseSwapchainImage(xr_swapchains[i].handle, &release_info);
+		}
 	}
 
 	layer.space     = xr_app_space;
@@ -668,6 +2582,94 @@ bool openxr_render_layer(XrTime predictedTime, vector<XrCompositionLayerProjecti
 	return true;
 }
 
+///////////////////////////////////////////
+
+void openxr_pipeline_start() {
+	// From here on, only the render thread touches the D3D context, and
+	// calls xrBeginFrame and xrEndFrame. OpenXR is fine with that, as long
+	// as each frame's calls still happen in the right order.
+	xr_render_quit = false;
+	xr_render_thread = thread([]() {
+		while (true) {
+			uint64_t submitted;
+			{
+				unique_lock<mutex> lock(xr_frames_lock);
+				xr_frames_changed.wait(lock, []() { return xr_render_quit || xr_frames_submitted != xr_frames_waited; });
+				if (xr_render_quit)
+					return;
+				submitted = xr_frames_submitted;
+			}
+			openxr_submit_frame(xr_frames[submitted % _countof(xr_frames)]);
+			{
+				lock_guard<mutex> lock(xr_frames_lock);
+				xr_frames_submitted = submitted + 1;
+			}
+			xr_frames_changed.notify_all();
+		}
+	});
+}
+
+///////////////////////////////////////////
+
+void openxr_pipeline_drain() {
+	unique_lock<mutex> lock(xr_frames_lock);
+	xr_frames_changed.wait(lock, []() { return xr_frames_submitted == xr_frames_waited; });
+}
+
+///////////////////////////////////////////
+
+void openxr_pipeline_stop() {
+	if (!xr_render_thread.joinable())
+		return;
+	openxr_pipeline_drain();
+	{
+		lock_guard<mutex> lock(xr_frames_lock);
+		xr_render_quit = true;
+	}
+	xr_frames_changed.notify_all();
+	xr_render_thread.join();
+}
+
+///////////////////////////////////////////
+
+void openxr_sampler_start() {
+	// Sampling needs to know what time it is right now, which only the
+	// time conversion extension can tell us.
+	if (app_config_input_sample_hz == 0 || openxr_time_now() == 0)
+		return;
+
+	// Action spaces don't need any locking to locate, so this thread can
+	// locate the hands whenever it likes.
+	xr_sampler_quit = false;
+	xr_sampler_thread = thread([]() {
+		auto    interval = chrono::nanoseconds(1000000000 / app_config_input_sample_hz);
+		XrSpace spaces[2];
+		for (int32_t i = 0; i < 2; i++)
+			spaces[i] = xr_actions.spaces[xr_actions.space_index[openxr_action_slot(xr_action_hand_pose, i)]];
+
+		auto next = chrono::high_resolution_clock::now();
+		while (!xr_sampler_quit.load(memory_order_relaxed)) {
+			XrTime               now = openxr_time_now();
+			XrPosef              poses[2];
+			XrSpaceLocationFlags flags[2];
+			openxr_locate_spaces(now, spaces, 2, poses, flags);
+			for (int32_t i = 0; i < 2; i++)
+				input_history_add(xr_history[i], now, poses[i], flags[i]);
+			next += interval;
+			this_thread::sleep_until(next);
+		}
+	});
+}
+
+///////////////////////////////////////////
+
+void openxr_sampler_stop() {
+	if (!xr_sampler_thread.joinable())
+		return;
+	xr_sampler_quit = true;
+	xr_sampler_thread.join();
+}
+
 ///////////////////////////////////////////
 // DirectX code                          //
 ///////////////////////////////////////////
@@ -714,13 +2716,20 @@ IDXGIAdapter1 *d3d_get_adapter(LUID &adapter_luid) {
 ///////////////////////////////////////////
 
 void d3d_shutdown() {
+	d3d_views_shutdown();
+	d3d_ring_shutdown();
+	for (uint32_t i = 0; i < d3d_timer_count; i++) {
+		for (uint32_t q = 0; q < 3; q++) {
+			if (d3d_timer_queries[i][q]) { d3d_timer_queries[i][q]->Release(); d3d_timer_queries[i][q] = nullptr; }
+		}
+	}
 	if (d3d_context) { d3d_context->Release(); d3d_context = nullptr; }
 	if (d3d_device ) { d3d_device->Release();  d3d_device  = nullptr; }
 }
 
 ///////////////////////////////////////////
 
-swapchain_surfdata_t d3d_make_surface_data(XrBaseInStructure &swapchain_img) {
+swapchain_surfdata_t d3d_make_surface_data(XrBaseInStructure &swapchain_img, int64_t format, ID3D11DepthStencilView *depth_view) {
 	swapchain_surfdata_t result = {};
 
 	// Get information about the swapchain image that OpenXR made for us!
@@ -729,31 +2738,50 @@ swapchain_surfdata_t d3d_make_surface_data(XrBaseInStructure &swapchain_img) {
 	d3d_swapchain_img.texture->GetDesc(&color_desc);
 
 	// Create a view resource for the swapchain image target that we can use to set up rendering.
+	// Texture array swapchains (for single pass stereo) need a view that covers all the slices.
 	D3D11_RENDER_TARGET_VIEW_DESC target_desc = {};
-	target_desc.ViewDimension = D3D11_RTV_DIMENSION_TEXTURE2D;
+	if (color_desc.ArraySize > 1) {
+		target_desc.ViewDimension                  = D3D11_RTV_DIMENSION_TEXTURE2DARRAY;
+		target_desc.Texture2DArray.ArraySize       = color_desc.ArraySize;
+		target_desc.Texture2DArray.FirstArraySlice = 0;
+	} else {
+		target_desc.ViewDimension = D3D11_RTV_DIMENSION_TEXTURE2D;
+	}
 	// NOTE: Why not use color_desc.Format? Check the notes over near the xrCreateSwapchain call!
 	// Basically, the color_desc.Format of the OpenXR created swapchain is TYPELESS, but in order to
 	// create a View for the texture, we need a concrete variant of the texture format like UNORM.
-	target_desc.Format        = (DXGI_FORMAT)d3d_swapchain_fmt; 
+	target_desc.Format        = (DXGI_FORMAT)format; 
 	d3d_device->CreateRenderTargetView(d3d_swapchain_img.texture, &target_desc, &result.target_view);
 
-	// Create a depth buffer that matches 
+	// The depth buffer belongs to the swapchain, we just draw with it
+	result.depth_view = depth_view;
+
+	return result;
+}
+
+///////////////////////////////////////////
+
+ID3D11DepthStencilView *d3d_make_depth(uint32_t width, uint32_t height, uint32_t array_size) {
+	// Create a depth buffer that matches the swapchain. The texture is
+	// TYPELESS, so it could also be read from a shader as a color format.
 	ID3D11Texture2D     *depth_texture;
 	D3D11_TEXTURE2D_DESC depth_desc = {};
 	depth_desc.SampleDesc.Count = 1;
 	depth_desc.MipLevels        = 1;
-	depth_desc.Width            = color_desc.Width;
-	depth_desc.Height           = color_desc.Height;
-	depth_desc.ArraySize        = color_desc.ArraySize;
-	depth_desc.Format           = DXGI_FORMAT_R32_TYPELESS;
+	depth_desc.Width            = width;
+	depth_desc.Height           = height;
+	depth_desc.ArraySize        = array_size;
 	depth_desc.BindFlags        = D3D11_BIND_SHADER_RESOURCE | D3D11_BIND_DEPTH_STENCIL;
-	d3d_device->CreateTexture2D(&depth_desc, nullptr, &depth_texture);
+	switch (app_config_depth_fmt) {
+	case DXGI_FORMAT_D16_UNORM:         depth_desc.Format = DXGI_FORMAT_R16_TYPELESS;   break;
+	case DXGI_FORMAT_D24_UNORM_S8_UINT: depth_desc.Format = DXGI_FORMAT_R24G8_TYPELESS; break;
+	default:                            depth_desc.Format = DXGI_FORMAT_R32_TYPELESS;   break;
+	}
+	if (FAILED(d3d_device->CreateTexture2D(&depth_desc, nullptr, &depth_texture)))
+		return nullptr;
 
 	// And create a view resource for the depth buffer, so we can set that up for rendering to as well!
-	D3D11_DEPTH_STENCIL_VIEW_DESC stencil_desc = {};
-	stencil_desc.ViewDimension = D3D11_DSV_DIMENSION_TEXTURE2D;
-	stencil_desc.Format        = DXGI_FORMAT_D32_FLOAT;
-	d3d_device->CreateDepthStencilView(depth_texture, &stencil_desc, &result.depth_view);
+	ID3D11DepthStencilView *result = d3d_make_depth_view(depth_texture, depth_desc.Format == DXGI_FORMAT_R32_TYPELESS ? DXGI_FORMAT_D32_FLOAT : app_config_depth_fmt, array_size);
 
 	// We don't need direct access to the ID3D11Texture2D object anymore, we only need the view
 	depth_texture->Release();
@@ -763,149 +2791,4784 @@ swapchain_surfdata_t d3d_make_surface_data(XrBaseInStructure &swapchain_img) {
 
 ///////////////////////////////////////////
 
-void d3d_render_layer(XrCompositionLayerProjectionView &view, swapchain_surfdata_t &surface) {
-	// Set up where on the render target we want to draw, the view has a 
-	XrRect2Di     &rect     = view.subImage.imageRect;
-	D3D11_VIEWPORT viewport = CD3D11_VIEWPORT((float)rect.offset.x, (float)rect.offset.y, (float)rect.extent.width, (float)rect.extent.height);
-	d3d_context->RSSetViewports(1, &viewport);
+ID3D11DepthStencilView *d3d_make_depth_view(ID3D11Texture2D *texture, int64_t format, uint32_t array_size) {
+	// Depth textures may be TYPELESS, so the view needs the real format
+	D3D11_DEPTH_STENCIL_VIEW_DESC stencil_desc = {};
+	if (array_size > 1) {
+		stencil_desc.ViewDimension                  = D3D11_DSV_DIMENSION_TEXTURE2DARRAY;
+		stencil_desc.Texture2DArray.ArraySize       = array_size;
+		stencil_desc.Texture2DArray.FirstArraySlice = 0;
+	} else {
+		stencil_desc.ViewDimension = D3D11_DSV_DIMENSION_TEXTURE2D;
+	}
+	stencil_desc.Format = (DXGI_FORMAT)format;
+	ID3D11DepthStencilView *result = nullptr;
+	d3d_device->CreateDepthStencilView(texture, &stencil_desc, &result);
+	return result;
+}
 
-	// Wipe our swapchain color and depth target clean, and then set them up for rendering!
-	float clear[] = { 0, 0, 0, 1 };
-	d3d_context->ClearRenderTargetView(surface.target_view, clear);
-	d3d_context->ClearDepthStencilView(surface.depth_view, D3D11_CLEAR_DEPTH | D3D11_CLEAR_STENCIL, 1.0f, 0);
-	d3d_context->OMSetRenderTargets(1, &surface.target_view, surface.depth_view);
+///////////////////////////////////////////
 
-	// And now that we're set up, pass on the rest of our rendering to the application
-	app_draw(view);
+uint32_t d3d_format_size(int64_t format) {
+	// Bytes per pixel, for the formats we might be using
+	switch (format) {
+	case DXGI_FORMAT_D16_UNORM:          return 2;
+	case DXGI_FORMAT_R16G16B16A16_FLOAT: return 8;
+	default:                             return 4;
+	}
 }
 
 ///////////////////////////////////////////
 
-void d3d_swapchain_destroy(swapchain_t &swapchain) {
-	for (uint32_t i = 0; i < swapchain.surface_data.size(); i++) {
-		swapchain.surface_data[i].depth_view ->Release();
-		swapchain.surface_data[i].target_view->Release();
+void d3d_timer_begin() {
+	// If all our queries are still waiting on the GPU, this frame just
+	// doesn't get timed.
+	d3d_timer_active = d3d_context != nullptr && d3d_timer_issued - d3d_timer_done < d3d_timer_count;
+	if (!d3d_timer_active)
+		return;
+
+	ID3D11Query **queries = d3d_timer_queries[d3d_timer_issued % d3d_timer_count];
+	if (queries[0] == nullptr) {
+		D3D11_QUERY_DESC disjoint_desc = { D3D11_QUERY_TIMESTAMP_DISJOINT };
+		D3D11_QUERY_DESC stamp_desc    = { D3D11_QUERY_TIMESTAMP };
+		d3d_device->CreateQuery(&disjoint_desc, &queries[0]);
+		d3d_device->CreateQuery(&stamp_desc,    &queries[1]);
+		d3d_device->CreateQuery(&stamp_desc,    &queries[2]);
 	}
+	d3d_context->Begin(queries[0]);
+	d3d_context->End  (queries[1]);
+}
+
+///////////////////////////////////////////
+
+void d3d_timer_end() {
+	if (!d3d_timer_active)
+		return;
+	ID3D11Query **queries = d3d_timer_queries[d3d_timer_issued % d3d_timer_count];
+	d3d_context->End(queries[2]);
+	d3d_context->End(queries[0]);
+	d3d_timer_issued += 1;
+	d3d_timer_active  = false;
 }
 
 ///////////////////////////////////////////
 
-XMMATRIX d3d_xr_projection(XrFovf fov, float clip_near, float clip_far) {
-	const float left  = clip_near * tanf(fov.angleLeft);
-	const float right = clip_near * tanf(fov.angleRight);
-	const float down  = clip_near * tanf(fov.angleDown);
-	const float up    = clip_near * tanf(fov.angleUp);
+bool d3d_timer_read(float &out_ms) {
+	// Collect every timing the GPU has finished, without waiting on it,
+	// and give back the most recent one.
+	bool found = false;
+	while (d3d_timer_done < d3d_timer_issued) {
+		ID3D11Query **queries = d3d_timer_queries[d3d_timer_done % d3d_timer_count];
+		D3D11_QUERY_DATA_TIMESTAMP_DISJOINT disjoint;
+		UINT64                              start, end;
+		if (d3d_context->GetData(queries[0], &disjoint, sizeof(disjoint), D3D11_ASYNC_GETDATA_DONOTFLUSH) != S_OK ||
+			d3d_context->GetData(queries[1], &start,    sizeof(start),    D3D11_ASYNC_GETDATA_DONOTFLUSH) != S_OK ||
+			d3d_context->GetData(queries[2], &end,      sizeof(end),      D3D11_ASYNC_GETDATA_DONOTFLUSH) != S_OK)
+			break;
+		d3d_timer_done += 1;
 
-	return XMMatrixPerspectiveOffCenterRH(left, right, down, up, clip_near, clip_far);
+		// If the GPU's clock changed partway, the timestamps are no good
+		if (!disjoint.Disjoint && disjoint.Frequency > 0) {
+			out_ms = (float)((end - start) * 1000.0 / disjoint.Frequency);
+			found  = true;
+		}
+	}
+	return found;
 }
 
 ///////////////////////////////////////////
 
-ID3DBlob *d3d_compile_shader(const char* hlsl, const char* entrypoint, const char* target) {
-	DWORD flags = D3DCOMPILE_PACK_MATRIX_COLUMN_MAJOR | D3DCOMPILE_ENABLE_STRICTNESS | D3DCOMPILE_WARNINGS_ARE_ERRORS;
-#ifdef _DEBUG
-	flags |= D3DCOMPILE_SKIP_OPTIMIZATION | D3DCOMPILE_DEBUG;
-#else
-	flags |= D3DCOMPILE_OPTIMIZATION_LEVEL3;
-#endif
+bool d3d_ring_init(uint32_t size) {
+	d3d_ring_shutdown();
+	if (d3d_device == nullptr)
+		return false;
 
-	ID3DBlob *compiled, *errors;
-	if (FAILED(D3DCompile(hlsl, strlen(hlsl), nullptr, nullptr, nullptr, entrypoint, target, flags, 0, &compiled, &errors)))
-		printf("Error: D3DCompile failed %s", (char*)errors->GetBufferPointer());
-	if (errors) errors->Release();
+	// Binding a constant buffer at an offset is a Direct3D 11.1 feature,
+	// and so is mapping one without throwing out what's already in it.
+	// Without both, constants go up through UpdateSubresource instead.
+	D3D11_FEATURE_DATA_D3D11_OPTIONS options  = {};
+	ID3D11DeviceContext1            *context1 = nullptr;
+	bool supported =
+		SUCCEEDED(d3d_device->CheckFeatureSupport(D3D11_FEATURE_D3D11_OPTIONS, &options, sizeof(options))) &&
+		options.ConstantBufferOffsetting && options.MapNoOverwriteOnDynamicConstantBuffer &&
+		SUCCEEDED(d3d_context->QueryInterface(__uuidof(ID3D11DeviceContext1), (void **)&context1));
+	if (context1) context1->Release();
+	if (!supported) {
+		printf("upload ring: no constant buffer offsets, using UpdateSubresource\n");
+		return false;
+	}
 
-	return compiled;
+	size -= size % d3d_ring_align;
+	CD3D11_BUFFER_DESC desc(size, D3D11_BIND_CONSTANT_BUFFER, D3D11_USAGE_DYNAMIC, D3D11_CPU_ACCESS_WRITE);
+	if (size == 0 || FAILED(d3d_device->CreateBuffer(&desc, nullptr, &d3d_ring_buffer)))
+		return false;
+	D3D11_QUERY_DESC fence_desc = { D3D11_QUERY_EVENT };
+	for (uint32_t i = 0; i < upload_ring_frames; i++) {
+		if (FAILED(d3d_device->CreateQuery(&fence_desc, &d3d_ring_fences[i]))) {
+			d3d_ring_shutdown();
+			return false;
+		}
+	}
+	upload_ring_init(d3d_ring, size, d3d_ring_align);
+	printf("upload ring: %uKB\n", size / 1024);
+	return true;
 }
 
 ///////////////////////////////////////////
-// App                                   //
+
+void d3d_ring_shutdown() {
+	for (uint32_t i = 0; i < upload_ring_frames; i++) {
+		if (d3d_ring_fences[i]) { d3d_ring_fences[i]->Release(); d3d_ring_fences[i] = nullptr; }
+	}
+	if (d3d_ring_buffer) { d3d_ring_buffer->Release(); d3d_ring_buffer = nullptr; }
+	d3d_ring        = {};
+	d3d_ring_issued = 0;
+	d3d_ring_done   = 0;
+	d3d_ring_mapped = false;
+	d3d_ring_fresh  = true;
+}
+
 ///////////////////////////////////////////
 
-void app_init() {
-	// Compile our shader code, and turn it into a shader resource!
-	ID3DBlob *vert_shader_blob  = d3d_compile_shader(app_shader_code, "vs", "vs_5_0");
-	ID3DBlob *pixel_shader_blob = d3d_compile_shader(app_shader_code, "ps", "ps_5_0");
-	d3d_device->CreateVertexShader(vert_shader_blob->GetBufferPointer(), vert_shader_blob ->GetBufferSize(), nullptr, &app_vshader);
-	d3d_device->CreatePixelShader(pixel_shader_blob->GetBufferPointer(), pixel_shader_blob->GetBufferSize(), nullptr, &app_pshader);
+uint8_t *d3d_ring_map(uint32_t bytes, uint32_t count, uint32_t *out_offsets) {
+	if (d3d_ring_buffer == nullptr)
+		return nullptr;
+
+	// Free up the space of every frame the GPU has finished with, without
+	// waiting on any that it hasn't.
+	BOOL fence_done;
+	while (d3d_ring_done < d3d_ring_issued &&
+		d3d_context->GetData(d3d_ring_fences[d3d_ring_done % upload_ring_frames], &fence_done, sizeof(fence_done), D3D11_ASYNC_GETDATA_DONOTFLUSH) == S_OK)
+		d3d_ring_done += 1;
+	upload_ring_retire(d3d_ring, d3d_ring_done);
+
+	// If the GPU is so far behind that we're out of fences, or out of
+	// room, we discard instead. The driver hands us fresh memory, and the
+	// GPU keeps reading the old memory until it's done, so every earlier
+	// frame is safe, and we don't have to wait on any of them.
+	bool discard = d3d_ring_fresh || d3d_ring_issued - d3d_ring_done >= upload_ring_frames;
+	for (int32_t attempt = 0; attempt < 2; attempt++) {
+		if (discard) {
+			upload_ring_reset(d3d_ring);
+			d3d_ring_done = d3d_ring_issued;
+		}
+		uint64_t head   = d3d_ring.head;
+		uint64_t offset = 0;
+		uint32_t i      = 0;
+		while (i < count && upload_ring_alloc(d3d_ring, bytes, &offset))
+			out_offsets[i++] = (uint32_t)offset;
+		if (i == count)
+			break;
+		d3d_ring.head = head;
+		if (discard)
+			return nullptr; // Doesn't fit even in an empty ring
+		discard = true;
+	}
 
-	// Describe how our mesh is laid out in memory
-	D3D11_INPUT_ELEMENT_DESC vert_desc[] = {
-		{"SV_POSITION", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, D3D11_APPEND_ALIGNED_ELEMENT, D3D11_INPUT_PER_VERTEX_DATA, 0},
-		{"NORMAL",      0, DXGI_FORMAT_R32G32B32_FLOAT, 0, D3D11_APPEND_ALIGNED_ELEMENT, D3D11_INPUT_PER_VERTEX_DATA, 0}, };
-	d3d_device->CreateInputLayout(vert_desc, (UINT)_countof(vert_desc), vert_shader_blob->GetBufferPointer(), vert_shader_blob->GetBufferSize(), &app_shader_layout);
-
-	// Create GPU resources for our mesh's vertices and indices! Constant buffers are for passing transform
-	// matrices into the shaders, so make a buffer for them too!
-	D3D11_SUBRESOURCE_DATA vert_buff_data = { app_verts };
-	D3D11_SUBRESOURCE_DATA ind_buff_data  = { app_inds };
-	CD3D11_BUFFER_DESC     vert_buff_desc (sizeof(app_verts),              D3D11_BIND_VERTEX_BUFFER);
-	CD3D11_BUFFER_DESC     ind_buff_desc  (sizeof(app_inds),               D3D11_BIND_INDEX_BUFFER);
-	CD3D11_BUFFER_DESC     const_buff_desc(sizeof(app_transform_buffer_t), D3D11_BIND_CONSTANT_BUFFER);
-	d3d_device->CreateBuffer(&vert_buff_desc, &vert_buff_data, &app_vertex_buffer);
-	d3d_device->CreateBuffer(&ind_buff_desc,  &ind_buff_data,  &app_index_buffer);
-	d3d_device->CreateBuffer(&const_buff_desc, nullptr,        &app_constant_buffer);
+	D3D11_MAPPED_SUBRESOURCE mapped = {};
+	if (FAILED(d3d_context->Map(d3d_ring_buffer, 0, discard ? D3D11_MAP_WRITE_DISCARD : D3D11_MAP_WRITE_NO_OVERWRITE, 0, &mapped)))
+		return nullptr;
+	d3d_ring_fresh  = false;
+	d3d_ring_mapped = true;
+	return (uint8_t *)mapped.pData;
 }
 
 ///////////////////////////////////////////
 
-void app_draw(XrCompositionLayerProjectionView &view) {
-	// Set up camera matrices based on OpenXR's predicted viewpoint information
-	XMMATRIX mat_projection = d3d_xr_projection(view.fov, 0.05f, 100.0f);
-	XMMATRIX mat_view       = XMMatrixInverse(nullptr, XMMatrixAffineTransformation(
-		DirectX::g_XMOne, DirectX::g_XMZero,
-		XMLoadFloat4((XMFLOAT4*)&view.pose.orientation),
-		XMLoadFloat3((XMFLOAT3*)&view.pose.position)));
-
-	// Set the active shaders and constant buffers.
-	d3d_context->VSSetConstantBuffers(0, 1, &app_constant_buffer);
-	d3d_context->VSSetShader(app_vshader, nullptr, 0);
-	d3d_context->PSSetShader(app_pshader, nullptr, 0);
+void d3d_ring_unmap() {
+	d3d_context->Unmap(d3d_ring_buffer, 0);
+}
 
-	// Set up the cube mesh's information
-	UINT strides[] = { sizeof(float) * 6 };
-	UINT offsets[] = { 0 };
-	d3d_context->IASetVertexBuffers    (0, 1, &app_vertex_buffer, strides, offsets);
-	d3d_context->IASetIndexBuffer      (app_index_buffer, DXGI_FORMAT_R16_UINT, 0);
-	d3d_context->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
-	d3d_context->IASetInputLayout      (app_shader_layout);
+///////////////////////////////////////////
 
-	// Put camera matrices into the shader's constant buffer
-	app_transform_buffer_t transform_buffer;
-	XMStoreFloat4x4(&transform_buffer.viewproj, XMMatrixTranspose(mat_view * mat_projection));
+void d3d_ring_fence() {
+	// This goes in right after the frame's rendering, so once the GPU gets
+	// here, it's done with everything this frame put in the ring.
+	if (!d3d_ring_mapped)
+		return;
+	d3d_context->End(d3d_ring_fences[d3d_ring_issued % upload_ring_frames]);
+	upload_ring_end(d3d_ring, d3d_ring_issued);
+	d3d_ring_issued += 1;
+	d3d_ring_mapped  = false;
+}
 
-	// Draw all the cubes we have in our list!
-	for (size_t i = 0; i < app_cubes.size(); i++) {
-		// Create a translate, rotate, scale matrix for the cube's world location
-		XMMATRIX mat_model = XMMatrixAffineTransformation(
-			DirectX::g_XMOne * 0.05f, DirectX::g_XMZero,
-			XMLoadFloat4((XMFLOAT4*)&app_cubes[i].orientation),
-			XMLoadFloat3((XMFLOAT3*)&app_cubes[i].position));
+///////////////////////////////////////////
 
-		// Update the shader's constant buffer with the transform matrix info, and then draw the mesh!
-		XMStoreFloat4x4(&transform_buffer.world, XMMatrixTranspose(mat_model));
-		d3d_context->UpdateSubresource(app_constant_buffer, 0, nullptr, &transform_buffer, 0, 0);
-		d3d_context->DrawIndexed((UINT)_countof(app_inds), 0, 0);
+void d3d_memory_report(const vector<swapchain_t> &swapchains, int64_t color_format) {
+	// Add up how much GPU memory our render targets take. The color images
+	// are made by the runtime, but they count just the same! We also work
+	// out what a 32 bit depth buffer for every image would have cost, which
+	// is what we used to do.
+	size_t   color_bytes = 0, depth_bytes = 0, depth_per_image_bytes = 0;
+	uint32_t color_count = 0, depth_count = 0;
+	for (size_t i = 0; i < swapchains.size(); i++) {
+		const swapchain_t &swapchain = swapchains[i];
+		size_t pixels = (size_t)swapchain.width * swapchain.height * swapchain.array_size;
+		color_bytes           += pixels * swapchain.sample_count * d3d_format_size(color_format) * swapchain.surface_images.size();
+		color_count           += (uint32_t)swapchain.surface_images.size();
+		depth_per_image_bytes += pixels * 4 * swapchain.surface_images.size();
+		if (swapchain.depth_view) {
+			depth_bytes += pixels * d3d_format_size(app_config_depth_fmt);
+			depth_count += 1;
+		}
+		// Depth swapchains need an image for each color image, since the
+		// runtime reads them after we're done.
+		depth_bytes += pixels * d3d_format_size(xr_depth_fmt) * swapchain.depth_images.size();
+		depth_count += (uint32_t)swapchain.depth_images.size();
 	}
+	printf("swapchain memory: color %.1fMB in %u images (DXGI_FORMAT %d), depth %.1fMB in %u targets (DXGI_FORMAT %d), was %.1fMB of depth with one per image\n",
+		color_bytes / (1024.0 * 1024.0), color_count, (int)color_format,
+		depth_bytes / (1024.0 * 1024.0), depth_count, xr_depth_layers ? (int)xr_depth_fmt : (int)app_config_depth_fmt,
+		depth_per_image_bytes / (1024.0 * 1024.0));
 }
 
 ///////////////////////////////////////////
 
-void app_update() {
-	// If the user presses the select action, lets add a cube at that location!
-	for (uint32_t i = 0; i < 2; i++) {
-		if (xr_input.handSelect[i])
-			app_cubes.push_back(xr_input.handPose[i]);
-	}
+bool d3d_supports_single_pass() {
+	// To pick which texture array slice to draw to from the vertex shader
+	// (SV_RenderTargetArrayIndex), we need a Direct3D 11.3 feature. Without
+	// it, we'd need a geometry shader, and that's not worth it!
+	if (d3d_device == nullptr)
+		return false;
+	D3D11_FEATURE_DATA_D3D11_OPTIONS3 options = {};
+	if (FAILED(d3d_device->CheckFeatureSupport(D3D11_FEATURE_D3D11_OPTIONS3, &options, sizeof(options))))
+		return false;
+	return options.VPAndRTArrayIndexFromAnyShaderFeedingRasterizer == TRUE;
 }
 
 ///////////////////////////////////////////
 
-void app_update_predicted() {
-	// Update the location of the hand cubes. This is done after the inputs have been updated to 
-	// use the predicted location, but during the render code, so we have the most up-to-date location.
-	if (app_cubes.size() < 2)
-		app_cubes.resize(2, xr_pose_identity);
-	for (uint32_t i = 0; i < 2; i++) {
-		app_cubes[i] = xr_input.renderHand[i] ? xr_input.handPose[i] : xr_pose_identity;
-	}
-}
\ No newline at end of file
+void d3d_render_layer(ID3D11DeviceContext *context, XrCompositionLayerProjectionView *views, uint32_t view_count, uint32_t first_view, swapchain_surfdata_t &surface, app_stats_t &stats) {
+	// No graphics device means we're running headless, nothing to draw!
+	// The context is either the immediate one, or a deferred context that
+	// only this thread is recording into.
+	if (context == nullptr)
+		return;
+
+	// Set up where on the render target we want to draw, the view has a 
+	// rectangle that covers the area we want. For single pass, each view has
+	// the same rectangle, just on a different array slice.
+	XrRect2Di     &rect     = views[0].subImage.imageRect;
+	D3D11_VIEWPORT viewport = CD3D11_VIEWPORT((float)rect.offset.x, (float)rect.offset.y, (float)rect.extent.width, (float)rect.extent.height);
+	context->RSSetViewports(1, &viewport);
+
+	// Wipe our swapchain color and depth target clean, and then set them up for rendering!
+	float clear[] = { 0, 0, 0, 1 };
+	context->ClearRenderTargetView(surface.target_view, clear);
+	context->ClearDepthStencilView(surface.depth_view, D3D11_CLEAR_DEPTH | D3D11_CLEAR_STENCIL, 1.0f, 0);
+	context->OMSetRenderTargets(1, &surface.target_view, surface.depth_view);
+
+	// And now that we're set up, pass on the rest of our rendering to the application
+	app_draw(context, views, view_count, first_view, stats);
+}
+
+///////////////////////////////////////////
+
+bool d3d_views_init(uint32_t view_count, uint32_t thread_count) {
+	d3d_views_shutdown();
+	if (d3d_device == nullptr || view_count == 0)
+		return false;
+
+	// Without driver support for command lists, D3D11 records them in
+	// software and replays them itself. That still spreads out the cost of
+	// our own draw code, but the driver's share stays on one thread.
+	D3D11_FEATURE_DATA_THREADING threading = {};
+	d3d_device->CheckFeatureSupport(D3D11_FEATURE_THREADING, &threading, sizeof(threading));
+
+	for (uint32_t i = 0; i < view_count; i++) {
+		ID3D11DeviceContext *context = nullptr;
+		if (FAILED(d3d_device->CreateDeferredContext(0, &context))) {
+			d3d_views_shutdown();
+			return false;
+		}
+		d3d_view_contexts.push_back(context);
+	}
+	d3d_view_lists   .assign(view_count, nullptr);
+	d3d_view_surfaces.assign(view_count, {});
+	d3d_view_stats   .assign(view_count, {});
+
+	// Whoever calls d3d_render_views records too, so it's one less thread
+	d3d_workers_start(d3d_workers, thread_count > 1 ? thread_count - 1 : 0);
+	printf("views: recording %u views on %u threads, %s command lists\n", view_count, max(thread_count, (uint32_t)1), threading.DriverCommandLists ? "driver" : "emulated");
+	return true;
+}
+
+///////////////////////////////////////////
+
+void d3d_views_shutdown() {
+	d3d_workers_stop(d3d_workers);
+	for (size_t i = 0; i < d3d_view_contexts.size(); i++) d3d_view_contexts[i]->Release();
+	for (size_t i = 0; i < d3d_view_lists   .size(); i++) { if (d3d_view_lists[i]) d3d_view_lists[i]->Release(); }
+	d3d_view_contexts.clear();
+	d3d_view_lists   .clear();
+	d3d_view_surfaces.clear();
+	d3d_view_stats   .clear();
+}
+
+///////////////////////////////////////////
+
+struct d3d_view_job_t {
+	XrCompositionLayerProjectionView *views;
+	swapchain_surfdata_t             *surfaces;
+};
+
+void d3d_render_views(XrCompositionLayerProjectionView *views, swapchain_surfdata_t *surfaces, uint32_t view_count) {
+	// Every view is recorded on whichever thread gets to it first. This
+	// returns once they're all recorded.
+	d3d_view_job_t job = { views, surfaces };
+	d3d_workers_run(d3d_workers, view_count, d3d_record_view, &job);
+
+	// Command lists play back on the immediate context in view order, so
+	// the GPU sees the same stream as if we'd drawn them one at a time.
+	prof_scope_t prof("ExecuteCommandList");
+	for (uint32_t i = 0; i < view_count; i++) {
+		if (d3d_view_lists[i] == nullptr)
+			continue;
+		d3d_context->ExecuteCommandList(d3d_view_lists[i], FALSE);
+		d3d_view_lists[i]->Release();
+		d3d_view_lists[i] = nullptr;
+
+		app_stats.draw_calls += d3d_view_stats[i].draw_calls;
+		app_stats.instances  += d3d_view_stats[i].instances;
+		app_stats.submit_ms  += d3d_view_stats[i].submit_ms;
+	}
+}
+
+///////////////////////////////////////////
+
+void d3d_record_view(uint32_t index, void *data) {
+	prof_scope_t    prof("d3d_record_view");
+	d3d_view_job_t *job     = (d3d_view_job_t *)data;
+	ID3D11DeviceContext *context = d3d_view_contexts[index];
+
+	// FALSE leaves the deferred context with default state for next time,
+	// which is what d3d_render_layer expects anyhow.
+	d3d_view_stats[index] = {};
+	d3d_render_layer(context, &job->views[index], 1, index, job->surfaces[index], d3d_view_stats[index]);
+	if (FAILED(context->FinishCommandList(FALSE, &d3d_view_lists[index])))
+		d3d_view_lists[index] = nullptr;
+}
+
+///////////////////////////////////////////
+
+void d3d_workers_start(d3d_workers_t &workers, uint32_t thread_count) {
+	d3d_workers_stop(workers);
+	workers.quit       = false;
+	workers.busy       = 0;
+	workers.generation = 0;
+	for (uint32_t i = 0; i < thread_count; i++) {
+		workers.threads.emplace_back([&workers]() {
+			uint64_t           seen = 0;
+			unique_lock<mutex> lock(workers.lock);
+			while (true) {
+				workers.wake.wait(lock, [&]() { return workers.quit || workers.generation != seen; });
+				if (workers.quit)
+					return;
+				seen = workers.generation;
+				workers.busy += 1;
+				lock.unlock();
+				d3d_workers_drain(workers);
+				lock.lock();
+				workers.busy -= 1;
+				if (workers.busy == 0)
+					workers.finished.notify_all();
+			}
+		});
+	}
+}
+
+///////////////////////////////////////////
+
+void d3d_workers_stop(d3d_workers_t &workers) {
+	{
+		lock_guard<mutex> lock(workers.lock);
+		workers.quit = true;
+	}
+	workers.wake.notify_all();
+	for (size_t i = 0; i < workers.threads.size(); i++)
+		workers.threads[i].join();
+	workers.threads.clear();
+}
+
+///////////////////////////////////////////
+
+void d3d_workers_run(d3d_workers_t &workers, uint32_t job_count, void (*job)(uint32_t index, void *data), void *data) {
+	// A worker that woke up late for the last batch could still be looking
+	// at it, so wait for it to find nothing left before starting this one.
+	unique_lock<mutex> lock(workers.lock);
+	workers.finished.wait(lock, [&]() { return workers.busy == 0; });
+	workers.job   = job;
+	workers.data  = data;
+	workers.count = job_count;
+	workers.next  = 0;
+	workers.generation += 1;
+	lock.unlock();
+	workers.wake.notify_all();
+
+	// Pitch in, and once every job's been taken, wait for the workers
+	// still finishing theirs.
+	d3d_workers_drain(workers);
+	lock.lock();
+	workers.finished.wait(lock, [&]() { return workers.busy == 0; });
+}
+
+///////////////////////////////////////////
+
+void d3d_workers_drain(d3d_workers_t &workers) {
+	for (uint32_t i = workers.next.fetch_add(1); i < workers.count; i = workers.next.fetch_add(1))
+		workers.job(i, workers.data);
+}
+
+///////////////////////////////////////////
+
+void d3d_swapchain_destroy(swapchain_t &swapchain) {
+	for (uint32_t i = 0; i < swapchain.surface_data.size(); i++) {
+		if (swapchain.surface_data[i].target_view) swapchain.surface_data[i].target_view->Release();
+	}
+	if (swapchain.depth_view) swapchain.depth_view->Release();
+	for (size_t i = 0; i < swapchain.depth_views.size(); i++) {
+		if (swapchain.depth_views[i]) swapchain.depth_views[i]->Release();
+	}
+}
+
+///////////////////////////////////////////
+
+bool d3d_compile_shader(const char* hlsl, const char* entrypoint, const char* target, const D3D_SHADER_MACRO *defines, uint32_t flags, vector<uint8_t> &out_bytecode) {
+	ID3DBlob *compiled = nullptr, *errors = nullptr;
+	if (FAILED(D3DCompile(hlsl, strlen(hlsl), nullptr, defines, nullptr, entrypoint, target, flags, 0, &compiled, &errors))) {
+		printf("Error: D3DCompile failed %s", errors ? (char*)errors->GetBufferPointer() : "");
+		if (errors) errors->Release();
+		return false;
+	}
+	if (errors) errors->Release();
+
+	const uint8_t *bytes = (const uint8_t *)compiled->GetBufferPointer();
+	out_bytecode.assign(bytes, bytes + compiled->GetBufferSize());
+	compiled->Release();
+	return true;
+}
+
+///////////////////////////////////////////
+// File code                             //
+///////////////////////////////////////////
+
+bool file_map(const char *filename, const uint8_t **out_data, size_t *out_size) {
+	*out_data = nullptr;
+	*out_size = 0;
+
+	// Returns false only when the file couldn't be opened, so callers can
+	// tell a missing file from a broken one. One that opened but is empty,
+	// or won't map, comes back with a null pointer instead. The view keeps
+	// the file open by itself, so the handles can be closed right away.
+#ifdef _WIN32
+	HANDLE file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+	LARGE_INTEGER size;
+	if (GetFileSizeEx(file, &size) && size.QuadPart > 0 && (uint64_t)size.QuadPart <= SIZE_MAX) {
+		HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (mapping != nullptr) {
+			*out_data = (const uint8_t *)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+			CloseHandle(mapping);
+		}
+		if (*out_data != nullptr)
+			*out_size = (size_t)size.QuadPart;
+	}
+	CloseHandle(file);
+#else
+	int file = open(filename, O_RDONLY | O_CLOEXEC);
+	if (file < 0)
+		return false;
+	struct stat info;
+	if (fstat(file, &info) == 0 && info.st_size > 0 && (uint64_t)info.st_size <= SIZE_MAX) {
+		void *data = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+		if (data != MAP_FAILED) {
+			*out_data = (const uint8_t *)data;
+			*out_size = (size_t)info.st_size;
+		}
+	}
+	close(file);
+#endif
+	return true;
+}
+
+///////////////////////////////////////////
+
+void file_unmap(const uint8_t *data, size_t size) {
+	if (data == nullptr) return;
+#ifdef _WIN32
+	UnmapViewOfFile(data);
+#else
+	munmap((void *)data, size);
+#endif
+}
+
+///////////////////////////////////////////
+
+void file_temp_name(char *out_name, size_t out_size, const char *filename) {
+	// Next to the real file, so the swap in file_replace is just a rename
+	// on the same drive, and named by process so two copies of the app
+	// don't write over each other's.
+#ifdef _WIN32
+	unsigned long process = (unsigned long)GetCurrentProcessId();
+#else
+	unsigned long process = (unsigned long)getpid();
+#endif
+	snprintf(out_name, out_size, "%s.%lu.tmp", filename, process);
+}
+
+///////////////////////////////////////////
+
+bool file_replace(const char *temp_file, const char *filename) {
+	// Swaps a finished file in over the old one, all at once. Anyone
+	// reading it sees either the old file or the new one, never half.
+#ifdef _WIN32
+	return MoveFileExA(temp_file, filename, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+	return rename(temp_file, filename) == 0;
+#endif
+}
+
+///////////////////////////////////////////
+// Shader cache code                     //
+///////////////////////////////////////////
+
+bool shader_cache_open(shader_cache_t &cache, const char *filename) {
+	cache = {};
+
+	// No file just means nothing has been cached yet. Anything else that
+	// goes wrong means the file is no good, and should be written again.
+	if (!file_map(filename, &cache.data, &cache.size))
+		return false;
+	cache.dirty = true;
+	if (cache.data == nullptr || cache.size < sizeof(shader_cache_header_t) || cache.size > UINT32_MAX) {
+		shader_cache_unmap(cache);
+		return false;
+	}
+
+	// Check the header, and that every entry's bytecode is actually inside
+	// the file. The bytecode itself gets checked when it's used.
+	const shader_cache_header_t *header = (const shader_cache_header_t *)cache.data;
+	if (header->magic   != shader_cache_magic   ||
+		header->version != shader_cache_version ||
+		header->count    > (cache.size - sizeof(shader_cache_header_t)) / sizeof(shader_cache_entry_t)) {
+		shader_cache_unmap(cache);
+		return false;
+	}
+	const shader_cache_entry_t *entries    = (const shader_cache_entry_t *)(cache.data + sizeof(shader_cache_header_t));
+	size_t                      data_start = sizeof(shader_cache_header_t) + header->count * sizeof(shader_cache_entry_t);
+	cache.dirty = false;
+	for (uint32_t i = 0; i < header->count; i++) {
+		const shader_cache_entry_t &entry = entries[i];
+		if (entry.offset >= data_start && entry.offset <= cache.size && entry.size <= cache.size - entry.offset)
+			cache.entries.push_back(entry);
+		else
+			cache.dirty = true;
+	}
+	return true;
+}
+
+///////////////////////////////////////////
+
+bool shader_cache_get(shader_cache_t &cache, const shader_compiler_t &compiler, const char *hlsl, const char *entrypoint, const char *target, const D3D_SHADER_MACRO *defines, const uint8_t **out_bytecode, size_t *out_size) {
+	// Anything that changes what the compiler would give us has to be part
+	// of the key. Strings include their terminator, so "ab"+"c" and "a"+"bc"
+	// don't hash the same.
+	uint64_t key = shader_cache_hash(14695981039346656037ull, compiler.name, strlen(compiler.name) + 1);
+	key = shader_cache_hash(key, &compiler.flags, sizeof(compiler.flags));
+	key = shader_cache_hash(key, hlsl,       strlen(hlsl)       + 1);
+	key = shader_cache_hash(key, entrypoint, strlen(entrypoint) + 1);
+	key = shader_cache_hash(key, target,     strlen(target)     + 1);
+	for (const D3D_SHADER_MACRO *define = defines; define && define->Name; define++) {
+		key = shader_cache_hash(key, define->Name,       strlen(define->Name) + 1);
+		key = shader_cache_hash(key, define->Definition, define->Definition ? strlen(define->Definition) + 1 : 0);
+	}
+
+	// Look in the pack file first. If the bytecode doesn't match its hash,
+	// the file got damaged somehow, so we drop it and compile it again.
+	for (size_t i = 0; i < cache.entries.size(); i++) {
+		const shader_cache_entry_t &entry = cache.entries[i];
+		if (entry.key != key)
+			continue;
+		if (shader_cache_hash(14695981039346656037ull, cache.data + entry.offset, entry.size) != entry.hash) {
+			cache.entries.erase(cache.entries.begin() + i);
+			cache.dirty = true;
+			break;
+		}
+		*out_bytecode = cache.data + entry.offset;
+		*out_size     = entry.size;
+		cache.hits += 1;
+		return true;
+	}
+	for (size_t i = 0; i < cache.added.size(); i++) {
+		if (cache.added[i].key == key) {
+			*out_bytecode = cache.added[i].bytecode.data();
+			*out_size     = cache.added[i].bytecode.size();
+			cache.hits += 1;
+			return true;
+		}
+	}
+
+	// A miss, so we'll have to compile it after all.
+	shader_cache_new_t shader = { key };
+	if (!compiler.compile(hlsl, entrypoint, target, defines, compiler.flags, shader.bytecode))
+		return false;
+	cache.added.push_back(move(shader));
+	cache.dirty   = true;
+	cache.misses += 1;
+	*out_bytecode = cache.added.back().bytecode.data();
+	*out_size     = cache.added.back().bytecode.size();
+	return true;
+}
+
+///////////////////////////////////////////
+
+bool shader_cache_close(shader_cache_t &cache, const char *filename) {
+	bool result = true;
+	if (cache.dirty) {
+		// Write a whole new pack file next to the old one, and then swap it
+		// in. Anyone reading the cache sees either the old file or the new
+		// one, never a half written one.
+		char temp_file[512];
+		file_temp_name(temp_file, sizeof(temp_file), filename);
+
+		shader_cache_header_t header = { shader_cache_magic, shader_cache_version, (uint32_t)(cache.entries.size() + cache.added.size()) };
+		vector<shader_cache_entry_t> entries;
+		uint32_t offset = (uint32_t)(sizeof(shader_cache_header_t) + header.count * sizeof(shader_cache_entry_t));
+		for (size_t i = 0; i < cache.entries.size(); i++) {
+			shader_cache_entry_t entry = cache.entries[i];
+			entry.offset = offset;
+			offset      += entry.size;
+			entries.push_back(entry);
+		}
+		for (size_t i = 0; i < cache.added.size(); i++) {
+			const vector<uint8_t> &bytecode = cache.added[i].bytecode;
+			entries.push_back({ cache.added[i].key, shader_cache_hash(14695981039346656037ull, bytecode.data(), bytecode.size()), offset, (uint32_t)bytecode.size() });
+			offset += (uint32_t)bytecode.size();
+		}
+
+		FILE *fp = nullptr;
+		result = fopen_s(&fp, temp_file, "wb") == 0;
+		if (result) {
+			result = fwrite(&header, sizeof(header), 1, fp) == 1;
+			if (result && !entries.empty())
+				result = fwrite(entries.data(), sizeof(shader_cache_entry_t), entries.size(), fp) == entries.size();
+			for (size_t i = 0; result && i < cache.entries.size(); i++)
+				result = fwrite(cache.data + cache.entries[i].offset, 1, cache.entries[i].size, fp) == cache.entries[i].size;
+			for (size_t i = 0; result && i < cache.added.size(); i++)
+				result = fwrite(cache.added[i].bytecode.data(), 1, cache.added[i].bytecode.size(), fp) == cache.added[i].bytecode.size();
+			result = fclose(fp) == 0 && result;
+		}
+
+		// The old file can't be replaced while we still have it mapped.
+		shader_cache_unmap(cache);
+		if (result)
+			result = file_replace(temp_file, filename);
+		if (!result) {
+			remove(temp_file);
+			printf("Warning: couldn't write shader cache '%s'\n", filename);
+		}
+	}
+	shader_cache_unmap(cache);
+	cache = {};
+	return result;
+}
+
+///////////////////////////////////////////
+
+void shader_cache_unmap(shader_cache_t &cache) {
+	file_unmap(cache.data, cache.size);
+	cache.data = nullptr;
+	cache.size = 0;
+}
+
+///////////////////////////////////////////
+
+uint64_t shader_cache_hash(uint64_t hash, const void *data, size_t size) {
+	// FNV-1a, it's simple, and plenty for telling shaders apart.
+	const uint8_t *bytes = (const uint8_t *)data;
+	for (size_t i = 0; i < size; i++) {
+		hash ^= bytes[i];
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+///////////////////////////////////////////
+// Math code                             //
+///////////////////////////////////////////
+
+// These few helpers wrap up whichever SIMD instruction set we're using, so
+// the batched math below only needs to be written once. simd_load reads
+// 'simd_width' floats in a row, for data that's already a structure of
+// arrays. simd_load_t loads 4 floats from 'simd_width' structures spaced
+// 'stride' floats apart, and transposes them so each register holds one
+// component from all of them. simd_store_t is the reverse of that.
+#if defined(MATH_AVX2)
+const char  *math_simd_name = "AVX2";
+typedef __m256 simd_t;
+const size_t simd_width = 8;
+inline simd_t simd_set(float f)            { return _mm256_set1_ps(f);   }
+inline simd_t simd_add(simd_t a, simd_t b) { return _mm256_add_ps(a, b); }
+inline simd_t simd_sub(simd_t a, simd_t b) { return _mm256_sub_ps(a, b); }
+inline simd_t simd_mul(simd_t a, simd_t b) { return _mm256_mul_ps(a, b); }
+inline simd_t simd_min(simd_t a, simd_t b) { return _mm256_min_ps(a, b); }
+inline simd_t simd_load(const float *src)  { return _mm256_loadu_ps(src); }
+// A bit for each lane that's >= 0
+inline int32_t simd_mask_ge0(simd_t a)     { return _mm256_movemask_ps(_mm256_cmp_ps(a, _mm256_setzero_ps(), _CMP_GE_OQ)); }
+// AVX shuffles work within each 128 bit lane, so this transposes the
+// low half and the high half as two separate 4x4 blocks.
+inline void simd_transpose(simd_t &r0, simd_t &r1, simd_t &r2, simd_t &r3) {
+	simd_t t0 = _mm256_unpacklo_ps(r0, r1);
+	simd_t t1 = _mm256_unpacklo_ps(r2, r3);
+	simd_t t2 = _mm256_unpackhi_ps(r0, r1);
+	simd_t t3 = _mm256_unpackhi_ps(r2, r3);
+	r0 = _mm256_shuffle_ps(t0, t1, _MM_SHUFFLE(1,0,1,0));
+	r1 = _mm256_shuffle_ps(t0, t1, _MM_SHUFFLE(3,2,3,2));
+	r2 = _mm256_shuffle_ps(t2, t3, _MM_SHUFFLE(1,0,1,0));
+	r3 = _mm256_shuffle_ps(t2, t3, _MM_SHUFFLE(3,2,3,2));
+}
+inline simd_t simd_load2(const float *lo, const float *hi) {
+	return _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(lo)), _mm_loadu_ps(hi), 1);
+}
+inline void simd_load_t(const float *src, size_t stride, simd_t &r0, simd_t &r1, simd_t &r2, simd_t &r3) {
+	r0 = simd_load2(src,            src + stride * 4);
+	r1 = simd_load2(src + stride,   src + stride * 5);
+	r2 = simd_load2(src + stride*2, src + stride * 6);
+	r3 = simd_load2(src + stride*3, src + stride * 7);
+	simd_transpose(r0, r1, r2, r3);
+}
+inline void simd_store_t(float *dst, size_t stride, simd_t r0, simd_t r1, simd_t r2, simd_t r3) {
+	simd_transpose(r0, r1, r2, r3);
+	simd_t r[4] = { r0, r1, r2, r3 };
+	for (size_t i = 0; i < 4; i++) {
+		_mm_storeu_ps(dst + stride * i,     _mm256_castps256_ps128(r[i]));
+		_mm_storeu_ps(dst + stride * (i+4), _mm256_extractf128_ps (r[i], 1));
+	}
+}
+#elif defined(MATH_SSE)
+const char  *math_simd_name = "SSE";
+typedef __m128 simd_t;
+const size_t simd_width = 4;
+inline simd_t simd_set(float f)            { return _mm_set1_ps(f);   }
+inline simd_t simd_add(simd_t a, simd_t b) { return _mm_add_ps(a, b); }
+inline simd_t simd_sub(simd_t a, simd_t b) { return _mm_sub_ps(a, b); }
+inline simd_t simd_mul(simd_t a, simd_t b) { return _mm_mul_ps(a, b); }
+inline simd_t simd_min(simd_t a, simd_t b) { return _mm_min_ps(a, b); }
+inline simd_t simd_load(const float *src)  { return _mm_loadu_ps(src); }
+inline int32_t simd_mask_ge0(simd_t a)     { return _mm_movemask_ps(_mm_cmpge_ps(a, _mm_setzero_ps())); }
+inline void simd_transpose(simd_t &r0, simd_t &r1, simd_t &r2, simd_t &r3) {
+	_MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+}
+inline void simd_load_t(const float *src, size_t stride, simd_t &r0, simd_t &r1, simd_t &r2, simd_t &r3) {
+	r0 = _mm_loadu_ps(src);
+	r1 = _mm_loadu_ps(src + stride);
+	r2 = _mm_loadu_ps(src + stride*2);
+	r3 = _mm_loadu_ps(src + stride*3);
+	simd_transpose(r0, r1, r2, r3);
+}
+inline void simd_store_t(float *dst, size_t stride, simd_t r0, simd_t r1, simd_t r2, simd_t r3) {
+	simd_transpose(r0, r1, r2, r3);
+	_mm_storeu_ps(dst,            r0);
+	_mm_storeu_ps(dst + stride,   r1);
+	_mm_storeu_ps(dst + stride*2, r2);
+	_mm_storeu_ps(dst + stride*3, r3);
+}
+#elif defined(MATH_NEON)
+const char  *math_simd_name = "NEON";
+typedef float32x4_t simd_t;
+const size_t simd_width = 4;
+inline simd_t simd_set(float f)            { return vdupq_n_f32(f);   }
+inline simd_t simd_add(simd_t a, simd_t b) { return vaddq_f32(a, b); }
+inline simd_t simd_sub(simd_t a, simd_t b) { return vsubq_f32(a, b); }
+inline simd_t simd_mul(simd_t a, simd_t b) { return vmulq_f32(a, b); }
+inline simd_t simd_min(simd_t a, simd_t b) { return vminq_f32(a, b); }
+inline simd_t simd_load(const float *src)  { return vld1q_f32(src); }
+inline int32_t simd_mask_ge0(simd_t a) {
+	const uint32_t bits[4] = { 1, 2, 4, 8 };
+	return (int32_t)vaddvq_u32(vandq_u32(vcgeq_f32(a, vdupq_n_f32(0)), vld1q_u32(bits)));
+}
+inline void simd_transpose(simd_t &r0, simd_t &r1, simd_t &r2, simd_t &r3) {
+	float32x4x2_t t01 = vtrnq_f32(r0, r1);
+	float32x4x2_t t23 = vtrnq_f32(r2, r3);
+	r0 = vcombine_f32(vget_low_f32 (t01.val[0]), vget_low_f32 (t23.val[0]));
+	r1 = vcombine_f32(vget_low_f32 (t01.val[1]), vget_low_f32 (t23.val[1]));
+	r2 = vcombine_f32(vget_high_f32(t01.val[0]), vget_high_f32(t23.val[0]));
+	r3 = vcombine_f32(vget_high_f32(t01.val[1]), vget_high_f32(t23.val[1]));
+}
+inline void simd_load_t(const float *src, size_t stride, simd_t &r0, simd_t &r1, simd_t &r2, simd_t &r3) {
+	r0 = vld1q_f32(src);
+	r1 = vld1q_f32(src + stride);
+	r2 = vld1q_f32(src + stride*2);
+	r3 = vld1q_f32(src + stride*3);
+	simd_transpose(r0, r1, r2, r3);
+}
+inline void simd_store_t(float *dst, size_t stride, simd_t r0, simd_t r1, simd_t r2, simd_t r3) {
+	simd_transpose(r0, r1, r2, r3);
+	vst1q_f32(dst,            r0);
+	vst1q_f32(dst + stride,   r1);
+	vst1q_f32(dst + stride*2, r2);
+	vst1q_f32(dst + stride*3, r3);
+}
+#else
+const char *math_simd_name = "scalar";
+#endif
+
+#if !defined(MATH_SCALAR)
+// This is the same quaternion to rotation matrix math as in
+// math_pose_matrix, just for a batch of poses at once. Each matrix gets
+// written out one column at a time.
+inline void simd_store_pose_matrices(float *dst, simd_t qx, simd_t qy, simd_t qz, simd_t qw, simd_t px, simd_t py, simd_t pz, simd_t s) {
+	const size_t mat_stride = sizeof(mat4_t) / sizeof(float);
+	const simd_t one        = simd_set(1);
+	const simd_t two        = simd_set(2);
+	const simd_t zero       = simd_set(0);
+	simd_t x2 = simd_mul(qx, two), y2 = simd_mul(qy, two), z2 = simd_mul(qz, two);
+	simd_t xx = simd_mul(qx, x2),  yy = simd_mul(qy, y2),  zz = simd_mul(qz, z2);
+	simd_t xy = simd_mul(qx, y2),  xz = simd_mul(qx, z2),  yz = simd_mul(qy, z2);
+	simd_t wx = simd_mul(qw, x2),  wy = simd_mul(qw, y2),  wz = simd_mul(qw, z2);
+
+	simd_t m00 = simd_mul(simd_sub(one, simd_add(yy, zz)), s);
+	simd_t m10 = simd_mul(simd_add(xy, wz), s);
+	simd_t m20 = simd_mul(simd_sub(xz, wy), s);
+	simd_t m01 = simd_mul(simd_sub(xy, wz), s);
+	simd_t m11 = simd_mul(simd_sub(one, simd_add(xx, zz)), s);
+	simd_t m21 = simd_mul(simd_add(yz, wx), s);
+	simd_t m02 = simd_mul(simd_add(xz, wy), s);
+	simd_t m12 = simd_mul(simd_sub(yz, wx), s);
+	simd_t m22 = simd_mul(simd_sub(one, simd_add(xx, yy)), s);
+
+	simd_store_t(dst,      mat_stride, m00, m10, m20, zero);
+	simd_store_t(dst + 4,  mat_stride, m01, m11, m21, zero);
+	simd_store_t(dst + 8,  mat_stride, m02, m12, m22, zero);
+	simd_store_t(dst + 12, mat_stride, px,  py,  pz,  one);
+}
+#endif
+
+///////////////////////////////////////////
+
+void math_poses_to_matrices(const XrPosef *poses, size_t count, float scale, mat4_t *out_matrices) {
+	size_t i = 0;
+#if !defined(MATH_SCALAR)
+	const size_t pose_stride = sizeof(XrPosef) / sizeof(float);
+	const simd_t s           = simd_set(scale);
+
+	// Convert a whole batch of poses at a time! Loading a position reads
+	// 4 floats, which is one past the end of the XrPosef, so we always need
+	// one more pose after the batch. The last few get done one at a time.
+	for (; i + simd_width < count; i += simd_width) {
+		simd_t qx, qy, qz, qw, px, py, pz, pw;
+		simd_load_t(&poses[i].orientation.x, pose_stride, qx, qy, qz, qw);
+		simd_load_t(&poses[i].position   .x, pose_stride, px, py, pz, pw);
+		simd_store_pose_matrices(out_matrices[i].m, qx, qy, qz, qw, px, py, pz, s);
+	}
+#endif
+	for (; i < count; i++) {
+		out_matrices[i] = math_pose_matrix(poses[i], scale);
+	}
+}
+
+///////////////////////////////////////////
+
+void math_joints_to_matrices(const hand_joints_t &joints, mat4_t *out_matrices) {
+	// Joints are already split up by component, so there's no transposing
+	// to do on the way in, and each joint is scaled by its own radius.
+	size_t i = 0;
+#if !defined(MATH_SCALAR)
+	for (; i + simd_width <= joints.count; i += simd_width) {
+		simd_store_pose_matrices(out_matrices[i].m,
+			simd_load(&joints.rot_x[i]), simd_load(&joints.rot_y[i]), simd_load(&joints.rot_z[i]), simd_load(&joints.rot_w[i]),
+			simd_load(&joints.pos_x[i]), simd_load(&joints.pos_y[i]), simd_load(&joints.pos_z[i]),
+			simd_load(&joints.radius[i]));
+	}
+#endif
+	for (; i < joints.count; i++) {
+		XrPosef pose = { { joints.rot_x[i], joints.rot_y[i], joints.rot_z[i], joints.rot_w[i] }, { joints.pos_x[i], joints.pos_y[i], joints.pos_z[i] } };
+		out_matrices[i] = math_pose_matrix(pose, joints.radius[i]);
+	}
+}
+
+///////////////////////////////////////////
+
+mat4_t math_pose_matrix(const XrPosef &pose, float scale) {
+	const XrQuaternionf &q = pose.orientation;
+	const float x2 = q.x * 2, y2 = q.y * 2, z2 = q.z * 2;
+	const float xx = q.x * x2, yy = q.y * y2, zz = q.z * z2;
+	const float xy = q.x * y2, xz = q.x * z2, yz = q.y * z2;
+	const float wx = q.w * x2, wy = q.w * y2, wz = q.w * z2;
+
+	mat4_t result = {{
+		(1 - (yy + zz)) * scale, (xy + wz) * scale,       (xz - wy) * scale,       0,
+		(xy - wz) * scale,       (1 - (xx + zz)) * scale, (yz + wx) * scale,       0,
+		(xz + wy) * scale,       (yz - wx) * scale,       (1 - (xx + yy)) * scale, 0,
+		pose.position.x,         pose.position.y,         pose.position.z,         1 }};
+	return result;
+}
+
+///////////////////////////////////////////
+
+XrPosef math_pose_inverse(const XrPosef &pose) {
+	// The inverse rotation is just the conjugate of the quaternion, and
+	// the inverse position is the negated position, rotated by that.
+	XrPosef result;
+	result.orientation = { -pose.orientation.x, -pose.orientation.y, -pose.orientation.z, pose.orientation.w };
+	result.position    = math_quat_rotate(result.orientation, { -pose.position.x, -pose.position.y, -pose.position.z });
+	return result;
+}
+
+///////////////////////////////////////////
+
+XrVector3f math_quat_rotate(const XrQuaternionf &q, const XrVector3f &v) {
+	// v + 2w(q x v) + 2q x (q x v)
+	const XrVector3f t = {
+		2 * (q.y * v.z - q.z * v.y),
+		2 * (q.z * v.x - q.x * v.z),
+		2 * (q.x * v.y - q.y * v.x) };
+	return {
+		v.x + q.w * t.x + (q.y * t.z - q.z * t.y),
+		v.y + q.w * t.y + (q.z * t.x - q.x * t.z),
+		v.z + q.w * t.z + (q.x * t.y - q.y * t.x) };
+}
+
+///////////////////////////////////////////
+
+XrQuaternionf math_quat_mul(const XrQuaternionf &a, const XrQuaternionf &b) {
+	// Rotates by b, and then by a
+	return {
+		a.w * b.x + a.x * b.w + a.y * b.z - a.z * b.y,
+		a.w * b.y - a.x * b.z + a.y * b.w + a.z * b.x,
+		a.w * b.z + a.x * b.y - a.y * b.x + a.z * b.w,
+		a.w * b.w - a.x * b.x - a.y * b.y - a.z * b.z };
+}
+
+///////////////////////////////////////////
+
+XrQuaternionf math_quat_slerp(const XrQuaternionf &a, const XrQuaternionf &b, float t) {
+	// q and -q are the same rotation, so flip b if that's the shorter way
+	// around.
+	float         dot  = a.x*b.x + a.y*b.y + a.z*b.z + a.w*b.w;
+	XrQuaternionf to   = b;
+	if (dot < 0) {
+		dot = -dot;
+		to  = { -b.x, -b.y, -b.z, -b.w };
+	}
+
+	// Nearly the same rotation, where the angle gets too small to divide
+	// by. A plain lerp is just as good there.
+	float wa = 1 - t, wb = t;
+	if (dot < 0.9995f) {
+		float angle = acosf(dot);
+		float sin_a = sinf(angle);
+		wa = sinf((1 - t) * angle) / sin_a;
+		wb = sinf(t       * angle) / sin_a;
+	}
+	XrQuaternionf result = {
+		wa * a.x + wb * to.x,
+		wa * a.y + wb * to.y,
+		wa * a.z + wb * to.z,
+		wa * a.w + wb * to.w };
+	float len = sqrtf(result.x*result.x + result.y*result.y + result.z*result.z + result.w*result.w);
+	return { result.x / len, result.y / len, result.z / len, result.w / len };
+}
+
+///////////////////////////////////////////
+
+XrQuaternionf math_quat_from_rotation(const XrVector3f &rotation) {
+	// A rotation vector's direction is the axis, and its length is the
+	// angle in radians.
+	float angle = sqrtf(rotation.x*rotation.x + rotation.y*rotation.y + rotation.z*rotation.z);
+	if (angle < 1e-6f)
+		return { rotation.x * 0.5f, rotation.y * 0.5f, rotation.z * 0.5f, 1 };
+	float s = sinf(angle * 0.5f) / angle;
+	return { rotation.x * s, rotation.y * s, rotation.z * s, cosf(angle * 0.5f) };
+}
+
+///////////////////////////////////////////
+
+XrVector3f math_quat_to_rotation(const XrQuaternionf &q) {
+	// The shortest way around, so a half turn is the most we'll get
+	float      sign  = q.w < 0 ? -1.0f : 1.0f;
+	XrVector3f axis  = { q.x * sign, q.y * sign, q.z * sign };
+	float      sin_h = sqrtf(axis.x*axis.x + axis.y*axis.y + axis.z*axis.z);
+	if (sin_h < 1e-6f)
+		return { axis.x * 2, axis.y * 2, axis.z * 2 };
+	float angle = 2 * atan2f(sin_h, q.w * sign);
+	return { axis.x / sin_h * angle, axis.y / sin_h * angle, axis.z / sin_h * angle };
+}
+
+///////////////////////////////////////////
+
+mat4_t math_projection(XrFovf fov, float clip_near, float clip_far) {
+	// An off-center, right handed perspective projection with a 0-1 depth
+	// range, the same as DirectX's XMMatrixPerspectiveOffCenterRH.
+	const float left   = tanf(fov.angleLeft);
+	const float right  = tanf(fov.angleRight);
+	const float down   = tanf(fov.angleDown);
+	const float up     = tanf(fov.angleUp);
+	const float width  = right - left;
+	const float height = up    - down;
+
+	mat4_t result = {};
+	result.m[0]  = 2 / width;
+	result.m[5]  = 2 / height;
+	result.m[8]  = (right + left) / width;
+	result.m[9]  = (up    + down) / height;
+	result.m[10] = clip_far / (clip_near - clip_far);
+	result.m[11] = -1;
+	result.m[14] = clip_near * clip_far / (clip_near - clip_far);
+	return result;
+}
+
+///////////////////////////////////////////
+
+mat4_t math_mul(const mat4_t &a, const mat4_t &b) {
+	mat4_t result;
+	for (int32_t col = 0; col < 4; col++) {
+		for (int32_t row = 0; row < 4; row++) {
+			result.m[col*4 + row] =
+				a.m[0*4 + row] * b.m[col*4 + 0] +
+				a.m[1*4 + row] * b.m[col*4 + 1] +
+				a.m[2*4 + row] * b.m[col*4 + 2] +
+				a.m[3*4 + row] * b.m[col*4 + 3];
+		}
+	}
+	return result;
+}
+
+///////////////////////////////////////////
+
+// A tiny linear congruential generator, for the benchmarks and tests.
+// It's the same sequence from the same seed every run, so results can be
+// compared between runs. The low bits of an LCG aren't very random, so
+// only the top 24 come back.
+uint32_t math_rand(uint32_t &seed) {
+	seed = seed * 1664525 + 1013904223;
+	return seed >> 8;
+}
+
+///////////////////////////////////////////
+
+float math_rand_range(uint32_t &seed, float min, float max) {
+	return min + (max - min) * (math_rand(seed) / 16777216.0f);
+}
+
+///////////////////////////////////////////
+
+math_frustum_t math_frustum_combined(const XrView *views, uint32_t view_count, float clip_near, float clip_far) {
+	// Add up the inward facing normals for each side of each view's frustum.
+	// For a stereo pair these are nearly identical, so the average makes a
+	// good direction for each plane of a single frustum around all of them.
+	// The order is left, right, down, up, near, far.
+	XrVector3f normals[6] = {};
+	for (uint32_t v = 0; v < view_count; v++) {
+		const XrFovf &fov = views[v].fov;
+		XrVector3f local[6] = {
+			{  cosf(fov.angleLeft),  0,                    sinf(fov.angleLeft)  },
+			{ -cosf(fov.angleRight), 0,                   -sinf(fov.angleRight) },
+			{  0,                    cosf(fov.angleDown),  sinf(fov.angleDown)  },
+			{  0,                   -cosf(fov.angleUp),   -sinf(fov.angleUp)    },
+			{  0,                    0,                   -1                    },
+			{  0,                    0,                    1                    } };
+		for (int32_t p = 0; p < 6; p++) {
+			XrVector3f n = math_quat_rotate(views[v].pose.orientation, local[p]);
+			normals[p] = { normals[p].x + n.x, normals[p].y + n.y, normals[p].z + n.z };
+		}
+	}
+
+	math_frustum_t result;
+	for (int32_t p = 0; p < 6; p++) {
+		XrVector3f &n   = normals[p];
+		float       len = sqrtf(n.x*n.x + n.y*n.y + n.z*n.z);
+		result.planes[p][0] = n.x / len;
+		result.planes[p][1] = n.y / len;
+		result.planes[p][2] = n.z / len;
+		result.planes[p][3] = -FLT_MAX;
+	}
+
+	// Now push each plane out until all 8 corners of every view's frustum
+	// are on the inside of it. Since a frustum is just the convex hull of
+	// its corners, the result is guaranteed to contain every view, even if
+	// they don't all face the same way. That keeps the culling conservative.
+	for (uint32_t v = 0; v < view_count; v++) {
+		const XrFovf &fov = views[v].fov;
+		for (int32_t c = 0; c < 8; c++) {
+			float      dist   = c < 4 ? clip_near : clip_far;
+			XrVector3f corner = {
+				(c & 1 ? tanf(fov.angleRight) : tanf(fov.angleLeft)) * dist,
+				(c & 2 ? tanf(fov.angleUp)    : tanf(fov.angleDown)) * dist,
+				-dist };
+			corner = math_quat_rotate(views[v].pose.orientation, corner);
+			corner = { corner.x + views[v].pose.position.x, corner.y + views[v].pose.position.y, corner.z + views[v].pose.position.z };
+
+			for (int32_t p = 0; p < 6; p++) {
+				float *plane = result.planes[p];
+				float  d     = -(plane[0]*corner.x + plane[1]*corner.y + plane[2]*corner.z);
+				if (d > plane[3]) plane[3] = d;
+			}
+		}
+	}
+	return result;
+}
+
+///////////////////////////////////////////
+
+bool math_frustum_bounds(const math_frustum_t &frustum, XrVector3f *out_min, XrVector3f *out_max) {
+	// Each corner is where three planes meet: left or right, down or up,
+	// and near or far. Solving for that point is Cramer's rule written with
+	// cross products. If any of them are parallel, there's no corner, and
+	// no box we can put around it.
+	*out_min = {  FLT_MAX,  FLT_MAX,  FLT_MAX };
+	*out_max = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+	auto cross = [](const float *a, const float *b) {
+		return XrVector3f{ a[1]*b[2] - a[2]*b[1], a[2]*b[0] - a[0]*b[2], a[0]*b[1] - a[1]*b[0] }; };
+	for (int32_t c = 0; c < 8; c++) {
+		const float *a   = frustum.planes[0 + ((c     ) & 1)];
+		const float *b   = frustum.planes[2 + ((c >> 1) & 1)];
+		const float *d   = frustum.planes[4 + ((c >> 2) & 1)];
+		XrVector3f   bd  = cross(b, d);
+		XrVector3f   da  = cross(d, a);
+		XrVector3f   ab  = cross(a, b);
+		float        det = a[0]*bd.x + a[1]*bd.y + a[2]*bd.z;
+		if (fabsf(det) < 1e-6f)
+			return false;
+		XrVector3f corner = {
+			-(a[3]*bd.x + b[3]*da.x + d[3]*ab.x) / det,
+			-(a[3]*bd.y + b[3]*da.y + d[3]*ab.y) / det,
+			-(a[3]*bd.z + b[3]*da.z + d[3]*ab.z) / det };
+		*out_min = { fminf(out_min->x, corner.x), fminf(out_min->y, corner.y), fminf(out_min->z, corner.z) };
+		*out_max = { fmaxf(out_max->x, corner.x), fmaxf(out_max->y, corner.y), fmaxf(out_max->z, corner.z) };
+	}
+	return true;
+}
+
+///////////////////////////////////////////
+
+size_t math_frustum_cull(const math_frustum_t &frustum, const XrPosef *poses, size_t count, float radius, uint32_t *out_visible) {
+	// A sphere is visible if its center is no further than its radius
+	// behind every plane. Since all our spheres are the same size, we can
+	// just move the planes outward by the radius ahead of time.
+	float planes[6][4];
+	for (int32_t p = 0; p < 6; p++) {
+		planes[p][0] = frustum.planes[p][0];
+		planes[p][1] = frustum.planes[p][1];
+		planes[p][2] = frustum.planes[p][2];
+		planes[p][3] = frustum.planes[p][3] + radius;
+	}
+
+	size_t visible = 0;
+	size_t i       = 0;
+#if !defined(MATH_SCALAR)
+	const size_t pose_stride = sizeof(XrPosef) / sizeof(float);
+	simd_t plane_x[6], plane_y[6], plane_z[6], plane_d[6];
+	for (int32_t p = 0; p < 6; p++) {
+		plane_x[p] = simd_set(planes[p][0]);
+		plane_y[p] = simd_set(planes[p][1]);
+		plane_z[p] = simd_set(planes[p][2]);
+		plane_d[p] = simd_set(planes[p][3]);
+	}
+
+	// Same as math_poses_to_matrices, loading positions needs one extra
+	// pose after the batch. For each batch, find the smallest distance to
+	// any of the planes, and keep the cubes where that's positive.
+	for (; i + simd_width < count; i += simd_width) {
+		simd_t px, py, pz, pw;
+		simd_load_t(&poses[i].position.x, pose_stride, px, py, pz, pw);
+
+		simd_t dist = simd_set(FLT_MAX);
+		for (int32_t p = 0; p < 6; p++) {
+			simd_t d = simd_add(simd_add(simd_mul(px, plane_x[p]), simd_mul(py, plane_y[p])), simd_add(simd_mul(pz, plane_z[p]), plane_d[p]));
+			dist = simd_min(dist, d);
+		}
+
+		int32_t mask = simd_mask_ge0(dist);
+		for (size_t lane = 0; mask != 0; lane++, mask >>= 1) {
+			if (mask & 1) out_visible[visible++] = (uint32_t)(i + lane);
+		}
+	}
+#endif
+	for (; i < count; i++) {
+		const XrVector3f &pt = poses[i].position;
+		bool inside = true;
+		for (int32_t p = 0; p < 6 && inside; p++) {
+			inside = planes[p][0]*pt.x + planes[p][1]*pt.y + planes[p][2]*pt.z + planes[p][3] >= 0;
+		}
+		if (inside) out_visible[visible++] = (uint32_t)i;
+	}
+	return visible;
+}
+
+///////////////////////////////////////////
+// Cube store code                       //
+///////////////////////////////////////////
+
+uint32_t cube_store_add(cube_store_t &store, const XrPosef &pose) {
+	// Each chunk reserves all its memory up front, and we never grow a chunk
+	// past that, so a pose never moves once it's been added.
+	size_t chunk = store.count / cube_chunk_size;
+	if (chunk >= store.chunks.size()) {
+		store.chunks.emplace_back();
+		store.chunks.back().reserve(cube_chunk_size);
+	}
+	store.chunks[chunk].push_back(pose);
+	return (uint32_t)store.count++;
+}
+
+///////////////////////////////////////////
+
+const XrPosef &cube_store_get(const cube_store_t &store, uint32_t id) {
+	return store.chunks[id / cube_chunk_size][id % cube_chunk_size];
+}
+
+///////////////////////////////////////////
+// Cube journal code                     //
+///////////////////////////////////////////
+
+bool cube_journal_open(cube_journal_t &journal, const char *snapshot_file, const char *journal_file, cube_store_t &cubes, spatial_index_t &index) {
+	journal.snapshot_file  = snapshot_file;
+	journal.journal_file   = journal_file;
+	journal.quit           = false;
+	journal.pending.clear();
+	journal.snapshot_count = 0;
+	journal.journal_count  = 0;
+	journal.batches        = 0;
+	journal.compactions    = 0;
+
+	// Both files are mapped and their poses go straight into the store,
+	// there's nothing to parse. Missing files just mean an empty scene.
+	cube_file_t snapshot, log;
+	cube_file_map(snapshot, snapshot_file, cube_snapshot_magic);
+	cube_file_map(log,      journal_file,  cube_journal_magic);
+	size_t skip = cube_journal_skip(snapshot, log);
+	const XrPosef *lists [2] = { snapshot.poses, log.poses + skip };
+	size_t         counts[2] = { snapshot.count, log.count - skip };
+	for (int32_t l = 0; l < 2; l++) {
+		uint32_t first_id = (uint32_t)cubes.count;
+		for (size_t i = 0; i < counts[l]; i++) {
+			cube_store_add(cubes, lists[l][i]);
+		}
+		spatial_insert_many(index, first_id, lists[l], counts[l], app_cube_radius);
+	}
+
+	// If the journal is anything other than a neat continuation of the
+	// snapshot, the writer compacts before it appends anything.
+	journal.clean          = log.data != nullptr && log.header->base == snapshot.count && !log.torn;
+	journal.snapshot_count = snapshot.count;
+	journal.journal_count  = log.count;
+	cube_file_unmap(snapshot);
+	cube_file_unmap(log);
+
+	journal.worker = thread(cube_journal_run, &journal);
+	return counts[0] + counts[1] > 0;
+}
+
+///////////////////////////////////////////
+
+void cube_journal_append(cube_journal_t &journal, const XrPosef &pose) {
+	// The writer only holds the lock long enough to swap 'pending' out, so
+	// this never waits on the disk.
+	{
+		lock_guard<mutex> lock(journal.lock);
+		journal.pending.push_back(pose);
+	}
+	journal.wake.notify_one();
+}
+
+///////////////////////////////////////////
+
+void cube_journal_close(cube_journal_t &journal) {
+	// The writer finishes off anything pending before it stops
+	if (!journal.worker.joinable())
+		return;
+	{
+		lock_guard<mutex> lock(journal.lock);
+		journal.quit = true;
+	}
+	journal.wake.notify_one();
+	journal.worker.join();
+}
+
+///////////////////////////////////////////
+
+void cube_journal_run(cube_journal_t *journal) {
+	if (!journal->clean)
+		cube_journal_compact(*journal);
+
+	FILE           *fp = nullptr;
+	vector<XrPosef> batch;
+	bool            quit = false;
+	while (!quit) {
+		{
+			unique_lock<mutex> lock(journal->lock);
+			journal->wake.wait(lock, [journal]() { return journal->quit || !journal->pending.empty(); });
+			// Placements tend to come in bursts, so give the rest of the
+			// burst a moment to show up, and write them all at once.
+			if (!journal->quit)
+				journal->wake.wait_for(lock, chrono::milliseconds(app_config_journal_batch_ms), [journal]() { return journal->quit; });
+			swap(batch, journal->pending);
+			quit = journal->quit;
+		}
+		if (batch.empty())
+			continue;
+
+		if (fp == nullptr && fopen_s(&fp, journal->journal_file, "ab") != 0) {
+			printf("Warning: couldn't open cube journal '%s'\n", journal->journal_file);
+			fp = nullptr;
+		}
+
+		// Only what made it to the file counts. A short write, like from a
+		// full disk, may also leave part of a pose at the end, which would
+		// throw every later append off by a few bytes. Compacting rewrites
+		// the journal from what's really in it, without the torn pose.
+		size_t written = 0;
+		bool   torn    = false;
+		if (fp != nullptr) {
+			written = fwrite(batch.data(), sizeof(XrPosef), batch.size(), fp);
+			torn    = fflush(fp) != 0 || written < batch.size();
+		}
+		journal->journal_count += written;
+		journal->batches       += 1;
+		batch.clear();
+		if (torn) {
+			printf("Warning: couldn't write to cube journal '%s'\n", journal->journal_file);
+			fclose(fp);
+			fp = nullptr;
+			cube_journal_compact(*journal);
+			continue;
+		}
+
+		// Once the journal is as big as the snapshot, fold it in. Letting
+		// it get that big means each cube gets rewritten only a few times
+		// total, no matter how many are placed.
+		if (journal->journal_count >= app_config_journal_compact && journal->journal_count >= journal->snapshot_count) {
+			if (fp != nullptr) fclose(fp);
+			fp = nullptr;
+			cube_journal_compact(*journal);
+		}
+	}
+	if (fp != nullptr) fclose(fp);
+}
+
+///////////////////////////////////////////
+
+bool cube_journal_compact(cube_journal_t &journal) {
+	cube_file_t snapshot, log;
+	cube_file_map(snapshot, journal.snapshot_file, cube_snapshot_magic);
+	cube_file_map(log,      journal.journal_file,  cube_journal_magic);
+	size_t skip = cube_journal_skip(snapshot, log);
+
+	// The new snapshot goes in first, and only then does the journal start
+	// over. If we crash in between, the journal's base tells us which of
+	// its cubes the snapshot already has.
+	const XrPosef *lists [2] = { snapshot.poses, log.poses + skip };
+	size_t         counts[2] = { snapshot.count, log.count - skip };
+	uint64_t       total     = counts[0] + counts[1];
+	char           temp_file[512];
+	file_temp_name(temp_file, sizeof(temp_file), journal.snapshot_file);
+	bool result = cube_file_write(temp_file, cube_snapshot_magic, total, lists, counts, 2);
+	cube_file_unmap(snapshot);
+	cube_file_unmap(log);
+	if (result)
+		result = file_replace(temp_file, journal.snapshot_file);
+	if (result) {
+		file_temp_name(temp_file, sizeof(temp_file), journal.journal_file);
+		result = cube_file_write(temp_file, cube_journal_magic, total, nullptr, nullptr, 0)
+			&&   file_replace(temp_file, journal.journal_file);
+	}
+	if (!result) {
+		remove(temp_file);
+		printf("Warning: couldn't compact cube journal '%s'\n", journal.journal_file);
+		return false;
+	}
+
+	journal.snapshot_count = total;
+	journal.journal_count  = 0;
+	journal.compactions   += 1;
+	return true;
+}
+
+///////////////////////////////////////////
+
+size_t cube_journal_skip(const cube_file_t &snapshot, cube_file_t &log) {
+	// A journal that starts past the end of the snapshot is missing cubes
+	// in between, so there's no way to place its cubes in the right order.
+	uint64_t snapshot_count = snapshot.data != nullptr ? snapshot.count : 0;
+	if (log.data == nullptr || log.header->base > snapshot_count) {
+		cube_file_unmap(log);
+		return 0;
+	}
+	// One that starts before the end was left over from a compaction that
+	// didn't finish, and the snapshot already has its first few cubes.
+	size_t skip = (size_t)(snapshot_count - log.header->base);
+	return skip < log.count ? skip : log.count;
+}
+
+///////////////////////////////////////////
+
+bool cube_file_map(cube_file_t &file, const char *filename, uint32_t magic) {
+	file = {};
+
+	file_map(filename, &file.data, &file.size);
+	if (file.data == nullptr || file.size < sizeof(cube_file_header_t)) {
+		cube_file_unmap(file);
+		return false;
+	}
+	file.header = (const cube_file_header_t *)file.data;
+	file.poses  = (const XrPosef *)(file.data + sizeof(cube_file_header_t));
+	file.count  = (file.size - sizeof(cube_file_header_t)) / sizeof(XrPosef);
+	file.torn   = (file.size - sizeof(cube_file_header_t)) % sizeof(XrPosef) != 0;
+	if (file.header->magic != magic || file.header->version != cube_file_version) {
+		cube_file_unmap(file);
+		return false;
+	}
+
+	// Snapshots are swapped in whole, so one that's short is broken
+	if (magic == cube_snapshot_magic) {
+		if (file.header->base > file.count) {
+			cube_file_unmap(file);
+			return false;
+		}
+		file.count = (size_t)file.header->base;
+	}
+	return true;
+}
+
+///////////////////////////////////////////
+
+void cube_file_unmap(cube_file_t &file) {
+	file_unmap(file.data, file.size);
+	file = {};
+}
+
+///////////////////////////////////////////
+
+bool cube_file_write(const char *filename, uint32_t magic, uint64_t base, const XrPosef **pose_lists, const size_t *counts, int32_t list_count) {
+	cube_file_header_t header = { magic, cube_file_version, base };
+	FILE *fp     = nullptr;
+	bool  result = fopen_s(&fp, filename, "wb") == 0;
+	if (!result)
+		return false;
+	result = fwrite(&header, sizeof(header), 1, fp) == 1;
+	for (int32_t i = 0; result && i < list_count; i++) {
+		if (counts[i] > 0)
+			result = fwrite(pose_lists[i], sizeof(XrPosef), counts[i], fp) == counts[i];
+	}
+	return fclose(fp) == 0 && result;
+}
+
+///////////////////////////////////////////
+// Spatial index code                    //
+///////////////////////////////////////////
+
+inline int32_t spatial_coord(float f, float cell_size) {
+	// Clamped so the conversion, and stepping to the next cell over, can't
+	// overflow. That's a billion cells out, far past anywhere we'll go.
+	const int32_t limit = 1 << 30;
+	float         cell  = floorf(f / cell_size);
+	return cell < -limit ? -limit : cell > limit ? limit : (int32_t)cell;
+}
+
+///////////////////////////////////////////
+
+const spatial_cell_t *spatial_find(const spatial_index_t &index, int32_t x, int32_t y, int32_t z) {
+	auto found = index.lookup.find({ x, y, z });
+	return found == index.lookup.end()
+		? nullptr
+		: &index.cells[found->second];
+}
+
+///////////////////////////////////////////
+
+void spatial_insert(spatial_index_t &index, uint32_t id, const XrVector3f &center, float radius) {
+	const float s  = index.cell_size;
+	int32_t     hx = spatial_coord(center.x, s), hy = spatial_coord(center.y, s), hz = spatial_coord(center.z, s);
+
+	// The cube's bounds can cover a few cells if it's near a cell edge. This
+	// is a constant amount of work, so inserting doesn't slow down as the
+	// index grows.
+	int32_t x0 = spatial_coord(center.x - radius, s), x1 = spatial_coord(center.x + radius, s);
+	int32_t y0 = spatial_coord(center.y - radius, s), y1 = spatial_coord(center.y + radius, s);
+	int32_t z0 = spatial_coord(center.z - radius, s), z1 = spatial_coord(center.z + radius, s);
+	for (int32_t x = x0; x <= x1; x++) {
+	for (int32_t y = y0; y <= y1; y++) {
+	for (int32_t z = z0; z <= z1; z++) {
+		spatial_cell_key_t key   = { x, y, z };
+		auto               found = index.lookup.find(key);
+		uint32_t cell_id;
+		if (found == index.lookup.end()) {
+			cell_id = (uint32_t)index.cells.size();
+			index.lookup[key] = cell_id;
+			index.cells.push_back({ x, y, z });
+		} else {
+			cell_id = found->second;
+		}
+
+		spatial_cell_t &cell = index.cells[cell_id];
+		if (x == hx && y == hy && z == hz) cell.home   .push_back(id);
+		else                               cell.overlap.push_back(id);
+	} } }
+}
+
+///////////////////////////////////////////
+
+void spatial_insert_many(spatial_index_t &index, uint32_t first_id, const XrPosef *poses, size_t count, float radius) {
+	// Inserting one at a time grows each cell's lists a little at a time,
+	// hopping all over memory as it goes. For a big batch, like restoring a
+	// saved scene, we find all the cells first and count what goes in
+	// them, so each list gets allocated just once.
+	const float      s = index.cell_size;
+	vector<uint64_t> entries; // cell id << 32 | home bit << 31 | poses index
+	entries.reserve(count * 2);
+	for (size_t i = 0; i < count; i++) {
+		const XrVector3f &center = poses[i].position;
+		int32_t hx = spatial_coord(center.x, s), hy = spatial_coord(center.y, s), hz = spatial_coord(center.z, s);
+		int32_t x0 = spatial_coord(center.x - radius, s), x1 = spatial_coord(center.x + radius, s);
+		int32_t y0 = spatial_coord(center.y - radius, s), y1 = spatial_coord(center.y + radius, s);
+		int32_t z0 = spatial_coord(center.z - radius, s), z1 = spatial_coord(center.z + radius, s);
+		for (int32_t x = x0; x <= x1; x++) {
+		for (int32_t y = y0; y <= y1; y++) {
+		for (int32_t z = z0; z <= z1; z++) {
+			spatial_cell_key_t key   = { x, y, z };
+			auto               found = index.lookup.find(key);
+			uint32_t cell_id;
+			if (found == index.lookup.end()) {
+				cell_id = (uint32_t)index.cells.size();
+				index.lookup[key] = cell_id;
+				index.cells.push_back({ x, y, z });
+			} else {
+				cell_id = found->second;
+			}
+			uint64_t home = (x == hx && y == hy && z == hz) ? 1 : 0;
+			entries.push_back(((uint64_t)cell_id << 32) | (home << 31) | (uint64_t)i);
+		} } }
+	}
+
+	vector<uint32_t> home_counts(index.cells.size(), 0), overlap_counts(index.cells.size(), 0);
+	for (size_t e = 0; e < entries.size(); e++) {
+		uint32_t cell_id = (uint32_t)(entries[e] >> 32);
+		if (entries[e] & (1u << 31)) home_counts   [cell_id]++;
+		else                         overlap_counts[cell_id]++;
+	}
+	for (size_t c = 0; c < index.cells.size(); c++) {
+		if (home_counts   [c] > 0) index.cells[c].home   .reserve(index.cells[c].home   .size() + home_counts   [c]);
+		if (overlap_counts[c] > 0) index.cells[c].overlap.reserve(index.cells[c].overlap.size() + overlap_counts[c]);
+	}
+	for (size_t e = 0; e < entries.size(); e++) {
+		spatial_cell_t &cell = index.cells[(uint32_t)(entries[e] >> 32)];
+		uint32_t        id   = first_id + (uint32_t)(entries[e] & 0x7FFFFFFF);
+		if (entries[e] & (1u << 31)) cell.home   .push_back(id);
+		else                         cell.overlap.push_back(id);
+	}
+}
+
+///////////////////////////////////////////
+
+size_t spatial_query_frustum(const spatial_index_t &index, const math_frustum_t &frustum, const cube_store_t &cubes, float radius, vector<XrPosef> &scratch, vector<uint32_t> &scratch_ids, uint32_t *out_ids, uint32_t *out_tested) {
+	// Every cube is entirely within its home cell, plus its radius. So we
+	// can check each cell as a sphere first, and only look at the cubes
+	// inside cells that are partially visible.
+	const float half_cell   = index.cell_size * 0.5f;
+	const float cell_radius = index.cell_size * 0.8660254f; // sqrt(3)/2
+	size_t      visible     = 0;
+	uint32_t    tested      = 0;
+	scratch    .clear();
+	scratch_ids.clear();
+
+	auto test_cell = [&](const spatial_cell_t &cell) {
+		if (cell.home.empty())
+			return;
+		tested += 1;
+
+		const float cx = cell.x * index.cell_size + half_cell;
+		const float cy = cell.y * index.cell_size + half_cell;
+		const float cz = cell.z * index.cell_size + half_cell;
+		float dist = FLT_MAX;
+		for (int32_t p = 0; p < 6; p++) {
+			const float *plane = frustum.planes[p];
+			dist = fminf(dist, plane[0]*cx + plane[1]*cy + plane[2]*cz + plane[3]);
+		}
+
+		if (dist < -(cell_radius + radius)) {
+			// Completely outside, skip everything in it!
+			return;
+		} else if (dist >= cell_radius) {
+			// Completely inside, so everything in here is visible
+			for (size_t c = 0; c < cell.home.size(); c++)
+				out_ids[visible++] = cell.home[c];
+		} else {
+			// Partially visible, gather these up to test individually
+			for (size_t c = 0; c < cell.home.size(); c++) {
+				scratch    .push_back(cube_store_get(cubes, cell.home[c]));
+				scratch_ids.push_back(cell.home[c]);
+			}
+		}
+	};
+
+	// Only cells inside the frustum's bounding box, plus a cube's radius,
+	// can have visible cubes in them. When there are fewer of those than
+	// there are occupied cells, we look each one up directly. Otherwise, we
+	// go through the occupied cells and skip the ones outside the box.
+	const float s = index.cell_size;
+	XrVector3f  bounds_min, bounds_max;
+	int32_t     lo[3] = { INT32_MIN, INT32_MIN, INT32_MIN };
+	int32_t     hi[3] = { INT32_MAX, INT32_MAX, INT32_MAX };
+	double      box_cells = DBL_MAX;
+	if (math_frustum_bounds(frustum, &bounds_min, &bounds_max)) {
+		lo[0] = spatial_coord(bounds_min.x - radius, s); hi[0] = spatial_coord(bounds_max.x + radius, s);
+		lo[1] = spatial_coord(bounds_min.y - radius, s); hi[1] = spatial_coord(bounds_max.y + radius, s);
+		lo[2] = spatial_coord(bounds_min.z - radius, s); hi[2] = spatial_coord(bounds_max.z + radius, s);
+		box_cells = ((double)hi[0] - lo[0] + 1) * ((double)hi[1] - lo[1] + 1) * ((double)hi[2] - lo[2] + 1);
+	}
+	if (box_cells < (double)index.cells.size()) {
+		for (int32_t x = lo[0]; x <= hi[0]; x++) {
+		for (int32_t y = lo[1]; y <= hi[1]; y++) {
+		for (int32_t z = lo[2]; z <= hi[2]; z++) {
+			const spatial_cell_t *cell = spatial_find(index, x, y, z);
+			if (cell) test_cell(*cell);
+		} } }
+	} else {
+		for (size_t i = 0; i < index.cells.size(); i++) {
+			const spatial_cell_t &cell = index.cells[i];
+			if (cell.x < lo[0] || cell.x > hi[0] ||
+				cell.y < lo[1] || cell.y > hi[1] ||
+				cell.z < lo[2] || cell.z > hi[2])
+				continue;
+			test_cell(cell);
+		}
+	}
+
+	// The cull gives us indices into the scratch list, so swap those back to
+	// the cube ids they came from.
+	tested += (uint32_t)scratch.size();
+	size_t culled = math_frustum_cull(frustum, scratch.data(), scratch.size(), radius, out_ids + visible);
+	for (size_t c = 0; c < culled; c++)
+		out_ids[visible + c] = scratch_ids[out_ids[visible + c]];
+	visible += culled;
+	if (out_tested) *out_tested = tested;
+	return visible;
+}
+
+///////////////////////////////////////////
+
+bool spatial_ray_cube(const XrPosef &pose, float half_size, const XrVector3f &origin, const XrVector3f &dir, float *out_dist) {
+	// Move the ray into the cube's local space, where it's just an axis
+	// aligned box, and do a standard slab test.
+	const XrQuaternionf inv_rot = { -pose.orientation.x, -pose.orientation.y, -pose.orientation.z, pose.orientation.w };
+	const XrVector3f    o       = math_quat_rotate(inv_rot, { origin.x - pose.position.x, origin.y - pose.position.y, origin.z - pose.position.z });
+	const XrVector3f    d       = math_quat_rotate(inv_rot, dir);
+	const float         o_arr[3] = { o.x, o.y, o.z };
+	const float         d_arr[3] = { d.x, d.y, d.z };
+
+	float t_min = 0, t_max = FLT_MAX;
+	for (int32_t a = 0; a < 3; a++) {
+		if (fabsf(d_arr[a]) < 1e-8f) {
+			if (o_arr[a] < -half_size || o_arr[a] > half_size) return false;
+			continue;
+		}
+		float t0 = (-half_size - o_arr[a]) / d_arr[a];
+		float t1 = ( half_size - o_arr[a]) / d_arr[a];
+		if (t0 > t1) swap(t0, t1);
+		t_min = fmaxf(t_min, t0);
+		t_max = fminf(t_max, t1);
+		if (t_min > t_max) return false;
+	}
+	*out_dist = t_min;
+	return true;
+}
+
+///////////////////////////////////////////
+
+int64_t spatial_query_ray(const spatial_index_t &index, const cube_store_t &cubes, XrVector3f origin, XrVector3f dir, float max_dist, float half_size, float *out_dist) {
+	// Walk through the grid cells along the ray, one at a time, in the order
+	// the ray passes through them (Amanatides & Woo). Since cubes are listed
+	// in every cell they overlap, the first hit we find in a cell is the
+	// closest one, once the ray has left that cell.
+	const float s        = index.cell_size;
+	const float o[3]     = { origin.x, origin.y, origin.z };
+	const float d[3]     = { dir.x,    dir.y,    dir.z    };
+	int32_t     cell[3]  = { spatial_coord(o[0], s), spatial_coord(o[1], s), spatial_coord(o[2], s) };
+	int32_t     step[3];
+	float       t_next[3], t_delta[3];
+	for (int32_t a = 0; a < 3; a++) {
+		if (d[a] > 0) {
+			step   [a] = 1;
+			t_next [a] = ((cell[a] + 1) * s - o[a]) / d[a];
+			t_delta[a] = s / d[a];
+		} else if (d[a] < 0) {
+			step   [a] = -1;
+			t_next [a] = (cell[a] * s - o[a]) / d[a];
+			t_delta[a] = -s / d[a];
+		} else {
+			step   [a] = 0;
+			t_next [a] = FLT_MAX;
+			t_delta[a] = FLT_MAX;
+		}
+	}
+
+	int64_t best      = -1;
+	float   best_dist = max_dist;
+	float   t         = 0;
+	while (t <= best_dist) {
+		const spatial_cell_t *found = spatial_find(index, cell[0], cell[1], cell[2]);
+		if (found) {
+			const vector<uint32_t> *lists[2] = { &found->home, &found->overlap };
+			for (int32_t l = 0; l < 2; l++) {
+				for (size_t c = 0; c < lists[l]->size(); c++) {
+					uint32_t id = (*lists[l])[c];
+					float    hit;
+					if (spatial_ray_cube(cube_store_get(cubes, id), half_size, origin, dir, &hit) && hit < best_dist) {
+						best      = id;
+						best_dist = hit;
+					}
+				}
+			}
+		}
+
+		// Step into whichever neighboring cell the ray reaches first
+		int32_t axis = t_next[0] < t_next[1]
+			? (t_next[0] < t_next[2] ? 0 : 2)
+			: (t_next[1] < t_next[2] ? 1 : 2);
+		t = t_next[axis];
+		t_next[axis] += t_delta[axis];
+		cell  [axis] += step[axis];
+	}
+
+	if (out_dist) *out_dist = best_dist;
+	return best;
+}
+
+///////////////////////////////////////////
+// Mesh code                             //
+///////////////////////////////////////////
+
+bool mesh_build(const float *verts, size_t vert_count, const uint32_t *inds, size_t ind_count, mesh_t &out_mesh, uint32_t *out_remap) {
+	// First, put the triangles in an order that reuses the GPU's vertex
+	// cache as much as possible, then put the vertices in the order those
+	// triangles first use them, so fetches walk through memory.
+	vector<uint32_t> opt_inds(inds, inds + ind_count);
+	vector<uint32_t> remap   (vert_count);
+	mesh_optimize_cache(opt_inds.data(), ind_count, vert_count);
+	size_t used = mesh_optimize_fetch(opt_inds.data(), ind_count, vert_count, remap.data());
+	if (used > 65536) {
+		printf("Mesh has %zu vertices, too many for 16 bit indices!\n", used);
+		return false;
+	}
+
+	// Positions are stored relative to the mesh's bounds, so find them
+	XrVector3f min = {  FLT_MAX,  FLT_MAX,  FLT_MAX };
+	XrVector3f max = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+	for (size_t i = 0; i < vert_count; i++) {
+		if (remap[i] == UINT32_MAX) continue;
+		const float *v = &verts[i * 6];
+		min = { fminf(min.x, v[0]), fminf(min.y, v[1]), fminf(min.z, v[2]) };
+		max = { fmaxf(max.x, v[0]), fmaxf(max.y, v[1]), fmaxf(max.z, v[2]) };
+	}
+	// A flat mesh still needs a size on every axis, or we'd divide by zero
+	out_mesh.bounds_min  = min;
+	out_mesh.bounds_size = { fmaxf(max.x - min.x, 1e-6f), fmaxf(max.y - min.y, 1e-6f), fmaxf(max.z - min.z, 1e-6f) };
+
+	out_mesh.verts.resize(used);
+	for (size_t i = 0; i < vert_count; i++) {
+		if (remap[i] == UINT32_MAX) continue;
+		out_mesh.verts[remap[i]] = mesh_pack_vert(&verts[i * 6], out_mesh.bounds_min, out_mesh.bounds_size);
+	}
+	out_mesh.inds.resize(ind_count);
+	for (size_t i = 0; i < ind_count; i++) {
+		out_mesh.inds[i] = (uint16_t)opt_inds[i];
+	}
+
+	if (out_remap) memcpy(out_remap, remap.data(), vert_count * sizeof(uint32_t));
+	return true;
+}
+
+///////////////////////////////////////////
+
+// Scores how much we'd like to use a vertex next, based on where it sits in
+// a simulated vertex cache, and how many triangles still need it. This is
+// Tom Forsyth's "Linear-Speed Vertex Cache Optimisation".
+float mesh_vert_score(int32_t cache_pos, uint32_t remaining) {
+	if (remaining == 0) return -1;
+
+	float score = 0;
+	if (cache_pos >= 0) {
+		// The last triangle's vertices get a fixed score, so we don't just
+		// fan out around the same few vertices forever.
+		if (cache_pos < 3) score = 0.75f;
+		else               score = powf(1.0f - (cache_pos - 3) / (float)(mesh_cache_size - 3), 1.5f);
+	}
+	// Favor vertices with few triangles left, so we finish them off instead
+	// of leaving lonely triangles behind for later.
+	return score + 2.0f / sqrtf((float)remaining);
+}
+
+///////////////////////////////////////////
+
+void mesh_optimize_cache(uint32_t *inds, size_t ind_count, size_t vert_count) {
+	size_t tri_count = ind_count / 3;
+	if (tri_count == 0) return;
+
+	// Build a list of triangles for each vertex
+	vector<uint32_t> remaining(vert_count, 0);
+	vector<uint32_t> offsets  (vert_count + 1, 0);
+	for (size_t i = 0; i < tri_count * 3; i++) remaining[inds[i]]++;
+	for (size_t i = 0; i < vert_count; i++) offsets[i + 1] = offsets[i] + remaining[i];
+	vector<uint32_t> vert_tris(tri_count * 3);
+	vector<uint32_t> fill     (offsets.begin(), offsets.end() - 1);
+	for (size_t t = 0; t < tri_count; t++) {
+		for (int32_t c = 0; c < 3; c++) vert_tris[fill[inds[t*3+c]]++] = (uint32_t)t;
+	}
+
+	vector<int32_t> cache_pos (vert_count, -1);
+	vector<float>   vert_score(vert_count);
+	vector<float>   tri_score (tri_count, 0);
+	vector<bool>    emitted   (tri_count, false);
+	for (size_t v = 0; v < vert_count; v++) vert_score[v] = mesh_vert_score(-1, remaining[v]);
+	for (size_t t = 0; t < tri_count; t++) {
+		for (int32_t c = 0; c < 3; c++) tri_score[t] += vert_score[inds[t*3+c]];
+	}
+
+	// The cache gets 3 extra slots, so the newest triangle can push out the
+	// oldest vertices before we trim it back down.
+	uint32_t cache[mesh_cache_size + 3];
+	uint32_t cache_count = 0;
+	vector<uint32_t> result(tri_count * 3);
+	size_t   scan_cursor = 0;
+	int64_t  best_tri    = -1;
+	for (size_t out = 0; out < tri_count; out++) {
+		// If nothing in the cache has triangles left, start somewhere new
+		if (best_tri < 0) {
+			while (emitted[scan_cursor]) scan_cursor++;
+			best_tri = (int64_t)scan_cursor;
+		}
+
+		uint32_t tri = (uint32_t)best_tri;
+		emitted[tri] = true;
+		for (int32_t c = 0; c < 3; c++) {
+			uint32_t v = inds[tri*3+c];
+			result[out*3+c] = v;
+
+			// Take this triangle off of the vertex's list
+			uint32_t *list = &vert_tris[offsets[v]];
+			uint32_t  last = remaining[v] - 1;
+			for (uint32_t i = 0; i < last; i++) {
+				if (list[i] == tri) { list[i] = list[last]; break; }
+			}
+			remaining[v] = last;
+		}
+
+		// Move the triangle's vertices to the front of the cache
+		uint32_t new_cache[mesh_cache_size + 3];
+		uint32_t new_count = 0;
+		for (int32_t c = 0; c < 3; c++) new_cache[new_count++] = inds[tri*3+c];
+		for (uint32_t i = 0; i < cache_count; i++) {
+			uint32_t v = cache[i];
+			if (v != inds[tri*3] && v != inds[tri*3+1] && v != inds[tri*3+2])
+				new_cache[new_count++] = v;
+		}
+
+		// Re-score everything that was in the cache, and the triangles that
+		// use them. Vertices that fell out of the cache get scored too.
+		for (uint32_t i = 0; i < new_count; i++) {
+			uint32_t v = new_cache[i];
+			cache_pos[v] = i < mesh_cache_size ? (int32_t)i : -1;
+			float score = mesh_vert_score(cache_pos[v], remaining[v]);
+			float delta = score - vert_score[v];
+			vert_score[v] = score;
+			for (uint32_t t = 0; t < remaining[v]; t++) tri_score[vert_tris[offsets[v] + t]] += delta;
+		}
+		cache_count = new_count < mesh_cache_size ? new_count : mesh_cache_size;
+		memcpy(cache, new_cache, cache_count * sizeof(uint32_t));
+
+		// The next triangle is the best one touching the cache
+		best_tri = -1;
+		float best_score = -1;
+		for (uint32_t i = 0; i < cache_count; i++) {
+			uint32_t v = cache[i];
+			for (uint32_t t = 0; t < remaining[v]; t++) {
+				uint32_t candidate = vert_tris[offsets[v] + t];
+				if (tri_score[candidate] > best_score) {
+					best_score = tri_score[candidate];
+					best_tri   = candidate;
+				}
+			}
+		}
+	}
+	memcpy(inds, result.data(), tri_count * 3 * sizeof(uint32_t));
+}
+
+///////////////////////////////////////////
+
+size_t mesh_optimize_fetch(uint32_t *inds, size_t ind_count, size_t vert_count, uint32_t *out_remap) {
+	// Number vertices in the order the triangles first use them. Vertices
+	// that no triangle uses are left as UINT32_MAX, and get dropped.
+	for (size_t i = 0; i < vert_count; i++) out_remap[i] = UINT32_MAX;
+	uint32_t next = 0;
+	for (size_t i = 0; i < ind_count; i++) {
+		uint32_t &id = out_remap[inds[i]];
+		if (id == UINT32_MAX) id = next++;
+		inds[i] = id;
+	}
+	return next;
+}
+
+///////////////////////////////////////////
+
+float mesh_acmr(const uint32_t *inds, size_t ind_count, uint32_t cache_size) {
+	// Average cache miss ratio: vertices transformed per triangle, with a
+	// simple FIFO cache like older hardware. 0.5 is ideal for big grids,
+	// and 3 means no reuse at all.
+	if (ind_count < 3) return 0;
+	vector<uint32_t> fifo(cache_size, UINT32_MAX);
+	uint32_t head   = 0;
+	size_t   misses = 0;
+	for (size_t i = 0; i < ind_count; i++) {
+		if (find(fifo.begin(), fifo.end(), inds[i]) != fifo.end()) continue;
+		fifo[head] = inds[i];
+		head = (head + 1) % cache_size;
+		misses++;
+	}
+	return misses / (float)(ind_count / 3);
+}
+
+///////////////////////////////////////////
+
+mesh_vert_t mesh_pack_vert(const float *pos_norm, const XrVector3f &bounds_min, const XrVector3f &bounds_size) {
+	auto unorm16 = [](float value, float min, float size) {
+		float t = (value - min) / size;
+		t = t < 0 ? 0 : (t > 1 ? 1 : t);
+		return (uint16_t)(t * 65535.0f + 0.5f);
+	};
+	mesh_vert_t result;
+	result.x      = unorm16(pos_norm[0], bounds_min.x, bounds_size.x);
+	result.y      = unorm16(pos_norm[1], bounds_min.y, bounds_size.y);
+	result.z      = unorm16(pos_norm[2], bounds_min.z, bounds_size.z);
+	result.normal = mesh_encode_normal({ pos_norm[3], pos_norm[4], pos_norm[5] });
+	return result;
+}
+
+///////////////////////////////////////////
+
+uint16_t mesh_encode_normal(XrVector3f n) {
+	// Project onto an octahedron, and fold the bottom half out over the
+	// top, which flattens a unit sphere into a square.
+	float len = fabsf(n.x) + fabsf(n.y) + fabsf(n.z);
+	if (len == 0) return mesh_encode_normal({ 0, 0, 1 });
+	float x = n.x / len;
+	float y = n.y / len;
+	if (n.z < 0) {
+		float fx = (1 - fabsf(y)) * (x >= 0 ? 1 : -1);
+		float fy = (1 - fabsf(x)) * (y >= 0 ? 1 : -1);
+		x = fx;
+		y = fy;
+	}
+	uint32_t qx = (uint32_t)((x * 0.5f + 0.5f) * 255.0f + 0.5f);
+	uint32_t qy = (uint32_t)((y * 0.5f + 0.5f) * 255.0f + 0.5f);
+	return (uint16_t)((qx << 8) | qy);
+}
+
+///////////////////////////////////////////
+
+XrVector3f mesh_decode_normal(uint16_t normal) {
+	// This matches mesh_normal in the shader
+	float x = (normal >> 8)  / 255.0f * 2 - 1;
+	float y = (normal & 255) / 255.0f * 2 - 1;
+	float z = 1 - fabsf(x) - fabsf(y);
+	float t = z < 0 ? -z : 0;
+	x += x >= 0 ? -t : t;
+	y += y >= 0 ? -t : t;
+	float len = sqrtf(x*x + y*y + z*z);
+	return { x / len, y / len, z / len };
+}
+
+///////////////////////////////////////////
+// Mesh file code                        //
+///////////////////////////////////////////
+
+bool mesh_file_write(const char *filename, const mesh_t &mesh) {
+	// Lay out the file, each stream's data on an aligned offset after the
+	// header and stream list.
+	mesh_file_header_t header = { mesh_file_magic, mesh_file_version, 2 };
+	memcpy(header.bounds_min,  &mesh.bounds_min,  sizeof(header.bounds_min));
+	memcpy(header.bounds_size, &mesh.bounds_size, sizeof(header.bounds_size));
+	mesh_file_stream_t streams[2] = {
+		{ mesh_stream_vertices, sizeof(mesh_vert_t), (uint32_t)mesh.verts.size() },
+		{ mesh_stream_indices,  sizeof(uint16_t),    (uint32_t)mesh.inds .size() } };
+	const void *stream_data[2] = { mesh.verts.data(), mesh.inds.data() };
+	uint64_t    offset         = sizeof(header) + sizeof(streams);
+	for (int32_t i = 0; i < 2; i++) {
+		offset             = (offset + mesh_file_align - 1) / mesh_file_align * mesh_file_align;
+		streams[i].offset  = offset;
+		offset            += (uint64_t)streams[i].stride * streams[i].count;
+	}
+
+	// Same as the shader cache, write it next to the old one and swap it
+	// in, so nobody ever maps half a file.
+	char temp_file[512];
+	file_temp_name(temp_file, sizeof(temp_file), filename);
+	const uint8_t padding[mesh_file_align] = {};
+	FILE *fp     = nullptr;
+	bool  result = fopen_s(&fp, temp_file, "wb") == 0;
+	if (result) {
+		result = fwrite(&header, sizeof(header), 1, fp) == 1
+			&&   fwrite(streams, sizeof(streams), 1, fp) == 1;
+		uint64_t at = sizeof(header) + sizeof(streams);
+		for (int32_t i = 0; result && i < 2; i++) {
+			size_t pad  = (size_t)(streams[i].offset - at);
+			size_t size = (size_t)streams[i].stride * streams[i].count;
+			result = (pad  == 0 || fwrite(padding,        1, pad,  fp) == pad)
+				&&   (size == 0 || fwrite(stream_data[i], 1, size, fp) == size);
+			at = streams[i].offset + size;
+		}
+		result = fclose(fp) == 0 && result;
+	}
+	if (result)
+		result = file_replace(temp_file, filename);
+	if (!result) {
+		remove(temp_file);
+		printf("Warning: couldn't write mesh file '%s'\n", filename);
+	}
+	return result;
+}
+
+///////////////////////////////////////////
+
+bool mesh_file_map(mesh_file_t &file, const char *filename) {
+	file = {};
+
+	file_map(filename, &file.data, &file.size);
+	if (file.data == nullptr || file.size < sizeof(mesh_file_header_t)) {
+		mesh_file_unmap(file);
+		return false;
+	}
+	file.header = (const mesh_file_header_t *)file.data;
+
+	// Nothing gets parsed or copied, we just make sure the streams we need
+	// are there and actually inside the file. Streams we don't know about
+	// are skipped, so newer files can add them without a version bump.
+	const mesh_file_header_t *header = file.header;
+	if (header->magic        != mesh_file_magic   ||
+		header->version      != mesh_file_version ||
+		header->stream_count  > (file.size - sizeof(mesh_file_header_t)) / sizeof(mesh_file_stream_t)) {
+		mesh_file_unmap(file);
+		return false;
+	}
+	const mesh_file_stream_t *streams = (const mesh_file_stream_t *)(file.data + sizeof(mesh_file_header_t));
+	for (uint32_t i = 0; i < header->stream_count; i++) {
+		const mesh_file_stream_t &stream = streams[i];
+		uint64_t bytes = (uint64_t)stream.stride * stream.count;
+		if (stream.offset % mesh_file_align != 0 || stream.offset > file.size || bytes > file.size - stream.offset)
+			continue;
+		if (stream.type == mesh_stream_vertices && stream.stride == sizeof(mesh_vert_t)) {
+			file.verts      = (const mesh_vert_t *)(file.data + stream.offset);
+			file.vert_count = stream.count;
+		} else if (stream.type == mesh_stream_indices && stream.stride == sizeof(uint16_t)) {
+			file.inds      = (const uint16_t *)(file.data + stream.offset);
+			file.ind_count = stream.count;
+		}
+	}
+	if (file.verts == nullptr || file.inds == nullptr || file.vert_count == 0 || file.ind_count == 0 || file.ind_count % 3 != 0) {
+		mesh_file_unmap(file);
+		return false;
+	}
+	return true;
+}
+
+///////////////////////////////////////////
+
+void mesh_file_unmap(mesh_file_t &file) {
+	file_unmap(file.data, file.size);
+	file = {};
+}
+
+///////////////////////////////////////////
+
+bool mesh_load_start(mesh_loader_t &loader, const char *filename) {
+	// One load at a time, and the last one has to be picked up first
+	if (loader.state.load() != mesh_load_idle)
+		return false;
+	if (loader.worker.joinable())
+		loader.worker.join();
+
+	loader.filename      = filename;
+	loader.vertex_buffer = nullptr;
+	loader.index_buffer  = nullptr;
+	loader.mesh_buffer   = nullptr;
+	loader.ind_count     = 0;
+	loader.bytes         = 0;
+	loader.load_ms       = 0;
+	loader.state.store(mesh_load_loading);
+	loader.worker = thread(mesh_load_run, &loader);
+	return true;
+}
+
+///////////////////////////////////////////
+
+void mesh_load_run(mesh_loader_t *loader) {
+	auto start = chrono::high_resolution_clock::now();
+
+	mesh_file_t file;
+	bool        result = mesh_file_map(file, loader->filename);
+
+	// A corrupt index would have the GPU reading outside the vertex buffer,
+	// so this is the one thing we do look at. Indices are small, and this
+	// also pulls their pages in before D3D needs them.
+	for (uint32_t i = 0; result && i < file.ind_count; i++) {
+		if (file.inds[i] >= file.vert_count) result = false;
+	}
+
+	// D3D11 devices are free threaded, so we can create buffers from here.
+	// They're immutable, and initialized straight from the mapped file.
+	// Without a device, like in the headless build, mapping and checking
+	// the file is as far as we go.
+	if (result && d3d_device != nullptr) {
+		app_mesh_buffer_t mesh_buffer = {
+			{ file.header->bounds_min [0], file.header->bounds_min [1], file.header->bounds_min [2], 0 },
+			{ file.header->bounds_size[0], file.header->bounds_size[1], file.header->bounds_size[2], 0 } };
+		D3D11_SUBRESOURCE_DATA vert_buff_data = { file.verts };
+		D3D11_SUBRESOURCE_DATA ind_buff_data  = { file.inds };
+		D3D11_SUBRESOURCE_DATA mesh_buff_data = { &mesh_buffer };
+		CD3D11_BUFFER_DESC     vert_buff_desc(sizeof(mesh_vert_t) * file.vert_count, D3D11_BIND_VERTEX_BUFFER,   D3D11_USAGE_IMMUTABLE);
+		CD3D11_BUFFER_DESC     ind_buff_desc (sizeof(uint16_t)    * file.ind_count,  D3D11_BIND_INDEX_BUFFER,    D3D11_USAGE_IMMUTABLE);
+		CD3D11_BUFFER_DESC     mesh_buff_desc(sizeof(app_mesh_buffer_t),             D3D11_BIND_CONSTANT_BUFFER, D3D11_USAGE_IMMUTABLE);
+		result =
+			SUCCEEDED(d3d_device->CreateBuffer(&vert_buff_desc, &vert_buff_data, &loader->vertex_buffer)) &&
+			SUCCEEDED(d3d_device->CreateBuffer(&ind_buff_desc,  &ind_buff_data,  &loader->index_buffer )) &&
+			SUCCEEDED(d3d_device->CreateBuffer(&mesh_buff_desc, &mesh_buff_data, &loader->mesh_buffer  ));
+	}
+	loader->ind_count = file.ind_count;
+	loader->bytes     = file.size;
+	mesh_file_unmap(file);
+
+	if (!result) {
+		if (loader->vertex_buffer) { loader->vertex_buffer->Release(); loader->vertex_buffer = nullptr; }
+		if (loader->index_buffer ) { loader->index_buffer ->Release(); loader->index_buffer  = nullptr; }
+		if (loader->mesh_buffer  ) { loader->mesh_buffer  ->Release(); loader->mesh_buffer   = nullptr; }
+	}
+	loader->load_ms = chrono::duration<double, milli>(chrono::high_resolution_clock::now() - start).count();
+	loader->state.store(result ? mesh_load_ready : mesh_load_failed);
+}
+
+///////////////////////////////////////////
+
+bool mesh_load_poll(mesh_loader_t &loader) {
+	// This is called every frame, so it's just an atomic load until the
+	// loader is done. By then the thread has finished, so joining it
+	// doesn't wait.
+	int32_t state = loader.state.load();
+	if (state == mesh_load_idle || state == mesh_load_loading)
+		return false;
+
+	loader.worker.join();
+	loader.state.store(mesh_load_idle);
+	if (state == mesh_load_failed) {
+		printf("Warning: couldn't load mesh file '%s'\n", loader.filename);
+		return false;
+	}
+	return true;
+}
+
+///////////////////////////////////////////
+
+void mesh_load_stop(mesh_loader_t &loader) {
+	// Wait out any load in progress, and drop anything it made that never
+	// got picked up.
+	if (loader.worker.joinable())
+		loader.worker.join();
+	if (loader.vertex_buffer) { loader.vertex_buffer->Release(); loader.vertex_buffer = nullptr; }
+	if (loader.index_buffer ) { loader.index_buffer ->Release(); loader.index_buffer  = nullptr; }
+	if (loader.mesh_buffer  ) { loader.mesh_buffer  ->Release(); loader.mesh_buffer   = nullptr; }
+	loader.state.store(mesh_load_idle);
+}
+
+///////////////////////////////////////////
+// Input history code                    //
+///////////////////////////////////////////
+
+void input_history_add(input_history_t &history, XrTime time, const XrPosef &pose, XrSpaceLocationFlags flags) {
+	// Only poses we can trust go in, so anything we read back out is
+	// something the runtime actually saw. Time also has to keep moving
+	// forward, or we couldn't binary search it.
+	if ((flags & XR_SPACE_LOCATION_POSITION_VALID_BIT   ) == 0 ||
+		(flags & XR_SPACE_LOCATION_ORIENTATION_VALID_BIT) == 0)
+		return;
+	uint64_t head = history.sample_head.load(memory_order_relaxed);
+	if (head > 0 && history.samples[(head - 1) % input_history_size].time >= time)
+		return;
+	history.samples[head % input_history_size] = { time, pose, flags };
+	history.sample_head.store(head + 1, memory_order_release);
+}
+
+///////////////////////////////////////////
+
+void input_history_event(input_history_t &history, XrTime time, int32_t action, XrBool32 pressed) {
+	uint64_t head = history.event_head.load(memory_order_relaxed);
+	history.events[head % input_history_events] = { time, action, pressed };
+	history.event_head.store(head + 1, memory_order_release);
+}
+
+///////////////////////////////////////////
+
+uint32_t input_history_events_since(const input_history_t &history, XrTime since, input_event_t *out_events, uint32_t capacity) {
+	// Walk backwards from the newest until we're at or before 'since', then
+	// hand them back oldest first.
+	for (int32_t attempt = 0; attempt < 4; attempt++) {
+		uint64_t head  = history.event_head.load(memory_order_acquire);
+		uint64_t first = head > input_history_events - input_history_margin ? head - (input_history_events - input_history_margin) : 0;
+		uint64_t start = head;
+		while (start > first && head - start < capacity && history.events[(start - 1) % input_history_events].time > since)
+			start--;
+		for (uint64_t i = start; i < head; i++)
+			out_events[i - start] = history.events[i % input_history_events];
+
+		atomic_thread_fence(memory_order_acquire);
+		if (history.event_head.load(memory_order_relaxed) < first + input_history_events)
+			return (uint32_t)(head - start);
+	}
+	return 0;
+}
+
+///////////////////////////////////////////
+
+bool input_history_velocity(const input_history_t &history, XrVector3f *out_linear, XrVector3f *out_angular) {
+	// Measuring across a couple of samples would amplify their noise, so
+	// we go back far enough that the motion dwarfs it.
+	for (int32_t attempt = 0; attempt < 4; attempt++) {
+		uint64_t head  = history.sample_head.load(memory_order_acquire);
+		uint64_t first = head > input_history_size - input_history_margin ? head - (input_history_size - input_history_margin) : 0;
+		if (head - first < 2)
+			return false;
+		input_sample_t newest = history.samples[(head - 1) % input_history_size];
+		uint64_t       older  = head - 2;
+		while (older > first && newest.time - history.samples[older % input_history_size].time < input_velocity_window)
+			older--;
+		input_sample_t oldest = history.samples[older % input_history_size];
+
+		atomic_thread_fence(memory_order_acquire);
+		if (history.sample_head.load(memory_order_relaxed) >= first + input_history_size)
+			continue;
+
+		float dt = (newest.time - oldest.time) / 1000000000.0f;
+		if (dt <= 0)
+			return false;
+		// Angular velocity is the rotation that takes us from the older
+		// orientation to the newer one, per second.
+		const XrQuaternionf &q0  = oldest.pose.orientation;
+		XrQuaternionf        inv = { -q0.x, -q0.y, -q0.z, q0.w };
+		XrVector3f           rot = math_quat_to_rotation(math_quat_mul(newest.pose.orientation, inv));
+		*out_linear  = {
+			(newest.pose.position.x - oldest.pose.position.x) / dt,
+			(newest.pose.position.y - oldest.pose.position.y) / dt,
+			(newest.pose.position.z - oldest.pose.position.z) / dt };
+		*out_angular = { rot.x / dt, rot.y / dt, rot.z / dt };
+		return true;
+	}
+	return false;
+}
+
+///////////////////////////////////////////
+
+bool input_history_pose(const input_history_t &history, XrTime time, XrPosef *out_pose) {
+	for (int32_t attempt = 0; attempt < 4; attempt++) {
+		uint64_t head  = history.sample_head.load(memory_order_acquire);
+		uint64_t first = head > input_history_size - input_history_margin ? head - (input_history_size - input_history_margin) : 0;
+		if (head == first)
+			return false;
+
+		// Find the first sample after 'time'. Samples are in time order, so
+		// this is a binary search.
+		uint64_t lo = first, hi = head;
+		while (lo < hi) {
+			uint64_t mid = lo + (hi - lo) / 2;
+			if (history.samples[mid % input_history_size].time <= time) lo = mid + 1;
+			else                                                         hi = mid;
+		}
+		bool           after = lo == head;
+		input_sample_t a     = {}, b = {};
+		if (lo > first) {
+			a = history.samples[(lo - 1) % input_history_size];
+			b = history.samples[(after ? lo - 1 : lo) % input_history_size];
+		}
+
+		atomic_thread_fence(memory_order_acquire);
+		if (history.sample_head.load(memory_order_relaxed) >= first + input_history_size)
+			continue;
+
+		// Older than anything we still have, we can't say where it was
+		if (lo == first)
+			return false;
+
+		if (after) {
+			// Past the newest sample, so carry on the way it was moving, but
+			// only for so long before it's more guess than pose.
+			XrDuration ahead = time - a.time;
+			if (ahead > input_extrapolate_max)
+				return false;
+			XrVector3f linear, angular;
+			if (!input_history_velocity(history, &linear, &angular)) {
+				*out_pose = a.pose;
+				return true;
+			}
+			float dt = ahead / 1000000000.0f;
+			out_pose->position = {
+				a.pose.position.x + linear.x * dt,
+				a.pose.position.y + linear.y * dt,
+				a.pose.position.z + linear.z * dt };
+			out_pose->orientation = math_quat_mul(math_quat_from_rotation({ angular.x * dt, angular.y * dt, angular.z * dt }), a.pose.orientation);
+			return true;
+		}
+
+		// Between two samples, so blend them
+		float t = a.time == b.time ? 0 : (float)(time - a.time) / (float)(b.time - a.time);
+		out_pose->position = {
+			a.pose.position.x + (b.pose.position.x - a.pose.position.x) * t,
+			a.pose.position.y + (b.pose.position.y - a.pose.position.y) * t,
+			a.pose.position.z + (b.pose.position.z - a.pose.position.z) * t };
+		out_pose->orientation = math_quat_slerp(a.pose.orientation, b.pose.orientation, t);
+		return true;
+	}
+	return false;
+}
+
+///////////////////////////////////////////
+// Upload ring code                      //
+///////////////////////////////////////////
+
+void upload_ring_init(upload_ring_t &ring, uint64_t size, uint64_t align) {
+	// Every allocation starts on an aligned offset, so the size has to be
+	// a whole number of those too, or the wrap point would be misaligned.
+	ring       = {};
+	ring.align = max(align, (uint64_t)1);
+	ring.size  = size - size % ring.align;
+}
+
+///////////////////////////////////////////
+
+bool upload_ring_alloc(upload_ring_t &ring, uint64_t bytes, uint64_t *out_offset) {
+	// Allocations never straddle the end of the buffer. If one won't fit
+	// before the end, the rest of the lap is wasted, and it goes at the
+	// start of the next lap instead.
+	if (ring.size == 0 || bytes > ring.size) {
+		ring.full += 1;
+		return false;
+	}
+	uint64_t start = (ring.head + ring.align - 1) / ring.align * ring.align;
+	if (start % ring.size + bytes > ring.size)
+		start = (start / ring.size + 1) * ring.size;
+
+	// Anything past the tail might still be on its way to the GPU, so we
+	// can only go as far as one lap ahead of it. With nothing in use at
+	// all, the space we just skipped doesn't hold anything either.
+	if (ring.tail == ring.head)
+		ring.tail = start;
+	if (start + bytes - ring.tail > ring.size) {
+		ring.full += 1;
+		return false;
+	}
+	if (ring.head > 0 && start / ring.size > (ring.head - 1) / ring.size)
+		ring.wraps += 1;
+	ring.head   = start + bytes;
+	*out_offset = start % ring.size;
+	return true;
+}
+
+///////////////////////////////////////////
+
+void upload_ring_end(upload_ring_t &ring, uint64_t frame_id) {
+	// If too many frames are already waiting, this one shares the newest
+	// one's entry. That frame's space just gets freed a little later.
+	uint32_t slot;
+	if (ring.frame_count < upload_ring_frames) {
+		slot = (ring.frame_first + ring.frame_count) % upload_ring_frames;
+		ring.frame_count += 1;
+	} else {
+		slot = (ring.frame_first + ring.frame_count - 1) % upload_ring_frames;
+	}
+	ring.frame_ids [slot] = frame_id;
+	ring.frame_ends[slot] = ring.head;
+	ring.frame_start      = ring.head;
+}
+
+///////////////////////////////////////////
+
+void upload_ring_retire(upload_ring_t &ring, uint64_t done_before) {
+	// Frames finish in order, so we only ever need to look at the oldest
+	while (ring.frame_count > 0 && ring.frame_ids[ring.frame_first] < done_before) {
+		ring.tail         = ring.frame_ends[ring.frame_first];
+		ring.frame_first  = (ring.frame_first + 1) % upload_ring_frames;
+		ring.frame_count -= 1;
+	}
+}
+
+///////////////////////////////////////////
+
+void upload_ring_reset(upload_ring_t &ring) {
+	// For when the buffer behind the ring gets swapped for a fresh one, so
+	// no earlier frame can be reading it. The frame we're filling now
+	// still keeps its space.
+	ring.tail        = ring.frame_start;
+	ring.frame_count = 0;
+	ring.resets     += 1;
+}
+
+///////////////////////////////////////////
+// Latency code                          //
+///////////////////////////////////////////
+
+void latency_add(latency_hist_t &hist, float ms) {
+	ms = max(ms, 0.0f);
+	uint32_t bucket = (uint32_t)min(ms / latency_bucket_ms, (float)(latency_buckets - 1));
+	hist.buckets[bucket] += 1;
+	hist.min_ms    = hist.count == 0 ? ms : min(hist.min_ms, ms);
+	hist.max_ms    = hist.count == 0 ? ms : max(hist.max_ms, ms);
+	hist.count    += 1;
+	hist.total_ms += ms;
+}
+
+///////////////////////////////////////////
+
+float latency_percentile(const latency_hist_t &hist, float percent) {
+	// Find the bucket the percentile lands in, and give back its top edge.
+	// The real min and max are tighter than a bucket, so we clamp to those,
+	// which makes it exact whenever every sample is the same.
+	if (hist.count == 0)
+		return 0;
+	uint32_t rank = max((uint32_t)ceilf(hist.count * percent / 100.0f), (uint32_t)1);
+	uint32_t seen = 0;
+	for (uint32_t i = 0; i < latency_buckets; i++) {
+		seen += hist.buckets[i];
+		if (seen >= rank)
+			return max(hist.min_ms, min(hist.max_ms, (i + 1) * latency_bucket_ms));
+	}
+	return hist.max_ms;
+}
+
+///////////////////////////////////////////
+
+void latency_print(const latency_hist_t &hist, const char *name) {
+	if (hist.count == 0) {
+		printf("%s: no samples\n", name);
+		return;
+	}
+	printf("%s: %u samples, min %.1fms, mean %.1fms, p50 %.1fms, p90 %.1fms, p99 %.1fms, max %.1fms\n",
+		name, hist.count, hist.min_ms, hist.total_ms / hist.count,
+		latency_percentile(hist, 50), latency_percentile(hist, 90), latency_percentile(hist, 99), hist.max_ms);
+
+	// And the histogram itself, skipping the empty buckets
+	uint32_t most = 0;
+	for (uint32_t i = 0; i < latency_buckets; i++)
+		most = max(most, hist.buckets[i]);
+	for (uint32_t i = 0; i < latency_buckets; i++) {
+		if (hist.buckets[i] == 0)
+			continue;
+		char     bar[41] = {};
+		uint32_t width   = max((uint32_t)1, hist.buckets[i] * 40 / most);
+		memset(bar, '#', width);
+		if (i == latency_buckets - 1) printf("  %5.1fms+      |%-40s %u\n", i * latency_bucket_ms, bar, hist.buckets[i]);
+		else                          printf("  %5.1f-%5.1fms |%-40s %u\n", i * latency_bucket_ms, (i + 1) * latency_bucket_ms, bar, hist.buckets[i]);
+	}
+}
+
+///////////////////////////////////////////
+
+int32_t latency_check(const latency_hist_t &hist, float budget_ms) {
+	if (hist.count == 0)
+		return latency_no_samples;
+	return latency_percentile(hist, 99) <= budget_ms ? latency_within : latency_over;
+}
+
+///////////////////////////////////////////
+// Session recording code                //
+///////////////////////////////////////////
+
+bool session_record_open(session_recorder_t &recorder, const char *filename, uint32_t view_count, uint32_t action_count) {
+	recorder.active  = false;
+	recorder.quit    = false;
+	recorder.records = 0;
+	recorder.stalls  = 0;
+	recorder.frame   = 0;
+	recorder.bytes   = 0;
+	recorder.failed  = false;
+
+	// The file gets opened here rather than on the writer thread, so we
+	// know right away if there's going to be a recording or not.
+	session_file_header_t header = { session_file_magic, session_file_version, view_count, action_count };
+	recorder.fp = nullptr;
+	if (fopen_s(&recorder.fp, filename, "wb") != 0 || fwrite(&header, sizeof(header), 1, recorder.fp) != 1) {
+		printf("Warning: couldn't start session recording '%s'\n", filename);
+		if (recorder.fp != nullptr) fclose(recorder.fp);
+		recorder.fp = nullptr;
+		return false;
+	}
+
+	// Both halves of the double buffer are allocated up front, so adding
+	// a record never touches the heap. The first sync records every
+	// action, since there's nothing to compare against yet.
+	recorder.capacity = max((size_t)app_config_record_buffer_kb * 1024, (size_t)4096);
+	recorder.pending.clear();
+	recorder.pending.reserve(recorder.capacity);
+	recorder.last_actions.assign((size_t)action_count * xr_actions.subactions.size(), session_action_t{ UINT64_MAX });
+	recorder.worker = thread(session_record_run, &recorder);
+	recorder.active = true;
+	return true;
+}
+
+///////////////////////////////////////////
+
+void session_record_close(session_recorder_t &recorder) {
+	// The writer gets everything pending out to disk before it stops
+	if (!recorder.active)
+		return;
+	{
+		lock_guard<mutex> lock(recorder.lock);
+		recorder.quit = true;
+	}
+	recorder.wake.notify_one();
+	recorder.worker.join();
+	recorder.active = false;
+
+	if (recorder.failed)
+		printf("Warning: couldn't write all of the session recording\n");
+	printf("Recording: %llu frames, %llu records, %.1fKB, %llu stalls waiting on the disk\n",
+		(unsigned long long)recorder.frame, (unsigned long long)recorder.records, recorder.bytes / 1024.0, (unsigned long long)recorder.stalls);
+}
+
+///////////////////////////////////////////
+
+void session_record_run(session_recorder_t *recorder) {
+	vector<uint8_t> batch;
+	batch.reserve(recorder->capacity);
+	bool quit = false;
+	while (!quit) {
+		// Records trickle in every frame, so rather than waking up for
+		// each one, we wait until there's a good amount, or a little time
+		// has passed.
+		{
+			unique_lock<mutex> lock(recorder->lock);
+			recorder->wake.wait_for(lock, chrono::milliseconds(app_config_record_flush_ms), [recorder]() {
+				return recorder->quit || recorder->pending.size() >= recorder->capacity / 2; });
+			swap(batch, recorder->pending);
+			quit = recorder->quit;
+		}
+		recorder->room.notify_all();
+		if (batch.empty())
+			continue;
+
+		if (!recorder->failed && fwrite(batch.data(), 1, batch.size(), recorder->fp) != batch.size())
+			recorder->failed = true;
+		recorder->bytes += batch.size();
+		batch.clear();
+	}
+	if (fclose(recorder->fp) != 0)
+		recorder->failed = true;
+	recorder->fp = nullptr;
+}
+
+///////////////////////////////////////////
+
+void session_record_append(session_recorder_t &recorder, uint32_t type, const void *data, size_t size, const void *extra, size_t extra_size) {
+	session_record_t header = { type, (uint32_t)(size + extra_size) };
+	size_t           total  = sizeof(header) + header.size;
+	bool             wake   = false;
+	{
+		unique_lock<mutex> lock(recorder.lock);
+		// If the writer can't keep up, we wait for it. Dropping records
+		// instead would keep the frame rate up, but then the replay
+		// wouldn't match the session, and it'd be useless as a benchmark.
+		if (recorder.pending.size() + total > recorder.capacity && !recorder.pending.empty()) {
+			recorder.stalls += 1;
+			recorder.wake.notify_one();
+			recorder.room.wait(lock, [&recorder, total]() {
+				return recorder.pending.size() + total <= recorder.capacity || recorder.pending.empty(); });
+		}
+		const uint8_t *bytes = (const uint8_t *)&header;
+		recorder.pending.insert(recorder.pending.end(), bytes, bytes + sizeof(header));
+		recorder.pending.insert(recorder.pending.end(), (const uint8_t *)data, (const uint8_t *)data + size);
+		if (extra_size > 0)
+			recorder.pending.insert(recorder.pending.end(), (const uint8_t *)extra, (const uint8_t *)extra + extra_size);
+		recorder.records += 1;
+		wake = recorder.pending.size() >= recorder.capacity / 2 && recorder.pending.size() - total < recorder.capacity / 2;
+	}
+	if (wake)
+		recorder.wake.notify_one();
+}
+
+///////////////////////////////////////////
+
+void session_record_frame(session_recorder_t &recorder, const XrFrameState &state) {
+	if (!recorder.active)
+		return;
+	session_frame_t frame = {};
+	frame.display_time  = state.predictedDisplayTime;
+	frame.period        = state.predictedDisplayPeriod;
+	frame.waited_at     = openxr_time_now();
+	frame.should_render = state.shouldRender;
+	session_record_append(recorder, session_type_frame, &frame, sizeof(frame), nullptr, 0);
+	recorder.frame += 1;
+}
+
+///////////////////////////////////////////
+
+void session_record_event(session_recorder_t &recorder, const XrEventDataBuffer &event) {
+	// Events can be big, but the only parts of them we use are small
+	if (!recorder.active)
+		return;
+	session_event_t record = { recorder.frame, event.type, XR_SESSION_STATE_UNKNOWN, 0 };
+	if (event.type == XR_TYPE_EVENT_DATA_SESSION_STATE_CHANGED) {
+		const XrEventDataSessionStateChanged *changed = (const XrEventDataSessionStateChanged *)&event;
+		record.state = changed->state;
+		record.time  = changed->time;
+	}
+	session_record_append(recorder, session_type_event, &record, sizeof(record), nullptr, 0);
+}
+
+///////////////////////////////////////////
+
+void session_record_action(session_recorder_t &recorder, uint32_t action, uint32_t subaction) {
+	// Most actions sit still most of the time, so we only record one when
+	// it's different from the last time we recorded it.
+	if (!recorder.active)
+		return;
+	uint32_t         slot  = openxr_action_slot(action, subaction);
+	session_action_t state = { recorder.frame, (uint16_t)action, (uint16_t)subaction,
+		xr_actions.active[slot], xr_actions.current[slot], xr_actions.changed[slot], xr_actions.value[slot], 0, xr_actions.changed_at[slot] };
+	session_action_t &last = recorder.last_actions[slot];
+	if (last.frame != UINT64_MAX &&
+		last.active  == state.active  && last.current == state.current && last.changed    == state.changed &&
+		last.value   == state.value   && last.changed_at == state.changed_at)
+		return;
+	last = state;
+	session_record_append(recorder, session_type_action, &state, sizeof(state), nullptr, 0);
+}
+
+///////////////////////////////////////////
+
+void session_record_locates(session_recorder_t &recorder, XrTime time, const XrSpace *spaces, uint32_t count, const XrPosef *poses, const XrSpaceLocationFlags *flags) {
+	// Only the hands are worth keeping, everything else is located
+	// relative to itself. This gets called from the render and sampler
+	// threads too, but the action spaces don't change once they're made.
+	if (!recorder.active)
+		return;
+	for (uint32_t i = 0; i < count; i++) {
+		for (uint32_t hand = 0; hand < 2; hand++) {
+			if (spaces[i] != xr_actions.spaces[xr_actions.space_index[openxr_action_slot(xr_action_hand_pose, hand)]])
+				continue;
+			session_locate_t record = { time, poses[i], hand, flags[i] };
+			session_record_append(recorder, session_type_locate, &record, sizeof(record), nullptr, 0);
+		}
+	}
+}
+
+///////////////////////////////////////////
+
+void session_record_views(session_recorder_t &recorder, XrTime display_time, const XrViewState &state, const XrView *views, uint32_t count) {
+	if (!recorder.active)
+		return;
+	session_view_t  poses[session_view_max];
+	session_views_t record = { display_time, state.viewStateFlags, min(count, session_view_max) };
+	for (uint32_t i = 0; i < record.count; i++)
+		poses[i] = { views[i].pose, views[i].fov };
+	session_record_append(recorder, session_type_views, &record, sizeof(record), poses, record.count * sizeof(session_view_t));
+}
+
+///////////////////////////////////////////
+// Resolution governor code              //
+///////////////////////////////////////////
+
+void res_governor_init(res_governor_t &gov, float scale_min, float scale_max) {
+	gov = {};
+	gov.scale_min = min(scale_min, scale_max);
+	gov.scale_max = scale_max;
+	gov.scale     = max(gov.scale_min, min(1.0f, scale_max));
+}
+
+///////////////////////////////////////////
+
+float res_governor_update(res_governor_t &gov, float render_ms, float period_ms) {
+	if (period_ms <= 0)
+		return gov.scale;
+
+	// Smooth out the render times, so one odd frame doesn't send the
+	// resolution bouncing around. A frame that's late enough to miss its
+	// display is different though, we need to react to that right away!
+	gov.smoothed_ms = gov.samples == 0 || render_ms > period_ms
+		? render_ms
+		: gov.smoothed_ms + (render_ms - gov.smoothed_ms) * 0.2f;
+	gov.samples += 1;
+
+	// Rendering cost goes with the number of pixels, which is the square of
+	// the scale. So this is the scale that would land right on target.
+	float load = gov.smoothed_ms / (period_ms * res_governor_target);
+	if (load <= 0)
+		return gov.scale;
+	float ideal = gov.scale / sqrtf(load);
+
+	// Drop quickly when we're over, and all at once if we're actually
+	// missing frames. Climb back slowly, and only once we're well under, so
+	// we don't end up bouncing between two resolutions.
+	if (render_ms > period_ms)
+		gov.scale = ideal;
+	else if (load > 1)
+		gov.scale += (ideal - gov.scale) * 0.5f;
+	else if (load < 1 - res_governor_band)
+		gov.scale += min((ideal - gov.scale) * 0.1f, 0.02f);
+	gov.scale = max(gov.scale_min, min(gov.scale_max, gov.scale));
+	return gov.scale;
+}
+
+///////////////////////////////////////////
+// Profiling code                        //
+///////////////////////////////////////////
+
+struct prof_phase_t {
+	const char   *name;
+	vector<float> ms;
+};
+
+vector<prof_ring_t*>         prof_rings;
+mutex                        prof_rings_lock;
+thread_local prof_ring_t    *prof_thread_ring = nullptr;
+prof_frame_t                 prof_frames[256];
+atomic<uint64_t>             prof_frames_head;
+uint64_t                     prof_frames_tail;
+atomic<uint64_t>             prof_frame_id;
+thread_local uint64_t        prof_thread_frame = 0; // The frame this thread is working on
+uint64_t                     prof_window_start;
+vector<prof_phase_t>         prof_phases;
+FILE                        *prof_trace   = nullptr;
+FILE                        *prof_summary = nullptr;
+chrono::steady_clock::time_point prof_start;
+
+///////////////////////////////////////////
+
+prof_scope_t::prof_scope_t(const char *name) : name(name), start_ns(prof_enabled ? prof_now() : 0) {}
+prof_scope_t::~prof_scope_t() {
+	if (prof_enabled)
+		prof_record(name, start_ns, prof_now());
+}
+
+///////////////////////////////////////////
+
+void prof_init() {
+	prof_start = chrono::steady_clock::now();
+	if (fopen_s(&prof_trace,   prof_trace_file,   "w") != 0) prof_trace   = nullptr;
+	if (fopen_s(&prof_summary, prof_summary_file, "w") != 0) prof_summary = nullptr;
+	if (prof_trace  ) fprintf(prof_trace,   "{\"traceEvents\":[\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"OpenXR sample\"}}");
+	if (prof_summary) fprintf(prof_summary, "last_frame,phase,count,p50_ms,p95_ms,p99_ms\n");
+	prof_enabled = true;
+}
+
+///////////////////////////////////////////
+
+void prof_shutdown() {
+	if (!prof_enabled)
+		return;
+	prof_flush();
+	prof_summarize(prof_frame_id.load(memory_order_relaxed));
+	prof_enabled = false;
+	if (prof_trace) {
+		fprintf(prof_trace, "\n]}\n");
+		fclose(prof_trace);
+	}
+	if (prof_summary) fclose(prof_summary);
+
+	// Nobody should be recording anymore, so it's safe to free the rings
+	lock_guard<mutex> lock(prof_rings_lock);
+	for (size_t i = 0; i < prof_rings.size(); i++)
+		delete prof_rings[i];
+	prof_rings.clear();
+}
+
+///////////////////////////////////////////
+
+uint64_t prof_now() {
+	return (uint64_t)chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - prof_start).count();
+}
+
+///////////////////////////////////////////
+
+void prof_record(const char *name, uint64_t start_ns, uint64_t end_ns) {
+	// The first time a thread records something, it gets its own ring.
+	// This is the only time recording allocates or locks.
+	if (prof_thread_ring == nullptr) {
+		prof_thread_ring = new prof_ring_t();
+		lock_guard<mutex> lock(prof_rings_lock);
+		prof_thread_ring->thread_id = (uint32_t)prof_rings.size() + 1;
+		prof_rings.push_back(prof_thread_ring);
+	}
+
+	// Write the event first, and only then publish it by moving the head.
+	prof_ring_t *ring = prof_thread_ring;
+	uint64_t     head = ring->head.load(memory_order_relaxed);
+	ring->events[head % prof_ring_size] = { name, start_ns, end_ns, prof_thread_frame };
+	ring->head.store(head + 1, memory_order_release);
+}
+
+///////////////////////////////////////////
+
+void prof_frame_begin() {
+	// Everything this thread records from here on counts towards the next
+	// frame.
+	prof_thread_frame = prof_frame_id.fetch_add(1, memory_order_relaxed) + 1;
+}
+
+///////////////////////////////////////////
+
+void prof_frame_set(uint64_t frame) {
+	// For threads that pick up a frame partway through, like the render
+	// thread when the frame loop is pipelined.
+	prof_thread_frame = frame;
+}
+
+///////////////////////////////////////////
+
+uint64_t prof_frame_info(XrTime predicted_time, XrBool32 should_render) {
+	if (!prof_enabled)
+		return prof_thread_frame;
+	uint64_t head = prof_frames_head.load(memory_order_relaxed);
+	prof_frames[head % _countof(prof_frames)] = { prof_thread_frame, prof_now(), predicted_time, should_render };
+	prof_frames_head.store(head + 1, memory_order_release);
+	return prof_thread_frame;
+}
+
+///////////////////////////////////////////
+
+void prof_summarize(uint64_t last_frame) {
+	// Sort each phase's times, and pick out the percentiles
+	for (size_t p = 0; p < prof_phases.size(); p++) {
+		vector<float> &ms = prof_phases[p].ms;
+		if (ms.empty())
+			continue;
+		sort(ms.begin(), ms.end());
+		auto percentile = [&ms](float pct) { return ms[min(ms.size() - 1, (size_t)(pct * ms.size()))]; };
+		if (prof_summary)
+			fprintf(prof_summary, "%llu,%s,%zu,%.4f,%.4f,%.4f\n", (unsigned long long)last_frame, prof_phases[p].name, ms.size(), percentile(0.5f), percentile(0.95f), percentile(0.99f));
+		ms.clear();
+	}
+	if (prof_summary) fflush(prof_summary);
+}
+
+///////////////////////////////////////////
+
+void prof_flush() {
+	if (!prof_enabled)
+		return;
+
+	// Frame markers go in the trace as instant events, with the runtime's
+	// prediction attached.
+	uint64_t frames_head = prof_frames_head.load(memory_order_acquire);
+	if (frames_head - prof_frames_tail > _countof(prof_frames))
+		prof_frames_tail = frames_head - _countof(prof_frames);
+	for (; prof_frames_tail < frames_head; prof_frames_tail++) {
+		const prof_frame_t &f = prof_frames[prof_frames_tail % _countof(prof_frames)];
+		if (prof_trace)
+			fprintf(prof_trace, ",\n{\"name\":\"frame\",\"ph\":\"i\",\"s\":\"g\",\"pid\":1,\"tid\":0,\"ts\":%.3f,\"args\":{\"frame\":%llu,\"predictedDisplayTime\":%lld,\"shouldRender\":%d}}",
+				f.time_ns / 1000.0, (unsigned long long)f.frame, (long long)f.predicted_time, (int)f.should_render);
+	}
+
+	lock_guard<mutex> lock(prof_rings_lock);
+	for (size_t r = 0; r < prof_rings.size(); r++) {
+		prof_ring_t *ring = prof_rings[r];
+		uint64_t     head = ring->head.load(memory_order_acquire);
+		if (head - ring->tail > prof_ring_size)
+			ring->tail = head - prof_ring_size;
+
+		for (; ring->tail < head; ring->tail++) {
+			prof_event_t ev = ring->events[ring->tail % prof_ring_size];
+
+			// If the owning thread lapped us while we were copying, this
+			// event may be half overwritten, so skip it.
+			if (ring->head.load(memory_order_acquire) - ring->tail > prof_ring_size)
+				continue;
+
+			if (prof_trace)
+				fprintf(prof_trace, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"frame\":%llu}}",
+					ev.name, ring->thread_id, ev.start_ns / 1000.0, (ev.end_ns - ev.start_ns) / 1000.0, (unsigned long long)ev.frame);
+
+			size_t p = 0;
+			while (p < prof_phases.size() && prof_phases[p].name != ev.name) p++;
+			if (p == prof_phases.size()) prof_phases.push_back({ ev.name });
+			prof_phases[p].ms.push_back((ev.end_ns - ev.start_ns) / 1000000.0f);
+		}
+	}
+
+	// Once we've seen enough frames, add another row to the summary
+	uint64_t frame = prof_frame_id.load(memory_order_relaxed);
+	if (frame - prof_window_start >= prof_window) {
+		prof_summarize(frame);
+		prof_window_start = frame;
+	}
+}
+
+///////////////////////////////////////////
+// App                                   //
+///////////////////////////////////////////
+
+void app_init() {
+	// Put back all the cubes placed in earlier sessions
+	if (app_config_journal) {
+		auto start = chrono::high_resolution_clock::now();
+		cube_journal_open(app_journal, cube_snapshot_file, cube_journal_file, app_cubes, app_cube_index);
+		if (app_cubes.count > 0)
+			printf("journal: restored %zu cubes in %.3fms\n", app_cubes.count, chrono::duration<double, milli>(chrono::high_resolution_clock::now() - start).count());
+	}
+
+	// Fill the scene up with a grid of cubes in front of the user, if we want
+	// to see how rendering holds up with lots of them!
+	if (app_config_bench_cubes > 0) {
+		int32_t side = (int32_t)ceilf(sqrtf((float)app_config_bench_cubes));
+		for (int32_t i = 0; i < (int32_t)app_config_bench_cubes; i++) {
+			XrPosef pose = xr_pose_identity;
+			pose.position = { (i % side - side/2) * 0.15f, (i / side - side/2) * 0.15f, -2 };
+			spatial_insert(app_cube_index, cube_store_add(app_cubes, pose), pose.position, app_cube_radius);
+		}
+	}
+
+	// Without a graphics device, we're running headless, and there's
+	// nothing to set up on the GPU.
+	if (d3d_device == nullptr)
+		return;
+
+	// Compile our shader code, and turn it into a shader resource! Single pass
+	// stereo needs a slightly different shader, so we use a define for that.
+	// Compiled shaders are kept in a cache file between runs, since compiling
+	// them is the slowest part of starting up.
+	D3D_SHADER_MACRO defines[] = {
+		{ xr_single_pass ? "SINGLE_PASS" : nullptr, "1" },
+		{ nullptr, nullptr } };
+	auto           shader_start = chrono::high_resolution_clock::now();
+	shader_cache_t cache        = {};
+	const uint8_t *vert_shader, *pixel_shader;
+	size_t         vert_shader_size, pixel_shader_size;
+	if (app_config_shader_cache)
+		shader_cache_open(cache, shader_cache_file);
+	if (!shader_cache_get(cache, d3d_shader_compiler, app_shader_code, "vs", "vs_5_0", defines, &vert_shader,  &vert_shader_size) ||
+		!shader_cache_get(cache, d3d_shader_compiler, app_shader_code, "ps", "ps_5_0", defines, &pixel_shader, &pixel_shader_size)) {
+		if (app_config_shader_cache)
+			shader_cache_close(cache, shader_cache_file);
+		return;
+	}
+	d3d_device->CreateVertexShader(vert_shader,  vert_shader_size,  nullptr, &app_vshader);
+	d3d_device->CreatePixelShader (pixel_shader, pixel_shader_size, nullptr, &app_pshader);
+
+	// Describe how our mesh is laid out in memory. Slot 0 is the mesh itself,
+	// and slot 1 is the instance buffer, which provides the id of the world
+	// matrix to use for each cube. With single pass stereo, each cube is
+	// drawn as two instances (one per eye), so the instance data should only
+	// step forward every other instance. The mesh's vertices are a
+	// mesh_vert_t, which is four 16 bit values.
+	UINT step = xr_single_pass ? 2 : 1;
+	D3D11_INPUT_ELEMENT_DESC vert_desc[] = {
+		{"SV_POSITION", 0, DXGI_FORMAT_R16G16B16A16_UNORM, 0, D3D11_APPEND_ALIGNED_ELEMENT, D3D11_INPUT_PER_VERTEX_DATA,   0},
+		{"CUBE_ID",     0, DXGI_FORMAT_R32_UINT,           1, D3D11_APPEND_ALIGNED_ELEMENT, D3D11_INPUT_PER_INSTANCE_DATA, step}, };
+	d3d_device->CreateInputLayout(vert_desc, (UINT)_countof(vert_desc), vert_shader, vert_shader_size, &app_shader_layout);
+
+	// The bytecode isn't needed anymore once the shaders are made. Closing
+	// the cache saves anything we had to compile, for next time.
+	uint32_t hits = cache.hits, misses = cache.misses;
+	if (app_config_shader_cache)
+		shader_cache_close(cache, shader_cache_file);
+	printf("shaders: %.3fms, %u from cache, %u compiled\n",
+		chrono::duration<double, milli>(chrono::high_resolution_clock::now() - shader_start).count(), hits, misses);
+
+	// Optimize and pack our mesh, and create GPU resources for its vertices and indices! Constant buffers
+	// are for passing transform matrices into the shaders, so make a buffer for them too! The mesh gets
+	// one as well, with the bounds its positions are packed into.
+	mesh_build(app_verts, _countof(app_verts) / 6, app_inds, _countof(app_inds), app_mesh);
+	app_mesh_buffer_t mesh_buffer = {
+		{ app_mesh.bounds_min .x, app_mesh.bounds_min .y, app_mesh.bounds_min .z, 0 },
+		{ app_mesh.bounds_size.x, app_mesh.bounds_size.y, app_mesh.bounds_size.z, 0 } };
+	D3D11_SUBRESOURCE_DATA vert_buff_data = { app_mesh.verts.data() };
+	D3D11_SUBRESOURCE_DATA ind_buff_data  = { app_mesh.inds.data() };
+	D3D11_SUBRESOURCE_DATA mesh_buff_data = { &mesh_buffer };
+	CD3D11_BUFFER_DESC     vert_buff_desc (sizeof(mesh_vert_t) * (UINT)app_mesh.verts.size(), D3D11_BIND_VERTEX_BUFFER);
+	CD3D11_BUFFER_DESC     ind_buff_desc  (sizeof(uint16_t)    * (UINT)app_mesh.inds .size(), D3D11_BIND_INDEX_BUFFER);
+	CD3D11_BUFFER_DESC     const_buff_desc(sizeof(app_transform_buffer_t), D3D11_BIND_CONSTANT_BUFFER);
+	CD3D11_BUFFER_DESC     mesh_buff_desc (sizeof(app_mesh_buffer_t),      D3D11_BIND_CONSTANT_BUFFER);
+	d3d_device->CreateBuffer(&vert_buff_desc, &vert_buff_data, &app_vertex_buffer);
+	d3d_device->CreateBuffer(&ind_buff_desc,  &ind_buff_data,  &app_index_buffer);
+	d3d_device->CreateBuffer(&const_buff_desc, nullptr,        &app_constant_buffer);
+	d3d_device->CreateBuffer(&mesh_buff_desc, &mesh_buff_data, &app_mesh_buffer);
+	app_index_count = (UINT)app_mesh.inds.size();
+	if (app_config_upload_ring_kb > 0)
+		d3d_ring_init(app_config_upload_ring_kb * 1024);
+
+	// Hand joints reuse the cube mesh, with their own world matrices. The
+	// joint ids never change, so that buffer is filled once, right here.
+	if (xr_hand_tracking) {
+		uint32_t joint_ids[hand_joint_max];
+		for (uint32_t i = 0; i < hand_joint_max; i++)
+			joint_ids[i] = i;
+		D3D11_SUBRESOURCE_DATA joint_id_data = { joint_ids };
+		CD3D11_BUFFER_DESC     joint_id_desc(sizeof(joint_ids), D3D11_BIND_VERTEX_BUFFER, D3D11_USAGE_IMMUTABLE);
+		CD3D11_BUFFER_DESC     joint_desc   (sizeof(app_joint_matrices), D3D11_BIND_SHADER_RESOURCE, D3D11_USAGE_DEFAULT, 0, D3D11_RESOURCE_MISC_BUFFER_STRUCTURED, sizeof(mat4_t));
+		CD3D11_SHADER_RESOURCE_VIEW_DESC joint_srv_desc(D3D11_SRV_DIMENSION_BUFFER, DXGI_FORMAT_UNKNOWN, 0, hand_joint_max);
+		d3d_device->CreateBuffer(&joint_id_desc, &joint_id_data, &app_joint_id_buffer);
+		d3d_device->CreateBuffer(&joint_desc,    nullptr,        &app_joint_buffer);
+		d3d_device->CreateShaderResourceView(app_joint_buffer, &joint_srv_desc, &app_joint_srv);
+	}
+
+	// Lots of views, each with their own swapchain, get recorded in
+	// parallel. One thread per view at most, the extra threads would just
+	// have nothing to do.
+	uint32_t view_count = (uint32_t)xr_config_views.size();
+	if (!xr_single_pass && app_config_parallel_views > 0 && view_count >= app_config_parallel_views)
+		d3d_views_init(view_count, min(view_count, max(thread::hardware_concurrency(), (uint32_t)1)));
+
+	// The built-in cube is really a placeholder, the mesh we want comes from
+	// a file, loaded in the background so a big one can't stall a frame. If
+	// there's no file yet, we write one from the built-in cube so there's
+	// something to load.
+	if (app_config_mesh_stream) {
+		FILE *fp = nullptr;
+		if (fopen_s(&fp, app_mesh_file, "rb") == 0) fclose(fp);
+		else                                        mesh_file_write(app_mesh_file, app_mesh);
+		mesh_load_start(app_mesh_loader, app_mesh_file);
+	}
+}
+
+///////////////////////////////////////////
+
+void app_draw_prepare(app_frame_t &frame) {
+	frame.stats = {};
+	frame.stats.input_calls = xr_actions.calls;
+	frame.stats.input_ms    = xr_actions.poll_ms;
+	xr_actions.calls   = 0;
+	xr_actions.poll_ms = 0;
+	frame.stats.joint_locate_ms = xr_joint_ms;
+	xr_joint_ms = 0;
+	frame.hands[0] = app_hands[0];
+	frame.hands[1] = app_hands[1];
+	frame.hands_active[0] = xr_input.renderHand[0];
+	frame.hands_active[1] = xr_input.renderHand[1];
+	frame.joints          = xr_joints;
+
+	// Pack up any cubes that have been placed since the last frame we sent
+	// off, so the render side can upload them without touching app_cubes.
+	frame.new_cubes.clear();
+	for (; app_cubes_sent < app_cubes.count; app_cubes_sent++)
+		frame.new_cubes.push_back(cube_store_get(app_cubes, (uint32_t)app_cubes_sent));
+
+	// Those cubes came from select presses, which ride along with the
+	// frame, so we can tell how long they took to show up.
+	frame.select_times.assign(app_latency_pending.begin(), app_latency_pending.end());
+	app_latency_pending.clear();
+
+	app_draw_cull(frame);
+}
+
+///////////////////////////////////////////
+
+void app_draw_cull(app_frame_t &frame) {
+	// Find which cubes are actually visible, as a list of ids into the GPU's
+	// world matrices. We build one frustum that contains all the views, so
+	// the visible list can be shared by all of them, and we only need to do
+	// this once per frame.
+	const uint32_t total = (uint32_t)(2 + app_cubes.count);
+	frame.draw_ids.resize(total);
+	frame.stats.cubes_tested = total;
+	if (!app_config_culling) {
+		for (uint32_t i = 0; i < total; i++)
+			frame.draw_ids[i] = i;
+		frame.stats.cubes_visible = total;
+		return;
+	}
+	math_frustum_t frustum = math_frustum_combined(frame.views.data(), frame.view_count, app_clip_near, app_clip_far);
+
+	// The hands move every frame, so they aren't in the spatial index,
+	// and always get tested on their own. They're the first two ids.
+	uint32_t *ids = frame.draw_ids.data();
+	size_t    hands = math_frustum_cull(frustum, app_hands, 2, app_cube_radius, ids);
+	size_t    count = hands;
+	if (app_config_spatial_index) {
+		uint32_t tested = 0;
+		count += spatial_query_frustum(app_cube_index, frustum, app_cubes, app_cube_radius, app_cull_scratch, app_cull_scratch_ids, ids + count, &tested);
+		frame.stats.cubes_tested = 2 + tested;
+	} else {
+		for (size_t c = 0; c < app_cubes.chunks.size(); c++) {
+			const vector<XrPosef> &chunk = app_cubes.chunks[c];
+			size_t start = count;
+			count += math_frustum_cull(frustum, chunk.data(), chunk.size(), app_cube_radius, ids + count);
+			for (size_t i = start; i < count; i++)
+				ids[i] += (uint32_t)(c * cube_chunk_size);
+		}
+	}
+	// Placed cubes come after the hands on the GPU
+	for (size_t i = hands; i < count; i++)
+		ids[i] += 2;
+
+	frame.draw_ids.resize(count);
+	frame.stats.cubes_visible = (uint32_t)count;
+}
+
+///////////////////////////////////////////
+
+void app_draw_upload(const app_frame_t &frame) {
+	// Culling stats came from the simulation, and we'll add the rest as we
+	// draw.
+	app_stats      = frame.stats;
+	if (frame.hands_located_at != 0)
+		app_stats.pose_age_ms = (frame.state.predictedDisplayTime - frame.hands_located_at) / 1000000.0;
+	app_draw_count      = frame.draw_ids.size();
+	app_latency_pose_at = frame.hands_located_at;
+
+	// Once the loader has the streamed mesh on the GPU, swap it in for the
+	// placeholder. This is just a few pointers, the real work is all done.
+	if (mesh_load_poll(app_mesh_loader)) {
+		app_vertex_buffer->Release();
+		app_index_buffer ->Release();
+		app_mesh_buffer  ->Release();
+		app_vertex_buffer = app_mesh_loader.vertex_buffer;
+		app_index_buffer  = app_mesh_loader.index_buffer;
+		app_mesh_buffer   = app_mesh_loader.mesh_buffer;
+		app_index_count   = app_mesh_loader.ind_count;
+		app_mesh_loader.vertex_buffer = nullptr;
+		app_mesh_loader.index_buffer  = nullptr;
+		app_mesh_loader.mesh_buffer   = nullptr;
+		printf("mesh: streamed '%s', %zu bytes in %.3fms\n", app_mesh_loader.filename, app_mesh_loader.bytes, app_mesh_loader.load_ms);
+	}
+
+	// Stand in for a heavy render workload, if we're benchmarking. Like
+	// real rendering, it gets cheaper at lower resolutions.
+	if (app_config_bench_render_ms > 0) {
+		float scale = app_config_dynamic_res ? xr_res_governor.scale : 1;
+		app_bench_spin(app_config_bench_render_ms * scale * scale);
+	}
+
+	// Every joint becomes a matrix, all in one batch. This happens even
+	// without a GPU, so the headless runtime can tell us what it costs.
+	if (frame.joints.count > 0) {
+		auto convert_start = chrono::high_resolution_clock::now();
+		math_joints_to_matrices(frame.joints, app_joint_matrices);
+		app_stats.joint_matrix_ms = chrono::duration<double, milli>(chrono::high_resolution_clock::now() - convert_start).count();
+	}
+	app_joint_count = frame.joints.count;
+	app_stats.joints = app_joint_count;
+
+	if (d3d_device == nullptr)
+		return;
+
+	// Camera matrices for every pass go into the upload ring together,
+	// with one Map for the whole frame, and each pass gets its own block.
+	// Single pass draws both eyes at once, so they share a block.
+	uint32_t view_count = frame.view_count;
+	app_views_per_pass  = xr_single_pass ? max(min(view_count, (uint32_t)2), (uint32_t)1) : 1;
+	uint32_t pass_count = (view_count + app_views_per_pass - 1) / app_views_per_pass;
+	uint32_t block_size = (sizeof(app_transform_buffer_t) + d3d_ring_align - 1) / d3d_ring_align * d3d_ring_align;
+	app_view_constants.resize(pass_count);
+	uint8_t *ring_data  = d3d_ring_map(block_size, pass_count, app_view_constants.data());
+	if (ring_data != nullptr) {
+		for (uint32_t p = 0; p < pass_count; p++) {
+			app_transform_buffer_t *transform = (app_transform_buffer_t *)(ring_data + app_view_constants[p]);
+			for (uint32_t v = 0; v < app_views_per_pass && p * app_views_per_pass + v < view_count; v++) {
+				const XrView &view = frame.views[p * app_views_per_pass + v];
+				transform->viewproj[v] = math_mul(
+					math_projection(view.fov, app_clip_near, app_clip_far),
+					math_pose_matrix(math_pose_inverse(view.pose), 1));
+			}
+			app_view_constants[p] /= 16; // Bound in constants, not bytes
+		}
+		d3d_ring_unmap();
+		app_stats.ring_bytes = (uint32_t)(d3d_ring.head - d3d_ring.frame_start);
+	} else {
+		app_view_constants.clear();
+	}
+
+	// The joints' buffer is only ever as big as both hands, and it all
+	// changes every frame, so there's nothing to be gained by patching it.
+	if (app_joint_count > 0) {
+		D3D11_BOX joint_box = { 0, 0, 0, (UINT)(sizeof(mat4_t) * app_joint_count), 1, 1 };
+		d3d_context->UpdateSubresource(app_joint_buffer, 0, &joint_box, app_joint_matrices, 0, 0);
+		app_stats.upload_bytes += (uint32_t)(sizeof(mat4_t) * app_joint_count);
+	}
+
+	// Make sure the GPU's world matrix buffer has room for every cube. When
+	// it grows, the matrices already on the GPU get copied over on the GPU,
+	// so we don't have to send any of them again.
+	const uint32_t total = (uint32_t)(2 + app_cubes_uploaded + frame.new_cubes.size());
+	if (total > app_world_capacity) {
+		uint32_t capacity = max(total, max(app_world_capacity * 2, (uint32_t)1024));
+		CD3D11_BUFFER_DESC world_desc(sizeof(mat4_t) * capacity, D3D11_BIND_SHADER_RESOURCE, D3D11_USAGE_DEFAULT, 0, D3D11_RESOURCE_MISC_BUFFER_STRUCTURED, sizeof(mat4_t));
+		ID3D11Buffer *world_buffer = nullptr;
+		if (FAILED(d3d_device->CreateBuffer(&world_desc, nullptr, &world_buffer)))
+			return;
+		if (app_world_buffer) {
+			D3D11_BOX box = { 0, 0, 0, (UINT)(sizeof(mat4_t) * (2 + app_cubes_uploaded)), 1, 1 };
+			d3d_context->CopySubresourceRegion(world_buffer, 0, 0, 0, 0, app_world_buffer, 0, &box);
+			app_world_buffer->Release();
+			app_world_srv   ->Release();
+		}
+		CD3D11_SHADER_RESOURCE_VIEW_DESC srv_desc(D3D11_SRV_DIMENSION_BUFFER, DXGI_FORMAT_UNKNOWN, 0, capacity);
+		d3d_device->CreateShaderResourceView(world_buffer, &srv_desc, &app_world_srv);
+		app_world_buffer   = world_buffer;
+		app_world_capacity = capacity;
+	}
+
+	// The hands move every frame, so they always need uploading.
+	app_upload_scratch.resize(max((size_t)2, frame.new_cubes.size()));
+	math_poses_to_matrices(frame.hands, 2, app_cube_scale, app_upload_scratch.data());
+	D3D11_BOX hand_box = { 0, 0, 0, sizeof(mat4_t) * 2, 1, 1 };
+	d3d_context->UpdateSubresource(app_world_buffer, 0, &hand_box, app_upload_scratch.data(), 0, 0);
+	app_stats.upload_bytes += sizeof(mat4_t) * 2;
+
+	// Placed cubes never move, so only the ones added since last frame need
+	// to go up.
+	if (!frame.new_cubes.empty()) {
+		size_t count = frame.new_cubes.size();
+		math_poses_to_matrices(frame.new_cubes.data(), count, app_cube_scale, app_upload_scratch.data());
+
+		D3D11_BOX box = { (UINT)(sizeof(mat4_t) * (2 + app_cubes_uploaded)), 0, 0, (UINT)(sizeof(mat4_t) * (2 + app_cubes_uploaded + count)), 1, 1 };
+		d3d_context->UpdateSubresource(app_world_buffer, 0, &box, app_upload_scratch.data(), 0, 0);
+		app_stats.upload_bytes += (uint32_t)(sizeof(mat4_t) * count);
+		app_cubes_uploaded     += count;
+	}
+
+	// Now the list of visible ids. A new buffer has nothing useful in it, so
+	// we forget what we sent before, and it all goes up again.
+	if (app_draw_count > app_id_capacity) {
+		if (app_id_buffer) app_id_buffer->Release();
+		app_id_capacity = max((uint32_t)app_draw_count, max(app_id_capacity * 2, (uint32_t)1024));
+		CD3D11_BUFFER_DESC id_desc(sizeof(uint32_t) * app_id_capacity, D3D11_BIND_VERTEX_BUFFER);
+		d3d_device->CreateBuffer(&id_desc, nullptr, &app_id_buffer);
+		app_draw_ids_uploaded.clear();
+	}
+
+	// When the view barely moves, most of the list is the same as last
+	// frame, so we only send the range between the first and last change.
+	size_t first = app_draw_count;
+	size_t last  = 0;
+	for (size_t i = 0; i < app_draw_count; i++) {
+		if (i >= app_draw_ids_uploaded.size() || frame.draw_ids[i] != app_draw_ids_uploaded[i]) {
+			if (first == app_draw_count) first = i;
+			last = i + 1;
+		}
+	}
+	app_draw_ids_uploaded.resize(max(app_draw_ids_uploaded.size(), app_draw_count));
+	if (first < last) {
+		D3D11_BOX box = { (UINT)(sizeof(uint32_t) * first), 0, 0, (UINT)(sizeof(uint32_t) * last), 1, 1 };
+		d3d_context->UpdateSubresource(app_id_buffer, 0, &box, &frame.draw_ids[first], 0, 0);
+		memcpy(&app_draw_ids_uploaded[first], &frame.draw_ids[first], sizeof(uint32_t) * (last - first));
+		app_stats.upload_id_bytes += (uint32_t)(sizeof(uint32_t) * (last - first));
+	}
+}
+
+///////////////////////////////////////////
+
+void app_draw_latch(const app_frame_t &frame, const XrPosef *hands, XrTime located_at) {
+	// Keep track of how much fresher the latched poses are than the ones
+	// we located right after xrWaitFrame. We keep the last latch of the
+	// frame, since that's the one the final view is drawn with.
+	app_stats.latches      += 1;
+	app_stats.latch_gain_ms = chrono::duration<double, milli>(chrono::high_resolution_clock::now() - frame.waited_at).count();
+	if (located_at != 0) {
+		app_stats.latch_age_ms = (frame.state.predictedDisplayTime - located_at) / 1000000.0;
+		app_latency_pose_at    = located_at;
+	}
+
+	if (d3d_device == nullptr || app_world_buffer == nullptr)
+		return;
+
+	// The hands have their own slot at the start of the world buffer, so
+	// patching them is just two matrices, and nothing else moves.
+	mat4_t matrices[2];
+	math_poses_to_matrices(hands, 2, app_cube_scale, matrices);
+	D3D11_BOX hand_box = { 0, 0, 0, sizeof(mat4_t) * 2, 1, 1 };
+	d3d_context->UpdateSubresource(app_world_buffer, 0, &hand_box, matrices, 0, 0);
+	app_stats.upload_bytes += sizeof(mat4_t) * 2;
+}
+
+///////////////////////////////////////////
+
+void app_draw(ID3D11DeviceContext *context, XrCompositionLayerProjectionView *views, uint32_t view_count, uint32_t first_view, app_stats_t &stats) {
+	if (app_draw_count == 0 && app_joint_count == 0)
+		return;
+	auto submit_start = chrono::high_resolution_clock::now();
+
+	// If app_draw_upload put this pass's camera matrices in the upload
+	// ring, we just point the shader at them. Otherwise, set up camera
+	// matrices based on OpenXR's predicted viewpoint information, one for
+	// each view we're drawing in this pass, and send them up now.
+	uint32_t              pass     = first_view / app_views_per_pass;
+	ID3D11DeviceContext1 *context1 = nullptr;
+	if (first_view % app_views_per_pass == 0 && pass < app_view_constants.size() &&
+		SUCCEEDED(context->QueryInterface(__uuidof(ID3D11DeviceContext1), (void **)&context1))) {
+		UINT first_constant = app_view_constants[pass];
+		UINT constant_count = d3d_ring_align / 16;
+		context1->VSSetConstantBuffers1(0, 1, &d3d_ring_buffer, &first_constant, &constant_count);
+		context1->Release();
+	} else {
+		app_transform_buffer_t transform_buffer;
+		for (uint32_t i = 0; i < view_count; i++) {
+			mat4_t mat_projection = math_projection(views[i].fov, app_clip_near, app_clip_far);
+			mat4_t mat_view       = math_pose_matrix(math_pose_inverse(views[i].pose), 1);
+			transform_buffer.viewproj[i] = math_mul(mat_projection, mat_view);
+		}
+		context->VSSetConstantBuffers(0, 1, &app_constant_buffer);
+		context->UpdateSubresource(app_constant_buffer, 0, nullptr, &transform_buffer, 0, 0);
+	}
+
+	// Set the active shaders and constant buffers, and the world matrices of
+	// all the cubes.
+	context->VSSetConstantBuffers(1, 1, &app_mesh_buffer);
+	context->VSSetShaderResources(0, 1, &app_world_srv);
+	context->VSSetShader(app_vshader, nullptr, 0);
+	context->PSSetShader(app_pshader, nullptr, 0);
+
+	// Set up the cube mesh's information, and the instance buffer with the
+	// ids of all the visible cubes in it.
+	ID3D11Buffer *buffers[] = { app_vertex_buffer, app_id_buffer };
+	UINT          strides[] = { sizeof(mesh_vert_t), sizeof(uint32_t) };
+	UINT          offsets[] = { 0, 0 };
+	context->IASetVertexBuffers    (0, 2, buffers, strides, offsets);
+	context->IASetIndexBuffer      (app_index_buffer, DXGI_FORMAT_R16_UINT, 0);
+	context->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+	context->IASetInputLayout      (app_shader_layout);
+
+	// Draw all the cubes we have in our list! The world matrices are already
+	// on the GPU, so this can be a single draw call. Each cube
+	// gets an instance for every view we're drawing to.
+	UINT cube_count = (UINT)app_draw_count;
+	if (cube_count > 0 && app_config_instancing) {
+		context->DrawIndexedInstanced(app_index_count, cube_count * view_count, 0, 0, 0);
+		stats.draw_calls += 1;
+	} else {
+		for (UINT i = 0; i < cube_count; i++)
+			context->DrawIndexedInstanced(app_index_count, view_count, 0, 0, i);
+		stats.draw_calls += cube_count;
+	}
+	stats.instances += cube_count * view_count;
+
+	// Both hands' joints are one more instanced draw of the same mesh, just
+	// pointed at the joint matrices and ids instead. Joints are small and
+	// always near the hands, so they skip culling.
+	if (app_joint_count > 0) {
+		ID3D11Buffer *joint_ids    = app_joint_id_buffer;
+		UINT          joint_stride = sizeof(uint32_t);
+		UINT          joint_offset = 0;
+		context->VSSetShaderResources(0, 1, &app_joint_srv);
+		context->IASetVertexBuffers  (1, 1, &joint_ids, &joint_stride, &joint_offset);
+		context->DrawIndexedInstanced(app_index_count, app_joint_count * view_count, 0, 0, 0);
+		stats.draw_calls += 1;
+		stats.instances  += app_joint_count * view_count;
+	}
+	stats.submit_ms += chrono::duration<double, milli>(chrono::high_resolution_clock::now() - submit_start).count();
+}
+
+///////////////////////////////////////////
+
+void app_draw_finish(const app_frame_t &frame) {
+	app_stats.latency_ms = chrono::duration<double, milli>(chrono::high_resolution_clock::now() - frame.waited_at).count();
+
+	// Log the average of the last few frames' worth of draw statistics
+	app_stats_total.draw_calls      += app_stats.draw_calls;
+	app_stats_total.instances       += app_stats.instances;
+	app_stats_total.cubes_tested    += app_stats.cubes_tested;
+	app_stats_total.cubes_visible   += app_stats.cubes_visible;
+	app_stats_total.upload_bytes    += app_stats.upload_bytes;
+	app_stats_total.upload_id_bytes += app_stats.upload_id_bytes;
+	app_stats_total.submit_ms       += app_stats.submit_ms;
+	app_stats_total.latency_ms      += app_stats.latency_ms;
+	app_stats_total.pose_age_ms     += app_stats.pose_age_ms;
+	app_stats_total.latch_age_ms    += app_stats.latch_age_ms;
+	app_stats_total.latch_gain_ms   += app_stats.latch_gain_ms;
+	app_stats_total.latches         += app_stats.latches;
+	app_stats_total.render_ms       += app_stats.render_ms;
+	app_stats_total.input_calls     += app_stats.input_calls;
+	app_stats_total.input_ms        += app_stats.input_ms;
+	app_stats_total.joints          += app_stats.joints;
+	app_stats_total.joint_locate_ms += app_stats.joint_locate_ms;
+	app_stats_total.joint_matrix_ms += app_stats.joint_matrix_ms;
+	app_stats_total.ring_bytes      += app_stats.ring_bytes;
+	app_stats_frames                += 1;
+	if (app_stats_frames == 1)
+		app_stats_start = chrono::high_resolution_clock::now();
+	if (app_stats_frames < 91)
+		return;
+
+	// The first frame of each batch just marks the start time
+	uint32_t frames  = app_stats_frames - 1;
+	double   seconds = chrono::duration<double>(chrono::high_resolution_clock::now() - app_stats_start).count();
+	if (app_config_bench_cubes > 0) {
+		printf("cubes: %zu, tested/frame: %u, visible/frame: %u, draws/frame: %u, instances/frame: %u, uploads/frame: %u+%u bytes, submit: %.3fms\n",
+			app_cubes_uploaded,
+			app_stats_total.cubes_tested    / app_stats_frames,
+			app_stats_total.cubes_visible   / app_stats_frames,
+			app_stats_total.draw_calls      / app_stats_frames,
+			app_stats_total.instances       / app_stats_frames,
+			app_stats_total.upload_bytes    / app_stats_frames,
+			app_stats_total.upload_id_bytes / app_stats_frames,
+			app_stats_total.submit_ms       / app_stats_frames);
+		if (d3d_ring_buffer != nullptr) {
+			printf("upload ring: %u bytes/frame, %u wraps, %u resets\n",
+				app_stats_total.ring_bytes / app_stats_frames,
+				d3d_ring.wraps,
+				d3d_ring.resets);
+		}
+	}
+	if (app_config_bench_update_ms > 0 || app_config_bench_render_ms > 0) {
+		printf("%s: %.1f frames/s, latency: %.3fms\n",
+			app_config_pipelined ? "pipelined" : "serial",
+			frames / seconds,
+			app_stats_total.latency_ms / app_stats_frames);
+	}
+	if (app_config_dynamic_res) {
+		printf("resolution: %.0f%%, render: %.3fms\n",
+			app_stats.res_scale * 100,
+			app_stats_total.render_ms / app_stats_frames);
+	}
+	if (app_config_input_stats && app_config_late_latch && app_stats_total.latches > 0) {
+		// Pose ages need the runtime's clock, which we only have when the
+		// time conversion extension is around.
+		if (openxr_time_now() != 0) {
+			printf("hand pose age: %.3fms at wait, %.3fms latched, ",
+				app_stats_total.pose_age_ms  / app_stats_frames,
+				app_stats_total.latch_age_ms / app_stats_frames);
+		}
+		printf("latched %.3fms after wait, %.1f latches/frame\n",
+			app_stats_total.latch_gain_ms / app_stats_frames,
+			(double)app_stats_total.latches / app_stats_frames);
+	}
+	if (app_config_input_stats) {
+		printf("input: %.1f runtime calls/frame, %.3fms, %s\n",
+			(double)app_stats_total.input_calls / app_stats_frames,
+			app_stats_total.input_ms / app_stats_frames,
+			xr_locate_batched ? "batched locates" : "one locate per space");
+		if (xr_hand_tracking) {
+			printf("joints: %.1f/frame, %.4fms locating, %.4fms to matrices (%s)\n",
+				(double)app_stats_total.joints / app_stats_frames,
+				app_stats_total.joint_locate_ms / app_stats_frames,
+				app_stats_total.joint_matrix_ms / app_stats_frames,
+				math_simd_name);
+		}
+	}
+	app_stats_total  = {};
+	app_stats_frames = 0;
+}
+
+///////////////////////////////////////////
+
+void app_latency_record(const app_frame_t &frame) {
+	// This frame was just submitted, so now we know when everything in it
+	// is going to be seen. Select presses count from when the runtime saw
+	// the button change, and hands from when we located them.
+	XrTime display = frame.state.predictedDisplayTime;
+	for (size_t i = 0; i < frame.select_times.size(); i++) {
+		if (frame.select_times[i] != 0)
+			latency_add(app_latency_select, (display - frame.select_times[i]) / 1000000.0f);
+	}
+	if (app_latency_pose_at != 0 && (frame.hands_active[0] || frame.hands_active[1]))
+		latency_add(app_latency_pose, (display - app_latency_pose_at) / 1000000.0f);
+}
+
+///////////////////////////////////////////
+
+bool app_latency_report() {
+	latency_print(app_latency_select, "select to photon");
+	latency_print(app_latency_pose,   "pose to photon");
+	if (app_config_latency_budget_ms <= 0)
+		return true;
+
+	// No samples means the session never got far enough to measure, which
+	// is a different problem from being slow, so it says so. It still
+	// fails, since a budget was asked for and couldn't be checked.
+	int32_t select = latency_check(app_latency_select, app_config_latency_budget_ms);
+	int32_t pose   = latency_check(app_latency_pose,   app_config_latency_budget_ms);
+	if (select == latency_no_samples || pose == latency_no_samples) {
+		printf("latency: no %s samples, so the %.1fms budget wasn't checked\n", select == latency_no_samples ? "select to photon" : "pose to photon", app_config_latency_budget_ms);
+		return false;
+	}
+	bool ok = select == latency_within && pose == latency_within;
+	printf("latency: p99 is %s the %.1fms budget\n", ok ? "within" : "OVER", app_config_latency_budget_ms);
+	return ok;
+}
+
+///////////////////////////////////////////
+
+void app_update() {
+	prof_scope_t prof("app_update");
+
+	// Stand in for a heavy simulation, if we're benchmarking
+	if (app_config_bench_update_ms > 0)
+		app_bench_spin(app_config_bench_update_ms);
+
+	// If the user presses the select action, lets add a cube at that location!
+	for (uint32_t i = 0; i < 2; i++) {
+		if (xr_input.handSelect[i]) {
+			uint32_t id = cube_store_add(app_cubes, xr_input.handPose[i]);
+			spatial_insert(app_cube_index, id, xr_input.handPose[i].position, app_cube_radius);
+			if (app_config_journal)
+				cube_journal_append(app_journal, xr_input.handPose[i]);
+			app_latency_pending.push_back(xr_input.handSelectTime[i]);
+		}
+	}
+}
+
+///////////////////////////////////////////
+
+void app_update_predicted() {
+	// Update the location of the hand cubes. This is done after the inputs have been updated to 
+	// use the predicted location, but during the render code, so we have the most up-to-date location.
+	for (uint32_t i = 0; i < 2; i++) {
+		app_hands[i] = xr_input.renderHand[i] ? xr_input.handPose[i] : xr_pose_identity;
+	}
+}
+
+///////////////////////////////////////////
+
+void app_bench_spin(float ms) {
+	// Keep the CPU busy, rather than sleeping, like real work would
+	auto until = chrono::high_resolution_clock::now() + chrono::duration_cast<chrono::nanoseconds>(chrono::duration<float, milli>(ms));
+	while (chrono::high_resolution_clock::now() < until) {}
+}
+
+///////////////////////////////////////////
+
+void app_bench_math() {
+	// Make up a big pile of poses with some arbitrary rotations
+	const size_t    count = 100000;
+	vector<XrPosef> poses(count);
+	vector<mat4_t>  matrices(count);
+	for (size_t i = 0; i < count; i++) {
+		float angle = i * 0.001f;
+		poses[i].orientation = { 0, sinf(angle), 0, cosf(angle) };
+		poses[i].position    = { (float)(i % 100), (float)(i / 100 % 100), (float)(i / 10000) };
+	}
+
+	// The baseline: one pose at a time with plain scalar math, which is
+	// what the batched version falls back to for its last few poses.
+	const int32_t iterations = 20;
+	auto start = chrono::high_resolution_clock::now();
+	for (int32_t it = 0; it < iterations; it++) {
+		for (size_t i = 0; i < count; i++) {
+			matrices[i] = math_pose_matrix(poses[i], 0.05f);
+		}
+	}
+	double scalar_s = chrono::duration<double>(chrono::high_resolution_clock::now() - start).count();
+
+	// The old way of doing it: a DirectXMath affine transform for each
+	// cube, then transposed for the shader. DirectXMath only comes with
+	// the Windows SDK, so it's only timed there.
+#ifdef _WIN32
+	start = chrono::high_resolution_clock::now();
+	for (int32_t it = 0; it < iterations; it++) {
+		for (size_t i = 0; i < count; i++) {
+			XMMATRIX mat_model = XMMatrixAffineTransformation(
+				DirectX::g_XMOne * 0.05f, DirectX::g_XMZero,
+				XMLoadFloat4((XMFLOAT4*)&poses[i].orientation),
+				XMLoadFloat3((XMFLOAT3*)&poses[i].position));
+			XMStoreFloat4x4((XMFLOAT4X4*)&matrices[i], XMMatrixTranspose(mat_model));
+		}
+	}
+	double dxmath_s = chrono::duration<double>(chrono::high_resolution_clock::now() - start).count();
+#endif
+
+	// And the batched version
+	start = chrono::high_resolution_clock::now();
+	for (int32_t it = 0; it < iterations; it++) {
+		math_poses_to_matrices(poses.data(), count, 0.05f, matrices.data());
+	}
+	double batch_s = chrono::duration<double>(chrono::high_resolution_clock::now() - start).count();
+
+	printf("Pose to matrix, %zu poses x %d:\n", count, iterations);
+	printf("- Scalar:         %.1f M matrices/s\n", (count * iterations) / scalar_s / 1000000.0);
+#ifdef _WIN32
+	printf("- DirectXMath:    %.1f M matrices/s\n", (count * iterations) / dxmath_s / 1000000.0);
+#endif
+	printf("- Batched (%s): %.1f M matrices/s, %.1fx scalar\n", math_simd_name, (count * iterations) / batch_s / 1000000.0, scalar_s / batch_s);
+}
+
+///////////////////////////////////////////
+
+void app_bench_spatial() {
+	const size_t sizes[] = { 10000, 1000000, 10000000 };
+	for (size_t s = 0; s < _countof(sizes); s++) {
+		// Scatter cubes randomly through a volume, about 30cm apart on average
+		const size_t    count = sizes[s];
+		const float     side  = 0.3f * cbrtf((float)count);
+		vector<XrPosef> poses(count, xr_pose_identity);
+		cube_store_t    cubes = {};
+		uint32_t        seed  = 1;
+		for (size_t i = 0; i < count; i++) {
+			poses[i].position = { math_rand_range(seed, -side/2, side/2), math_rand_range(seed, -side/2, side/2), math_rand_range(seed, -side/2, side/2) };
+		}
+
+		spatial_index_t index = { 1.0f };
+		auto start = chrono::high_resolution_clock::now();
+		for (size_t i = 0; i < count; i++) {
+			spatial_insert(index, cube_store_add(cubes, poses[i]), poses[i].position, app_cube_radius);
+		}
+		double insert_s = chrono::duration<double>(chrono::high_resolution_clock::now() - start).count();
+
+		// A typical headset view from the middle of the volume
+		XrView view = { XR_TYPE_VIEW };
+		view.pose = xr_pose_identity;
+		view.fov  = { -0.8f, 0.8f, 0.8f, -0.8f };
+		math_frustum_t  frustum = math_frustum_combined(&view, 1, app_clip_near, app_clip_far);
+		vector<uint32_t> visible(count), scratch_ids;
+		vector<XrPosef>  scratch;
+		size_t          visible_count = 0;
+		const int32_t   frustum_iterations = 10;
+		start = chrono::high_resolution_clock::now();
+		for (int32_t i = 0; i < frustum_iterations; i++) {
+			visible_count = spatial_query_frustum(index, frustum, cubes, app_cube_radius, scratch, scratch_ids, visible.data(), nullptr);
+		}
+		double frustum_ms = chrono::duration<double, milli>(chrono::high_resolution_clock::now() - start).count() / frustum_iterations;
+
+		// Rays from the middle, in random directions
+		const int32_t ray_count = 1000;
+		int32_t       ray_hits  = 0;
+		start = chrono::high_resolution_clock::now();
+		for (int32_t i = 0; i < ray_count; i++) {
+			XrVector3f dir = { math_rand_range(seed, -1, 1), math_rand_range(seed, -1, 1), math_rand_range(seed, -1, 1) };
+			float      len = sqrtf(dir.x*dir.x + dir.y*dir.y + dir.z*dir.z);
+			dir = { dir.x / len, dir.y / len, dir.z / len };
+			if (spatial_query_ray(index, cubes, { 0,0,0 }, dir, 10, app_cube_scale, nullptr) >= 0)
+				ray_hits++;
+		}
+		double ray_us = chrono::duration<double, micro>(chrono::high_resolution_clock::now() - start).count() / ray_count;
+
+		printf("Spatial index, %zu cubes in %zu cells:\n", count, index.cells.size());
+		printf("- insert:  %.2f M cubes/s\n", count / insert_s / 1000000.0);
+		printf("- frustum: %.3f ms, %zu visible\n", frustum_ms, visible_count);
+		printf("- ray:     %.3f us, %d/%d hit\n", ray_us, ray_hits, ray_count);
+	}
+}
+
+///////////////////////////////////////////
+void app_bench_mesh() {
+	// A UV sphere is a good stand-in for a real mesh: lots of shared
+	// vertices, and smooth normals pointing every direction.
+	const uint32_t rings = 128, segments = 256;
+	vector<float>    verts;
+	vector<uint32_t> grid_inds;
+	for (uint32_t r = 0; r <= rings; r++) {
+		for (uint32_t s = 0; s <= segments; s++) {
+			float      theta = (float)r / rings * 3.14159265f;
+			float      phi   = (float)s / segments * 6.28318531f;
+			XrVector3f n     = { sinf(theta) * cosf(phi), cosf(theta), sinf(theta) * sinf(phi) };
+			float      v[6]  = { n.x * 0.5f, n.y * 0.5f, n.z * 0.5f, n.x, n.y, n.z };
+			verts.insert(verts.end(), v, v + 6);
+		}
+	}
+	for (uint32_t r = 0; r < rings; r++) {
+		for (uint32_t s = 0; s < segments; s++) {
+			uint32_t a = r * (segments + 1) + s;
+			uint32_t b = a + segments + 1;
+			uint32_t quad[6] = { a, b, a + 1, a + 1, b, b + 1 };
+			grid_inds.insert(grid_inds.end(), quad, quad + 6);
+		}
+	}
+	size_t vert_count = verts.size() / 6;
+
+	// Meshes from exporters are rarely this tidy, so try one with its
+	// triangles in a random order too.
+	vector<uint32_t> shuffled_inds = grid_inds;
+	uint32_t seed = 1;
+	for (size_t t = shuffled_inds.size() / 3 - 1; t > 0; t--) {
+		size_t other = math_rand(seed) % (t + 1);
+		for (int32_t c = 0; c < 3; c++) swap(shuffled_inds[t*3+c], shuffled_inds[other*3+c]);
+	}
+
+	const char             *names  [] = { "grid", "shuffled" };
+	const vector<uint32_t> *sources[] = { &grid_inds, &shuffled_inds };
+	for (int32_t m = 0; m < 2; m++) {
+		const vector<uint32_t> &inds = *sources[m];
+		mesh_t           mesh;
+		vector<uint32_t> remap(vert_count);
+		auto start = chrono::high_resolution_clock::now();
+		if (!mesh_build(verts.data(), vert_count, inds.data(), inds.size(), mesh, remap.data()))
+			return;
+		double build_ms = chrono::duration<double, milli>(chrono::high_resolution_clock::now() - start).count();
+		vector<uint32_t> built_inds(mesh.inds.begin(), mesh.inds.end());
+
+		// How much did packing cost us?
+		float pos_err = 0, norm_err = 0;
+		for (size_t i = 0; i < vert_count; i++) {
+			const float       *v = &verts[i * 6];
+			const mesh_vert_t &p = mesh.verts[remap[i]];
+			XrVector3f pos = {
+				mesh.bounds_min.x + p.x / 65535.0f * mesh.bounds_size.x,
+				mesh.bounds_min.y + p.y / 65535.0f * mesh.bounds_size.y,
+				mesh.bounds_min.z + p.z / 65535.0f * mesh.bounds_size.z };
+			XrVector3f n   = mesh_decode_normal(p.normal);
+			float      dot = n.x*v[3] + n.y*v[4] + n.z*v[5];
+			pos_err  = fmaxf(pos_err,  fmaxf(fabsf(pos.x - v[0]), fmaxf(fabsf(pos.y - v[1]), fabsf(pos.z - v[2]))));
+			norm_err = fmaxf(norm_err, acosf(fminf(dot, 1.0f)) * 57.2957795f);
+		}
+
+		printf("Mesh %s, %zu verts, %zu tris:\n", names[m], vert_count, inds.size() / 3);
+		printf("- vertex:    %zu -> %zu bytes\n", sizeof(float) * 6, sizeof(mesh_vert_t));
+		printf("- index:     %zu -> %zu bytes\n", sizeof(uint32_t), sizeof(uint16_t));
+		printf("- acmr 16:   %.3f -> %.3f\n", mesh_acmr(inds.data(), inds.size(), 16), mesh_acmr(built_inds.data(), built_inds.size(), 16));
+		printf("- acmr 32:   %.3f -> %.3f\n", mesh_acmr(inds.data(), inds.size(), 32), mesh_acmr(built_inds.data(), built_inds.size(), 32));
+		printf("- build:     %.2f ms\n", build_ms);
+		printf("- max error: %.3f mm position, %.2f deg normal\n", pos_err * 1000, norm_err);
+	}
+}
+
+///////////////////////////////////////////
+void app_bench_mesh_load() {
+	// The biggest mesh 16 bit indices allow: a 256x256 vertex grid, wrapped
+	// into a sphere.
+	const uint32_t   side = 256;
+	vector<float>    verts;
+	vector<uint32_t> inds;
+	for (uint32_t r = 0; r < side; r++) {
+		for (uint32_t s = 0; s < side; s++) {
+			float      theta = (float)r / (side - 1) * 3.14159265f;
+			float      phi   = (float)s / (side - 1) * 6.28318531f;
+			XrVector3f n     = { sinf(theta) * cosf(phi), cosf(theta), sinf(theta) * sinf(phi) };
+			float      v[6]  = { n.x * 0.5f, n.y * 0.5f, n.z * 0.5f, n.x, n.y, n.z };
+			verts.insert(verts.end(), v, v + 6);
+		}
+	}
+	for (uint32_t r = 0; r < side - 1; r++) {
+		for (uint32_t s = 0; s < side - 1; s++) {
+			uint32_t a = r * side + s;
+			uint32_t b = a + side;
+			uint32_t quad[6] = { a, b, a + 1, a + 1, b, b + 1 };
+			inds.insert(inds.end(), quad, quad + 6);
+		}
+	}
+	mesh_t mesh;
+	const char *filename = "bench.mesh";
+	if (!mesh_build(verts.data(), verts.size() / 6, inds.data(), inds.size(), mesh) || !mesh_file_write(filename, mesh))
+		return;
+
+	// Loading right on the main thread, the whole load is a stall
+	const int32_t loads      = 32;
+	mesh_loader_t loader     = {};
+	double        sync_worst = 0;
+	for (int32_t i = 0; i < loads; i++) {
+		auto start = chrono::high_resolution_clock::now();
+		loader.filename = filename;
+		mesh_load_run(&loader);
+		mesh_load_stop(loader);
+		sync_worst = max(sync_worst, chrono::duration<double, milli>(chrono::high_resolution_clock::now() - start).count());
+	}
+
+	// Streaming, the main thread only ever starts a load and polls it, so
+	// time just those while pretending to render frames.
+	double  async_worst = 0;
+	size_t  bytes       = 0;
+	int32_t frames      = 0;
+	auto    total_start = chrono::high_resolution_clock::now();
+	for (int32_t i = 0; i < loads; i++) {
+		bool done = false;
+		auto start = chrono::high_resolution_clock::now();
+		mesh_load_start(loader, filename);
+		async_worst = max(async_worst, chrono::duration<double, milli>(chrono::high_resolution_clock::now() - start).count());
+		while (!done) {
+			this_thread::sleep_for(chrono::microseconds(500));
+			start = chrono::high_resolution_clock::now();
+			done  = mesh_load_poll(loader);
+			async_worst = max(async_worst, chrono::duration<double, milli>(chrono::high_resolution_clock::now() - start).count());
+			frames++;
+		}
+		bytes += loader.bytes;
+		mesh_load_stop(loader);
+	}
+	double total_s = chrono::duration<double>(chrono::high_resolution_clock::now() - total_start).count();
+	remove(filename);
+
+	printf("Mesh load, %d loads of %zu bytes%s:\n", loads, bytes / loads, d3d_device ? "" : " (no GPU, map and check only)");
+	printf("- throughput:   %.1f MB/s\n", bytes / total_s / (1024 * 1024));
+	printf("- worst stall:  %.3f ms sync, %.3f ms streamed\n", sync_worst, async_worst);
+	printf("- polls:        %.1f per load\n", frames / (float)loads);
+}
+
+///////////////////////////////////////////
+
+void app_bench_journal() {
+	const char *snapshot_file = "bench_cubes.snapshot";
+	const char *journal_file  = "bench_cubes.journal";
+	remove(snapshot_file);
+	remove(journal_file);
+
+	// Place a million cubes, timing just what the frame loop would see
+	const size_t   count = 1000000;
+	const float    side  = 0.3f * cbrtf((float)count);
+	uint32_t       seed  = 1;
+	cube_journal_t journal;
+	{
+		cube_store_t    cubes = {};
+		spatial_index_t index = { 1.0f };
+		cube_journal_open(journal, snapshot_file, journal_file, cubes, index);
+	}
+	double append_worst = 0;
+	auto   start        = chrono::high_resolution_clock::now();
+	for (size_t i = 0; i < count; i++) {
+		XrPosef pose  = xr_pose_identity;
+		pose.position = { math_rand_range(seed, -side/2, side/2), math_rand_range(seed, -side/2, side/2), math_rand_range(seed, -side/2, side/2) };
+		auto append_start = chrono::high_resolution_clock::now();
+		cube_journal_append(journal, pose);
+		append_worst = max(append_worst, chrono::duration<double, micro>(chrono::high_resolution_clock::now() - append_start).count());
+	}
+	double append_ms = chrono::duration<double, milli>(chrono::high_resolution_clock::now() - start).count();
+	start = chrono::high_resolution_clock::now();
+	cube_journal_close(journal);
+	double   flush_ms    = chrono::duration<double, milli>(chrono::high_resolution_clock::now() - start).count();
+	uint64_t batches     = journal.batches;
+	uint64_t compactions = journal.compactions;
+	uint64_t in_journal  = journal.journal_count;
+
+	// And put them all back, like on startup
+	cube_store_t    cubes = {};
+	spatial_index_t index = { 1.0f };
+	start = chrono::high_resolution_clock::now();
+	cube_journal_open(journal, snapshot_file, journal_file, cubes, index);
+	double restore_ms = chrono::duration<double, milli>(chrono::high_resolution_clock::now() - start).count();
+	cube_journal_close(journal);
+	remove(snapshot_file);
+	remove(journal_file);
+
+	printf("Cube journal, %zu cubes:\n", count);
+	printf("- append:  %.3f us avg, %.3f us worst\n", append_ms * 1000 / count, append_worst);
+	printf("- writer:  %llu batches, %llu compactions, %.1f ms to flush on close\n", (unsigned long long)batches, (unsigned long long)compactions, flush_ms);
+	printf("- restore: %.1f ms for %zu cubes, %llu from the journal\n", restore_ms, cubes.count, (unsigned long long)in_journal);
+}
+
+///////////////////////////////////////////
+
+void app_bench_input() {
+	// A few seconds of a hand moving and turning at 250Hz. How accurate
+	// the poses come back is up to the input history test, this is just
+	// how long asking for one takes.
+	const XrDuration step  = 4000000; // 250Hz
+	const XrTime     start = 1000000000;
+	input_history_t *history = new input_history_t();
+	const uint64_t   count   = 375;
+	for (uint64_t i = 0; i < count; i++) {
+		float   s = i * step / 1000000000.0f;
+		XrPosef pose;
+		pose.position    = { 0.3f * sinf(2 * s), 0.2f * cosf(3 * s), 0.1f * s };
+		pose.orientation = math_quat_from_rotation({ 1.44f * s, 1.92f * s, 1.8f * s });
+		input_history_add(*history, start + i * step, pose, XR_SPACE_LOCATION_POSITION_VALID_BIT | XR_SPACE_LOCATION_ORIENTATION_VALID_BIT);
+	}
+
+	// Query cost, from anywhere in the window
+	const XrTime  newest  = start + (count - 1) * step;
+	const int32_t queries = 1000000;
+	uint32_t      seed    = 1;
+	int32_t       found   = 0;
+	XrPosef       pose;
+	auto time_start = chrono::high_resolution_clock::now();
+	for (int32_t i = 0; i < queries; i++) {
+		if (input_history_pose(*history, start + math_rand(seed) % (newest - start), &pose))
+			found++;
+	}
+	double query_ns = chrono::duration<double, nano>(chrono::high_resolution_clock::now() - time_start).count() / queries;
+	delete history;
+
+	printf("Input history, %llu samples at 250Hz:\n", (unsigned long long)count);
+	printf("- query: %.1f ns, %d of %d found\n", query_ns, found, queries);
+}
+
+///////////////////////////////////////////
+
+void app_bench_views() {
+	if (d3d_device == nullptr) {
+		printf("Parallel views: needs a graphics device, skipping\n");
+		return;
+	}
+
+	// Views all the way around, like a CAVE with a wall per view, each with
+	// its own render target.
+	const uint32_t   max_views = 12;
+	const int32_t    size      = 1024;
+	app_frame_t      frame     = {};
+	XrCompositionLayerProjectionView views   [max_views];
+	swapchain_surfdata_t             surfaces[max_views];
+	frame.views.resize(max_views, { XR_TYPE_VIEW });
+	frame.view_count = max_views;
+	for (uint32_t i = 0; i < max_views; i++) {
+		float angle = i * 6.2831853f / max_views;
+		frame.views[i].pose = { { 0, sinf(angle / 2), 0, cosf(angle / 2) }, { 0, 0, 0 } };
+		frame.views[i].fov  = { -0.8f, 0.8f, 0.8f, -0.8f };
+		views[i] = { XR_TYPE_COMPOSITION_LAYER_PROJECTION_VIEW };
+		views[i].pose = frame.views[i].pose;
+		views[i].fov  = frame.views[i].fov;
+		views[i].subImage.imageRect = { { 0, 0 }, { size, size } };
+
+		ID3D11Texture2D     *texture;
+		D3D11_TEXTURE2D_DESC desc = {};
+		desc.SampleDesc.Count = 1;
+		desc.MipLevels        = 1;
+		desc.Width            = size;
+		desc.Height           = size;
+		desc.ArraySize        = 1;
+		desc.Format           = DXGI_FORMAT_R8G8B8A8_UNORM;
+		desc.BindFlags        = D3D11_BIND_RENDER_TARGET;
+		surfaces[i] = {};
+		if (SUCCEEDED(d3d_device->CreateTexture2D(&desc, nullptr, &texture))) {
+			d3d_device->CreateRenderTargetView(texture, nullptr, &surfaces[i].target_view);
+			texture->Release();
+		}
+		surfaces[i].depth_view = d3d_make_depth(size, size, 1);
+	}
+
+	// One frame's worth of the current scene, same as a real frame would
+	// send. One draw per cube makes for a draw stream that's actually
+	// worth spreading out, instancing would leave nothing to record.
+	app_draw_prepare(frame);
+	app_draw_upload (frame);
+	bool instancing = app_config_instancing;
+	app_config_instancing = false;
+
+	uint32_t restore_views   = (uint32_t)d3d_view_contexts.size();
+	uint32_t restore_threads = (uint32_t)d3d_workers.threads.size() + 1;
+	uint32_t max_threads     = max(thread::hardware_concurrency(), (uint32_t)1);
+	const uint32_t view_counts[] = { 2, 4, 8, 12 };
+	const int32_t  frames        = 50;
+	printf("Parallel views, %zu draws per view, %u hardware threads:\n", app_draw_count, max_threads);
+	for (uint32_t v = 0; v < _countof(view_counts); v++) {
+		uint32_t count = view_counts[v];
+		printf("- %2u views:", count);
+		for (uint32_t threads = 1; threads <= min(count, max_threads); threads *= 2) {
+			// One thread is the plain immediate context, the way views are
+			// drawn without parallel recording.
+			if (threads > 1)
+				d3d_views_init(count, threads);
+			auto start = chrono::high_resolution_clock::now();
+			for (int32_t f = 0; f < frames; f++) {
+				if (threads > 1) {
+					d3d_render_views(views, surfaces, count);
+				} else {
+					for (uint32_t i = 0; i < count; i++)
+						d3d_render_layer(d3d_context, &views[i], 1, i, surfaces[i], app_stats);
+				}
+				d3d_context->Flush();
+			}
+			double ms = chrono::duration<double, milli>(chrono::high_resolution_clock::now() - start).count() / frames;
+			d3d_views_shutdown();
+			printf(" %u thread%s %.3fms,", threads, threads == 1 ? "" : "s", ms);
+		}
+		printf("\n");
+	}
+
+	app_config_instancing = instancing;
+	app_stats             = {};
+	if (restore_views > 0)
+		d3d_views_init(restore_views, restore_threads);
+	for (uint32_t i = 0; i < max_views; i++) {
+		if (surfaces[i].target_view) surfaces[i].target_view->Release();
+		if (surfaces[i].depth_view ) surfaces[i].depth_view ->Release();
+	}
+}
+
+///////////////////////////////////////////
+// Headless runtime code                 //
+///////////////////////////////////////////
+
+#ifdef XR_HEADLESS
+
+// This is a tiny stand-in for an OpenXR runtime, covering just the functions
+// this sample calls. Since these have the same names as the loader's
+// functions, the linker uses these instead. Time advances by exactly one
+// display period each frame, and the session states, hands, and select
+// presses all follow a script, so every run is the same! It can also play
+// back a session recorded on a real runtime, which is just as repeatable.
+
+struct headless_script_t {
+	uint64_t       frame;
+	XrSessionState state;
+};
+struct headless_swapchain_t {
+	int32_t                 width;
+	int32_t                 height;
+	uint32_t                array_size;
+	uint32_t                next_image;
+	vector<vector<uint8_t>> images; // RGBA8 pixels, in CPU memory
+};
+struct headless_space_t {
+	int32_t hand; // -1 for reference spaces
+	XrPosef offset;
+};
+
+// A session recording, when we're playing one back instead of following
+// the script. Frames, events, and actions are handed out in order, while
+// locates and views get looked up by the time they're asked for.
+struct headless_replay_t {
+	bool                     active;
+	vector<session_frame_t>  frames;
+	vector<session_event_t>  events;
+	vector<session_action_t> actions;
+	vector<session_locate_t> locates;     // Sorted by hand, then time
+	vector<bool>             locate_used;
+	vector<session_views_t>  views;       // Sorted by display time
+	vector<uint32_t>         view_first;  // Where each entry's poses start in view_poses
+	vector<session_view_t>   view_poses;
+	size_t                   event_at;
+	size_t                   action_at;
+	vector<session_action_t> action_state; // The latest for each action and subaction path
+	mutex                    lock;         // Locates, which the render and sampler threads do too
+	chrono::steady_clock::time_point start;
+};
+
+const XrDuration  headless_period       = 11111111; // 90Hz, in nanoseconds
+const XrTime      headless_start_time   = 1000000000;
+const int32_t     headless_width        = 1440;
+const int32_t     headless_height       = 1600;
+const uint32_t    headless_image_count  = 3;
+const uint64_t    headless_select_every = 45; // Frames between select presses, alternating hands
+const uint64_t    headless_hand_lost_every = 300; // Frames between the right hand losing tracking
+const uint64_t    headless_hand_lost_for   = 30;  // And how many frames it stays lost
+const uint64_t    headless_frames       = 2000;
+const uint64_t    headless_display_lead = 2; // Periods ahead that frames are predicted for, like a real compositor
+headless_script_t headless_script[] = {
+	{ 0,               XR_SESSION_STATE_IDLE         },
+	{ 0,               XR_SESSION_STATE_READY        },
+	{ 1,               XR_SESSION_STATE_SYNCHRONIZED },
+	{ 1,               XR_SESSION_STATE_VISIBLE      },
+	{ 1,               XR_SESSION_STATE_FOCUSED      },
+	{ headless_frames, XR_SESSION_STATE_VISIBLE      },
+	{ headless_frames, XR_SESSION_STATE_SYNCHRONIZED },
+	{ headless_frames, XR_SESSION_STATE_STOPPING     }, };
+
+atomic<uint64_t>             headless_frame; // The render thread reads the clock too, when frames are pipelined
+uint64_t                     headless_depth_views;
+size_t                       headless_script_at;
+vector<XrEventDataSessionStateChanged> headless_events;
+vector<string>               headless_paths;
+vector<headless_swapchain_t> headless_swapchains;
+vector<headless_space_t>     headless_spaces;
+uint32_t                     headless_actions;
+headless_replay_t            headless_replay;
+bool                         headless_select     [2];
+bool                         headless_select_prev[2];
+XrTime                       headless_select_time[2];
+chrono::high_resolution_clock::time_point headless_begin;
+
+///////////////////////////////////////////
+
+session_frame_t headless_replay_frame(uint64_t index) {
+	// Past the end of the recording, frames keep on coming at the same rate
+	const vector<session_frame_t> &frames = headless_replay.frames;
+	if (index < frames.size())
+		return frames[index];
+	session_frame_t result = frames.back();
+	XrDuration      offset = (XrDuration)(index - (frames.size() - 1)) * result.period;
+	result.display_time += offset;
+	if (result.waited_at != 0)
+		result.waited_at += offset;
+	result.should_render = XR_TRUE;
+	return result;
+}
+
+///////////////////////////////////////////
+
+XrTime headless_time() {
+	// When replaying, it's whatever time it was when the app's latest
+	// xrWaitFrame returned in the recording.
+	if (headless_replay.active) {
+		uint64_t        frame = headless_frame;
+		session_frame_t state = headless_replay_frame(frame > 0 ? frame - 1 : 0);
+		return state.waited_at != 0 ? state.waited_at : state.display_time - headless_display_lead * state.period;
+	}
+	return headless_start_time + headless_frame * headless_period;
+}
+
+///////////////////////////////////////////
+
+void headless_push_event(XrSessionState state, XrTime time) {
+	XrEventDataSessionStateChanged event = { XR_TYPE_EVENT_DATA_SESSION_STATE_CHANGED };
+	event.session = (XrSession)1;
+	event.state   = state;
+	event.time    = time;
+	headless_events.push_back(event);
+}
+
+///////////////////////////////////////////
+
+XrPosef headless_hand_pose(int32_t hand, XrTime time) {
+	// Each hand traces a small circle out in front of the user
+	float   t      = (float)((time - headless_start_time) / 1000000000.0);
+	float   side   = hand == 0 ? -1.0f : 1.0f;
+	XrPosef result = xr_pose_identity;
+	result.position = { side * 0.2f + 0.1f * cosf(t * 2), -0.2f + 0.1f * sinf(t * 2), -0.4f };
+	return result;
+}
+
+///////////////////////////////////////////
+
+void headless_hand_joints(int32_t hand, XrTime time, XrHandJointLocationEXT *out_joints) {
+	// A hand held flat at the controller's pose, with the wrist behind it
+	// and the fingers reaching forward, slowly curling into a fist and
+	// opening back up. Joints follow XrHandJointEXT's order: palm, wrist,
+	// then four thumb joints, and five for each finger.
+	float   t     = (float)((time - headless_start_time) / 1000000000.0);
+	float   curl  = 0.6f * (1 - cosf(t * 1.5f));
+	XrPosef root  = headless_hand_pose(hand, time);
+	float   side  = hand == 0 ? -1.0f : 1.0f;
+	const XrSpaceLocationFlags valid =
+		XR_SPACE_LOCATION_ORIENTATION_VALID_BIT | XR_SPACE_LOCATION_POSITION_VALID_BIT |
+		XR_SPACE_LOCATION_ORIENTATION_TRACKED_BIT | XR_SPACE_LOCATION_POSITION_TRACKED_BIT;
+
+	out_joints[0] = { valid, root, 0.02f };
+	out_joints[1] = { valid, root, 0.02f };
+	out_joints[1].pose.position.z += 0.08f;
+
+	uint32_t joint = 2;
+	for (int32_t finger = 0; finger < 5; finger++) {
+		int32_t    segments = finger == 0 ? 4 : 5;
+		XrVector3f at       = { root.position.x + side * (finger - 2) * 0.02f, root.position.y, root.position.z + 0.04f };
+		float      bend     = 0;
+		for (int32_t i = 0; i < segments; i++) {
+			XrHandJointLocationEXT &result = out_joints[joint++];
+			result.locationFlags    = valid;
+			result.pose.orientation = { sinf(bend / 2), 0, 0, cosf(bend / 2) };
+			result.pose.position    = at;
+			result.radius           = 0.011f - i * 0.0012f;
+			bend += i == 0 ? 0 : curl;
+			at    = { at.x, at.y + 0.03f * sinf(bend), at.z - 0.03f * cosf(bend) };
+		}
+	}
+}
+
+///////////////////////////////////////////
+
+XrPosef headless_head_pose(XrTime time) {
+	// Slowly look left and right, so what's visible keeps changing
+	float   t      = (float)((time - headless_start_time) / 1000000000.0);
+	float   yaw    = 0.3f * sinf(t * 0.5f);
+	XrPosef result = xr_pose_identity;
+	result.orientation = { 0, sinf(yaw / 2), 0, cosf(yaw / 2) };
+	return result;
+}
+
+///////////////////////////////////////////
+
+int32_t headless_path_hand(XrPath path) {
+	if (path == XR_NULL_PATH || path > headless_paths.size()) return -1;
+	const string &str = headless_paths[path - 1];
+	if (str == "/user/hand/left" ) return 0;
+	if (str == "/user/hand/right") return 1;
+	return -1;
+}
+
+///////////////////////////////////////////
+
+bool headless_replay_load(headless_replay_t &replay, const char *filename) {
+	FILE *fp = nullptr;
+	if (fopen_s(&fp, filename, "rb") != 0)
+		return false;
+	vector<uint8_t> data;
+	uint8_t         chunk[64 * 1024];
+	size_t          read;
+	while ((read = fread(chunk, 1, sizeof(chunk), fp)) > 0)
+		data.insert(data.end(), chunk, chunk + read);
+	fclose(fp);
+
+	session_file_header_t header;
+	if (data.size() < sizeof(header))
+		return false;
+	memcpy(&header, data.data(), sizeof(header));
+	if (header.magic != session_file_magic || header.version != session_file_version)
+		return false;
+
+	// Records we don't know about get skipped, and so does a partial one
+	// at the end, which is what a crash while recording leaves behind.
+	size_t at = sizeof(header);
+	while (at + sizeof(session_record_t) <= data.size()) {
+		session_record_t record;
+		memcpy(&record, &data[at], sizeof(record));
+		const uint8_t *body = &data[at + sizeof(record)];
+		if (record.size > data.size() - at - sizeof(record))
+			break;
+		switch (record.type) {
+		case session_type_frame: {
+			session_frame_t frame;
+			if (record.size < sizeof(frame)) break;
+			memcpy(&frame, body, sizeof(frame));
+			replay.frames.push_back(frame);
+		} break;
+		case session_type_event: {
+			session_event_t event;
+			if (record.size < sizeof(event)) break;
+			memcpy(&event, body, sizeof(event));
+			replay.events.push_back(event);
+		} break;
+		case session_type_action: {
+			session_action_t action;
+			if (record.size < sizeof(action)) break;
+			memcpy(&action, body, sizeof(action));
+			replay.actions.push_back(action);
+		} break;
+		case session_type_locate: {
+			session_locate_t locate;
+			if (record.size < sizeof(locate)) break;
+			memcpy(&locate, body, sizeof(locate));
+			replay.locates.push_back(locate);
+		} break;
+		case session_type_views: {
+			session_views_t views;
+			if (record.size < sizeof(views)) break;
+			memcpy(&views, body, sizeof(views));
+			if (record.size < sizeof(views) + views.count * sizeof(session_view_t)) break;
+			replay.views     .push_back(views);
+			replay.view_first.push_back((uint32_t)replay.view_poses.size());
+			for (uint32_t i = 0; i < views.count; i++) {
+				session_view_t view;
+				memcpy(&view, body + sizeof(views) + i * sizeof(view), sizeof(view));
+				replay.view_poses.push_back(view);
+			}
+		} break;
+		default: break;
+		}
+		at += sizeof(record) + record.size;
+	}
+	if (replay.frames.empty())
+		return false;
+
+	// The replay ends where the recorded session did. If the recording
+	// stopped before the session did, we stop it ourselves at the end.
+	bool ended = false;
+	for (size_t i = 0; i < replay.events.size() && !ended; i++) {
+		const session_event_t &event = replay.events[i];
+		ended = event.type == XR_TYPE_EVENT_DATA_INSTANCE_LOSS_PENDING ||
+			(event.type == XR_TYPE_EVENT_DATA_SESSION_STATE_CHANGED &&
+			(event.state == XR_SESSION_STATE_STOPPING || event.state == XR_SESSION_STATE_EXITING || event.state == XR_SESSION_STATE_LOSS_PENDING));
+		if (ended)
+			replay.events.resize(i + 1);
+	}
+	if (!ended)
+		replay.events.push_back({ replay.frames.size(), XR_TYPE_EVENT_DATA_SESSION_STATE_CHANGED, XR_SESSION_STATE_STOPPING, replay.frames.back().display_time });
+
+	// Anything can be located more than once, so equal times keep the
+	// order they were recorded in.
+	stable_sort(replay.locates.begin(), replay.locates.end(), [](const session_locate_t &a, const session_locate_t &b) {
+		return a.hand != b.hand ? a.hand < b.hand : a.time < b.time; });
+	replay.locate_used.assign(replay.locates.size(), false);
+	replay.action_state.assign(header.action_count * _countof(xr_subaction_names), session_action_t{});
+	replay.active = true;
+	return true;
+}
+
+///////////////////////////////////////////
+
+const session_action_t *headless_replay_action(XrAction action, XrPath subaction_path) {
+	int32_t subaction = headless_path_hand(subaction_path);
+	if (subaction < 0)
+		return nullptr;
+	size_t slot = ((uintptr_t)action - 1) * _countof(xr_subaction_names) + subaction;
+	return slot < headless_replay.action_state.size() ? &headless_replay.action_state[slot] : nullptr;
+}
+
+///////////////////////////////////////////
+
+void headless_replay_locate(int32_t hand, XrTime time, XrSpaceLocation *location) {
+	// The same time often gets located more than once, like when hands
+	// are latched right before drawing, and each of those gets what was
+	// recorded for it, in order. Times the recording doesn't have, like
+	// the sampler's, are blended from the ones on either side.
+	lock_guard<mutex>         lock(headless_replay.lock);
+	vector<session_locate_t> &locates = headless_replay.locates;
+	session_locate_t key = {};
+	key.hand = (uint32_t)hand;
+	key.time = time;
+	auto range = equal_range(locates.begin(), locates.end(), key, [](const session_locate_t &a, const session_locate_t &b) {
+		return a.hand != b.hand ? a.hand < b.hand : a.time < b.time; });
+	size_t next = range.first - locates.begin();
+	if (range.first != range.second) {
+		size_t last = range.second - locates.begin() - 1;
+		while (next < last && headless_replay.locate_used[next])
+			next++;
+		headless_replay.locate_used[next] = true;
+		location->pose          = locates[next].pose;
+		location->locationFlags = locates[next].flags;
+		return;
+	}
+
+	bool has_prev = next > 0              && locates[next - 1].hand == (uint32_t)hand;
+	bool has_next = next < locates.size() && locates[next    ].hand == (uint32_t)hand;
+	if (!has_prev || !has_next) {
+		const session_locate_t *nearest = has_prev ? &locates[next - 1] : (has_next ? &locates[next] : nullptr);
+		location->pose          = nearest != nullptr ? nearest->pose  : xr_pose_identity;
+		location->locationFlags = nearest != nullptr ? nearest->flags : 0;
+		return;
+	}
+	const session_locate_t &a = locates[next - 1];
+	const session_locate_t &b = locates[next];
+	float t = (float)(time - a.time) / (float)(b.time - a.time);
+	location->pose.position = {
+		a.pose.position.x + (b.pose.position.x - a.pose.position.x) * t,
+		a.pose.position.y + (b.pose.position.y - a.pose.position.y) * t,
+		a.pose.position.z + (b.pose.position.z - a.pose.position.z) * t };
+	location->pose.orientation = math_quat_slerp(a.pose.orientation, b.pose.orientation, t);
+	location->locationFlags    = a.flags & b.flags;
+}
+
+///////////////////////////////////////////
+
+XRAPI_ATTR XrResult XRAPI_CALL xrEnumerateInstanceExtensionProperties(const char *, uint32_t capacity, uint32_t *count, XrExtensionProperties *properties) {
+	const char *extensions[] = { XR_KHR_D3D11_ENABLE_EXTENSION_NAME, XR_KHR_COMPOSITION_LAYER_DEPTH_EXTENSION_NAME,
+#ifdef XR_KHR_locate_spaces
+		XR_KHR_LOCATE_SPACES_EXTENSION_NAME,
+#endif
+		XR_EXT_HAND_TRACKING_EXTENSION_NAME,
+#ifdef XR_USE_PLATFORM_WIN32
+		XR_KHR_WIN32_CONVERT_PERFORMANCE_COUNTER_TIME_EXTENSION_NAME,
+#else
+		XR_KHR_CONVERT_TIMESPEC_TIME_EXTENSION_NAME,
+#endif
+	};
+	*count = _countof(extensions);
+	for (uint32_t i = 0; i < capacity && i < *count; i++) {
+		strcpy_s(properties[i].extensionName, extensions[i]);
+		properties[i].extensionVersion = 1;
+	}
+	return XR_SUCCESS;
+}
+
+XRAPI_ATTR XrResult XRAPI_CALL xrCreateInstance(const XrInstanceCreateInfo *, XrInstance *instance) {
+	if (app_config_replay_file != nullptr) {
+		if (!headless_replay_load(headless_replay, app_config_replay_file)) {
+			printf("Headless: couldn't load session recording '%s'\n", app_config_replay_file);
+			return XR_ERROR_INITIALIZATION_FAILED;
+		}
+		printf("Headless: replaying %zu frames from '%s'%s\n", headless_replay.frames.size(), app_config_replay_file, app_config_replay_realtime ? " in real time" : "");
+	}
+	*instance = (XrInstance)1;
+	return XR_SUCCESS;
+}
+
+XRAPI_ATTR XrResult XRAPI_CALL xrDestroyInstance(XrInstance) {
+	return XR_SUCCESS;
+}
+
+#ifdef XR_KHR_locate_spaces
+XrResult XRAPI_CALL headless_xrLocateSpacesKHR(XrSession, const XrSpacesLocateInfoKHR *info, XrSpaceLocationsKHR *locations) {
+	for (uint32_t i = 0; i < info->spaceCount && i < locations->locationCount; i++) {
+		XrSpaceLocation location = { XR_TYPE_SPACE_LOCATION };
+		xrLocateSpace(info->spaces[i], info->baseSpace, info->time, &location);
+		locations->locations[i].locationFlags = location.locationFlags;
+		locations->locations[i].pose          = location.pose;
+	}
+	return XR_SUCCESS;
+}
+#endif
+
+XrResult XRAPI_CALL headless_xrCreateHandTrackerEXT(XrSession, const XrHandTrackerCreateInfoEXT *info, XrHandTrackerEXT *tracker) {
+	*tracker = (XrHandTrackerEXT)(uintptr_t)info->hand;
+	return XR_SUCCESS;
+}
+
+XrResult XRAPI_CALL headless_xrDestroyHandTrackerEXT(XrHandTrackerEXT) {
+	return XR_SUCCESS;
+}
+
+XrResult XRAPI_CALL headless_xrLocateHandJointsEXT(XrHandTrackerEXT tracker, const XrHandJointsLocateInfoEXT *info, XrHandJointLocationsEXT *locations) {
+	// Every so often the right hand goes out of view for a moment
+	// Recordings don't have joints, so a replay doesn't either.
+	int32_t hand = (uintptr_t)tracker == XR_HAND_LEFT_EXT ? 0 : 1;
+	locations->isActive = !headless_replay.active && !(hand == 1 && headless_frame % headless_hand_lost_every < headless_hand_lost_for);
+	if (locations->jointCount < XR_HAND_JOINT_COUNT_EXT)
+		return XR_ERROR_VALIDATION_FAILURE;
+	if (locations->isActive)
+		headless_hand_joints(hand, info->time, locations->jointLocations);
+	return XR_SUCCESS;
+}
+
+// Time only moves when a frame does, so now is always the current frame
+#ifdef XR_USE_PLATFORM_WIN32
+XrResult XRAPI_CALL headless_xrConvertWin32PerformanceCounterToTimeKHR(XrInstance, const LARGE_INTEGER *, XrTime *time) {
+	*time = headless_time();
+	return XR_SUCCESS;
+}
+#else
+XrResult XRAPI_CALL headless_xrConvertTimespecTimeToTimeKHR(XrInstance, const timespec *, XrTime *time) {
+	*time = headless_time();
+	return XR_SUCCESS;
+}
+#endif
+
+XRAPI_ATTR XrResult XRAPI_CALL xrGetInstanceProcAddr(XrInstance, const char *name, PFN_xrVoidFunction *function) {
+	// Only xrLocateSpacesKHR, time conversion, and hand tracking are here!
+	// The sample checks for null before using the others, and skips the
+	// D3D11 requirements entirely when headless.
+	const struct { const char *name; PFN_xrVoidFunction function; } functions[] = {
+#ifdef XR_KHR_locate_spaces
+		{ "xrLocateSpacesKHR",       (PFN_xrVoidFunction)headless_xrLocateSpacesKHR       },
+#endif
+#ifdef XR_USE_PLATFORM_WIN32
+		{ "xrConvertWin32PerformanceCounterToTimeKHR", (PFN_xrVoidFunction)headless_xrConvertWin32PerformanceCounterToTimeKHR },
+#else
+		{ "xrConvertTimespecTimeToTimeKHR", (PFN_xrVoidFunction)headless_xrConvertTimespecTimeToTimeKHR },
+#endif
+		{ "xrCreateHandTrackerEXT",  (PFN_xrVoidFunction)headless_xrCreateHandTrackerEXT  },
+		{ "xrDestroyHandTrackerEXT", (PFN_xrVoidFunction)headless_xrDestroyHandTrackerEXT },
+		{ "xrLocateHandJointsEXT",   (PFN_xrVoidFunction)headless_xrLocateHandJointsEXT   }, };
+	for (size_t i = 0; i < _countof(functions); i++) {
+		if (strcmp(name, functions[i].name) == 0) {
+			*function = functions[i].function;
+			return XR_SUCCESS;
+		}
+	}
+	*function = nullptr;
+	return XR_ERROR_FUNCTION_UNSUPPORTED;
+}
+
+XRAPI_ATTR XrResult XRAPI_CALL xrGetSystem(XrInstance, const XrSystemGetInfo *, XrSystemId *system_id) {
+	*system_id = 1;
+	return XR_SUCCESS;
+}
+
+XRAPI_ATTR XrResult XRAPI_CALL xrGetSystemProperties(XrInstance, XrSystemId, XrSystemProperties *properties) {
+	// Walk the chain for the one extension struct we know about
+	for (XrBaseOutStructure *next = (XrBaseOutStructure *)properties->next; next != nullptr; next = next->next) {
+		if (next->type == XR_TYPE_SYSTEM_HAND_TRACKING_PROPERTIES_EXT)
+			((XrSystemHandTrackingPropertiesEXT *)next)->supportsHandTracking = XR_TRUE;
+	}
+	return XR_SUCCESS;
+}
+
+XRAPI_ATTR XrResult XRAPI_CALL xrEnumerateEnvironmentBlendModes(XrInstance, XrSystemId, XrViewConfigurationType, uint32_t capacity, uint32_t *count, XrEnvironmentBlendMode *modes) {
+	*count = 1;
+	if (capacity > 0) modes[0] = XR_ENVIRONMENT_BLEND_MODE_OPAQUE;
+	return XR_SUCCESS;
+}
+
+XRAPI_ATTR XrResult XRAPI_CALL xrEnumerateViewConfigurationViews(XrInstance, XrSystemId, XrViewConfigurationType type, uint32_t capacity, uint32_t *count, XrViewConfigurationView *views) {
+	*count = type == XR_VIEW_CONFIGURATION_TYPE_PRIMARY_STEREO ? 2 : 1;
+	for (uint32_t i = 0; i < capacity && i < *count; i++) {
+		views[i].recommendedImageRectWidth       = headless_width;
+		views[i].recommendedImageRectHeight      = headless_height;
+		views[i].recommendedSwapchainSampleCount = 1;
+		views[i].maxImageRectWidth               = headless_width  * 2;
+		views[i].maxImageRectHeight              = headless_height * 2;
+		views[i].maxSwapchainSampleCount         = 1;
+	}
+	return XR_SUCCESS;
+}
+
+///////////////////////////////////////////
+
+XRAPI_ATTR XrResult XRAPI_CALL xrCreateSession(XrInstance, const XrSessionCreateInfo *, XrSession *session) {
+	*session = (XrSession)1;
+	return XR_SUCCESS;
+}
+
+XRAPI_ATTR XrResult XRAPI_CALL xrDestroySession(XrSession) {
+	double ms = chrono::duration<double, milli>(chrono::high_resolution_clock::now() - headless_begin).count();
+	printf("Headless: %llu frames in %.1fms, %.3fms/frame, %llu views with depth\n", (unsigned long long)headless_frame, ms, headless_frame > 0 ? ms / headless_frame : 0, (unsigned long long)headless_depth_views);
+	if (headless_replay.active)
+		printf("Headless: replayed %llu of %zu recorded frames\n", (unsigned long long)min((uint64_t)headless_frame, (uint64_t)headless_replay.frames.size()), headless_replay.frames.size());
+	return XR_SUCCESS;
+}
+
+XRAPI_ATTR XrResult XRAPI_CALL xrBeginSession(XrSession, const XrSessionBeginInfo *) {
+	headless_begin = chrono::high_resolution_clock::now();
+	return XR_SUCCESS;
+}
+
+XRAPI_ATTR XrResult XRAPI_CALL xrEndSession(XrSession) {
+	headless_push_event(XR_SESSION_STATE_IDLE,    headless_time());
+	headless_push_event(XR_SESSION_STATE_EXITING, headless_time());
+	return XR_SUCCESS;
+}
+
+XRAPI_ATTR XrResult XRAPI_CALL xrPollEvent(XrInstance, XrEventDataBuffer *event_data) {
+	// Queue up any scripted state changes that are due, or when replaying,
+	// the recorded ones. Losing the instance ends the app the same way
+	// losing the session does, and it ignores every other kind of event.
+	if (headless_replay.active) {
+		while (headless_replay.event_at < headless_replay.events.size() && headless_replay.events[headless_replay.event_at].frame <= headless_frame) {
+			const session_event_t &event = headless_replay.events[headless_replay.event_at++];
+			if      (event.type == XR_TYPE_EVENT_DATA_SESSION_STATE_CHANGED)  headless_push_event(event.state, event.time);
+			else if (event.type == XR_TYPE_EVENT_DATA_INSTANCE_LOSS_PENDING) headless_push_event(XR_SESSION_STATE_LOSS_PENDING, event.time);
+		}
+	}
+	while (!headless_replay.active && headless_script_at < _countof(headless_script) && headless_script[headless_script_at].frame <= headless_frame) {
+		headless_push_event(headless_script[headless_script_at].state, headless_time());
+		headless_script_at++;
+	}
+	if (headless_events.empty())
+		return XR_EVENT_UNAVAILABLE;
+
+	*(XrEventDataSessionStateChanged *)event_data = headless_events.front();
+	headless_events.erase(headless_events.begin());
+	return XR_SUCCESS;
+}
+
+///////////////////////////////////////////
+
+XRAPI_ATTR XrResult XRAPI_CALL xrWaitFrame(XrSession, const XrFrameWaitInfo *, XrFrameState *frame_state) {
+	// A replay hands out the recorded frames, either right away, or at
+	// the same pace they were recorded at.
+	if (headless_replay.active) {
+		session_frame_t frame = headless_replay_frame(headless_frame);
+		if (app_config_replay_realtime) {
+			if (headless_frame == 0)
+				headless_replay.start = chrono::steady_clock::now();
+			this_thread::sleep_until(headless_replay.start + chrono::nanoseconds(frame.display_time - headless_replay.frames[0].display_time));
+		}
+		headless_frame += 1;
+		frame_state->predictedDisplayTime   = frame.display_time;
+		frame_state->predictedDisplayPeriod = frame.period;
+		frame_state->shouldRender           = frame.should_render;
+		return XR_SUCCESS;
+	}
+
+	// No waiting! Just step time forward by exactly one frame.
+	headless_frame += 1;
+	frame_state->predictedDisplayTime   = headless_time() + headless_display_lead * headless_period;
+	frame_state->predictedDisplayPeriod = headless_period;
+	frame_state->shouldRender           = XR_TRUE;
+	return XR_SUCCESS;
+}
+
+XRAPI_ATTR XrResult XRAPI_CALL xrBeginFrame(XrSession, const XrFrameBeginInfo *) {
+	return XR_SUCCESS;
+}
+
+XRAPI_ATTR XrResult XRAPI_CALL xrEndFrame(XrSession, const XrFrameEndInfo *info) {
+	// Keep track of how many views came with depth, to check we get it
+	for (uint32_t i = 0; i < info->layerCount; i++) {
+		if (info->layers[i]->type != XR_TYPE_COMPOSITION_LAYER_PROJECTION)
+			continue;
+		const XrCompositionLayerProjection *layer = (const XrCompositionLayerProjection *)info->layers[i];
+		for (uint32_t v = 0; v < layer->viewCount; v++) {
+			const XrCompositionLayerDepthInfoKHR *depth = (const XrCompositionLayerDepthInfoKHR *)layer->views[v].next;
+			if (depth && depth->type == XR_TYPE_COMPOSITION_LAYER_DEPTH_INFO_KHR && depth->subImage.swapchain != XR_NULL_HANDLE)
+				headless_depth_views += 1;
+		}
+	}
+	return XR_SUCCESS;
+}
+
+XRAPI_ATTR XrResult XRAPI_CALL xrLocateViews(XrSession, const XrViewLocateInfo *info, XrViewState *state, uint32_t capacity, uint32_t *count, XrView *views) {
+	// Like a validating runtime, views have to be big enough and typed
+	*count = info->viewConfigurationType == XR_VIEW_CONFIGURATION_TYPE_PRIMARY_STEREO ? 2 : 1;
+	if (capacity == 0)
+		return XR_SUCCESS;
+	if (capacity < *count)
+		return XR_ERROR_SIZE_INSUFFICIENT;
+	for (uint32_t i = 0; i < *count; i++) {
+		if (views[i].type != XR_TYPE_VIEW)
+			return XR_ERROR_VALIDATION_FAILURE;
+	}
+	state->viewStateFlags = XR_VIEW_STATE_ORIENTATION_VALID_BIT | XR_VIEW_STATE_POSITION_VALID_BIT;
+
+	// Replays use the recorded views closest to the time we're asked for
+	uint32_t recorded = 0;
+	if (headless_replay.active) {
+		const vector<session_views_t> &list = headless_replay.views;
+		auto at = lower_bound(list.begin(), list.end(), info->displayTime, [](const session_views_t &views, XrTime time) { return views.display_time < time; });
+		if (at == list.end() || (at->display_time != info->displayTime && at != list.begin()))
+			at = at == list.begin() ? at : at - 1;
+		if (at != list.end()) {
+			const session_view_t *poses = &headless_replay.view_poses[headless_replay.view_first[at - list.begin()]];
+			state->viewStateFlags = at->flags;
+			recorded = min(at->count, min(capacity, *count));
+			for (uint32_t i = 0; i < recorded; i++) {
+				views[i].pose = poses[i].pose;
+				views[i].fov  = poses[i].fov;
+			}
+		}
+	}
+
+	XrPosef head = headless_head_pose(info->displayTime);
+	for (uint32_t i = recorded; i < capacity && i < *count; i++) {
+		float      eye    = *count == 1 ? 0 : (i == 0 ? -0.032f : 0.032f);
+		XrVector3f offset = math_quat_rotate(head.orientation, { eye, 0, 0 });
+		views[i].pose = head;
+		views[i].pose.position = { head.position.x + offset.x, head.position.y + offset.y, head.position.z + offset.z };
+		views[i].fov  = { -0.8f, 0.8f, 0.8f, -0.8f };
+	}
+	return XR_SUCCESS;
+}
+
+///////////////////////////////////////////
+
+XRAPI_ATTR XrResult XRAPI_CALL xrEnumerateSwapchainFormats(XrSession, uint32_t capacity, uint32_t *count, int64_t *formats) {
+	// Like most runtimes, we'd prefer sRGB, but can do a few others too
+	const int64_t supported[] = { DXGI_FORMAT_R8G8B8A8_UNORM_SRGB, DXGI_FORMAT_B8G8R8A8_UNORM_SRGB, DXGI_FORMAT_R8G8B8A8_UNORM, DXGI_FORMAT_B8G8R8A8_UNORM,
+		DXGI_FORMAT_D32_FLOAT, DXGI_FORMAT_D24_UNORM_S8_UINT, DXGI_FORMAT_D16_UNORM };
+	*count = _countof(supported);
+	for (uint32_t i = 0; i < capacity && i < *count; i++)
+		formats[i] = supported[i];
+	return XR_SUCCESS;
+}
+
+XRAPI_ATTR XrResult XRAPI_CALL xrCreateSwapchain(XrSession, const XrSwapchainCreateInfo *info, XrSwapchain *swapchain) {
+	// There's no graphics device, so swapchain images are just CPU memory
+	headless_swapchain_t result = {};
+	result.width      = info->width;
+	result.height     = info->height;
+	result.array_size = info->arraySize;
+	result.images.resize(headless_image_count, vector<uint8_t>((size_t)info->width * info->height * info->arraySize * 4));
+	headless_swapchains.push_back(result);
+	*swapchain = (XrSwapchain)(uintptr_t)headless_swapchains.size();
+	return XR_SUCCESS;
+}
+
+XRAPI_ATTR XrResult XRAPI_CALL xrDestroySwapchain(XrSwapchain swapchain) {
+	headless_swapchains[(uintptr_t)swapchain - 1].images.clear();
+	return XR_SUCCESS;
+}
+
+XRAPI_ATTR XrResult XRAPI_CALL xrEnumerateSwapchainImages(XrSwapchain, uint32_t capacity, uint32_t *count, XrSwapchainImageBaseHeader *images) {
+	*count = headless_image_count;
+	XrSwapchainImageD3D11KHR *d3d_images = (XrSwapchainImageD3D11KHR *)images;
+	for (uint32_t i = 0; i < capacity && i < *count; i++)
+		d3d_images[i].texture = nullptr;
+	return XR_SUCCESS;
+}
+
+XRAPI_ATTR XrResult XRAPI_CALL xrAcquireSwapchainImage(XrSwapchain swapchain, const XrSwapchainImageAcquireInfo *, uint32_t *index) {
+	headless_swapchain_t &chain = headless_swapchains[(uintptr_t)swapchain - 1];
+	*index = chain.next_image;
+	chain.next_image = (chain.next_image + 1) % headless_image_count;
+	return XR_SUCCESS;
+}
+
+XRAPI_ATTR XrResult XRAPI_CALL xrWaitSwapchainImage(XrSwapchain, const XrSwapchainImageWaitInfo *) {
+	return XR_SUCCESS;
+}
+
+XRAPI_ATTR XrResult XRAPI_CALL xrReleaseSwapchainImage(XrSwapchain, const XrSwapchainImageReleaseInfo *) {
+	return XR_SUCCESS;
+}
+
+///////////////////////////////////////////
+
+XRAPI_ATTR XrResult XRAPI_CALL xrCreateReferenceSpace(XrSession, const XrReferenceSpaceCreateInfo *info, XrSpace *space) {
+	headless_spaces.push_back({ -1, info->poseInReferenceSpace });
+	*space = (XrSpace)(uintptr_t)headless_spaces.size();
+	return XR_SUCCESS;
+}
+
+XRAPI_ATTR XrResult XRAPI_CALL xrCreateActionSpace(XrSession, const XrActionSpaceCreateInfo *info, XrSpace *space) {
+	headless_spaces.push_back({ headless_path_hand(info->subactionPath), info->poseInActionSpace });
+	*space = (XrSpace)(uintptr_t)headless_spaces.size();
+	return XR_SUCCESS;
+}
+
+XRAPI_ATTR XrResult XRAPI_CALL xrDestroySpace(XrSpace) {
+	return XR_SUCCESS;
+}
+
+XRAPI_ATTR XrResult XRAPI_CALL xrLocateSpace(XrSpace space, XrSpace, XrTime time, XrSpaceLocation *location) {
+	// Everything is located relative to the one reference space, and we
+	// ignore the pose offsets, since the sample always uses identity.
+	const headless_space_t &info = headless_spaces[(uintptr_t)space - 1];
+	if (headless_replay.active && info.hand >= 0) {
+		headless_replay_locate(info.hand, time, location);
+		return XR_SUCCESS;
+	}
+	location->pose          = info.hand >= 0 ? headless_hand_pose(info.hand, time) : xr_pose_identity;
+	location->locationFlags =
+		XR_SPACE_LOCATION_ORIENTATION_VALID_BIT | XR_SPACE_LOCATION_POSITION_VALID_BIT |
+		XR_SPACE_LOCATION_ORIENTATION_TRACKED_BIT | XR_SPACE_LOCATION_POSITION_TRACKED_BIT;
+	return XR_SUCCESS;
+}
+
+///////////////////////////////////////////
+
+XRAPI_ATTR XrResult XRAPI_CALL xrStringToPath(XrInstance, const char *str, XrPath *path) {
+	for (size_t i = 0; i < headless_paths.size(); i++) {
+		if (headless_paths[i] == str) {
+			*path = i + 1;
+			return XR_SUCCESS;
+		}
+	}
+	headless_paths.push_back(str);
+	*path = headless_paths.size();
+	return XR_SUCCESS;
+}
+
+XRAPI_ATTR XrResult XRAPI_CALL xrCreateActionSet(XrInstance, const XrActionSetCreateInfo *, XrActionSet *action_set) {
+	*action_set = (XrActionSet)1;
+	return XR_SUCCESS;
+}
+
+XRAPI_ATTR XrResult XRAPI_CALL xrDestroyActionSet(XrActionSet) {
+	return XR_SUCCESS;
+}
+
+XRAPI_ATTR XrResult XRAPI_CALL xrCreateAction(XrActionSet, const XrActionCreateInfo *, XrAction *action) {
+	// Numbered in the order they're made, which is their row in the app's
+	// action table, and that's how recordings know them.
+	*action = (XrAction)(uintptr_t)++headless_actions;
+	return XR_SUCCESS;
+}
+
+XRAPI_ATTR XrResult XRAPI_CALL xrSuggestInteractionProfileBindings(XrInstance, const XrInteractionProfileSuggestedBinding *) {
+	return XR_SUCCESS;
+}
+
+XRAPI_ATTR XrResult XRAPI_CALL xrAttachSessionActionSets(XrSession, const XrSessionActionSetsAttachInfo *) {
+	return XR_SUCCESS;
+}
+
+XRAPI_ATTR XrResult XRAPI_CALL xrSyncActions(XrSession, const XrActionsSyncInfo *) {
+	// Replays catch up on every recorded change up to this frame
+	if (headless_replay.active) {
+		while (headless_replay.action_at < headless_replay.actions.size() && headless_replay.actions[headless_replay.action_at].frame <= headless_frame) {
+			const session_action_t &action = headless_replay.actions[headless_replay.action_at++];
+			size_t slot = (size_t)action.action * _countof(xr_subaction_names) + action.subaction;
+			if (slot < headless_replay.action_state.size())
+				headless_replay.action_state[slot] = action;
+		}
+		return XR_SUCCESS;
+	}
+
+	// Every so often, one of the hands presses select for a single frame
+	for (int32_t hand = 0; hand < 2; hand++) {
+		bool pressed = headless_frame > 0 && headless_frame % headless_select_every == 0 &&
+			(int32_t)(headless_frame / headless_select_every % 2) == hand;
+		headless_select_prev[hand] = headless_select[hand];
+		headless_select     [hand] = pressed;
+		if (headless_select[hand] != headless_select_prev[hand])
+			headless_select_time[hand] = headless_time();
+	}
+	return XR_SUCCESS;
+}
+
+XRAPI_ATTR XrResult XRAPI_CALL xrGetActionStatePose(XrSession, const XrActionStateGetInfo *info, XrActionStatePose *state) {
+	if (headless_replay.active) {
+		const session_action_t *recorded = headless_replay_action(info->action, info->subactionPath);
+		state->isActive = recorded != nullptr ? recorded->active : XR_FALSE;
+		return XR_SUCCESS;
+	}
+	state->isActive = headless_path_hand(info->subactionPath) >= 0;
+	return XR_SUCCESS;
+}
+
+XRAPI_ATTR XrResult XRAPI_CALL xrGetActionStateFloat(XrSession, const XrActionStateGetInfo *info, XrActionStateFloat *state) {
+	if (headless_replay.active) {
+		const session_action_t *recorded = headless_replay_action(info->action, info->subactionPath);
+		state->isActive = XR_FALSE;
+		if (recorded != nullptr) {
+			state->isActive             = recorded->active;
+			state->currentState         = recorded->value;
+			state->changedSinceLastSync = recorded->changed;
+			state->lastChangeTime       = recorded->changed_at;
+		}
+		return XR_SUCCESS;
+	}
+	// There aren't any float inputs on the simple controller
+	state->isActive = XR_FALSE;
+	return XR_SUCCESS;
+}
+
+XRAPI_ATTR XrResult XRAPI_CALL xrGetActionStateBoolean(XrSession, const XrActionStateGetInfo *info, XrActionStateBoolean *state) {
+	int32_t hand = headless_path_hand(info->subactionPath);
+	if (hand < 0) return XR_ERROR_PATH_INVALID;
+	if (headless_replay.active) {
+		const session_action_t *recorded = headless_replay_action(info->action, info->subactionPath);
+		state->isActive = XR_FALSE;
+		if (recorded != nullptr) {
+			state->isActive             = recorded->active;
+			state->currentState         = recorded->current;
+			state->changedSinceLastSync = recorded->changed;
+			state->lastChangeTime       = recorded->changed_at;
+		}
+		return XR_SUCCESS;
+	}
+	state->isActive             = XR_TRUE;
+	state->currentState         = headless_select[hand];
+	state->changedSinceLastSync = headless_select[hand] != headless_select_prev[hand];
+	state->lastChangeTime       = headless_select_time[hand];
+	return XR_SUCCESS;
+}
+
+#endif
@@ -0,0 +1,28 @@
+#pragma once
+
+// Each test is its own little program that includes the whole sample, so
+// it can call any of its functions directly. They build with XR_HEADLESS,
+// so the stand-in runtime is there for anything that needs OpenXR.
+#define APP_NO_MAIN
+#include "main.cpp"
+
+int test_failures = 0;
+
+// Prints the failed condition with where it was, and keeps going so one
+// run shows every failure rather than just the first.
+#define TEST_CHECK(condition) test_check((condition), #condition, __FILE__, __LINE__)
+
+bool test_check(bool passed, const char *condition, const char *file, int line) {
+	if (!passed) {
+		printf("%s(%d): FAILED %s\n", file, line, condition);
+		test_failures += 1;
+	}
+	return passed;
+}
+
+// What main should return: zero only if every check passed
+int test_finish(const char *name) {
+	if (test_failures == 0) printf("%s: passed\n", name);
+	else                    printf("%s: %d checks FAILED\n", name, test_failures);
+	return test_failures == 0 ? 0 : 1;
+}
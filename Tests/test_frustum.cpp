@@ -0,0 +1,144 @@
+#include "test.h"
+
+// Two eyes 64mm apart, both looking down -Z with a 90 degree field of
+// view. That puts each side plane of the combined frustum at 45 degrees
+// through the outside eye, and the near and far planes straight across.
+const float test_ipd    = 0.064f;
+const float test_near   = 0.1f;
+const float test_far    = 10;
+const float test_radius = 0.05f;
+
+struct test_sphere_t {
+	const char *name;
+	XrVector3f  center;
+	bool        keep;
+};
+
+///////////////////////////////////////////
+
+XrView test_view(float x, XrFovf fov) {
+	XrView view = { XR_TYPE_VIEW };
+	view.pose             = xr_pose_identity;
+	view.pose.position.x  = x;
+	view.fov              = fov;
+	return view;
+}
+
+///////////////////////////////////////////
+
+// Is the sphere at least partly inside one eye's own frustum? Tested in
+// the eye's space, against planes straight from its fov angles.
+bool test_eye_sees(const XrView &view, XrVector3f center, float radius) {
+	const XrQuaternionf &q       = view.pose.orientation;
+	const XrQuaternionf  inverse = { -q.x, -q.y, -q.z, q.w };
+	XrVector3f p = { center.x - view.pose.position.x, center.y - view.pose.position.y, center.z - view.pose.position.z };
+	p = math_quat_rotate(inverse, p);
+	const XrFovf &fov = view.fov;
+	float dists[6] = {
+		 cosf(fov.angleLeft)  * p.x + sinf(fov.angleLeft)  * p.z,
+		-cosf(fov.angleRight) * p.x - sinf(fov.angleRight) * p.z,
+		 cosf(fov.angleDown)  * p.y + sinf(fov.angleDown)  * p.z,
+		-cosf(fov.angleUp)    * p.y - sinf(fov.angleUp)    * p.z,
+		-p.z - test_near,
+		 p.z + test_far };
+	for (int32_t i = 0; i < 6; i++) {
+		if (dists[i] + radius < 0) return false;
+	}
+	return true;
+}
+
+///////////////////////////////////////////
+
+// Culls the spheres in one call, repeated a few times over so each one
+// lands in both the SIMD batches and the scalar tail.
+void test_cull(const math_frustum_t &frustum, const test_sphere_t *spheres, size_t count) {
+	const int32_t    repeat = 5;
+	vector<XrPosef>  poses(count * repeat, xr_pose_identity);
+	vector<uint32_t> visible(poses.size());
+	for (size_t i = 0; i < poses.size(); i++)
+		poses[i].position = spheres[i % count].center;
+
+	size_t        visible_count = math_frustum_cull(frustum, poses.data(), poses.size(), test_radius, visible.data());
+	vector<bool> kept(poses.size(), false);
+	for (size_t i = 0; i < visible_count; i++)
+		kept[visible[i]] = true;
+
+	for (size_t i = 0; i < poses.size(); i++) {
+		const test_sphere_t &sphere = spheres[i % count];
+		if (kept[i] != sphere.keep)
+			printf("'%s' at index %zu was %s\n", sphere.name, i, kept[i] ? "kept" : "culled");
+		TEST_CHECK(kept[i] == sphere.keep);
+	}
+}
+
+///////////////////////////////////////////
+
+int main() {
+	const float  quarter = 3.14159265f / 4;
+	const XrFovf fov     = { -quarter, quarter, quarter, -quarter };
+	XrView views[2] = {
+		test_view(-test_ipd / 2, fov),
+		test_view( test_ipd / 2, fov) };
+	math_frustum_t frustum = math_frustum_combined(views, 2, test_near, test_far);
+
+	// The left plane runs through the left eye at 45 degrees, so at 2m out
+	// it's at x = -2 - ipd/2. A sphere's kept until its center is a whole
+	// radius past a plane, which at 45 degrees is radius * sqrt(2) along x.
+	const float edge   = 2 + test_ipd / 2;
+	const float slant  = test_radius * 1.41421356f;
+	const test_sphere_t spheres[] = {
+		{ "straight ahead",              {  0,                      0,                   -2              }, true  },
+		{ "corner of the view",          { -1.5f,                   1.5f,                -2              }, true  },
+		{ "straddling the left plane",   { -edge - slant * 0.5f,    0,                   -2              }, true  },
+		{ "past the left plane",         { -edge - slant * 1.5f,    0,                   -2              }, false },
+		{ "straddling the right plane",  {  edge + slant * 0.5f,    0,                   -2              }, true  },
+		{ "past the right plane",        {  edge + slant * 1.5f,    0,                   -2              }, false },
+		{ "straddling the top plane",    {  0,                      2 + slant * 0.5f,    -2              }, true  },
+		{ "past the top plane",          {  0,                      2 + slant * 1.5f,    -2              }, false },
+		{ "straddling the bottom plane", {  0,                    -(2 + slant * 0.5f),   -2              }, true  },
+		{ "past the bottom plane",       {  0,                    -(2 + slant * 1.5f),   -2              }, false },
+		{ "between the eyes",            {  0,                      0,                    0              }, false },
+		{ "between the eyes, in front",  {  0,                      0,                   -test_near - test_radius * 0.5f }, true },
+		{ "straddling the near plane",   {  0,                      0,                   -test_near + test_radius * 0.5f }, true },
+		{ "behind the eyes",             {  0,                      0,                    1              }, false },
+		{ "straddling the far plane",    {  0,                      0,                   -test_far - test_radius * 0.5f }, true },
+		{ "past the far plane",          {  0,                      0,                   -test_far - test_radius * 1.5f }, false },
+		{ "way past the far plane",      {  0,                      0,                   -test_far * 2   }, false },
+	};
+	test_cull(frustum, spheres, _countof(spheres));
+
+	// The combined frustum has to be conservative for views that aren't so
+	// tidy, too. Nothing either eye can see may be culled. These eyes have
+	// lopsided fields of view, and are turned outward a little.
+	const XrFovf fov_left  = { -0.94f, 0.70f, 0.82f, -0.90f };
+	const XrFovf fov_right = { -0.70f, 0.94f, 0.82f, -0.90f };
+	views[0] = test_view(-test_ipd / 2, fov_left);
+	views[1] = test_view( test_ipd / 2, fov_right);
+	views[0].pose.orientation = { 0,  sinf(0.05f), 0, cosf(0.05f) };
+	views[1].pose.orientation = { 0, -sinf(0.05f), 0, cosf(0.05f) };
+	frustum = math_frustum_combined(views, 2, test_near, test_far);
+
+	uint32_t seed = 1;
+	vector<XrPosef> poses(20000, xr_pose_identity);
+	vector<bool>    seen (poses.size());
+	for (size_t i = 0; i < poses.size(); i++) {
+		poses[i].position = { math_rand_range(seed, -15, 15), math_rand_range(seed, -15, 15), math_rand_range(seed, -12, 2) };
+		seen[i] = test_eye_sees(views[0], poses[i].position, test_radius)
+			||    test_eye_sees(views[1], poses[i].position, test_radius);
+	}
+	vector<uint32_t> visible(poses.size());
+	size_t           visible_count = math_frustum_cull(frustum, poses.data(), poses.size(), test_radius, visible.data());
+	vector<bool>     kept(poses.size(), false);
+	for (size_t i = 0; i < visible_count; i++)
+		kept[visible[i]] = true;
+	size_t wrongly_culled = 0, seen_count = 0;
+	for (size_t i = 0; i < poses.size(); i++) {
+		if (seen[i])            seen_count     += 1;
+		if (seen[i] && !kept[i]) wrongly_culled += 1;
+	}
+	TEST_CHECK(seen_count > 1000);
+	TEST_CHECK(wrongly_culled == 0);
+	TEST_CHECK(visible_count < poses.size() / 2);
+
+	return test_finish("frustum");
+}
@@ -0,0 +1,172 @@
+#include "test.h"
+
+// A made up hand, moving along a curve and turning steadily around a
+// tilted axis, so we always know exactly where it should be.
+const XrDuration test_step  = 4000000; // 250Hz
+const XrTime     test_start = 1000000000;
+const float      test_spin  = 3.0f;    // Radians per second
+const XrVector3f test_axis  = { 0.48f, 0.64f, 0.6f };
+const XrSpaceLocationFlags test_valid = XR_SPACE_LOCATION_POSITION_VALID_BIT | XR_SPACE_LOCATION_ORIENTATION_VALID_BIT;
+
+XrPosef test_truth(XrTime time) {
+	float   s = (time - test_start) / 1000000000.0f;
+	XrPosef pose;
+	pose.position    = { 0.3f * sinf(2 * s), 0.2f * cosf(3 * s), 0.1f * s };
+	pose.orientation = math_quat_from_rotation({ test_axis.x * test_spin * s, test_axis.y * test_spin * s, test_axis.z * test_spin * s });
+	return pose;
+}
+
+///////////////////////////////////////////
+
+float test_pos_error(const XrPosef &a, const XrPosef &b) {
+	float x = a.position.x - b.position.x, y = a.position.y - b.position.y, z = a.position.z - b.position.z;
+	return sqrtf(x*x + y*y + z*z);
+}
+
+///////////////////////////////////////////
+
+float test_rot_error(const XrPosef &a, const XrPosef &b) {
+	const XrQuaternionf &q = b.orientation;
+	XrVector3f r = math_quat_to_rotation(math_quat_mul(a.orientation, { -q.x, -q.y, -q.z, q.w }));
+	return sqrtf(r.x*r.x + r.y*r.y + r.z*r.z);
+}
+
+///////////////////////////////////////////
+
+int main() {
+	input_history_t *history = new input_history_t();
+	const uint64_t   count   = 375;
+	for (uint64_t i = 0; i < count; i++) {
+		XrTime time = test_start + i * test_step;
+		input_history_add(*history, time, test_truth(time), test_valid);
+	}
+	XrTime newest = test_start + (count - 1) * test_step;
+
+	// Poses the runtime couldn't vouch for, or that go back in time, stay out
+	input_history_add(*history, newest + test_step, xr_pose_identity, XR_SPACE_LOCATION_POSITION_VALID_BIT);
+	input_history_add(*history, newest + test_step, xr_pose_identity, 0);
+	input_history_add(*history, test_start,         xr_pose_identity, test_valid);
+	input_history_add(*history, newest,             xr_pose_identity, test_valid);
+	TEST_CHECK(history->sample_head.load() == count);
+
+	// On the samples themselves, and halfway between them
+	float exact_pos = 0, exact_rot = 0, mid_pos = 0, mid_rot = 0;
+	bool  all_found = true;
+	for (uint64_t i = 0; i < count - 1; i++) {
+		XrTime  time = test_start + i * test_step;
+		XrPosef pose;
+		all_found = input_history_pose(*history, time, &pose) && all_found;
+		exact_pos = max(exact_pos, test_pos_error(pose, test_truth(time)));
+		exact_rot = max(exact_rot, test_rot_error(pose, test_truth(time)));
+		all_found = input_history_pose(*history, time + test_step / 2, &pose) && all_found;
+		mid_pos = max(mid_pos, test_pos_error(pose, test_truth(time + test_step / 2)));
+		mid_rot = max(mid_rot, test_rot_error(pose, test_truth(time + test_step / 2)));
+	}
+	printf("on samples: %.7f m, %.7f rad\n", exact_pos, exact_rot);
+	printf("between:    %.7f m, %.7f rad\n", mid_pos,   mid_rot);
+	TEST_CHECK(all_found);
+	TEST_CHECK(exact_pos < 0.00001f && exact_rot < 0.001f);
+	TEST_CHECK(mid_pos   < 0.0001f  && mid_rot   < 0.001f);
+
+	// Velocity is measured across a window, so it's most true in the middle
+	// of that window.
+	XrVector3f linear, angular;
+	TEST_CHECK(input_history_velocity(*history, &linear, &angular));
+	float      mid_s    = (newest - input_velocity_window / 2 - test_start) / 1000000000.0f;
+	XrVector3f lin_true = { 0.6f * cosf(2 * mid_s), -0.6f * sinf(3 * mid_s), 0.1f };
+	XrVector3f ang_true = { test_axis.x * test_spin, test_axis.y * test_spin, test_axis.z * test_spin };
+	float lin_err = sqrtf((linear .x-lin_true.x)*(linear .x-lin_true.x) + (linear .y-lin_true.y)*(linear .y-lin_true.y) + (linear .z-lin_true.z)*(linear .z-lin_true.z));
+	float ang_err = sqrtf((angular.x-ang_true.x)*(angular.x-ang_true.x) + (angular.y-ang_true.y)*(angular.y-ang_true.y) + (angular.z-ang_true.z)*(angular.z-ang_true.z));
+	printf("velocity:   %.5f m/s, %.5f rad/s off\n", lin_err, ang_err);
+	TEST_CHECK(lin_err < 0.001f && ang_err < 0.001f);
+
+	// When tracking drops out, it guesses ahead from that velocity. The
+	// guess drifts the further ahead it goes, but not by much.
+	XrPosef          pose;
+	const XrDuration aheads   [3] = { 10000000, 30000000, 90000000 };
+	const float      pos_limit[3] = { 0.0005f,  0.001f,   0.005f   };
+	for (int32_t i = 0; i < 3; i++) {
+		TEST_CHECK(input_history_pose(*history, newest + aheads[i], &pose));
+		float pos_err = test_pos_error(pose, test_truth(newest + aheads[i]));
+		float rot_err = test_rot_error(pose, test_truth(newest + aheads[i]));
+		printf("@%2lldms:      %.5f m, %.5f rad\n", (long long)(aheads[i] / 1000000), pos_err, rot_err);
+		TEST_CHECK(pos_err < pos_limit[i] && rot_err < 0.001f);
+	}
+
+	// Past the newest sample it extrapolates, but only so far. Before the
+	// oldest, there's nothing to say.
+	TEST_CHECK( input_history_pose(*history, newest + input_extrapolate_max,     &pose));
+	TEST_CHECK(!input_history_pose(*history, newest + input_extrapolate_max + 1, &pose));
+	TEST_CHECK( input_history_pose(*history, test_start,                          &pose));
+	TEST_CHECK(!input_history_pose(*history, test_start - 1,                      &pose));
+
+	// Once the ring laps, the oldest poses are gone, and so is anything in
+	// the margin a writer could be overwriting while we read it.
+	for (uint64_t i = count; i < input_history_size + 100; i++) {
+		XrTime time = test_start + i * test_step;
+		input_history_add(*history, time, test_truth(time), test_valid);
+	}
+	uint64_t head        = history->sample_head.load();
+	XrTime   oldest_kept = test_start + (head - (input_history_size - input_history_margin)) * test_step;
+	TEST_CHECK(!input_history_pose(*history, test_start,           &pose));
+	TEST_CHECK(!input_history_pose(*history, oldest_kept - 1,      &pose));
+	TEST_CHECK( input_history_pose(*history, oldest_kept,          &pose));
+	TEST_CHECK(test_pos_error(pose, test_truth(oldest_kept)) < 0.00001f);
+
+	// Button presses come back oldest first, only the ones after 'since',
+	// and never more than the caller has room for.
+	input_history_event(*history, test_start + 10 * test_step, xr_action_select, XR_TRUE);
+	input_history_event(*history, test_start + 20 * test_step, xr_action_select, XR_FALSE);
+	input_history_event(*history, test_start + 30 * test_step, xr_action_select, XR_TRUE);
+	input_event_t events[8];
+	uint32_t      event_count = input_history_events_since(*history, test_start + 15 * test_step, events, _countof(events));
+	TEST_CHECK(event_count == 2);
+	TEST_CHECK(events[0].time == test_start + 20 * test_step && events[0].pressed == XR_FALSE);
+	TEST_CHECK(events[1].time == test_start + 30 * test_step && events[1].pressed == XR_TRUE);
+	TEST_CHECK(input_history_events_since(*history, test_start + 30 * test_step, events, _countof(events)) == 0);
+	event_count = input_history_events_since(*history, 0, events, 1);
+	TEST_CHECK(event_count == 1 && events[0].time == test_start + 30 * test_step);
+
+	// Lapping the events drops the oldest ones, rather than handing back
+	// slots that are being written over.
+	for (uint64_t i = 0; i < input_history_events; i++)
+		input_history_event(*history, test_start + (40 + i) * test_step, xr_action_select, i % 2 == 0);
+	input_event_t all_events[input_history_events];
+	event_count = input_history_events_since(*history, 0, all_events, _countof(all_events));
+	TEST_CHECK(event_count == input_history_events - input_history_margin);
+	TEST_CHECK(all_events[event_count - 1].time == test_start + (40 + input_history_events - 1) * test_step);
+	delete history;
+
+	// And with a sampler thread writing as fast as it can underneath. The
+	// pose's x is its own time, so any blend of two real samples gives back
+	// the time we asked for, and anything else means a torn read.
+	input_history_t *shared = new input_history_t();
+	atomic<bool>     done   = { false };
+	thread writer([&]() {
+		for (XrTime t = 1; t < 1000000; t++) {
+			XrPosef p = xr_pose_identity;
+			p.position.x = (float)t;
+			input_history_add(*shared, t, p, test_valid);
+		}
+		done = true;
+	});
+	uint64_t reads = 0, found = 0, torn = 0;
+	while (!done.load(memory_order_relaxed)) {
+		uint64_t shared_head = shared->sample_head.load(memory_order_acquire);
+		if (shared_head < 2) { this_thread::yield(); continue; }
+		XrTime want = (XrTime)(shared_head - 1 - (reads % 64));
+		if (input_history_pose(*shared, want, &pose)) {
+			found++;
+			if (fabsf(pose.position.x - (float)want) > 0.01f)
+				torn++;
+		}
+		reads++;
+	}
+	writer.join();
+	delete shared;
+	printf("concurrent: %llu of %llu reads found, %llu torn\n", (unsigned long long)found, (unsigned long long)reads, (unsigned long long)torn);
+	TEST_CHECK(found > 0);
+	TEST_CHECK(torn == 0);
+
+	return test_finish("input_history");
+}
@@ -0,0 +1,37 @@
+#include "test.h"
+
+// Runs the whole headless session, the same as the headless program does,
+// and holds its select to photon and pose to photon latency to the budget.
+// The headless runtime's timing is exact, so any extra frame of latency
+// shows up here, every time.
+int main() {
+	float budget_ms = app_config_latency_budget_ms;
+	int   result    = wWinMain(nullptr, nullptr, nullptr, 0);
+
+	// Without samples there's nothing to hold to the budget. That means the
+	// session itself is broken, not slow, so it gets its own exit code.
+	if (budget_ms <= 0 || app_latency_select.count == 0 || app_latency_pose.count == 0) {
+		printf("latency: setup error, %.1fms budget, %u select and %u pose samples\n", budget_ms, app_latency_select.count, app_latency_pose.count);
+		return 2;
+	}
+
+	float select_p99 = latency_percentile(app_latency_select, 99);
+	float pose_p99   = latency_percentile(app_latency_pose,   99);
+	printf("select to photon p99 %.1fms, pose to photon p99 %.1fms, budget %.1fms\n", select_p99, pose_p99, budget_ms);
+	TEST_CHECK(latency_check(app_latency_select, budget_ms) == latency_within);
+	TEST_CHECK(latency_check(app_latency_pose,   budget_ms) == latency_within);
+	TEST_CHECK(result == 0);
+
+	// And the check itself: the budget is on the 99th percentile, so one
+	// slow sample in a hundred is fine, and two aren't.
+	latency_hist_t hist = {};
+	TEST_CHECK(latency_check(hist, budget_ms) == latency_no_samples);
+	for (int32_t i = 0; i < 99; i++)
+		latency_add(hist, budget_ms / 2);
+	latency_add(hist, budget_ms * 2);
+	TEST_CHECK(latency_check(hist, budget_ms) == latency_within);
+	latency_add(hist, budget_ms * 2);
+	TEST_CHECK(latency_check(hist, budget_ms) == latency_over);
+
+	return test_finish("latency");
+}
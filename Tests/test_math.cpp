@@ -0,0 +1,193 @@
+#include "test.h"
+
+// The batched matrix code only takes its SIMD path for whole batches, and
+// finishes off the last few one at a time, so counts from 1 up past two
+// batches cover every mix of batch and tail for 4 and 8 wide SIMD. This
+// checks whichever path the build targets, so the test gets built once
+// per instruction set the compiler can do. NEON only runs on ARM builds.
+const size_t test_max_count = 17;
+const float  test_tolerance = 0.0001f;
+
+uint32_t test_seed = 1;
+
+///////////////////////////////////////////
+
+XrPosef test_rand_pose() {
+	XrQuaternionf q = { math_rand_range(test_seed, -1, 1), math_rand_range(test_seed, -1, 1), math_rand_range(test_seed, -1, 1), math_rand_range(test_seed, -1, 1) };
+	float length = sqrtf(q.x*q.x + q.y*q.y + q.z*q.z + q.w*q.w);
+	XrPosef pose;
+	pose.orientation = { q.x / length, q.y / length, q.z / length, q.w / length };
+	pose.position    = { math_rand_range(test_seed, -10, 10), math_rand_range(test_seed, -10, 10), math_rand_range(test_seed, -10, 10) };
+	return pose;
+}
+
+///////////////////////////////////////////
+
+// Builds the matrix without any of the quaternion to matrix shortcuts:
+// each column is just an axis, rotated and scaled, then the position.
+mat4_t test_reference_matrix(const XrPosef &pose, float scale) {
+	XrVector3f x = math_quat_rotate(pose.orientation, { scale, 0, 0 });
+	XrVector3f y = math_quat_rotate(pose.orientation, { 0, scale, 0 });
+	XrVector3f z = math_quat_rotate(pose.orientation, { 0, 0, scale });
+	mat4_t result = {{
+		x.x, x.y, x.z, 0,
+		y.x, y.y, y.z, 0,
+		z.x, z.y, z.z, 0,
+		pose.position.x, pose.position.y, pose.position.z, 1 }};
+	return result;
+}
+
+///////////////////////////////////////////
+
+bool test_matrix_near(const mat4_t &a, const mat4_t &b) {
+	for (int32_t i = 0; i < 16; i++) {
+		if (fabsf(a.m[i] - b.m[i]) > test_tolerance * fmaxf(1, fabsf(b.m[i])))
+			return false;
+	}
+	return true;
+}
+
+///////////////////////////////////////////
+
+// Everything past 'count' should be left just how it was
+bool test_untouched(const vector<mat4_t> &matrices, size_t count) {
+	for (size_t i = count; i < matrices.size(); i++) {
+		for (int32_t m = 0; m < 16; m++) {
+			if (matrices[i].m[m] != -1) return false;
+		}
+	}
+	return true;
+}
+
+///////////////////////////////////////////
+
+void test_poses() {
+	const float scales[] = { 0.05f, 1, 3.5f };
+	for (size_t s = 0; s < _countof(scales); s++) {
+		for (size_t count = 1; count <= test_max_count; count++) {
+			// Sized exactly, so reading past the last pose would show up
+			// under a memory checker.
+			vector<XrPosef> poses(count);
+			for (size_t i = 0; i < count; i++)
+				poses[i] = test_rand_pose();
+
+			vector<mat4_t> matrices(test_max_count + 1, mat4_t{ { -1,-1,-1,-1, -1,-1,-1,-1, -1,-1,-1,-1, -1,-1,-1,-1 } });
+			math_poses_to_matrices(poses.data(), count, scales[s], matrices.data());
+
+			size_t wrong = 0;
+			for (size_t i = 0; i < count; i++) {
+				if (!test_matrix_near(matrices[i], test_reference_matrix(poses[i], scales[s]))) wrong += 1;
+				if (!test_matrix_near(matrices[i], math_pose_matrix     (poses[i], scales[s]))) wrong += 1;
+			}
+			if (!TEST_CHECK(wrong == 0) || !TEST_CHECK(test_untouched(matrices, count)))
+				printf("- poses: %zu of %zu wrong at scale %g\n", wrong, count, scales[s]);
+		}
+	}
+}
+
+///////////////////////////////////////////
+
+void test_joints() {
+	// Every count up to both hands full, each joint with its own radius
+	for (uint32_t count = 1; count <= hand_joint_max; count++) {
+		hand_joints_t joints = {};
+		joints.count = count;
+		for (uint32_t i = 0; i < count; i++) {
+			XrPosef pose = test_rand_pose();
+			joints.pos_x [i] = pose.position.x;
+			joints.pos_y [i] = pose.position.y;
+			joints.pos_z [i] = pose.position.z;
+			joints.rot_x [i] = pose.orientation.x;
+			joints.rot_y [i] = pose.orientation.y;
+			joints.rot_z [i] = pose.orientation.z;
+			joints.rot_w [i] = pose.orientation.w;
+			joints.radius[i] = math_rand_range(test_seed, 0.005f, 0.02f);
+		}
+
+		vector<mat4_t> matrices(hand_joint_max + 1, mat4_t{ { -1,-1,-1,-1, -1,-1,-1,-1, -1,-1,-1,-1, -1,-1,-1,-1 } });
+		math_joints_to_matrices(joints, matrices.data());
+
+		size_t wrong = 0;
+		for (uint32_t i = 0; i < count; i++) {
+			XrPosef pose = { { joints.rot_x[i], joints.rot_y[i], joints.rot_z[i], joints.rot_w[i] }, { joints.pos_x[i], joints.pos_y[i], joints.pos_z[i] } };
+			if (!test_matrix_near(matrices[i], test_reference_matrix(pose, joints.radius[i]))) wrong += 1;
+		}
+		if (!TEST_CHECK(wrong == 0) || !TEST_CHECK(test_untouched(matrices, count)))
+			printf("- joints: %zu of %u wrong\n", wrong, count);
+	}
+}
+
+///////////////////////////////////////////
+
+// Pushes a view space point through the projection, and divides by w
+XrVector3f test_project(const mat4_t &proj, XrVector3f p, float *out_w) {
+	float clip[4];
+	for (int32_t r = 0; r < 4; r++)
+		clip[r] = proj.m[r] * p.x + proj.m[4 + r] * p.y + proj.m[8 + r] * p.z + proj.m[12 + r];
+	*out_w = clip[3];
+	return { clip[0] / clip[3], clip[1] / clip[3], clip[2] / clip[3] };
+}
+
+///////////////////////////////////////////
+
+void test_projection() {
+	// A right handed projection looking down -Z, with D3D's 0 to 1 depth.
+	// The corners of the frustum should land on the corners of clip
+	// space, and the near and far planes on depth 0 and 1. The fovs are
+	// lopsided like a real headset's, so an off-center mistake shows up.
+	const XrFovf fovs[] = {
+		{ -0.785398f, 0.785398f, 0.785398f, -0.785398f },
+		{ -0.94f,     0.70f,     0.82f,     -0.90f     },
+		{ -0.30f,     1.10f,     0.40f,     -1.20f     } };
+	const float clip_near = 0.05f;
+	const float clip_far  = 50;
+
+	for (size_t f = 0; f < _countof(fovs); f++) {
+		const XrFovf &fov  = fovs[f];
+		mat4_t        proj = math_projection(fov, clip_near, clip_far);
+
+		const float depths[] = { clip_near, clip_far };
+		for (size_t d = 0; d < _countof(depths); d++) {
+			float dist = depths[d];
+			float w_min, w_max;
+			XrVector3f min = test_project(proj, { dist * tanf(fov.angleLeft),  dist * tanf(fov.angleDown), -dist }, &w_min);
+			XrVector3f max = test_project(proj, { dist * tanf(fov.angleRight), dist * tanf(fov.angleUp),   -dist }, &w_max);
+			float      depth = (float)d;
+			bool ok =
+				TEST_CHECK(fabsf(min.x + 1) < test_tolerance) && TEST_CHECK(fabsf(min.y + 1) < test_tolerance) &&
+				TEST_CHECK(fabsf(max.x - 1) < test_tolerance) && TEST_CHECK(fabsf(max.y - 1) < test_tolerance) &&
+				TEST_CHECK(fabsf(min.z - depth) < test_tolerance * 10) && TEST_CHECK(fabsf(max.z - depth) < test_tolerance * 10) &&
+				TEST_CHECK(fabsf(w_min - dist) < test_tolerance * dist) && TEST_CHECK(fabsf(w_max - dist) < test_tolerance * dist);
+			if (!ok)
+				printf("- projection %zu at %g: (%g, %g, %g) to (%g, %g, %g)\n", f, dist, min.x, min.y, min.z, max.x, max.y, max.z);
+		}
+
+		// Points further along the same ray land on the same spot, with
+		// depth climbing toward the far plane.
+		float w;
+		float mid_x = tanf((fov.angleLeft + fov.angleRight) / 2);
+		float mid_y = tanf((fov.angleDown + fov.angleUp)    / 2);
+		XrVector3f a = test_project(proj, { mid_x * 1, mid_y * 1, -1 }, &w);
+		XrVector3f b = test_project(proj, { mid_x * 5, mid_y * 5, -5 }, &w);
+		TEST_CHECK(a.z > 0 && a.z < b.z && b.z < 1);
+		TEST_CHECK(fabsf(a.x - b.x) < test_tolerance && fabsf(a.y - b.y) < test_tolerance);
+	}
+}
+
+///////////////////////////////////////////
+
+int main() {
+#if defined(MATH_AVX2) && defined(__GNUC__)
+	// This one's built with AVX2 on purpose, but not every CPU running
+	// the tests can do it.
+	if (!__builtin_cpu_supports("avx2")) {
+		printf("math (AVX2): skipped, this CPU doesn't support AVX2\n");
+		return 77;
+	}
+#endif
+	printf("math: checking the %s path\n", math_simd_name);
+	test_poses();
+	test_joints();
+	test_projection();
+	return test_finish("math");
+}
@@ -0,0 +1,23 @@
+#include "test.h"
+
+// Runs the whole headless session with simulation and rendering on their
+// own threads, which none of the other tests do. Every frame the
+// simulation fills in has to get drawn, in order, with every view.
+int main() {
+	app_config_pipelined = true;
+	int result = wWinMain(nullptr, nullptr, nullptr, 0);
+
+	printf("pipelined: %llu frames waited, %llu submitted, %llu views with depth\n", (unsigned long long)xr_frames_waited, (unsigned long long)xr_frames_submitted, (unsigned long long)headless_depth_views);
+	TEST_CHECK(result == 0);
+	TEST_CHECK(xr_frames_waited > headless_frames / 2);
+	TEST_CHECK(xr_frames_submitted == xr_frames_waited);
+	TEST_CHECK(xr_frames_submitted_total == xr_frames_waited);
+	TEST_CHECK(!xr_render_thread.joinable());
+
+	// A frame without all of its views drawn means a locate failed, or a
+	// frame slot lost track of its views between frames.
+	TEST_CHECK(headless_depth_views >= (xr_frames_waited - 2) * 2);
+	TEST_CHECK(app_latency_select.count > 0 && app_latency_pose.count > 0);
+
+	return test_finish("pipelined");
+}
@@ -0,0 +1,148 @@
+#include "test.h"
+
+// What a headless session did, for comparing a recording with its replay
+struct test_summary_t {
+	uint64_t       frames;
+	uint64_t       submitted;
+	uint64_t       cubes;
+	uint64_t       cube_hash;
+	latency_hist_t select;
+	latency_hist_t pose;
+};
+
+///////////////////////////////////////////
+
+// The session's state is all globals, so each run gets a process of its
+// own: this same program, started again with what to run. It writes
+// what happened to 'summary_file' for the first one to look at.
+int test_child(const char *mode, const char *session_file, const char *summary_file) {
+	if (strcmp(mode, "record") == 0) app_config_record_file = session_file;
+	else                              app_config_replay_file = session_file;
+	int result = wWinMain(nullptr, nullptr, nullptr, 0);
+
+	test_summary_t summary = {};
+	summary.frames    = headless_frame;
+	summary.submitted = xr_frames_submitted_total;
+	summary.cubes     = app_cubes.count;
+	summary.cube_hash = 14695981039346656037ull;
+	for (size_t i = 0; i < app_cubes.chunks.size(); i++)
+		summary.cube_hash = shader_cache_hash(summary.cube_hash, app_cubes.chunks[i].data(), app_cubes.chunks[i].size() * sizeof(XrPosef));
+	summary.select = app_latency_select;
+	summary.pose   = app_latency_pose;
+
+	FILE *fp = nullptr;
+	if (fopen_s(&fp, summary_file, "wb") != 0)
+		return 1;
+	bool written = fwrite(&summary, sizeof(summary), 1, fp) == 1;
+	fclose(fp);
+	return written ? result : 1;
+}
+
+///////////////////////////////////////////
+
+bool test_run(const char *self, const char *mode, const char *session_file, test_summary_t &out_summary) {
+	char command[1024];
+	snprintf(command, sizeof(command), "\"%s\" %s %s test_replay_summary.bin", self, mode, session_file);
+	remove("test_replay_summary.bin");
+	int result = system(command);
+
+	FILE *fp = nullptr;
+	out_summary = {};
+	if (fopen_s(&fp, "test_replay_summary.bin", "rb") != 0)
+		return false;
+	bool read = fread(&out_summary, sizeof(out_summary), 1, fp) == 1;
+	fclose(fp);
+	remove("test_replay_summary.bin");
+	return result == 0 && read;
+}
+
+///////////////////////////////////////////
+
+bool test_hist_equal(const latency_hist_t &a, const latency_hist_t &b) {
+	return a.count == b.count && a.min_ms == b.min_ms && a.max_ms == b.max_ms &&
+		memcmp(a.buckets, b.buckets, sizeof(a.buckets)) == 0;
+}
+
+///////////////////////////////////////////
+
+bool test_write(const char *filename, const vector<uint8_t> &data) {
+	FILE *fp = nullptr;
+	if (fopen_s(&fp, filename, "wb") != 0)
+		return false;
+	bool result = fwrite(data.data(), 1, data.size(), fp) == data.size();
+	return fclose(fp) == 0 && result;
+}
+
+///////////////////////////////////////////
+
+int main(int argc, char **argv) {
+	if (argc == 4)
+		return test_child(argv[1], argv[2], argv[3]);
+
+	// Record the scripted session, then play it back. Everything the
+	// sample did the first time, it has to do again.
+	test_summary_t recorded, replayed;
+	remove("test_replay.xrec");
+	TEST_CHECK(test_run(argv[0], "record", "test_replay.xrec", recorded));
+	TEST_CHECK(test_run(argv[0], "replay", "test_replay.xrec", replayed));
+	printf("recorded: %llu frames, %llu cubes, %u select and %u pose samples\n", (unsigned long long)recorded.submitted, (unsigned long long)recorded.cubes, recorded.select.count, recorded.pose.count);
+	printf("replayed: %llu frames, %llu cubes, %u select and %u pose samples\n", (unsigned long long)replayed.submitted, (unsigned long long)replayed.cubes, replayed.select.count, replayed.pose.count);
+	TEST_CHECK(recorded.submitted > 0 && recorded.cubes > 0 && recorded.select.count > 0);
+	TEST_CHECK(replayed.submitted == recorded.submitted);
+	TEST_CHECK(replayed.cubes     == recorded.cubes);
+	TEST_CHECK(replayed.cube_hash == recorded.cube_hash);
+	TEST_CHECK(test_hist_equal(replayed.select, recorded.select));
+	TEST_CHECK(test_hist_equal(replayed.pose,   recorded.pose));
+
+	// Now some damaged copies of the recording. Put a record we've never
+	// heard of on the end, then one more frame after it.
+	vector<uint8_t> data;
+	FILE *fp = nullptr;
+	if (TEST_CHECK(fopen_s(&fp, "test_replay.xrec", "rb") == 0)) {
+		uint8_t chunk[64 * 1024];
+		size_t  read;
+		while ((read = fread(chunk, 1, sizeof(chunk), fp)) > 0)
+			data.insert(data.end(), chunk, chunk + read);
+		fclose(fp);
+	}
+	headless_replay_t *original = new headless_replay_t();
+	TEST_CHECK(headless_replay_load(*original, "test_replay.xrec"));
+
+	const uint8_t    unknown_body[12] = { 1, 2, 3 };
+	session_record_t unknown          = { 99, sizeof(unknown_body) };
+	session_record_t frame_record     = { session_type_frame, sizeof(session_frame_t) };
+	session_frame_t  frame            = original->frames.back();
+	frame.display_time += frame.period;
+	data.insert(data.end(), (uint8_t *)&unknown,      (uint8_t *)&unknown      + sizeof(unknown));
+	data.insert(data.end(), unknown_body,             unknown_body             + sizeof(unknown_body));
+	data.insert(data.end(), (uint8_t *)&frame_record, (uint8_t *)&frame_record + sizeof(frame_record));
+	data.insert(data.end(), (uint8_t *)&frame,        (uint8_t *)&frame        + sizeof(frame));
+
+	// The unknown record is skipped, and everything after it still loads
+	headless_replay_t *extended = new headless_replay_t();
+	TEST_CHECK(test_write("test_replay_damaged.xrec", data));
+	TEST_CHECK(headless_replay_load(*extended, "test_replay_damaged.xrec"));
+	TEST_CHECK(extended->frames.size()  == original->frames.size() + 1);
+	TEST_CHECK(extended->frames.back().display_time == frame.display_time);
+	TEST_CHECK(extended->locates.size() == original->locates.size() && extended->views.size() == original->views.size());
+
+	// Cut off partway through that last frame, the way a crash while
+	// recording would. The torn frame is dropped, and nothing else is.
+	for (size_t cut = 1; cut < sizeof(frame_record) + sizeof(frame); cut += 7) {
+		headless_replay_t *truncated = new headless_replay_t();
+		vector<uint8_t>    torn(data.begin(), data.end() - cut);
+		TEST_CHECK(test_write("test_replay_damaged.xrec", torn));
+		TEST_CHECK(headless_replay_load(*truncated, "test_replay_damaged.xrec"));
+		TEST_CHECK(truncated->frames.size()  == original->frames.size());
+		TEST_CHECK(truncated->actions.size() == original->actions.size());
+		TEST_CHECK(truncated->locates.size() == original->locates.size());
+		TEST_CHECK(truncated->views.size()   == original->views.size());
+		delete truncated;
+	}
+	delete extended;
+	delete original;
+
+	remove("test_replay.xrec");
+	remove("test_replay_damaged.xrec");
+	return test_finish("replay");
+}
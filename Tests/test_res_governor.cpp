@@ -0,0 +1,91 @@
+#include "test.h"
+
+// Render time goes with the number of pixels, which is the square of the
+// scale. 'full_ms' is how long a frame takes at the recommended size.
+float test_render_ms(float full_ms, float scale) {
+	return full_ms * scale * scale;
+}
+
+///////////////////////////////////////////
+
+// Runs frames against a made up GPU, with a little deterministic jitter
+// on the render times, and returns the scale after each one.
+vector<float> test_run(res_governor_t &gov, float full_ms, float period_ms, int32_t frames, float jitter, uint32_t &seed) {
+	vector<float> scales;
+	for (int32_t i = 0; i < frames; i++) {
+		float noise = 1 + jitter * math_rand_range(seed, -1, 1);
+		scales.push_back(res_governor_update(gov, test_render_ms(full_ms, gov.scale) * noise, period_ms));
+	}
+	return scales;
+}
+
+///////////////////////////////////////////
+
+int main() {
+	const float period_ms = 1000.0f / 90;
+	const float target_ms = period_ms * res_governor_target;
+	uint32_t    seed      = 1;
+
+	// A light scene settles at the top, and stays there
+	res_governor_t gov;
+	res_governor_init(gov, 0.5f, 1.4f);
+	TEST_CHECK(gov.scale == 1);
+	test_run(gov, 3, period_ms, 400, 0, seed);
+	TEST_CHECK(gov.scale == 1.4f);
+
+	// A frame that misses its display drops the scale all at once, right
+	// to where that frame would have fit the target.
+	float before   = gov.scale;
+	float late_ms  = period_ms * 1.5f;
+	float expected = before / sqrtf(late_ms / target_ms);
+	float after    = res_governor_update(gov, late_ms, period_ms);
+	printf("missed frame: %.3f -> %.3f\n", before, after);
+	TEST_CHECK(fabsf(after - expected) < 0.0001f);
+	TEST_CHECK(test_render_ms(late_ms / (before * before), after) <= target_ms * 1.0001f);
+
+	// Something heavy shows up and pins us at the bottom. Once it goes
+	// away, the climb back up is never more than 0.02 a frame.
+	test_run(gov, 40, period_ms, 50, 0, seed);
+	TEST_CHECK(gov.scale == 0.5f);
+	vector<float> climb = test_run(gov, 3, period_ms, 200, 0.05f, seed);
+	float prev      = 0.5f;
+	float max_step  = 0;
+	for (size_t i = 0; i < climb.size(); i++) {
+		max_step = fmaxf(max_step, climb[i] - prev);
+		prev     = climb[i];
+	}
+	printf("climb: 0.500 -> %.3f, at most %.4f a frame\n", climb.back(), max_step);
+	TEST_CHECK(max_step <= 0.02f + 0.00001f);
+	TEST_CHECK(climb.back() == 1.4f);
+
+	// With the load anywhere inside the band under the target, the scale
+	// holds still, no matter how the render times wobble.
+	const float loads[] = { 1 - res_governor_band + 0.02f, 1 - res_governor_band / 2, 0.99f };
+	for (size_t l = 0; l < _countof(loads); l++) {
+		res_governor_init(gov, 0.5f, 1.4f);
+		float full_ms = target_ms * loads[l];
+		vector<float> held = test_run(gov, full_ms, period_ms, 500, 0.01f, seed);
+		bool steady = true;
+		for (size_t i = 0; i < held.size(); i++)
+			steady = steady && held[i] == 1;
+		printf("load %.3f: scale %s\n", loads[l], steady ? "held" : "moved");
+		TEST_CHECK(steady);
+	}
+
+	// A scene that's just a bit too heavy settles near the target, and
+	// then stays put instead of bouncing between two resolutions.
+	res_governor_init(gov, 0.5f, 1.4f);
+	vector<float> settle = test_run(gov, target_ms * 1.6f, period_ms, 600, 0.03f, seed);
+	int32_t reversals = 0;
+	for (size_t i = 302; i < settle.size(); i++) {
+		float a = settle[i - 1] - settle[i - 2];
+		float b = settle[i]     - settle[i - 1];
+		if ((a > 0 && b < 0) || (a < 0 && b > 0)) reversals += 1;
+	}
+	float settled_load = test_render_ms(target_ms * 1.6f, settle.back()) / target_ms;
+	printf("settled: scale %.3f, load %.3f, %d reversals\n", settle.back(), settled_load, reversals);
+	TEST_CHECK(reversals == 0);
+	TEST_CHECK(settled_load <= 1.03f && settled_load >= 1 - res_governor_band - 0.03f);
+
+	return test_finish("res_governor");
+}
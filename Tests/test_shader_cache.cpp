@@ -0,0 +1,119 @@
+#include "test.h"
+
+const char *test_cache_file = "test_shader_cache.bin";
+int32_t     test_compiles   = 0;
+
+// Stands in for D3DCompile. The "bytecode" is a few KB made from a hash
+// of everything it was given, so different inputs give different blobs,
+// and it counts how many times it was asked.
+bool test_compile(const char *hlsl, const char *entrypoint, const char *target, const D3D_SHADER_MACRO *defines, uint32_t flags, vector<uint8_t> &out_bytecode) {
+	test_compiles += 1;
+	uint64_t hash = shader_cache_hash(14695981039346656037ull, hlsl, strlen(hlsl));
+	hash = shader_cache_hash(hash, entrypoint, strlen(entrypoint));
+	hash = shader_cache_hash(hash, target,     strlen(target));
+	hash = shader_cache_hash(hash, &flags,     sizeof(flags));
+	for (const D3D_SHADER_MACRO *define = defines; define && define->Name; define++)
+		hash = shader_cache_hash(hash, define->Name, strlen(define->Name));
+	out_bytecode.resize(4096);
+	for (size_t i = 0; i < out_bytecode.size(); i++) {
+		hash = shader_cache_hash(hash, &i, sizeof(i));
+		out_bytecode[i] = (uint8_t)hash;
+	}
+	return true;
+}
+
+///////////////////////////////////////////
+
+// Does what app_init does with the cache: open it, get both of the
+// sample's shaders, and close it again. Returns how many it compiled, and
+// prints how long it took. The stub is far quicker than D3DCompile, so a
+// cold start here is only a floor on what a real one costs.
+int32_t test_startup(const shader_compiler_t &compiler, const D3D_SHADER_MACRO *defines, const char *name) {
+	int32_t before = test_compiles;
+	auto    start  = chrono::high_resolution_clock::now();
+
+	shader_cache_t cache = {};
+	const uint8_t *vert_shader  = nullptr, *pixel_shader      = nullptr;
+	size_t         vert_shader_size = 0,    pixel_shader_size = 0;
+	shader_cache_open(cache, test_cache_file);
+	TEST_CHECK(shader_cache_get(cache, compiler, app_shader_code, "vs", "vs_5_0", defines, &vert_shader,  &vert_shader_size));
+	TEST_CHECK(shader_cache_get(cache, compiler, app_shader_code, "ps", "ps_5_0", defines, &pixel_shader, &pixel_shader_size));
+
+	// Whether they came from the file or the compiler, they're the same
+	// blobs. This has to happen before closing, which unmaps the file.
+	double  ms       = chrono::duration<double, milli>(chrono::high_resolution_clock::now() - start).count();
+	int32_t compiled = test_compiles - before;
+	vector<uint8_t> vert_expected, pixel_expected;
+	test_compile(app_shader_code, "vs", "vs_5_0", defines, compiler.flags, vert_expected);
+	test_compile(app_shader_code, "ps", "ps_5_0", defines, compiler.flags, pixel_expected);
+	test_compiles -= 2;
+	TEST_CHECK(vert_shader_size  == vert_expected .size() && memcmp(vert_shader,  vert_expected .data(), vert_shader_size)  == 0);
+	TEST_CHECK(pixel_shader_size == pixel_expected.size() && memcmp(pixel_shader, pixel_expected.data(), pixel_shader_size) == 0);
+
+	start = chrono::high_resolution_clock::now();
+	TEST_CHECK(shader_cache_close(cache, test_cache_file));
+	ms += chrono::duration<double, milli>(chrono::high_resolution_clock::now() - start).count();
+
+	printf("%-14s %.3fms, %d compiled\n", name, ms, compiled);
+	return compiled;
+}
+
+///////////////////////////////////////////
+
+// Flips a byte in the middle of the first shader in the pack file
+void test_corrupt() {
+	FILE *fp = nullptr;
+	if (!TEST_CHECK(fopen_s(&fp, test_cache_file, "r+b") == 0))
+		return;
+	shader_cache_header_t header = {};
+	shader_cache_entry_t  entry  = {};
+	TEST_CHECK(fread(&header, sizeof(header), 1, fp) == 1 && header.count == 2);
+	TEST_CHECK(fread(&entry,  sizeof(entry),  1, fp) == 1);
+	uint8_t byte = 0;
+	fseek(fp, entry.offset + entry.size / 2, SEEK_SET);
+	TEST_CHECK(fread(&byte, 1, 1, fp) == 1);
+	byte ^= 0xFF;
+	fseek(fp, entry.offset + entry.size / 2, SEEK_SET);
+	TEST_CHECK(fwrite(&byte, 1, 1, fp) == 1);
+	fclose(fp);
+}
+
+///////////////////////////////////////////
+
+int main() {
+	const shader_compiler_t compiler   = { "test", 1, test_compile };
+	const shader_compiler_t flagged    = { "test", 3, test_compile };
+	D3D_SHADER_MACRO        defines[]  = { { nullptr, nullptr } };
+	D3D_SHADER_MACRO        stereo[]   = { { "SINGLE_PASS", "1" }, { nullptr, nullptr } };
+	remove(test_cache_file);
+
+	// Nothing cached, so everything compiles. Then it's all in the file.
+	TEST_CHECK(test_startup(compiler, defines, "cold:")  == 2);
+	TEST_CHECK(test_startup(compiler, defines, "warm:")  == 0);
+
+	// A damaged blob is caught by its hash and compiled again, and the
+	// file that gets written back is whole again.
+	test_corrupt();
+	TEST_CHECK(test_startup(compiler, defines, "corrupted:") == 1);
+	TEST_CHECK(test_startup(compiler, defines, "repaired:")  == 0);
+
+	// Anything that changes what the compiler would make is a new key, and
+	// the old shaders are still kept alongside the new ones.
+	TEST_CHECK(test_startup(compiler, stereo,  "new define:") == 2);
+	TEST_CHECK(test_startup(flagged,  defines, "new flags:")  == 2);
+	TEST_CHECK(test_startup(compiler, defines, "all warm:")   == 0);
+	TEST_CHECK(test_startup(compiler, stereo,  "all warm:")   == 0);
+	TEST_CHECK(test_startup(flagged,  defines, "all warm:")   == 0);
+
+	// A file that isn't a cache at all is just a cold start
+	FILE *fp = nullptr;
+	if (TEST_CHECK(fopen_s(&fp, test_cache_file, "wb") == 0)) {
+		fputs("not a shader cache", fp);
+		fclose(fp);
+	}
+	TEST_CHECK(test_startup(compiler, defines, "garbage file:") == 2);
+	TEST_CHECK(test_startup(compiler, defines, "warm:")         == 0);
+
+	remove(test_cache_file);
+	return test_finish("shader_cache");
+}
@@ -0,0 +1,84 @@
+#include "test.h"
+
+const float test_radius = 0.05f;
+
+///////////////////////////////////////////
+
+math_frustum_t test_frustum(XrVector3f position, float yaw, float clip_far) {
+	XrView view = { XR_TYPE_VIEW };
+	view.pose                 = xr_pose_identity;
+	view.pose.position        = position;
+	view.pose.orientation     = { 0, sinf(yaw / 2), 0, cosf(yaw / 2) };
+	view.fov                  = { -0.8f, 0.8f, 0.7f, -0.7f };
+	return math_frustum_combined(&view, 1, 0.1f, clip_far);
+}
+
+///////////////////////////////////////////
+
+// The index is only a shortcut, so it has to find exactly what culling
+// every cube one by one does.
+void test_query_matches(const spatial_index_t &index, const cube_store_t &cubes, const vector<XrPosef> &poses, const math_frustum_t &frustum, const char *name) {
+	vector<uint32_t> expected(poses.size());
+	expected.resize(math_frustum_cull(frustum, poses.data(), poses.size(), test_radius, expected.data()));
+
+	vector<XrPosef>  scratch;
+	vector<uint32_t> scratch_ids;
+	vector<uint32_t> found(poses.size());
+	uint32_t         tested = 0;
+	found.resize(spatial_query_frustum(index, frustum, cubes, test_radius, scratch, scratch_ids, found.data(), &tested));
+
+	sort(expected.begin(), expected.end());
+	sort(found   .begin(), found   .end());
+	printf("%s: %zu visible, %u cells and cubes tested\n", name, found.size(), tested);
+	TEST_CHECK(!expected.empty());
+	TEST_CHECK(found == expected);
+}
+
+///////////////////////////////////////////
+
+int main() {
+	// Scatter cubes through a 60m box, a few per cell
+	uint32_t seed = 1;
+	vector<XrPosef> poses(100000, xr_pose_identity);
+	cube_store_t    cubes = {};
+	spatial_index_t index = { 1.0f };
+	for (size_t i = 0; i < poses.size(); i++) {
+		poses[i].position = { math_rand_range(seed, -30, 30), math_rand_range(seed, -30, 30), math_rand_range(seed, -30, 30) };
+		spatial_insert(index, cube_store_add(cubes, poses[i]), poses[i].position, test_radius);
+	}
+
+	// A short frustum has fewer cells in its bounds than the index has, so
+	// those get looked up one by one. A long one goes through the index.
+	test_query_matches(index, cubes, poses, test_frustum({ 0, 0, 0 },  0,    5),   "short frustum");
+	test_query_matches(index, cubes, poses, test_frustum({ 3, 1, -2 }, 2.1f, 8),   "short frustum, turned");
+	test_query_matches(index, cubes, poses, test_frustum({ 0, 0, 20 }, 0.4f, 100), "long frustum");
+
+	// Cells 2^21 apart have the same hash. They still need to be separate
+	// cells, and a cube in one must never show up in the other.
+	const float     far_x      = (float)(1 << 21);
+	spatial_index_t far_index  = { 1.0f };
+	cube_store_t    far_cubes  = {};
+	vector<XrPosef> far_poses(2, xr_pose_identity);
+	far_poses[0].position = { 0.5f,         0.5f, -2.5f };
+	far_poses[1].position = { far_x + 0.5f, 0.5f, -2.5f };
+	for (size_t i = 0; i < far_poses.size(); i++)
+		spatial_insert(far_index, cube_store_add(far_cubes, far_poses[i]), far_poses[i].position, test_radius);
+	TEST_CHECK(far_index.cells.size() == 2);
+
+	const spatial_cell_t *near_cell = spatial_find(far_index, 0,               0, -3);
+	const spatial_cell_t *far_cell  = spatial_find(far_index, (int32_t)far_x,  0, -3);
+	TEST_CHECK(near_cell != nullptr && near_cell->x == 0              && near_cell->home.size() == 1 && near_cell->home[0] == 0);
+	TEST_CHECK(far_cell  != nullptr && far_cell ->x == (int32_t)far_x && far_cell ->home.size() == 1 && far_cell ->home[0] == 1);
+
+	vector<XrPosef>  scratch;
+	vector<uint32_t> scratch_ids;
+	uint32_t         ids[2];
+	size_t           count = spatial_query_frustum(far_index, test_frustum({ 0, 0, 0 }, 0, 10), far_cubes, test_radius, scratch, scratch_ids, ids, nullptr);
+	TEST_CHECK(count == 1 && ids[0] == 0);
+
+	float   dist = 0;
+	int64_t hit  = spatial_query_ray(far_index, far_cubes, { 0.5f, 0.5f, 0 }, { 0, 0, -1 }, 10, test_radius, &dist);
+	TEST_CHECK(hit == 0);
+
+	return test_finish("spatial");
+}
@@ -0,0 +1,167 @@
+#include "test.h"
+
+// Allocates, and checks it landed where we expected. 'expected' of -1
+// means it should have failed.
+void test_alloc(upload_ring_t &ring, uint64_t bytes, int64_t expected) {
+	uint64_t offset = 0;
+	uint64_t head   = ring.head;
+	uint32_t full   = ring.full;
+	bool     result = upload_ring_alloc(ring, bytes, &offset);
+	if (expected < 0) {
+		TEST_CHECK(!result);
+		TEST_CHECK(ring.head == head && ring.full == full + 1);
+	} else {
+		if (!result || offset != (uint64_t)expected)
+			printf("%llu bytes: expected offset %lld, got %s %llu\n", (unsigned long long)bytes, (long long)expected, result ? "offset" : "a failure at", (unsigned long long)offset);
+		TEST_CHECK(result && offset == (uint64_t)expected);
+	}
+}
+
+///////////////////////////////////////////
+
+// Pretends to be a renderer with a GPU a few frames behind, and keeps
+// track of every byte each frame was handed. Nothing the GPU could still
+// be reading may ever be handed out again.
+void test_frames(uint64_t size, uint64_t align, uint32_t frames, uint32_t &seed) {
+	struct test_alloc_t { uint64_t frame, offset, bytes; };
+	upload_ring_t        ring;
+	vector<test_alloc_t> live;
+	uint64_t             done     = 0;
+	uint64_t             overlaps = 0, misaligned = 0, handed = 0;
+	upload_ring_init(ring, size, align);
+
+	for (uint64_t frame = 0; frame < frames; frame++) {
+		// The GPU finishes some frames, but never gets more than a few
+		// behind. Sometimes we hear about it late, and ask about a fence
+		// we've already gone past.
+		uint32_t rand = math_rand(seed);
+		uint64_t lag  = rand % (upload_ring_frames + 2);
+		if (frame > lag) done = max(done, frame - lag);
+		upload_ring_retire(ring, (rand >> 12) % 4 == 0 && done > 2 ? done - 2 : done);
+		live.erase(remove_if(live.begin(), live.end(), [done](const test_alloc_t &a) { return a.frame < done; }), live.end());
+
+		uint32_t count = 1 + (rand >> 4) % 6;
+		for (uint32_t i = 0; i < count; i++) {
+			uint64_t bytes  = 1 + math_rand(seed) % (size / 3);
+			uint64_t offset = 0;
+			if (!upload_ring_alloc(ring, bytes, &offset))
+				continue;
+			handed += 1;
+			if (offset % ring.align != 0 || offset + bytes > ring.size)
+				misaligned += 1;
+			for (size_t l = 0; l < live.size(); l++) {
+				if (offset < live[l].offset + live[l].bytes && live[l].offset < offset + bytes)
+					overlaps += 1;
+			}
+			live.push_back({ frame, offset, bytes });
+		}
+		upload_ring_end(ring, frame);
+	}
+	printf("%llu byte ring: %llu handed out over %u frames, %u wraps, %u full\n", (unsigned long long)ring.size, (unsigned long long)handed, frames, ring.wraps, ring.full);
+	TEST_CHECK(handed > frames);
+	TEST_CHECK(ring.wraps > 0 && ring.full > 0);
+	TEST_CHECK(misaligned == 0);
+	TEST_CHECK(overlaps == 0);
+}
+
+///////////////////////////////////////////
+
+int main() {
+	upload_ring_t ring;
+
+	// Sizes round down to the alignment, and every allocation starts on it
+	upload_ring_init(ring, 1000, 64);
+	TEST_CHECK(ring.size == 960);
+	test_alloc(ring, 100, 0);
+	test_alloc(ring, 100, 128);
+	test_alloc(ring, 1,   256);
+
+	// Wrapping around. What won't fit before the end goes at the start of
+	// the next lap, once the frames there are done.
+	upload_ring_init(ring, 256, 16);
+	test_alloc(ring, 100, 0);
+	test_alloc(ring, 100, 112);
+	upload_ring_end(ring, 0);
+	test_alloc(ring, 100, -1); // Would need the start, which frame 0 is still using
+	upload_ring_retire(ring, 1);
+	TEST_CHECK(ring.tail == 212);
+	test_alloc(ring, 100, 0);
+	TEST_CHECK(ring.wraps == 1 && ring.head == 356);
+	test_alloc(ring, 40,  112); // Right up to frame 0's old space, which is free now
+	upload_ring_end(ring, 1);
+
+	// A full ring refuses, and leaves itself untouched, until a frame
+	// finishes and frees up some room.
+	upload_ring_init(ring, 256, 64);
+	for (int32_t i = 0; i < 4; i++) {
+		test_alloc(ring, 64, i * 64);
+		upload_ring_end(ring, i);
+	}
+	test_alloc(ring, 1, -1);
+	TEST_CHECK(ring.full == 1);
+	upload_ring_retire(ring, 1);
+	test_alloc(ring, 64, 0);
+	test_alloc(ring, 1,  -1);
+
+	// Frames are done before a fence, so hearing about a later fence first
+	// frees every frame before it. Hearing about an older one afterwards
+	// mustn't take any of that space back.
+	upload_ring_init(ring, 256, 16);
+	for (int32_t i = 0; i < 3; i++) {
+		test_alloc(ring, 64, i * 64);
+		upload_ring_end(ring, i);
+	}
+	upload_ring_retire(ring, 2);
+	TEST_CHECK(ring.tail == 128 && ring.frame_count == 1);
+	upload_ring_retire(ring, 1);
+	TEST_CHECK(ring.tail == 128 && ring.frame_count == 1);
+	upload_ring_retire(ring, 3);
+	TEST_CHECK(ring.tail == 192 && ring.frame_count == 0);
+	upload_ring_retire(ring, 0);
+	TEST_CHECK(ring.tail == 192 && ring.frame_count == 0);
+
+	// Frame ids don't have to be next to each other
+	upload_ring_init(ring, 256, 16);
+	test_alloc(ring, 64, 0);
+	upload_ring_end(ring, 10);
+	test_alloc(ring, 64, 64);
+	upload_ring_end(ring, 12);
+	upload_ring_retire(ring, 11);
+	TEST_CHECK(ring.tail == 64 && ring.frame_count == 1);
+
+	// With more frames waiting than there are slots, the extra ones share
+	// the newest slot, and get freed along with the last of them.
+	upload_ring_init(ring, 1024, 16);
+	for (int32_t i = 0; i < 6; i++) {
+		test_alloc(ring, 64, i * 64);
+		upload_ring_end(ring, i);
+	}
+	TEST_CHECK(ring.frame_count == upload_ring_frames);
+	upload_ring_retire(ring, 4);
+	TEST_CHECK(ring.tail == 192 && ring.frame_count == 1);
+	upload_ring_retire(ring, 6);
+	TEST_CHECK(ring.tail == 384 && ring.frame_count == 0);
+
+	// Bigger than the whole ring never fits, not even in an empty one. The
+	// whole ring does, but only from the start of a lap.
+	upload_ring_init(ring, 256, 16);
+	test_alloc(ring, 257, -1);
+	test_alloc(ring, 256, 0);
+	upload_ring_end(ring, 0);
+	upload_ring_retire(ring, 1);
+	test_alloc(ring, 16,  0);
+	test_alloc(ring, 256, -1);
+	upload_ring_end(ring, 1);
+	upload_ring_retire(ring, 2);
+	test_alloc(ring, 256, 0);
+	upload_ring_init(ring, 8, 16);
+	TEST_CHECK(ring.size == 0);
+	test_alloc(ring, 1, -1);
+
+	// And a long run of frames, with allocations of every size
+	uint32_t seed = 1;
+	test_frames(4096, 256, 5000, seed);
+	test_frames(1000, 16,  5000, seed);
+
+	return test_finish("upload_ring");
+}
@@ -0,0 +1,149 @@
+// Builds .mesh files offline, the same way the sample builds cube.mesh on
+// startup: triangles reordered for the vertex cache, vertices reordered
+// for fetch, and everything packed into mesh_vert_t's 8 bytes.
+//
+//   mesh_tool <out.mesh>             writes the sample's own cube
+//   mesh_tool <in.obj> <out.mesh>    converts a Wavefront OBJ
+//
+// Like the tests, it includes the whole sample through the headless build,
+// so it's using the exact same mesh_build and mesh_file_write.
+#define APP_NO_MAIN
+#include "main.cpp"
+
+///////////////////////////////////////////
+
+// OBJ indices start at 1, and negative ones count back from the end
+bool obj_index(const char *text, size_t count, uint32_t *out_index) {
+	long index = strtol(text, nullptr, 10);
+	if (index < 0) index += (long)count + 1;
+	if (index < 1 || (size_t)index > count) return false;
+	*out_index = (uint32_t)(index - 1);
+	return true;
+}
+
+///////////////////////////////////////////
+
+// Reads positions, normals, and faces, and ignores everything else.
+// Faces are fanned into triangles. Corners without a normal get their
+// face's flat normal.
+bool obj_load(const char *filename, vector<float> &out_verts, vector<uint32_t> &out_inds) {
+	FILE *fp = nullptr;
+	if (fopen_s(&fp, filename, "r") != 0) {
+		printf("Couldn't open '%s'\n", filename);
+		return false;
+	}
+
+	vector<XrVector3f> positions, normals;
+	unordered_map<uint64_t, uint32_t> corners; // position << 32 | normal -> vertex
+	char   line[1024];
+	int32_t line_num = 0;
+	bool   result   = true;
+	while (result && fgets(line, sizeof(line), fp)) {
+		line_num += 1;
+		XrVector3f v;
+		if (sscanf(line, "v %f %f %f", &v.x, &v.y, &v.z) == 3) {
+			positions.push_back(v);
+		} else if (sscanf(line, "vn %f %f %f", &v.x, &v.y, &v.z) == 3) {
+			float len = sqrtf(v.x*v.x + v.y*v.y + v.z*v.z);
+			normals.push_back(len > 0 ? XrVector3f{ v.x / len, v.y / len, v.z / len } : XrVector3f{ 0, 1, 0 });
+		} else if (line[0] == 'f' && line[1] == ' ') {
+			uint32_t pos[64], norm[64];
+			int32_t  count = 0;
+			bool     flat  = false;
+			for (char *token = strtok(line + 2, " \t\r\n"); token && count < 64; token = strtok(nullptr, " \t\r\n")) {
+				const char *slash1 = strchr(token, '/');
+				const char *slash2 = slash1 ? strchr(slash1 + 1, '/') : nullptr;
+				if (!obj_index(token, positions.size(), &pos[count])) { result = false; break; }
+				if (slash2 && slash2[1] != '\0') {
+					if (!obj_index(slash2 + 1, normals.size(), &norm[count])) { result = false; break; }
+				} else {
+					flat = true;
+				}
+				count += 1;
+			}
+			if (!result || count < 3) {
+				printf("%s(%d): bad face\n", filename, line_num);
+				result = false;
+				break;
+			}
+			if (flat) {
+				XrVector3f a = positions[pos[0]], b = positions[pos[1]], c = positions[pos[2]];
+				XrVector3f ab = { b.x - a.x, b.y - a.y, b.z - a.z };
+				XrVector3f ac = { c.x - a.x, c.y - a.y, c.z - a.z };
+				XrVector3f n  = { ab.y*ac.z - ab.z*ac.y, ab.z*ac.x - ab.x*ac.z, ab.x*ac.y - ab.y*ac.x };
+				float    len  = sqrtf(n.x*n.x + n.y*n.y + n.z*n.z);
+				normals.push_back(len > 0 ? XrVector3f{ n.x / len, n.y / len, n.z / len } : XrVector3f{ 0, 1, 0 });
+				for (int32_t i = 0; i < count; i++) norm[i] = (uint32_t)normals.size() - 1;
+			}
+
+			// Corners that share both a position and a normal are the same
+			// vertex, which is what lets the vertex cache do its job.
+			uint32_t verts[64];
+			for (int32_t i = 0; i < count; i++) {
+				uint64_t key   = ((uint64_t)pos[i] << 32) | norm[i];
+				auto     found = corners.find(key);
+				if (found == corners.end()) {
+					verts[i] = (uint32_t)(out_verts.size() / 6);
+					corners[key] = verts[i];
+					const XrVector3f &p = positions[pos[i]], &n = normals[norm[i]];
+					float vert[6] = { p.x, p.y, p.z, n.x, n.y, n.z };
+					out_verts.insert(out_verts.end(), vert, vert + 6);
+				} else {
+					verts[i] = found->second;
+				}
+			}
+			for (int32_t i = 1; i + 1 < count; i++) {
+				uint32_t tri[3] = { verts[0], verts[i], verts[i + 1] };
+				out_inds.insert(out_inds.end(), tri, tri + 3);
+			}
+		}
+	}
+	fclose(fp);
+	if (result && out_inds.empty()) {
+		printf("'%s' has no faces\n", filename);
+		result = false;
+	}
+	return result;
+}
+
+///////////////////////////////////////////
+
+int main(int argc, char **argv) {
+	if (argc < 2 || argc > 3) {
+		printf("usage: mesh_tool [in.obj] <out.mesh>\n");
+		return 1;
+	}
+	const char *out_file = argv[argc - 1];
+
+	vector<float>    verts;
+	vector<uint32_t> inds;
+	if (argc == 3) {
+		if (!obj_load(argv[1], verts, inds))
+			return 1;
+	} else {
+		verts.assign(app_verts, app_verts + _countof(app_verts));
+		inds .assign(app_inds,  app_inds  + _countof(app_inds));
+	}
+
+	mesh_t mesh;
+	size_t vert_count = verts.size() / 6;
+	if (!mesh_build(verts.data(), vert_count, inds.data(), inds.size(), mesh) || !mesh_file_write(out_file, mesh))
+		return 1;
+
+	// Read it back the way the sample will, to be sure it's good
+	mesh_file_t file = {};
+	bool        valid = mesh_file_map(file, out_file) && file.vert_count == mesh.verts.size() && file.ind_count == mesh.inds.size();
+	mesh_file_unmap(file);
+	if (!valid) {
+		printf("'%s' didn't read back correctly!\n", out_file);
+		return 1;
+	}
+
+	vector<uint32_t> built_inds(mesh.inds.begin(), mesh.inds.end());
+	printf("%s: %zu verts, %zu tris, %zu bytes, acmr %.3f -> %.3f\n", out_file,
+		mesh.verts.size(), mesh.inds.size() / 3,
+		mesh.verts.size() * sizeof(mesh_vert_t) + mesh.inds.size() * sizeof(uint16_t),
+		mesh_acmr(inds.data(), inds.size(), mesh_cache_size),
+		mesh_acmr(built_inds.data(), built_inds.size(), mesh_cache_size));
+	return 0;
+}